@@ -1,143 +1,52 @@
 #define CEA2045Port "/dev/ttyUSB0"
-#define SHED 0x01
-#define END_SHED 0x02
-#define APP_ACK 0x03
-#define APP_NAK 0x04
-#define POWER_LEVEL 0x06
-#define PRESENT_RELATIVE_PRICE 0x07
-#define NEXT_RELATIVE_PRICE 0x08
-#define TIME_REMAINING_PRICE 0x09
-#define CPP 0x0a
-#define GRID_EMERGENCY 0x0b
-#define GRID_GUIDANCE 0x0c
-#define COMM_STATUS 0x0e
-#define CUST_OVERRIDE 0x11
-#define OPER_STATE_REQ 0x12
-#define OPER_STATE_RESP 0x13
-#define SLEEP_STATE 0x14
-#define WAKE_STATE 0x15
-#define SIMPLE_TIME_SYNC 0x16
-#define LOADUP 0x17
-#define INFO_REQ 0x01
-#define SET_UTC_TIME 0x02
-
-#define TIMEOUT 500				// 500 millisecond from first to last byte of message
 #define NB_ENABLE 0
 #define NB_DISABLE 1
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>	
 #include <fcntl.h>
 #include <termios.h>
 #include <stdbool.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <math.h>
 #include <stdint.h>
 
-/* Structure definitions */
-struct cea2045BasicStruct {
-	float	priceRatio;			// Present Relative Price ratio to send to SGD
-	time_t	endTime;			// Date/Time in OADR format converted to UTC
-	bool	overRide;			// Override status
-	bool	sleepState;			// Sleep status
-	bool	pendingOpState;		// Set to true if a OpState response is pending
-	bool 	pendingAppAck;		// Flag to show a Application Ack is waiting to be sent to SGD
-	bool 	pendingAppNak;		// Flag to show a Application Nak is waiting to be sent to SGD
-	unsigned char opState;		// Latest operationa state
-	unsigned char appAckSend;	// Application Ack/Nak Opcode 2 value to be sent to SGD in App Ack/Nak message
-	unsigned char appAckRtn;	// Return opcode expected on SGD application ack response
-	unsigned char opCode1;		// Last received OpCode1 from SGD
-	unsigned char opCode2;		// Last received OpCode2 from SGD
-	time_t timeoutTime;			// Time to wait for reply, 0 = not waiting for reply
-};
-
-struct cea2045InterStruct {
-	unsigned char respOpCode1;	// Expected response opcode 1, 0 if none pending
-	unsigned char respOpCode2;	// Expected response opcode 2
-	bool respPending;			// A reaponse is expected
-	time_t timeoutTime;			// Time to wait for reply, 0 = not waiting for reply
-	unsigned char lastOpCode1;	// Last successfully completed intermediate command
-	time_t completeTime;		// Time last command completed successfully
-};
-struct linkStruct {
-	int		txCount;			// App layer writes a value to this after filling the txBuffer
-								// Link layer clears this value after sending characters
-	int		rxCount;			// Link layer writes a value to this after all characters are received
-								// App layer clears this value after processing characters
-	int		nakVal;				// Value returned in link nak from SGD or -1 if link ack returned
-	bool	rxOverflow;			// Set by Link layer if rxCount exceeds rxBuffer size. Cleared on rxFlush
-	bool	rxFlush;			// App layer sets to true to flush rxBuffer.
-								// Link layer sets to false after setting rxCount to 0
-	bool	txFlush;			// App layer sets to true to flush txBuffer.
-								// Link layer sets to false after setting txCount to 0
-	bool	txBlock;			// Transmit must wait 100ms before sending message after link ack/nak.
-	bool	sunSpec;			// App layer sets to true to this is a SunSpec SGD
-};
-
-struct devInfoStruct {			// Device Information structure
-	unsigned char respCode;		// Response code
-	unsigned char ceaVer[2];	// ASCII CEA-2045 version
-	uint16_t vendorID;			// 16 bit vendor ID
-	uint16_t devType;			// 16 bit device type
-	uint16_t devRev;			// 16 bit device revision
-	uint32_t capBitmap;			// 32 bit capability bitmap
-	unsigned char reserve;		// Reserved (not currently used)
-	unsigned char modelNum[16];	// ASCII model number
-	unsigned char serialNum[16];	// ASCII serial number
-	unsigned char firmYear;		//Firmware year
-	unsigned char firmMonth;	//Firmware month
-	unsigned char firmDay;		//Firmware day
-	unsigned char firmMajor;	//Firmware major
-	unsigned char firmMinor;	//Firmware minor
-};
-
-struct	utcTimeStruct {
-	time_t lastTime;	//Last time sent or received
-	unsigned char tz;	//Time zone offset in 15 minute blocks
-	unsigned char dst;	//DST offset in 15 minute blocks
-};
+#include "cea2045lib.h"
+
+// Print link and app layer progress when enabled on the port
+#define linkDebug(port, ...) do { if ((port)->debug) printf(__VA_ARGS__); } while (0)
 
 // Function declorations
-int CEA2045basic(unsigned char cmd, long cmdparam, float cmdparamf);
-int CEA2045basicRx();
-int CEA2045inter(unsigned char opcode1,unsigned char opcode2);
-int CEA2045interRx();
-int linkLayer();
-long int calcTimeDiff(struct timeval *compareTime);
-void addTimeOffset(struct timeval *timestruct, long int adder);
-unsigned char calcRelativePriceByte(float relativePrice);
-int calcChecksum(unsigned char* buffData, int msgSize, bool validate);
-int initSerialPort();
-void nonblock(int state);
-int kbhit();
+static void linkArmTimer(struct cea2045PortStruct *port);
+static void linkWatch(struct cea2045PortStruct *port, bool watch);
+static int initSerialPort(const char *path);
+static int linkSunSpecRx(struct cea2045PortStruct *port, uint32_t events);
+static unsigned char *linkSunSpecPayload(struct cea2045PortStruct *port);
+static void linkQueueNext(struct cea2045PortStruct *port);
+static void linkBasicTx(struct cea2045PortStruct *port, unsigned char opcode1, unsigned char opcode2);
+static bool CEA2045encode(struct cea2045PortStruct *port, unsigned char cmd, long cmdparam, float cmdparamf,
+	unsigned char *opcode1Out, unsigned char *opcode2Out);
+static int cmdClass(unsigned char opcode1);
+static void cmdSent(struct cea2045PortStruct *port, unsigned char opcode1, long cmdparam);
+static bool linkAckMatch(struct cea2045PortStruct *port, unsigned char opcode1);
+static int linkAckExpire(struct cea2045PortStruct *port);
+static int linkLayer(struct cea2045PortStruct *port, uint32_t events);
+static int linkEventWait(struct cea2045PortStruct *port, int timeout);
+static uint64_t monoTimeMs();
+static int calcChecksumIov(const struct iovec *iov, int iovCount, unsigned char *checksum, bool validate);
+
+#ifdef CEA2045_MAIN
+static void nonblock(int state);
 
 //Globals
 volatile bool STOP = false;
-unsigned char txBuffer[256];		// Buffer for characters to be sent to SGD
-unsigned char rxBuffer[256];		// Buffer for characters received from SGD
-unsigned char linkAckBuff[2];
-struct cea2045BasicStruct basic;
-struct cea2045InterStruct inter;
-struct linkStruct linkData;
-struct devInfoStruct devInfo;		// Device Information structure
-struct utcTimeStruct utcTime;		// Set-Get utc time structure
-struct termios tio;
-struct timeval rxStartTime;
-struct timeval txStartTime;
-struct timeval currentTime;
-struct timeval pendingTime;
-struct timeval pendAckTime;
-struct timeval txDelayTime;
-struct timeval pendingTxTime;
-time_t shedEndTime = 0;
 time_t currentTimeSec = 0;
-int expectedMsgSize = 0;
-int rxCount = 0;
-int cea2045_fd;
-bool pendingTxLinkAck = false;
-bool pendingLinkAck = false;
 
 /**
  ****************************************************************************
@@ -146,7 +55,6 @@ bool pendingLinkAck = false;
  */
 int main(int Parm_Count, char *Parms[])
 {
-	int i;
 //	int count = 0;
 	int teststep = 0;
 	char Key;
@@ -154,29 +62,68 @@ int main(int Parm_Count, char *Parms[])
 	int rtn;
 	unsigned char tempstr[64];
 	int tempInt;
+	int timeout;
+	int linkEvents;
+	int nfds;
+	int i;
+	bool keyHit;
+	int epoll_fd;
+	struct epoll_event ev;
+	struct epoll_event events[CEA2045_MAX_EVENTS];
+	struct cea2045PortStruct *port;
 
 	nonblock(NB_ENABLE);			// Set keyboard to non-blocking input
-	cea2045_fd = initSerialPort();	//open the device(com port) to be non-blocking
-	if (cea2045_fd < 0)
+	port = cea2045Open(Parm_Count > 1 ? Parms[1] : CEA2045Port);	//open the device(com port) to be non-blocking
+	if (port == NULL)
 	{
 		perror(CEA2045Port);
 		return 3;			// Exit on failure
 	}
+	port->debug = true;
+	// Event loop waits on the port event loop and the keyboard
+	epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0)
+	{
+		perror("epoll");
+		return 3;			// Exit on failure
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = port->epollFd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, port->epollFd, &ev);
+	ev.data.fd = STDIN_FILENO;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
 	teststep = 12;
-	cycleTime = time(&currentTimeSec) + 10;
+	cycleTime = time(NULL) + 10;
 	//***************************************************************
 	// This is the main program loop
 	//***************************************************************
 	while (STOP == false)
 	{
 	
-		// This loop will run roughly every millisecond
-		rtn = linkLayer();
+		// Sleep until characters are received, a link timer expires or the next app step is due
+		currentTimeSec = time(NULL);
+		timeout = (cycleTime - currentTimeSec) * 1000;
+		if (port->basic.timeoutTime > 0 && (port->basic.timeoutTime - currentTimeSec) * 1000 < timeout) {
+			timeout = (port->basic.timeoutTime - currentTimeSec) * 1000;
+		}
+		if (timeout < 0) {
+			timeout = 0;
+		}
+		nfds = epoll_wait(epoll_fd, events, CEA2045_MAX_EVENTS, timeout);
+		linkEvents = 0;
+		keyHit = false;
+		for (i = 0; i < nfds; i++) {
+			if (events[i].data.fd == port->epollFd) {
+				linkEvents = linkEventWait(port, 0);
+			}
+			else if (events[i].data.fd == STDIN_FILENO) {
+				keyHit = true;
+			}
+		}
+		rtn = linkLayer(port, linkEvents);
 
 		//Look for keyboard input - This section is for debugging only
-		i = 0;
-		i=kbhit();
-		if (i!= 0) {
+		if (keyHit == true) {
 			Key=fgetc(stdin);
 			switch (Key)
 			{ /* branch to appropiate key handler */
@@ -190,21 +137,21 @@ int main(int Parm_Count, char *Parms[])
 			}  //end of switch key
 		}  //end if a key was hit
 		
-		currentTimeSec = time(&currentTimeSec);
+		currentTimeSec = time(NULL);
 		if (cycleTime <= currentTimeSec) {
 			switch (teststep) {
 				//================================================================================
 				// This section provides examples of using the CEA-2045 basic commands 
 				//================================================================================
 				case 0:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue shed command\n");
-						rtn = CEA2045basic(SHED, 60, 0);		//Issue shed command duration = 60 seconds
+						rtn = CEA2045basic(port, CEA2045_SHED, 60, 0);		//Issue shed command duration = 60 seconds
 						if (rtn == 0) {
-							basic.appAckRtn = SHED;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_SHED;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -212,14 +159,14 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 1:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue cpp command\n");
-						rtn = CEA2045basic(CPP, 60, 0);		//Issue shed command duration = 60 seconds
+						rtn = CEA2045basic(port, CEA2045_CPP, 60, 0);		//Issue shed command duration = 60 seconds
 						if (rtn == 0) {
-							basic.appAckRtn = CPP;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_CPP;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -227,14 +174,14 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 2:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue grid emergency command\n");
-						rtn = CEA2045basic(GRID_EMERGENCY, 60, 0);		//Issue grid emergency command duration = 60 seconds
+						rtn = CEA2045basic(port, CEA2045_GRID_EMERGENCY, 60, 0);		//Issue grid emergency command duration = 60 seconds
 						if (rtn == 0) {
-							basic.appAckRtn = GRID_EMERGENCY;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_GRID_EMERGENCY;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -242,14 +189,14 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 3:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue time remaining at price command\n");
-						rtn = CEA2045basic(TIME_REMAINING_PRICE, 60, 0);		//Issue time remaining command duration = 60 seconds
+						rtn = CEA2045basic(port, CEA2045_TIME_REMAINING_PRICE, 60, 0);		//Issue time remaining command duration = 60 seconds
 						if (rtn == 0) {
-							basic.appAckRtn = TIME_REMAINING_PRICE;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_TIME_REMAINING_PRICE;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -257,14 +204,14 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 4:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue End Shed command\n");
-						rtn = CEA2045basic(END_SHED, 0, 0);	//Issue end shed command
+						rtn = CEA2045basic(port, CEA2045_END_SHED, 0, 0);	//Issue end shed command
 						if (rtn == 0) {
-							basic.appAckRtn = END_SHED;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_END_SHED;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -272,18 +219,18 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 5:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Grid Guidance command\n");
-						rtn = CEA2045basic(GRID_GUIDANCE, 0, 0);	//Issue grid guidance command
+						rtn = CEA2045basic(port, CEA2045_GRID_GUIDANCE, 0, 0);	//Issue grid guidance command
 						//Second parameters are: 
 						// 0 = Bad time to use energy
 						// 1 = Neutral
 						// 2 = Good time to use energy
 						if (rtn == 0) {
-							basic.appAckRtn = GRID_GUIDANCE;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_GRID_GUIDANCE;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -291,18 +238,18 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 6:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Outside Comm Connection Status\n");
-						rtn = CEA2045basic(COMM_STATUS, 1, 0);	//Issue comm status command
+						rtn = CEA2045basic(port, CEA2045_COMM_STATUS, 1, 0);	//Issue comm status command
 						//Second parameters are: 
 						// 0 = No/Lost connection
 						// 1 = Found/Good connection
 						// 3 = Poor/unreliable connection
 						if (rtn == 0) {
-							basic.appAckRtn = COMM_STATUS;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_COMM_STATUS;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -310,14 +257,14 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 7:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Operational State Request\n");
-						rtn = CEA2045basic(OPER_STATE_REQ, 0, 0);	//Issue operational state request
+						rtn = CEA2045basic(port, CEA2045_OPER_STATE_REQ, 0, 0);	//Issue operational state request
 						if (rtn == 0) {
-							basic.pendingOpState = true;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.pendingOpState = true;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -325,18 +272,18 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 8:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Simple Time Sync command\n");
-						rtn = CEA2045basic(SIMPLE_TIME_SYNC, 1, 0);	//Issue simple time sync command (Sunday at 1AM)
+						rtn = CEA2045basic(port, CEA2045_SIMPLE_TIME_SYNC, 1, 0);	//Issue simple time sync command (Sunday at 1AM)
 						//Second parameter is: 
 						// Bits 7 to 5 is weekday 0 = Sunday - 6 = Saturday
 						// Bits 7 to 5 is hour 0 to 23
 						// Command is only issued on exact hour transition
 						if (rtn == 0) {
-							basic.appAckRtn = SIMPLE_TIME_SYNC;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_SIMPLE_TIME_SYNC;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -344,17 +291,17 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 9:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Power Level command\n");
-						rtn = CEA2045basic(POWER_LEVEL, 64, 0);	//Issue power level command
+						rtn = CEA2045basic(port, CEA2045_POWER_LEVEL, 64, 0);	//Issue power level command
 						//Second parameter is: 
 						// Bit 7 (MSB) 0 = power absorbed, 1 = power produced
 						// Bits 0 to 6 is percent power requested in 0 to 127 scale (127 = 100%)
 						if (rtn == 0) {
-							basic.appAckRtn = POWER_LEVEL;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_POWER_LEVEL;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -362,16 +309,16 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 10:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Present Relative Price command\n");
-						rtn = CEA2045basic(PRESENT_RELATIVE_PRICE, 0, 1.9);	//Issue present relative price at 1.9 command
+						rtn = CEA2045basic(port, CEA2045_PRESENT_RELATIVE_PRICE, 0, 1.9);	//Issue present relative price at 1.9 command
 						//Second parameter is: 
 						// relative price ratio = (Byte Value - 1) * (Byte Value + 63) / 8192
 						if (rtn == 0) {
-							basic.appAckRtn = PRESENT_RELATIVE_PRICE;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_PRESENT_RELATIVE_PRICE;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -379,16 +326,16 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 11:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Next Relative Price command\n");
-						rtn = CEA2045basic(NEXT_RELATIVE_PRICE, 0, 2.3);	//Issue simple time sync command
+						rtn = CEA2045basic(port, CEA2045_NEXT_RELATIVE_PRICE, 0, 2.3);	//Issue simple time sync command
 						//Second parameter is: 
 						// relative price ratio = (Byte Value - 1) * (Byte Value + 63) / 8192
 						if (rtn == 0) {
-							basic.appAckRtn = NEXT_RELATIVE_PRICE;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_NEXT_RELATIVE_PRICE;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -396,14 +343,14 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 12:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue Load Up command\n");
-						rtn = CEA2045basic(LOADUP, 3600, 0);	//Issue Load Up command with a duration of 1 hour
+						rtn = CEA2045basic(port, CEA2045_LOADUP, 3600, 0);	//Issue Load Up command with a duration of 1 hour
 						if (rtn == 0) {
-							basic.appAckRtn = LOADUP;
-							basic.timeoutTime = time(&currentTimeSec) + 4;
+							port->basic.appAckRtn = CEA2045_LOADUP;
+							port->basic.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -411,20 +358,20 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 13:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						printf("Issue intermediate info request\n");
 						//=============================================================================
-						// When this command completes, the inter.lastOpCode1 will contain the opcode 1 value
-						// and inter.completeTime will contain the time it completed.
+						// When this command completes, the port->inter.lastOpCode1 will contain the opcode 1 value
+						// and port->inter.completeTime will contain the time it completed.
 						// This is the same for all intermediate commands.
 						//=============================================================================
-						rtn = CEA2045inter(INFO_REQ, 1);	//Issue an intermediate information request
+						rtn = CEA2045inter(port, CEA2045_INFO_REQ, 1);	//Issue an intermediate information request
 						if (rtn == 0) {
-							inter.respOpCode1 = INFO_REQ;
-							inter.respOpCode2 = 0x81;
-							inter.timeoutTime = time(&currentTimeSec) + 4;
+							port->inter.respOpCode1 = CEA2045_INFO_REQ;
+							port->inter.respOpCode2 = 0x81;
+							port->inter.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -432,19 +379,19 @@ int main(int Parm_Count, char *Parms[])
 					}
 					break;
 				case 14:
-					if (linkData.txBlock == false) {
+					if (port->linkData.txBlock == false) {
 						cycleTime = currentTimeSec + 10;	//Do next step in 10 seconds
 						teststep += 1;
 						tempInt = -20;			//Time zone offset in 15 minute blocks for EST
-						utcTime.tz = tempInt & 0xff;
-						utcTime.dst = 4;		//DST offset in 15 minute blocks EDT
+						port->utcTime.tz = tempInt & 0xff;
+						port->utcTime.dst = 4;		//DST offset in 15 minute blocks EDT
 
 						printf("Issue intermediate Set UTC time command\n");
-						rtn = CEA2045inter(SET_UTC_TIME, 0);	//Issue an intermediate information request
+						rtn = CEA2045inter(port, CEA2045_SET_UTC_TIME, 0);	//Issue an intermediate information request
 						if (rtn == 0) {
-							inter.respOpCode1 = SET_UTC_TIME;
-							inter.respOpCode2 = 0x80;
-							inter.timeoutTime = time(&currentTimeSec) + 4;
+							port->inter.respOpCode1 = CEA2045_SET_UTC_TIME;
+							port->inter.respOpCode2 = 0x80;
+							port->inter.timeoutTime = time(NULL) + 4;
 						}
 					}
 					else {
@@ -453,26 +400,26 @@ int main(int Parm_Count, char *Parms[])
 					break;
 				default:
 					// Print results of device information command
-					printf("devInfo.respCode = %i\n",devInfo.respCode);
-					memcpy(tempstr, &devInfo.ceaVer[0], 2);
+					printf("devInfo.respCode = %i\n",port->devInfo.respCode);
+					memcpy(tempstr, &port->devInfo.ceaVer[0], 2);
 					tempstr[2] = 0;
 					printf("devInfo.modelNum = %s\n",tempstr);
-					printf("devInfo.vendorID = %x\n",devInfo.vendorID);
-					printf("devInfo.devType = %x\n",devInfo.devType);
-					printf("devInfo.devRev = %x\n",devInfo.devRev);
-					printf("devInfo.capBitmap = %x\n",devInfo.capBitmap);
-					printf("devInfo.reserve = %i\n",devInfo.reserve);
-					memcpy(tempstr, &devInfo.modelNum[0], 16);
+					printf("devInfo.vendorID = %x\n",port->devInfo.vendorID);
+					printf("devInfo.devType = %x\n",port->devInfo.devType);
+					printf("devInfo.devRev = %x\n",port->devInfo.devRev);
+					printf("devInfo.capBitmap = %x\n",port->devInfo.capBitmap);
+					printf("devInfo.reserve = %i\n",port->devInfo.reserve);
+					memcpy(tempstr, &port->devInfo.modelNum[0], 16);
 					tempstr[16] = 0;
 					printf("devInfo.modelNum = %s\n",tempstr);
-					memcpy(tempstr, &devInfo.serialNum[0], 16);
+					memcpy(tempstr, &port->devInfo.serialNum[0], 16);
 					tempstr[16] = 0;
 					printf("devInfo.serialNum = %s\n",tempstr);
-					printf("devInfo.firmYear = %i\n",devInfo.firmYear);
-					printf("devInfo.firmMonth = %i\n",devInfo.firmMonth);
-					printf("devInfo.firmDay = %i\n",devInfo.firmDay);
-					printf("devInfo.firmMajor = %i\n",devInfo.firmMajor);
-					printf("devInfo.firmMinor = %i\n",devInfo.firmMinor);
+					printf("devInfo.firmYear = %i\n",port->devInfo.firmYear);
+					printf("devInfo.firmMonth = %i\n",port->devInfo.firmMonth);
+					printf("devInfo.firmDay = %i\n",port->devInfo.firmDay);
+					printf("devInfo.firmMajor = %i\n",port->devInfo.firmMajor);
+					printf("devInfo.firmMinor = %i\n",port->devInfo.firmMinor);
 					//Test routine complete
 					STOP = true;
 					break;
@@ -480,149 +427,396 @@ int main(int Parm_Count, char *Parms[])
 		}
 
 		//Process returned messages
-		if (linkData.rxCount > 0) {
-			if (rxBuffer[0] == 8) {
+		if (port->linkData.rxCount > 0) {
+			if (port->rxBuffer[0] == 8) {
 				// This is a basic or intermediate message
-				if (rxBuffer[1] == 1) {
+				if (port->rxBuffer[1] == 1) {
 					// This is a basic message
 					printf("Processing basic message\n");
-					rtn = CEA2045basicRx();
+					rtn = CEA2045basicRx(port);
 					//================================================================================
 					// This is where the applications decides what to do with the 
 					// message contents. The last received opcode 1 and 2 are place in the basic 
 					// structure. Typical responses would be:
 					// rtn = 0x03 - Application Ack - No need to do anything else
-					// rtn = 0x04 - Application Nak - error code in basic.err - Posibly resend message
-					// rtn = 0x13 - Operational State - State returned in basic.state
-					// rtn = 0x11 - Customer Override - Override status in basic.override
+					// rtn = 0x04 - Application Nak - error code in port->basic.err - Posibly resend message
+					// rtn = 0x13 - Operational State - State returned in port->basic.state
+					// rtn = 0x11 - Customer Override - Override status in port->basic.override
 					// rtn = 0x14 - Sleep - UCM can go into low power mode if desired
 					// rtn = 0x15 - Wake - UCM needs to update grid information and send to SGD
 					//================================================================================
 				}
 				
 				else {
-					// This is an intermediate message rxBuffer[1] == 2
+					// This is an intermediate message port->rxBuffer[1] == 2
 					printf("Processing intermediate message\n");
-					rtn = CEA2045interRx();
+					rtn = CEA2045interRx(port);
 					//================================================================================
 					// Each intermediate message is a special structure. The call returns an ID of the 
 					// message type which defines the strucure to use to view the message.
 					//================================================================================
 				}
 			}	
-			else if (rxBuffer[0] == 9) {
-					// This is a pass through message type - rxBuffer[1] defines protocol
+			else if (port->rxBuffer[0] == 9) {
+					// This is a pass through message type - port->rxBuffer[1] defines protocol
 					// Simply pass the contents on to the sending grid device
 			}
 		}				
 				
 		//Process pending basic message operations
-		if (linkData.txBlock == false && (basic.pendingAppAck == true || basic.pendingAppNak == true)) {
-			if (basic.pendingAppAck == true) {
-				printf("Issue Application Ack command\n");
-				rtn = CEA2045basic(APP_ACK, basic.appAckSend, 0);	//Issue Application Ack reply
+		if (port->basic.pendingAppAck == true || port->basic.pendingAppNak == true) {
+			if (port->basic.pendingAppAck == true) {
+				printf("Queue Application Ack command\n");
+				rtn = CEA2045queue(port, CEA2045_APP_ACK, port->basic.appAckSend, 0);	//Queue Application Ack reply
 			}
 			else {
-				printf("Issue Application Nak command\n");
-				rtn = CEA2045basic(APP_NAK, basic.appAckSend, 0);	//Issue Application Nak reply
+				printf("Queue Application Nak command\n");
+				rtn = CEA2045queue(port, CEA2045_APP_NAK, port->basic.appAckSend, 0);	//Queue Application Nak reply
 			}
-			basic.pendingAppAck = false;
-			basic.pendingAppNak = false;
+			port->basic.pendingAppAck = false;
+			port->basic.pendingAppNak = false;
 		}
-		else if (basic.timeoutTime > 0 && basic.timeoutTime < time(&currentTimeSec)) {
+		else if (port->basic.timeoutTime > 0 && port->basic.timeoutTime < time(NULL)) {
 			//We have timed out waiting for a response
 			printf("Timed out waiting for a response\n");
-			basic.appAckRtn = 0;
-			linkData.rxCount = 0;
-			basic.pendingOpState = false;
-			basic.timeoutTime = 0;
+			port->basic.appAckRtn = 0;
+			port->linkData.rxCount = 0;
+			port->basic.pendingOpState = false;
+			port->basic.timeoutTime = 0;
+		}
+		if (linkAckExpire(port) > 0) {
+			printf("Timed out waiting for a queued command response\n");
 		}
 		
-		usleep(1000);		// Sleep for 1ms to allow other threads to operate
+		// Send anything the app layer queued and re-arm the link timer
+		linkLayer(port, 0);
 	}
+	printf("%lu wake-ups (%lu rx, %lu timer) for %lu messages received and %lu sent\n",
+		port->linkStats.wakeups, port->linkStats.rxWakeups, port->linkStats.timerWakeups, port->linkStats.rxMessages, port->linkStats.txMessages);
+	if (port->linkStats.rxMessages + port->linkStats.txMessages > 0) {
+		printf("%.2f wake-ups per message\n",
+			(double) port->linkStats.wakeups / (port->linkStats.rxMessages + port->linkStats.txMessages));
+	}
+	printf("%lu commands queued, %lu sent, %lu coalesced, max queue depth %i\n",
+		port->cmdQueue.queued, port->cmdQueue.sent, port->cmdQueue.coalesced, port->cmdQueue.maxCount);
+	printf("%lu application acks matched, %lu timed out\n", port->cmdQueue.acked, port->cmdQueue.ackTimeouts);
 	//Close UART on exit
-	close(cea2045_fd);
+	close(epoll_fd);
+	cea2045Close(port);
 	nonblock(NB_DISABLE);
 	return rtn;
 }  //end of main
+#endif /* CEA2045_MAIN */
+
+/**
+ *==========================================================================
+ * Open a UCM port on the serial device at path. All link and app layer
+ * state lives in the returned port, so any number of ports can be driven
+ * from the same process. Each port has its own event loop holding the
+ * serial port and the link timer; its descriptor (port->epollFd) can be
+ * added to a caller's event loop.
+ * @return port on success
+ * @return NULL if the serial port or the event loop can't be created
+ *==========================================================================
+ */
+struct cea2045PortStruct *cea2045Open(const char *path)
+{
+	struct cea2045PortStruct *port;
+	struct epoll_event ev;
+
+	port = calloc(1, sizeof(struct cea2045PortStruct));
+	if (port == NULL) {
+		return NULL;
+	}
+	port->fd = initSerialPort(path);	//open the device(com port) to be non-blocking
+	port->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	port->epollFd = epoll_create1(0);
+	if (port->fd < 0 || port->timerFd < 0 || port->epollFd < 0) {
+		cea2045Close(port);
+		return NULL;
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = port->fd;
+	epoll_ctl(port->epollFd, EPOLL_CTL_ADD, port->fd, &ev);
+	ev.data.fd = port->timerFd;
+	epoll_ctl(port->epollFd, EPOLL_CTL_ADD, port->timerFd, &ev);
+	port->rxWatch = true;
+	port->linkData.nakVal = -1;
+	return port;
+}
+
+/**
+ ***************************************************************************
+ * Close the serial port and event loop and free the port. 
+ ***************************************************************************
+ */
+void cea2045Close(struct cea2045PortStruct *port) {
+	if (port == NULL) {
+		return;
+	}
+	if (port->epollFd >= 0) {
+		close(port->epollFd);
+	}
+	if (port->timerFd >= 0) {
+		close(port->timerFd);
+	}
+	if (port->fd >= 0) {
+		close(port->fd);
+	}
+	free(port);
+}
+
+/**
+ ***************************************************************************
+ * Wait up to timeout milliseconds for the port and run the link layer once.
+ * A message the app layer has queued is sent before waiting. 
+ *
+ * @param timeout  Milliseconds to wait, 0 to only run pending link work
+ * @return linkLayer() result
+ ***************************************************************************
+ */
+int cea2045Poll(struct cea2045PortStruct *port, int timeout) {
+	if (port->linkData.txBlock == false && port->pendingLinkAck == false &&
+		(port->linkData.txCount > 0 || port->ssTxLen > 0 || port->cmdQueue.count > 0)) {
+		linkLayer(port, 0);
+	}
+	return linkLayer(port, linkEventWait(port, timeout));
+}
+
+/**
+ ***************************************************************************
+ * Discard queued and partially received messages. A pending link ack/nak
+ * is still sent so the SGD isn't left waiting. 
+ *
+ * @param txClear  True to drop a message waiting to be sent
+ * @param rxClear  True to drop received characters and messages
+ * @return 0 on success
+ ***************************************************************************
+ */
+int cea2045Flush(struct cea2045PortStruct *port, bool txClear, bool rxClear) {
+	if (txClear == true) {
+		port->linkData.txCount = 0;
+	}
+	if (rxClear == true) {
+		tcflush(port->fd, TCIFLUSH);
+		port->linkData.rxCount = 0;
+		port->linkTimer.rxDeadline = 0;
+		port->rxCount = 0;
+		port->expectedMsgSize = 0;
+	}
+	linkArmTimer(port);
+	linkWatch(port, port->linkData.rxCount == 0);
+	return 0;
+}
+
+/**
+ *==========================================================================
+ * Send a SunSpec Modbus frame to the SGD as a pass through message and
+ * wait for the link ack. On a SunSpec port (port->linkData.sunSpec) the
+ * message is framed around buf and sent without waiting for the link ack;
+ * the ack is picked up by the CEA2045ss_read() for the response. 
+ * Syntax is:
+ * int rtnval = CEA2045ss_write(port, buf, len, timeout);
+ * @param timeout  Milliseconds to wait for the link to be free and the ack
+ * @return len on success
+ * @return 0 on link nak or timeout
+ * @return -1 if the frame doesn't fit in a message
+ *==========================================================================
+ */
+int CEA2045ss_write(struct cea2045PortStruct *port, unsigned char *buf, uint16_t len, uint32_t timeout) {
+	uint64_t deadline = monoTimeMs() + timeout;
+	uint64_t now;
+	int rtn;
+
+	if (port->linkData.sunSpec == false && len + 6 > CEA2045_MSG_BUFFER_SIZE) {
+		return -1;
+	}
+	// Wait for the link to be free
+	while (port->linkData.txBlock == true || port->linkData.txCount > 0 || port->pendingLinkAck == true) {
+		now = monoTimeMs();
+		if (now >= deadline) {
+			return 0;
+		}
+		cea2045Poll(port, deadline - now);
+	}
+	if (port->linkData.sunSpec == true) {
+		port->ssTxBuf = buf;
+		port->ssTxLen = len;
+		cea2045Poll(port, 0);
+		if (port->ssTxLen > 0) {
+			port->ssTxBuf = NULL;
+			port->ssTxLen = 0;
+			return 0;
+		}
+		return len;
+	}
+	port->txBuffer[0] = CEA2045_PASS_THROUGH;		//Message type
+	port->txBuffer[1] = CEA2045_PASS_THROUGH_MODBUS;
+	port->txBuffer[2] = len >> 8;			//Payload length
+	port->txBuffer[3] = len & 0xff;
+	memcpy(&port->txBuffer[4], buf, len);
+	port->linkData.txCount = len + 4;
+	rtn = cea2045Poll(port, 0);
+	// Wait for the link ack/nak
+	while (rtn == 0) {
+		now = monoTimeMs();
+		if (now >= deadline) {
+			cea2045Flush(port, true, false);
+			return 0;
+		}
+		rtn = cea2045Poll(port, deadline - now);
+	}
+	return rtn == 1 ? len : 0;
+}
+
+/**
+ *==========================================================================
+ * Wait for a SunSpec Modbus frame from the SGD and copy it to buf. Basic
+ * and intermediate messages that arrive first are handed to
+ * CEA2045basicRx() and CEA2045interRx(). Returns once the link ack for the
+ * frame has been sent. On a SunSpec port the frame is received straight
+ * into buf, and a link nak or ack timeout for the request ends the wait. 
+ * Syntax is:
+ * int rtnval = CEA2045ss_read(port, buf, len, timeout);
+ * @param timeout  Milliseconds to wait for the frame
+ * @return frame length on success
+ * @return 0 on timeout
+ *==========================================================================
+ */
+int CEA2045ss_read(struct cea2045PortStruct *port, unsigned char *buf, uint16_t len, uint32_t timeout) {
+	uint64_t deadline = monoTimeMs() + timeout;
+	uint64_t now;
+	int count = 0;
+
+	if (port->linkData.sunSpec == true) {
+		port->ssRxBuf = buf;
+		port->ssRxSize = len;
+		port->ssRxCount = 0;
+	}
+	while (count == 0) {
+		if (port->ssRxCount > 0) {
+			count = port->ssRxCount;
+			break;
+		}
+		if (port->linkData.rxCount > 0) {
+			if (port->rxBuffer[0] == CEA2045_PASS_THROUGH && port->rxBuffer[1] == CEA2045_PASS_THROUGH_MODBUS) {
+				count = port->linkData.rxCount - 4;
+				if (count > len) {
+					count = len;
+				}
+				memcpy(buf, &port->rxBuffer[4], count);
+			}
+			else if (port->rxBuffer[0] == 0x08 && port->rxBuffer[1] == 0x01) {
+				CEA2045basicRx(port);
+			}
+			else if (port->rxBuffer[0] == 0x08) {
+				CEA2045interRx(port);
+			}
+			port->linkData.rxCount = 0;
+			linkWatch(port, true);
+			if (count > 0) {
+				break;
+			}
+		}
+		now = monoTimeMs();
+		if (now >= deadline) {
+			break;
+		}
+		if (cea2045Poll(port, deadline - now) < 0 && port->linkData.sunSpec == true) {
+			break;
+		}
+	}
+	port->ssRxBuf = NULL;
+	port->ssRxCount = 0;
+	// Let the link ack go out before the caller sends the next request
+	while (port->pendingTxLinkAck == true) {
+		cea2045Poll(port, CEA2045_LINK_ACK_DELAY);
+	}
+	return count;
+}
 				
 				
 /**
  *==========================================================================
  * This function is called to process basic messages received from the SGD
  * Syntax is:
- * int rtnval = CEA2045basicRx();
+ * int rtnval = CEA2045basicRx(port);
  * @return command ID on success
  * @return -1 on invalid message received
  *==========================================================================
  */
-int CEA2045basicRx()
+int CEA2045basicRx(struct cea2045PortStruct *port)
 {
 	int rtn = 0;
 	
-	basic.opCode1 = rxBuffer[4];
-	basic.opCode2 = rxBuffer[5];
+	port->basic.opCode1 = port->rxBuffer[4];
+	port->basic.opCode2 = port->rxBuffer[5];
+	//Check for the Application Ack/Nak of a queued command
+	if ((port->rxBuffer[4] == CEA2045_APP_ACK || port->rxBuffer[4] == CEA2045_APP_NAK) && linkAckMatch(port, port->rxBuffer[5])) {
+		rtn = port->rxBuffer[4];
+		linkDebug(port, "Application %s %i received\n", rtn == CEA2045_APP_ACK ? "ACK" : "NAK", port->rxBuffer[5]);
+	}
 	//Check if Application Ack is pending
-	if (basic.appAckRtn > 0) {
+	else if (port->basic.appAckRtn > 0) {
 		//Verify Application Ack value
-		if (rxBuffer[4] == 3) {
-			if (rxBuffer[5] == basic.appAckRtn) {
+		if (port->rxBuffer[4] == 3) {
+			if (port->rxBuffer[5] == port->basic.appAckRtn) {
 				//Proper application ack was returned
-				rtn = rxBuffer[4];
-				printf("Application ACK %i received\n", basic.appAckRtn);
+				rtn = port->rxBuffer[4];
+				linkDebug(port, "Application ACK %i received\n", port->basic.appAckRtn);
 			}
 			else {
 				//Wrong application ack was returned
-				printf("Wrong Application ACK received\n");
+				linkDebug(port, "Wrong Application ACK received\n");
 				rtn = -1;
 			}
 		}
 	}
-	else if (basic.pendingOpState == true) {
+	else if (port->basic.pendingOpState == true) {
 		//Get returned operational state
-		if (rxBuffer[4] == 0x13) {
+		if (port->rxBuffer[4] == 0x13) {
 			//Operational state was returned
-			basic.opState =  rxBuffer[5];
-			rtn = rxBuffer[4];
-			printf("Operational state %i received\n", rxBuffer[5]);
+			port->basic.opState =  port->rxBuffer[5];
+			rtn = port->rxBuffer[4];
+			linkDebug(port, "Operational state %i received\n", port->rxBuffer[5]);
 		}
 		else {
-			printf("Operational state not received\n");
+			linkDebug(port, "Operational state not received\n");
 			rtn = -1;
 		}
 	}
-	else if (rxBuffer[4] == CUST_OVERRIDE) {
-		//Operator Override state received - rxBuffer[5] = 0 is override disabled, 1 is override enabled
-		printf("Customer Override received: %i\n", rxBuffer[5]);
-		if (rxBuffer[5] == 0) basic.overRide = false;
-		else basic.overRide = true;
+	else if (port->rxBuffer[4] == CEA2045_CUST_OVERRIDE) {
+		//Operator Override state received - port->rxBuffer[5] = 0 is override disabled, 1 is override enabled
+		linkDebug(port, "Customer Override received: %i\n", port->rxBuffer[5]);
+		if (port->rxBuffer[5] == 0) port->basic.overRide = false;
+		else port->basic.overRide = true;
 		//Send application Ack
-		rtn = rxBuffer[4];
-		basic.pendingAppAck = true;
-		basic.appAckSend = CUST_OVERRIDE;
+		rtn = port->rxBuffer[4];
+		port->basic.pendingAppAck = true;
+		port->basic.appAckSend = CEA2045_CUST_OVERRIDE;
 	}
-	else if (rxBuffer[4] == SLEEP_STATE) {
+	else if (port->rxBuffer[4] == CEA2045_SLEEP_STATE) {
 		//Sleep command received from SGD
-		basic.sleepState = true;
-		printf("Sleep command received\n");
+		port->basic.sleepState = true;
+		linkDebug(port, "Sleep command received\n");
 		//Send application Ack
-		rtn = rxBuffer[4];
-		basic.pendingAppAck = true;
-		basic.appAckSend = SLEEP_STATE;
+		rtn = port->rxBuffer[4];
+		port->basic.pendingAppAck = true;
+		port->basic.appAckSend = CEA2045_SLEEP_STATE;
 	}
-	else if (rxBuffer[4] == WAKE_STATE) {
+	else if (port->rxBuffer[4] == CEA2045_WAKE_STATE) {
 		//Wake command received from SGD
-		basic.sleepState = false;
-		printf("Wake command received\n");
+		port->basic.sleepState = false;
+		linkDebug(port, "Wake command received\n");
 		//Send application Ack
-		rtn = rxBuffer[4];
-		basic.pendingAppAck = true;
-		basic.appAckSend = WAKE_STATE;
-	}
-	basic.appAckRtn = 0;
-	linkData.rxCount = 0;
-	basic.pendingOpState = false;
-	basic.timeoutTime = 0;
+		rtn = port->rxBuffer[4];
+		port->basic.pendingAppAck = true;
+		port->basic.appAckSend = CEA2045_WAKE_STATE;
+	}
+	port->basic.appAckRtn = 0;
+	port->linkData.rxCount = 0;
+	port->basic.pendingOpState = false;
+	port->basic.timeoutTime = 0;
  
 	return rtn;
 } 			
@@ -632,63 +826,63 @@ int CEA2045basicRx()
  * This function is called to process intermediate messages received from
  * the SGD
  * Syntax is:
- * int rtnval = CEA2045interRx();
+ * int rtnval = CEA2045interRx(port);
  * @return command ID on success
  * @return -1 on invalid message received
  *==========================================================================
  */
-int CEA2045interRx()
+int CEA2045interRx(struct cea2045PortStruct *port)
 {
 	int rtn = 0;
 	int messageSize;
 	
 	//Check if response is pending
-	if (inter.respOpCode1 != 0) {
+	if (port->inter.respOpCode1 != 0) {
 		//Verify Response opcodes
-		if (rxBuffer[4] == inter.respOpCode1 && rxBuffer[5] == inter.respOpCode2) {
+		if (port->rxBuffer[4] == port->inter.respOpCode1 && port->rxBuffer[5] == port->inter.respOpCode2) {
 			//This is a valid response
 			// Calculate message size
-			messageSize = rxBuffer[2] *256 + rxBuffer[3];
-			if (rxBuffer[4] == INFO_REQ && rxBuffer[5] == 0x81) {
+			messageSize = port->rxBuffer[2] *256 + port->rxBuffer[3];
+			if (port->rxBuffer[4] == CEA2045_INFO_REQ && port->rxBuffer[5] == 0x81) {
 				//This is a device information response
-				devInfo.respCode = rxBuffer[6];		//Response code
-				devInfo.ceaVer[0] = rxBuffer[7];	//CEA-2045 version
-				devInfo.ceaVer[1] = rxBuffer[8];	//CEA-2045 version
-				devInfo.vendorID = rxBuffer[9] * 256 + rxBuffer[10];	//Vendor ID integer
-				devInfo.devType = rxBuffer[11] * 256 + rxBuffer[12];	//Device type
-				devInfo.devRev = rxBuffer[13] * 256 + rxBuffer[14];	//Device revision
-				devInfo.capBitmap = ((unsigned long)rxBuffer[15] << 24) + ((unsigned long)rxBuffer[16] << 16) + ((unsigned long)rxBuffer[17] << 8) + rxBuffer[18];	//Capability bitmap
-				devInfo.reserve = rxBuffer[19];		//Reserved
+				port->devInfo.respCode = port->rxBuffer[6];		//Response code
+				port->devInfo.ceaVer[0] = port->rxBuffer[7];	//CEA-2045 version
+				port->devInfo.ceaVer[1] = port->rxBuffer[8];	//CEA-2045 version
+				port->devInfo.vendorID = port->rxBuffer[9] * 256 + port->rxBuffer[10];	//Vendor ID integer
+				port->devInfo.devType = port->rxBuffer[11] * 256 + port->rxBuffer[12];	//Device type
+				port->devInfo.devRev = port->rxBuffer[13] * 256 + port->rxBuffer[14];	//Device revision
+				port->devInfo.capBitmap = ((unsigned long)port->rxBuffer[15] << 24) + ((unsigned long)port->rxBuffer[16] << 16) + ((unsigned long)port->rxBuffer[17] << 8) + port->rxBuffer[18];	//Capability bitmap
+				port->devInfo.reserve = port->rxBuffer[19];		//Reserved
 				if (messageSize >= 32) {
-					memcpy(&devInfo.modelNum[0],&rxBuffer[20],16);	//Model number
+					memcpy(&port->devInfo.modelNum[0],&port->rxBuffer[20],16);	//Model number
 				}
 				if (messageSize >= 48) {
-					memcpy(&devInfo.serialNum[0],&rxBuffer[36],16);	//Serial number
+					memcpy(&port->devInfo.serialNum[0],&port->rxBuffer[36],16);	//Serial number
 				}
 				if (messageSize >= 53) {
-					devInfo.firmYear = rxBuffer[52];	//Firmware year
-					devInfo.firmMonth = rxBuffer[53];	//Firmware month
-					devInfo.firmDay = rxBuffer[54];		//Firmware day
-					devInfo.firmMajor = rxBuffer[55];	//Firmware major
-					devInfo.firmMinor = rxBuffer[56];	//Firmware minor
+					port->devInfo.firmYear = port->rxBuffer[52];	//Firmware year
+					port->devInfo.firmMonth = port->rxBuffer[53];	//Firmware month
+					port->devInfo.firmDay = port->rxBuffer[54];		//Firmware day
+					port->devInfo.firmMajor = port->rxBuffer[55];	//Firmware major
+					port->devInfo.firmMinor = port->rxBuffer[56];	//Firmware minor
 				}
-				inter.lastOpCode1 = inter.respOpCode1;
-				inter.respOpCode1 = 0;
-				inter.timeoutTime = 0;
-				inter.completeTime = time(&currentTimeSec);
+				port->inter.lastOpCode1 = port->inter.respOpCode1;
+				port->inter.respOpCode1 = 0;
+				port->inter.timeoutTime = 0;
+				port->inter.completeTime = time(NULL);
 			}
-			else if (rxBuffer[4] == SET_UTC_TIME && rxBuffer[5] == 0x80) {
+			else if (port->rxBuffer[4] == CEA2045_SET_UTC_TIME && port->rxBuffer[5] == 0x80) {
 				//This is a Set UTC Time response
-				if (rxBuffer[6] == 0) {
+				if (port->rxBuffer[6] == 0) {
 					//Success
-					inter.lastOpCode1 = inter.respOpCode1;
-					inter.respOpCode1 = 0;
-					inter.timeoutTime = 0;
-					inter.completeTime = time(&currentTimeSec);
-					utcTime.lastTime = currentTimeSec;		// Save the last time the UTC time was set
+					port->inter.lastOpCode1 = port->inter.respOpCode1;
+					port->inter.respOpCode1 = 0;
+					port->inter.timeoutTime = 0;
+					port->inter.completeTime = time(NULL);
+					port->utcTime.lastTime = time(NULL);		// Save the last time the UTC time was set
 				}
 			}
-			linkData.rxCount = 0;
+			port->linkData.rxCount = 0;
 		}
 	}
  
@@ -699,50 +893,50 @@ int CEA2045interRx()
  *==========================================================================
  * This function is called to send an Intermediate message to the SGD
  * Syntax is:
- * int rtnval = CEA2045basic(byte opcode1,byte opcode2);
+ * int rtnval = CEA2045basic(port, byte opcode1,byte opcode2);
  * @return 0 on success
  * @return 1 on failure to interpret a value
  * @return 2 on routine called when blocked
  *==========================================================================
  */
-int CEA2045inter(unsigned char opcode1,unsigned char opcode2)
+int CEA2045inter(struct cea2045PortStruct *port, unsigned char opcode1,unsigned char opcode2)
 {
 	bool valid;
 	int rtnval;
 	time_t tempTime;
 	
-	if (linkData.txBlock == true) {
+	if (port->linkData.txBlock == true) {
 		return 2;		//Routine called when blocked	
 	}
 	valid = true;
 	rtnval = 0;
 	switch(opcode1) {
-		case INFO_REQ:
-			txBuffer[3] = 0x02;
-			linkData.txCount = 6;
+		case CEA2045_INFO_REQ:
+			port->txBuffer[3] = 0x02;
+			port->linkData.txCount = 6;
 			break;
-		case SET_UTC_TIME:
-			txBuffer[3] = 0x08;
-			tempTime = time(&currentTimeSec) - 946684800;	// Convert unix time to seconds since 1/1/2000
-			txBuffer[6] = (tempTime & 0xff000000) >> 24;	// UTC time
-			txBuffer[7] = (tempTime & 0xff0000) >> 16;
-			txBuffer[8] = (tempTime & 0xff00) >> 8;
-			txBuffer[9] = tempTime & 0xff;
-			txBuffer[10] = utcTime.tz;	//Time zone offset in 15 minute blocks
-			txBuffer[11] = utcTime.dst;	//DST offset in 15 minute blocks
-			linkData.txCount = 12;
+		case CEA2045_SET_UTC_TIME:
+			port->txBuffer[3] = 0x08;
+			tempTime = time(NULL) - 946684800;	// Convert unix time to seconds since 1/1/2000
+			port->txBuffer[6] = (tempTime & 0xff000000) >> 24;	// UTC time
+			port->txBuffer[7] = (tempTime & 0xff0000) >> 16;
+			port->txBuffer[8] = (tempTime & 0xff00) >> 8;
+			port->txBuffer[9] = tempTime & 0xff;
+			port->txBuffer[10] = port->utcTime.tz;	//Time zone offset in 15 minute blocks
+			port->txBuffer[11] = port->utcTime.dst;	//DST offset in 15 minute blocks
+			port->linkData.txCount = 12;
 			break;
 		default:
 			valid = false;
 			break;
 	}
 	if (valid == true) {
-		expectedMsgSize = 2;		//Set size of expected message
-		txBuffer[0] = 0x08;			//Message type
-		txBuffer[1] = 0x02;
-		txBuffer[2] = 0x00;			//Payload length
-		txBuffer[4] = opcode1;		//Message opcode
-		txBuffer[5] = opcode2;		//Message operand
+		port->expectedMsgSize = 2;		//Set size of expected message
+		port->txBuffer[0] = 0x08;			//Message type
+		port->txBuffer[1] = 0x02;
+		port->txBuffer[2] = 0x00;			//Payload length
+		port->txBuffer[4] = opcode1;		//Message opcode
+		port->txBuffer[5] = opcode2;		//Message operand
 	}
 	return rtnval;
 
@@ -752,59 +946,185 @@ int CEA2045inter(unsigned char opcode1,unsigned char opcode2)
  *==========================================================================
  * This function is called to send a Basic message to the SGD
  * Syntax is:
- * int rtnval = CEA2045basic(byte COMMAND,int cmdparam);
+ * int rtnval = CEA2045basic(port, byte COMMAND,int cmdparam);
  * @return 0 on success
  * @return 1 on failure to interpret a value
  * @return 2 on routine called when blocked
  *==========================================================================
  */
-int CEA2045basic(unsigned char cmd,long cmdparam, float cmdparamf)
+int CEA2045basic(struct cea2045PortStruct *port, unsigned char cmd,long cmdparam, float cmdparamf)
 {
 	unsigned char opcode1 = 0;		// opcode1
 	unsigned char opcode2 = 0;		// opcode2
-	long tempval;
-	bool valid;
-	int rtnval;
 
-	if (linkData.txBlock == true) {
+	if (port->linkData.txBlock == true) {
 		return 2;		//Routine called when blocked	
 	}
+	if (CEA2045encode(port, cmd, cmdparam, cmdparamf, &opcode1, &opcode2) == false) {
+		return 1;
+	}
+	linkBasicTx(port, opcode1, opcode2);
+	cmdSent(port, opcode1, cmdparam);
+	return 0;
+}
+
+/**
+ *==========================================================================
+ * This function is called to queue a Basic message for the SGD. Queued
+ * messages are sent by the link layer as soon as the link is free, without
+ * waiting for the application ack of the previous one. A new command
+ * replaces a queued command it supersedes: the latest price, power level
+ * or grid guidance wins, and a shed, end shed, CPP, grid emergency or load
+ * up replaces any queued event command (so an end shed cancels a queued
+ * shed). Application ack/nak replies are never replaced. A command takes
+ * effect (e.g. the shed end time) only when it is sent.
+ * Syntax is:
+ * int rtnval = CEA2045queue(port, byte COMMAND,int cmdparam, float cmdparamf);
+ * @return queue depth on success
+ * @return -1 on failure to interpret a value or queue full
+ *==========================================================================
+ */
+int CEA2045queue(struct cea2045PortStruct *port, unsigned char cmd, long cmdparam, float cmdparamf)
+{
+	struct cea2045CmdQueueStruct *queue = &port->cmdQueue;
+	unsigned char opcode1 = 0;
+	unsigned char opcode2 = 0;
+	int slot = -1;
+	int i;
+	int j;
+
+	if (CEA2045encode(port, cmd, cmdparam, cmdparamf, &opcode1, &opcode2) == false) {
+		return -1;
+	}
+	// The first superseded command is replaced in place, any others are dropped
+	for (i = 0, j = 0; i < queue->count; i++) {
+		if (cmdClass(opcode1) != 0 && cmdClass(queue->cmd[i].opCode1) == cmdClass(opcode1)) {
+			queue->coalesced++;
+			if (slot >= 0) {
+				continue;
+			}
+			slot = j;
+		}
+		queue->cmd[j++] = queue->cmd[i];
+	}
+	queue->count = j;
+	if (slot < 0) {
+		if (queue->count == CEA2045_CMD_QUEUE_SIZE) {
+			return -1;
+		}
+		slot = queue->count++;
+	}
+	queue->cmd[slot].opCode1 = opcode1;
+	queue->cmd[slot].opCode2 = opcode2;
+	queue->cmd[slot].param = cmdparam;
+	queue->cmd[slot].timeoutTime = 0;
+	queue->queued++;
+	if (queue->count > queue->maxCount) {
+		queue->maxCount = queue->count;
+	}
+	return queue->count;
+}
+
+/**
+ ***************************************************************************
+ * Number of Basic messages waiting in the port's command queue. 
+ ***************************************************************************
+ */
+int cea2045QueueDepth(struct cea2045PortStruct *port) {
+	return port->cmdQueue.count;
+}
+
+/**
+ ***************************************************************************
+ * Commands in the same class supersede each other in the command queue. 
+ *
+ * @return class of the command, 0 if it is never superseded
+ ***************************************************************************
+ */
+static int cmdClass(unsigned char opcode1) {
+	switch(opcode1) {
+		case CEA2045_SHED:
+		case CEA2045_END_SHED:
+		case CEA2045_CPP:
+		case CEA2045_GRID_EMERGENCY:
+		case CEA2045_LOADUP:
+			return CEA2045_SHED;
+		case CEA2045_APP_ACK:
+		case CEA2045_APP_NAK:
+			return 0;
+		default:
+			return opcode1;
+	}
+}
+
+/**
+ ***************************************************************************
+ * Apply the side effects of a Basic command once it is handed to the link
+ * layer, so a queued command replaced before it is sent has none. 
+ ***************************************************************************
+ */
+static void cmdSent(struct cea2045PortStruct *port, unsigned char opcode1, long cmdparam) {
+	switch(opcode1) {
+		case CEA2045_SHED:
+		case CEA2045_CPP:
+		case CEA2045_GRID_EMERGENCY:
+		case CEA2045_LOADUP:
+			port->shedEndTime = time(NULL) + cmdparam;
+			break;
+		case CEA2045_END_SHED:
+			port->shedEndTime = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+/**
+ ***************************************************************************
+ * Convert a Basic command and its parameter to message opcodes. 
+ *
+ * @return true on success, false on failure to interpret a value
+ ***************************************************************************
+ */
+static bool CEA2045encode(struct cea2045PortStruct *port, unsigned char cmd, long cmdparam, float cmdparamf,
+	unsigned char *opcode1Out, unsigned char *opcode2Out)
+{
+	unsigned char opcode1 = 0;		// opcode1
+	unsigned char opcode2 = 0;		// opcode2
+	long tempval;
+	bool valid;
+
 	valid = true;
-	rtnval = 0;
 	switch(cmd) {
-		case SHED:
-		case TIME_REMAINING_PRICE:
-		case CPP:
-		case GRID_EMERGENCY:
-		case LOADUP:
+		case CEA2045_SHED:
+		case CEA2045_TIME_REMAINING_PRICE:
+		case CEA2045_CPP:
+		case CEA2045_GRID_EMERGENCY:
+		case CEA2045_LOADUP:
 			opcode1 = cmd;
 			tempval = sqrt(cmdparam/2);
 			if (tempval > 0xff) opcode2 = 0xff;
 			else opcode2 = tempval;
-			if (cmd != TIME_REMAINING_PRICE) {
-				shedEndTime = time(&currentTimeSec) + cmdparam;
-			} 
 			break;
-		case END_SHED:		
+		case CEA2045_END_SHED:		
 			opcode1 = cmd;
 			opcode2 = 0;
-			shedEndTime = 0;
 			break;
-		case COMM_STATUS:		
-		case OPER_STATE_REQ:		
-		case SIMPLE_TIME_SYNC:		
-		case APP_ACK:
-		case APP_NAK:
-		case GRID_GUIDANCE:
+		case CEA2045_COMM_STATUS:		
+		case CEA2045_OPER_STATE_REQ:		
+		case CEA2045_SIMPLE_TIME_SYNC:		
+		case CEA2045_APP_ACK:
+		case CEA2045_APP_NAK:
+		case CEA2045_GRID_GUIDANCE:
 			opcode1 = cmd;
 			opcode2 = cmdparam;
 			break;
-		case PRESENT_RELATIVE_PRICE:
-		case NEXT_RELATIVE_PRICE:
+		case CEA2045_PRESENT_RELATIVE_PRICE:
+		case CEA2045_NEXT_RELATIVE_PRICE:
 			opcode1 = cmd;
-			opcode2 = calcRelativePriceByte(cmdparamf);
+			opcode2 = cea2045RelativePriceByte(cmdparamf);
 			break;
-		case POWER_LEVEL:
+		case CEA2045_POWER_LEVEL:
 			opcode1 = cmd;
 			if (cmdparam > 0) {		// Power absorbed
 				if (cmdparam > 127) {
@@ -823,216 +1143,526 @@ int CEA2045basic(unsigned char cmd,long cmdparam, float cmdparamf)
 			valid = false;
 			break;
 	}	
-	if (valid == true) {
-//		linkData.txBlock = false;	//Prevent any new messages until this completes	
-		expectedMsgSize = 2;		//Set size of expected message
-		txBuffer[0] = 0x08;			//Message type
-		txBuffer[1] = 0x01;
-		txBuffer[2] = 0x00;			//Payload length (always 2)
-		txBuffer[3] = 0x02; 
-		txBuffer[4] = opcode1;		//Message opcode
-		txBuffer[5] = opcode2;		//Message operand
-		linkData.txCount = 6;
-	}
-	return rtnval;
+	*opcode1Out = opcode1;
+	*opcode2Out = opcode2;
+	return valid;
+}
+
+/**
+ ***************************************************************************
+ * Load a Basic message into the transmit buffer for the link layer. 
+ ***************************************************************************
+ */
+static void linkBasicTx(struct cea2045PortStruct *port, unsigned char opcode1, unsigned char opcode2) {
+	port->expectedMsgSize = 2;		//Set size of expected message
+	port->txBuffer[0] = 0x08;			//Message type
+	port->txBuffer[1] = 0x01;
+	port->txBuffer[2] = 0x00;			//Payload length (always 2)
+	port->txBuffer[3] = 0x02; 
+	port->txBuffer[4] = opcode1;		//Message opcode
+	port->txBuffer[5] = opcode2;		//Message operand
+	port->linkData.txCount = 6;
 }
 
 /**
  *==========================================================================
- * Link layer functionality. Trigger this routine every millisecond or so.
- * If desired this routine and its supporting subroutines can be made a 
- * separate process, thread or interrupt routine. Data could then be passed
- * via shared memory, pipe, etc.
+ * Link layer functionality. Call this routine from the event loop each time
+ * epoll_wait() returns, passing the events reported for the CEA-2045 port
+ * (0 if only the link timer or other descriptors woke the loop), and once
+ * more after the app layer has queued a message so it is sent right away.
+ * Deadlines are kept on CLOCK_MONOTONIC and the link timerfd is re-armed for
+ * the earliest one, so the loop only wakes on received characters or an
+ * expiring timer. On a SunSpec port (port->linkData.sunSpec) received
+ * messages are handled by linkSunSpecRx().
  * @return 0 on success
  * @return 1 on link ack received
- * @return -1 on link nak - nak value in linkData.nakVal
+ * @return -1 on link nak - nak value in port->linkData.nakVal
  * @return -2 on link ack/nak timeout
  *==========================================================================
  */
-int linkLayer()
+static int linkLayer(struct cea2045PortStruct *port, uint32_t events)
 {
 	int newChars;
+	int rtn = 0;
+	uint64_t now;
+	struct iovec iov[3];
 
 	
-	if (linkData.sunSpec == false) {
+	if (port->linkData.sunSpec == false) {
 		// This is a normal CEA2045 SGD device
 		//Get any new characters from SGD
-		if (linkData.rxCount == 0) {		// Only check for new received data if app layer is done with last message
-//			printf("linkData.rxCount = %i\n", linkData.rxCount);
-			// Check for received data 
-			newChars = read(cea2045_fd, &rxBuffer[rxCount], sizeof(rxBuffer - rxCount));
+		if ((events & EPOLLIN) && port->linkData.rxCount == 0) {		// Only read new data if app layer is done with last message
+			// Read received data 
+			newChars = read(port->fd, &port->rxBuffer[port->rxCount], sizeof(port->rxBuffer) - port->rxCount);
 			if (newChars > 0) {
-				printf("%i bytes read\n", newChars);
-				rxCount += newChars;
-				if (pendingLinkAck == true) {
+				linkDebug(port, "%i bytes read\n", newChars);
+				port->rxCount += newChars;
+				if (port->pendingLinkAck == true) {
 					//If waiting for link ack
-					if (rxCount > 1) {
+					if (port->rxCount > 1) {
 						//At least 2 characters have been received so check for link ack/nak
-						addTimeOffset(&txDelayTime, 100000);
-						linkData.txBlock = true;
-						pendingLinkAck = false;
-						expectedMsgSize = 0;
-						rxCount = 0;
-						txStartTime.tv_sec = 0;
-						if (rxBuffer[0] == 6 && rxBuffer[1] == 0) {
+						port->linkTimer.txBlockDeadline = monoTimeMs() + CEA2045_TX_BLOCK_TIME;
+						port->linkData.txBlock = true;
+						port->pendingLinkAck = false;
+						port->expectedMsgSize = 0;
+						port->linkTimer.ackDeadline = 0;
+						if (port->rxBuffer[0] == 6 && port->rxBuffer[1] == 0) {
 							//Link ack received
-							printf("Received Link Ack\n");
-							linkData.nakVal = -1;
-							return 1;
+							linkDebug(port, "Received Link Ack\n");
+							port->linkData.nakVal = -1;
+							rtn = 1;
 						}
-						else if (rxBuffer[0] == 0x15) {
+						else if (port->rxBuffer[0] == 0x15) {
 							//Link nak received
-							linkData.nakVal = rxBuffer[1];
-							return -1;
+							port->linkData.nakVal = port->rxBuffer[1];
+							rtn = -1;
 						}
+						// Keep anything the SGD sent after the ack/nak
+						port->rxCount -= 2;
+						memmove(&port->rxBuffer[0], &port->rxBuffer[2], port->rxCount);
 					}
 					
 				}
-				else {
-					if (rxCount == newChars) {
+				if (port->pendingLinkAck == false && port->rxCount > 0) {
+					if (port->linkTimer.rxDeadline == 0) {
 						//Start of a received message
-						gettimeofday(&rxStartTime, NULL);
+						port->linkTimer.rxDeadline = monoTimeMs() + CEA2045_RX_MSG_TIMEOUT;
 					}
-					if (expectedMsgSize == 0) {
+					if (port->expectedMsgSize == 0) {
 						//Message size has not been determined
-						if ((rxBuffer[0] == 0x08 || rxBuffer[0] == 0x09) && rxCount > 3) {
+						if ((port->rxBuffer[0] == 0x08 || port->rxBuffer[0] == 0x09) && port->rxCount > 3) {
 							// enough characters have been received to calculate message size
-							expectedMsgSize = (rxBuffer[2] * 256) + rxBuffer[3] + 6;
-							printf("%i Expected message size\n", expectedMsgSize);
+							port->expectedMsgSize = (port->rxBuffer[2] * 256) + port->rxBuffer[3] + 6;
+							linkDebug(port, "%i Expected message size\n", port->expectedMsgSize);
 						}
 					}
-					if (expectedMsgSize > 0 && rxCount >= expectedMsgSize) {
+					if (port->expectedMsgSize > 0 && port->rxCount >= port->expectedMsgSize) {
 						// Complete message received - validate checksum
-						printf("Complete message received\n");
-						rxStartTime.tv_sec = 0;
-						if (calcChecksum(rxBuffer, expectedMsgSize - 2, true) == 0) {
-//							printf("Got here 1\n");
-							linkAckBuff[0] = 0x06;
-							linkAckBuff[1] = 0x0;
-							linkData.rxCount = expectedMsgSize -2;
-							rxCount = 0;
-							expectedMsgSize = 0;
-							addTimeOffset(&pendingTxTime, 40000);		//send ack in 40ms
-							pendingTxLinkAck = true;
-							linkData.txBlock = true;
+						linkDebug(port, "Complete message received\n");
+						port->linkTimer.rxDeadline = 0;
+						port->linkStats.rxMessages++;
+						if (cea2045Checksum(port->rxBuffer, port->expectedMsgSize - 2, true) == 0) {
+							port->linkAckBuff[0] = 0x06;
+							port->linkAckBuff[1] = 0x0;
+							port->linkData.rxCount = port->expectedMsgSize -2;
 						}
 						else {
-							linkAckBuff[0] = 0x15;
-							linkAckBuff[1] = 0x03;			// Nak for bad checksum
-							rxCount = 0;					// Flush receive buffer
-							expectedMsgSize = 0;
-							addTimeOffset(&pendingTxTime, 40000);		//send ack in 40ms
-							pendingTxLinkAck = true;
-							linkData.txBlock = true;
+							port->linkAckBuff[0] = 0x15;
+							port->linkAckBuff[1] = 0x03;			// Nak for bad checksum
 						}
+						port->rxCount = 0;					// Flush receive buffer
+						port->expectedMsgSize = 0;
+						port->linkTimer.ackTxDeadline = monoTimeMs() + CEA2045_LINK_ACK_DELAY;		//send ack in 40ms
+						port->pendingTxLinkAck = true;
+						port->linkData.txBlock = true;
 						//===============================================
 						// add additional code for other link errors
 						//===============================================
 					}
 				}
 			}
-			else if (rxStartTime.tv_sec > 0){
-				//Check for timeout on message
-				if (calcTimeDiff(&rxStartTime) > 100) {
-					//It has been over 100ms since start of message so nak message
-					rxStartTime.tv_sec = 0;
-					linkAckBuff[0] = 0x15;
-					linkAckBuff[1] = 0x05;			// Nak for message timeout
-					rxCount = 0;					// Flush receive buffer
-					expectedMsgSize = 0;
-					write(cea2045_fd, &linkAckBuff[0], 2);	// Write a link nak to the SGD
-					addTimeOffset(&txDelayTime, 100000);		//Don't send messages for 100ms
-					linkData.txBlock = true;
+		}
+
+	}
+	else {
+		// SunSpec SGD - pass through messages are framed in place
+		rtn = linkSunSpecRx(port, events);
+	}
+
+	now = monoTimeMs();
+	if (port->linkTimer.rxDeadline > 0 && now >= port->linkTimer.rxDeadline) {
+		//It has been over 100ms since start of message so nak message
+		port->linkTimer.rxDeadline = 0;
+		port->linkAckBuff[0] = 0x15;
+		port->linkAckBuff[1] = 0x05;			// Nak for message timeout
+		port->rxCount = 0;					// Flush receive buffer
+		port->expectedMsgSize = 0;
+		write(port->fd, &port->linkAckBuff[0], 2);	// Write a link nak to the SGD
+		port->linkTimer.txBlockDeadline = now + CEA2045_TX_BLOCK_TIME;		//Don't send messages for 100ms
+		port->linkData.txBlock = true;
+	}
+	else if (port->pendingLinkAck == true && now >= port->linkTimer.ackDeadline) {
+		//It has been over 120ms since message was sent so timeout
+		port->linkTimer.ackDeadline = 0;
+		port->linkTimer.txBlockDeadline = 0;
+		port->pendingLinkAck = false;
+		port->rxCount = 0;					// Flush receive buffer
+		port->expectedMsgSize = 0;
+		port->linkData.txBlock = false;
+		rtn = -2;
+	}
+	if (port->pendingTxLinkAck == true && now >= port->linkTimer.ackTxDeadline) {
+		//Time to send pending link ack/nak
+		linkDebug(port, "Sending Link Ack/Nak\n");
+		write(port->fd, &port->linkAckBuff[0], 2);	// Write a link ack/nak to the SGD
+		port->pendingTxLinkAck = false;
+		port->linkTimer.ackTxDeadline = 0;
+		port->linkTimer.txBlockDeadline = now + CEA2045_TX_BLOCK_TIME;		//Don't send messages for 100ms
+		port->linkData.txBlock = true;
+	}
+	if (port->linkData.txBlock == true && port->pendingTxLinkAck == false && now >= port->linkTimer.txBlockDeadline) {
+		//Transmit block has expired
+		port->linkTimer.txBlockDeadline = 0;
+		linkDebug(port, "Clearing txBlock\n");
+		port->linkData.txBlock = false;
+	}
+	if (port->linkData.txBlock == false && port->linkData.txCount == 0 && port->ssTxLen == 0 &&
+		port->pendingLinkAck == false && port->cmdQueue.count > 0) {
+		// Link is free - send the next queued command
+		linkQueueNext(port);
+	}
+	if (port->linkData.txBlock == false && port->linkData.txCount > 0 && port->pendingLinkAck == false) {
+		// Transmit new message to SGD
+		cea2045Checksum(port->txBuffer, port->linkData.txCount, false);
+		write(port->fd, &port->txBuffer[0], port->linkData.txCount + 2);	// Write data in port->txBuffer to the CEA 2045 port
+		port->linkTimer.ackDeadline = now + CEA2045_LINK_ACK_TIMEOUT;
+		port->linkTimer.txBlockDeadline = now + CEA2045_TX_ACK_BLOCK_TIME;		//Don't send messages for 150ms or until Link ack received
+		port->linkStats.txMessages++;
+		port->linkData.txBlock = true;
+		port->linkData.txCount = 0;
+		port->pendingLinkAck = true;
+		port->expectedMsgSize = 2;		//Set size of expected message
+	}
+	else if (port->linkData.txBlock == false && port->ssTxLen > 0 && port->pendingLinkAck == false) {
+		// Frame the SunSpec request around the caller's buffer
+		port->txBuffer[0] = CEA2045_PASS_THROUGH;			//Message type
+		port->txBuffer[1] = CEA2045_PASS_THROUGH_MODBUS;
+		port->txBuffer[2] = port->ssTxLen >> 8;		//Payload length
+		port->txBuffer[3] = port->ssTxLen & 0xff;
+		iov[0].iov_base = port->txBuffer;
+		iov[0].iov_len = 4;
+		iov[1].iov_base = port->ssTxBuf;
+		iov[1].iov_len = port->ssTxLen;
+		calcChecksumIov(iov, 2, &port->txBuffer[4], false);
+		iov[2].iov_base = &port->txBuffer[4];
+		iov[2].iov_len = 2;
+		writev(port->fd, iov, 3);
+		port->linkTimer.ackDeadline = now + CEA2045_LINK_ACK_TIMEOUT;
+		port->linkTimer.txBlockDeadline = now + CEA2045_TX_ACK_BLOCK_TIME;
+		port->linkStats.txMessages++;
+		port->linkData.txBlock = true;
+		port->ssTxBuf = NULL;
+		port->ssTxLen = 0;
+		port->pendingLinkAck = true;
+	}
+	linkArmTimer(port);
+	// Stop watching the port while the app layer holds a received message
+	linkWatch(port, port->linkData.rxCount == 0);
+	return rtn;
+}
+
+/**
+ *==========================================================================
+ * SunSpec link layer receive. Characters are read up to the next field of
+ * the message so the payload of a SunSpec pass through message lands
+ * directly in the buffer handed to CEA2045ss_read() (port->ssRxBuf).
+ * Other messages are received into port->rxBuffer as usual. The link
+ * ack/nak is sent as soon as a message is complete so the UCM isn't held
+ * up waiting for the next request.
+ * @return 0 on success
+ * @return 1 on link ack received
+ * @return -1 on link nak - nak value in port->linkData.nakVal
+ *==========================================================================
+ */
+static int linkSunSpecRx(struct cea2045PortStruct *port, uint32_t events)
+{
+	unsigned char *dest;
+	struct iovec iov[2];
+	int payloadSize = 0;
+	int need;
+	int newChars;
+	int rtn = 0;
+
+	if (!(events & EPOLLIN) || port->linkData.rxCount != 0) {
+		return 0;
+	}
+	while (port->ssRxCount == 0 && port->linkData.rxCount == 0) {
+		if (port->rxCount >= 4) {
+			payloadSize = (port->rxBuffer[2] * 256) + port->rxBuffer[3];
+		}
+		if (port->pendingLinkAck == true) {
+			dest = &port->rxBuffer[port->rxCount];
+			need = 2 - port->rxCount;
+		}
+		else if (port->rxCount < 4) {
+			dest = &port->rxBuffer[port->rxCount];
+			need = 4 - port->rxCount;
+		}
+		else if (port->rxCount < payloadSize + 4) {
+			dest = linkSunSpecPayload(port) + port->rxCount - 4;
+			need = payloadSize + 4 - port->rxCount;
+		}
+		else {
+			dest = &port->rxChecksum[port->rxCount - payloadSize - 4];
+			need = payloadSize + 6 - port->rxCount;
+		}
+		newChars = read(port->fd, dest, need);
+		if (newChars <= 0) {
+			break;
+		}
+		linkDebug(port, "%i bytes read\n", newChars);
+		port->rxCount += newChars;
+		if (port->pendingLinkAck == true) {
+			if (port->rxCount == 2) {
+				port->linkTimer.txBlockDeadline = monoTimeMs() + CEA2045_TX_BLOCK_TIME;
+				port->linkData.txBlock = true;
+				port->pendingLinkAck = false;
+				port->rxCount = 0;
+				port->linkTimer.ackDeadline = 0;
+				if (port->rxBuffer[0] == 6 && port->rxBuffer[1] == 0) {
+					//Link ack received
+					linkDebug(port, "Received Link Ack\n");
+					port->linkData.nakVal = -1;
+					rtn = 1;
+				}
+				else if (port->rxBuffer[0] == 0x15) {
+					//Link nak received
+					port->linkData.nakVal = port->rxBuffer[1];
+					rtn = -1;
 				}
 			}
-			else if (pendingLinkAck == true) {
-				//Check for timeout waiting on link ack/nak
-				if (calcTimeDiff(&txStartTime) > 120) {
-					//It has been over 120ms since message was sent so timeout
-					txStartTime.tv_sec = 0;
-					pendingLinkAck = false;
-					rxCount = 0;					// Flush receive buffer
-					expectedMsgSize = 0;
-					linkData.txBlock = false;
-					return -2;
+			continue;
+		}
+		if (port->linkTimer.rxDeadline == 0) {
+			//Start of a received message
+			port->linkTimer.rxDeadline = monoTimeMs() + CEA2045_RX_MSG_TIMEOUT;
+		}
+		if (port->rxCount == 4 && linkSunSpecPayload(port) == NULL) {
+			//Message doesn't fit anywhere - flush it and nak
+			tcflush(port->fd, TCIFLUSH);
+			port->linkTimer.rxDeadline = 0;
+			port->linkAckBuff[0] = 0x15;
+			port->linkAckBuff[1] = 0x03;
+			port->rxCount = 0;
+			write(port->fd, &port->linkAckBuff[0], 2);	// Write a link nak to the SGD
+			port->linkTimer.txBlockDeadline = monoTimeMs() + CEA2045_TX_BLOCK_TIME;
+			port->linkData.txBlock = true;
+			break;
+		}
+		if (port->rxCount >= 6 && port->rxCount == (port->rxBuffer[2] * 256) + port->rxBuffer[3] + 6) {
+			// Complete message received - validate checksum
+			payloadSize = port->rxCount - 6;
+			dest = linkSunSpecPayload(port);
+			iov[0].iov_base = port->rxBuffer;
+			iov[0].iov_len = 4;
+			iov[1].iov_base = dest;
+			iov[1].iov_len = payloadSize;
+			port->linkTimer.rxDeadline = 0;
+			port->linkStats.rxMessages++;
+			if (calcChecksumIov(iov, 2, port->rxChecksum, true) == 0) {
+				port->linkAckBuff[0] = 0x06;
+				port->linkAckBuff[1] = 0x0;
+				if (dest == port->ssRxBuf) {
+					port->ssRxCount = payloadSize;
+				}
+				else {
+					port->linkData.rxCount = payloadSize + 4;
 				}
 			}
-			if (pendingTxLinkAck == true) {
-//				printf("Got here 2\n");
-				//Check if it is time to send pending link ack/nak
-				if (calcTimeDiff(&pendingTxTime) >= 0) {
-					printf("Sending Link Ack/Nak\n");
-					write(cea2045_fd, &linkAckBuff[0], 2);	// Write a link nak to the SGD
-					pendingTxLinkAck = false;
-					addTimeOffset(&txDelayTime, 100000);		//Don't send messages for 100ms
-					linkData.txBlock = true;
-				} 
+			else {
+				port->linkAckBuff[0] = 0x15;
+				port->linkAckBuff[1] = 0x03;			// Nak for bad checksum
 			}
+			port->rxCount = 0;
+			linkDebug(port, "Sending Link Ack/Nak\n");
+			write(port->fd, &port->linkAckBuff[0], 2);	// Write a link ack/nak to the SGD
+			port->linkTimer.txBlockDeadline = monoTimeMs() + CEA2045_TX_BLOCK_TIME;
+			port->linkData.txBlock = true;
 		}
-		if (linkData.txBlock == true) {
-			//Check if txDelayTime has expired
-			if (calcTimeDiff(&txDelayTime) >= 0) {
-				txDelayTime.tv_sec = 0;		//Clear the block on transmitting messages
-				printf("Clearing txBlock\n");
-				linkData.txBlock = false;
-			}
+	}
+	return rtn;
+}
+
+/**
+ ***************************************************************************
+ * Where the payload of the message being received goes: the
+ * CEA2045ss_read() buffer for a SunSpec pass through message that fits,
+ * otherwise port->rxBuffer. 
+ *
+ * @return payload buffer, NULL if the message fits in neither
+ ***************************************************************************
+ */
+static unsigned char *linkSunSpecPayload(struct cea2045PortStruct *port) {
+	int payloadSize = (port->rxBuffer[2] * 256) + port->rxBuffer[3];
+
+	if (port->rxBuffer[0] == CEA2045_PASS_THROUGH && port->rxBuffer[1] == CEA2045_PASS_THROUGH_MODBUS &&
+		port->ssRxBuf != NULL && payloadSize <= port->ssRxSize) {
+		return port->ssRxBuf;
+	}
+	if (payloadSize + 6 <= CEA2045_MSG_BUFFER_SIZE) {
+		return &port->rxBuffer[4];
+	}
+	return NULL;
+}
+
+/**
+ ***************************************************************************
+ * Move the oldest queued command to the transmit buffer and note the
+ * application ack expected for it. Each sent command waits for its own
+ * ack, so commands sent back to back can all be acked. 
+ ***************************************************************************
+ */
+static void linkQueueNext(struct cea2045PortStruct *port) {
+	struct cea2045CmdQueueStruct *queue = &port->cmdQueue;
+	struct cea2045CmdStruct cmd = queue->cmd[0];
+
+	linkBasicTx(port, cmd.opCode1, cmd.opCode2);
+	queue->count--;
+	memmove(&queue->cmd[0], &queue->cmd[1], queue->count * sizeof(queue->cmd[0]));
+	queue->sent++;
+	cmdSent(port, cmd.opCode1, cmd.param);
+	if (cmd.opCode1 != CEA2045_APP_ACK && cmd.opCode1 != CEA2045_APP_NAK) {
+		linkAckExpire(port);
+		if (queue->ackCount == CEA2045_CMD_QUEUE_SIZE) {
+			// Oldest command has waited longest, give up on its ack
+			queue->ackCount--;
+			queue->ackTimeouts++;
+			memmove(&queue->ackWait[0], &queue->ackWait[1], queue->ackCount * sizeof(queue->ackWait[0]));
 		}
-		if (linkData.txBlock == false && linkData.txCount > 0) {
-			// Transmit data to SGD
-			if (txStartTime.tv_sec == 0) {
-				// This is a new message to be sent
-				calcChecksum(txBuffer, linkData.txCount, false);
-				gettimeofday(&txStartTime, NULL);
-				write(cea2045_fd, &txBuffer[0], linkData.txCount + 2);	// Write data in txBuffer to the CEA 2045 port
-				addTimeOffset(&txDelayTime, 150000);		//Don't send messages for 150ms or until Link ack received
-				linkData.txBlock = true;
-				linkData.txCount = 0;
-				pendingLinkAck = true;
-				expectedMsgSize = 2;		//Set size of expected message
-			}
+		cmd.timeoutTime = time(NULL) + CEA2045_APP_ACK_TIMEOUT;
+		queue->ackWait[queue->ackCount++] = cmd;
+	}
+}
+
+/**
+ ***************************************************************************
+ * Match an application ack/nak to the oldest sent command still waiting
+ * for one with the same opcode. 
+ *
+ * @return true if a sent command was waiting for the ack
+ ***************************************************************************
+ */
+static bool linkAckMatch(struct cea2045PortStruct *port, unsigned char opcode1) {
+	struct cea2045CmdQueueStruct *queue = &port->cmdQueue;
+	int i;
+
+	linkAckExpire(port);
+	for (i = 0; i < queue->ackCount; i++) {
+		if (queue->ackWait[i].opCode1 == opcode1) {
+			queue->ackCount--;
+			memmove(&queue->ackWait[i], &queue->ackWait[i + 1], (queue->ackCount - i) * sizeof(queue->ackWait[0]));
+			queue->acked++;
+			return true;
 		}
 	}
-	else {
-		// Put SunSpec code here for CSI project
+	return false;
+}
+
+/**
+ ***************************************************************************
+ * Stop waiting for application acks that are overdue. 
+ *
+ * @return number of sent commands that timed out
+ ***************************************************************************
+ */
+static int linkAckExpire(struct cea2045PortStruct *port) {
+	struct cea2045CmdQueueStruct *queue = &port->cmdQueue;
+	time_t now = time(NULL);
+	int expired = 0;
+	int i;
+	int j;
+
+	for (i = 0, j = 0; i < queue->ackCount; i++) {
+		if (queue->ackWait[i].timeoutTime < now) {
+			expired++;
+			continue;
+		}
+		queue->ackWait[j++] = queue->ackWait[i];
 	}
-	return 0;
+	queue->ackCount = j;
+	queue->ackTimeouts += expired;
+	return expired;
 }
 
 /**
  ***************************************************************************
- * This function calculates time in milliseconds from passed value to now. 
- * A negative number says the passed time is still in the future.
- * A positive number says the passed time is still in the past.
+ * Arm the link timerfd for the earliest pending link deadline, or disarm
+ * it when no deadline is running.
+ ***************************************************************************
+ */
+static void linkArmTimer(struct cea2045PortStruct *port) {
+	struct itimerspec its;
+	uint64_t deadline = 0;
+	uint64_t deadlines[4];
+	int i;
+
+	deadlines[0] = port->linkTimer.rxDeadline;
+	deadlines[1] = port->pendingLinkAck ? port->linkTimer.ackDeadline : 0;
+	deadlines[2] = port->pendingTxLinkAck ? port->linkTimer.ackTxDeadline : 0;
+	deadlines[3] = port->linkData.txBlock ? port->linkTimer.txBlockDeadline : 0;
+	for (i = 0; i < 4; i++) {
+		if (deadlines[i] > 0 && (deadline == 0 || deadlines[i] < deadline)) {
+			deadline = deadlines[i];
+		}
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000;
+	its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+	timerfd_settime(port->timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ ***************************************************************************
+ * Enable or disable wake-ups for received characters on the CEA-2045 port. 
  *
- * @param compareTime  A pointer to a timeval structure.
- * @return long int number of milliseconds
+ * @param watch  True to wake on received characters
  ***************************************************************************
  */
-long int calcTimeDiff(struct timeval *compareTime) {
-long int t1;
+static void linkWatch(struct cea2045PortStruct *port, bool watch) {
+	struct epoll_event ev;
 
-	gettimeofday(&currentTime, NULL);
-	t1 = (currentTime.tv_sec - compareTime->tv_sec) * 1000 + ((currentTime.tv_usec - compareTime->tv_usec) / 1000);
-	return t1;
+	if (watch != port->rxWatch) {
+		ev.events = watch ? EPOLLIN : 0;
+		ev.data.fd = port->fd;
+		epoll_ctl(port->epollFd, EPOLL_CTL_MOD, port->fd, &ev);
+		port->rxWatch = watch;
+	}
 }
 
 /**
- ******************************************************************************
- * This function adds a passed number of microseconds to now in timeval struct 
+ ***************************************************************************
+ * Wait for the CEA-2045 port or the link timer. Timer expirations are
+ * consumed here. 
  *
- * @param timestruct  A pointer to a timeval structure
- * @param adder  Number of micriseconds to add to current time.
- * @param validate True if this is a checksum test, false otherwise.
- ******************************************************************************
+ * @param timeout  Milliseconds until the app layer needs to run, -1 for none
+ * @return epoll events for the CEA-2045 port
+ ***************************************************************************
  */
-void addTimeOffset(struct timeval *timestruct, long int adder) {
+static int linkEventWait(struct cea2045PortStruct *port, int timeout) {
+	struct epoll_event events[CEA2045_MAX_EVENTS];
+	uint64_t expirations;
+	int linkEvents = 0;
+	int nfds;
+	int i;
 
-	gettimeofday(timestruct, NULL);
-	timestruct->tv_usec += adder;
-	while (timestruct->tv_usec > 999999) {
-		timestruct->tv_sec += 1;
-		timestruct->tv_usec -= 1000000;
+	nfds = epoll_wait(port->epollFd, events, CEA2045_MAX_EVENTS, timeout);
+	port->linkStats.wakeups++;
+	for (i = 0; i < nfds; i++) {
+		if (events[i].data.fd == port->fd) {
+			linkEvents = events[i].events;
+			port->linkStats.rxWakeups++;
+		}
+		else if (events[i].data.fd == port->timerFd) {
+			read(port->timerFd, &expirations, sizeof(expirations));
+			port->linkStats.timerWakeups++;
+		}
 	}
+	return linkEvents;
+}
+
+/**
+ ***************************************************************************
+ * This function returns CLOCK_MONOTONIC time in milliseconds. 
+ *
+ * @return milliseconds since an arbitrary fixed point
+ ***************************************************************************
+ */
+static uint64_t monoTimeMs() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 /**
@@ -1044,7 +1674,7 @@ void addTimeOffset(struct timeval *timestruct, long int adder) {
  ******************************************************************************
  */
 
-unsigned char calcRelativePriceByte(float relativePrice) {
+unsigned char cea2045RelativePriceByte(float relativePrice) {
 	float f1;
 	
 	if (relativePrice > 9.825) {
@@ -1070,28 +1700,53 @@ unsigned char calcRelativePriceByte(float relativePrice) {
  * @return -1 if checksum fails validation
  ***************************************************************************
  */
-int calcChecksum(unsigned char* buffData, int msgSize, bool validate) {
-	// Message is in array buffData
-	int i;
+int cea2045Checksum(unsigned char* buffData, int msgSize, bool validate) {
+	struct iovec iov;
+
+	iov.iov_base = buffData;
+	iov.iov_len = msgSize;
+	return calcChecksumIov(&iov, 1, &buffData[msgSize], validate);
+}
+
+/**
+ ***************************************************************************
+ * Same as cea2045Checksum() for a message held in several pieces, such as a
+ * header in the port buffer and a payload in the caller's buffer. 
+ *
+ * @param iov  Pieces of the message without checksum.
+ * @param iovCount  Number of pieces.
+ * @param checksum  The two checksum bytes, written or verified.
+ * @param validate True if this is a checksum test, false otherwise.
+ * @return 0 on success
+ * @return -1 if checksum fails validation
+ ***************************************************************************
+ */
+static int calcChecksumIov(const struct iovec *iov, int iovCount, unsigned char *checksum, bool validate) {
+	unsigned char *buffData;
+	size_t i;
+	int j;
 	int checksum1 = 0xaa;
 	int checksum2 = 0;
 
-	for (i = 0; i < msgSize; i++) {
-		checksum1 += buffData[i];
-		checksum1 = checksum1 % 0xff;
-		checksum2 += checksum1;
-		checksum2 = checksum2 % 0xff;
+	for (j = 0; j < iovCount; j++) {
+		buffData = iov[j].iov_base;
+		for (i = 0; i < iov[j].iov_len; i++) {
+			checksum1 += buffData[i];
+			checksum1 = checksum1 % 0xff;
+			checksum2 += checksum1;
+			checksum2 = checksum2 % 0xff;
+		}
 	}
 	if (validate != true) {
-		// Copy checksum to end of buffer
-		buffData[msgSize] = 255 - ((checksum1 + checksum2) % 255);
-		buffData[msgSize + 1] = 255 - ((checksum1 + buffData[msgSize]) % 255);
+		// Copy checksum to end of message
+		checksum[0] = 255 - ((checksum1 + checksum2) % 255);
+		checksum[1] = 255 - ((checksum1 + checksum[0]) % 255);
 		return 0;
 	}
 	else {
-		// Verify the last two characters of buffer match the checksum calculated
-		if (buffData[msgSize] == 255 - ((checksum1 + checksum2) % 255)) {
-			if (buffData[msgSize + 1] == 255 - ((checksum1 + buffData[msgSize]) % 255)) {
+		// Verify the checksum bytes match the checksum calculated
+		if (checksum[0] == 255 - ((checksum1 + checksum2) % 255)) {
+			if (checksum[1] == 255 - ((checksum1 + checksum[0]) % 255)) {
 				return 0;
 			}
 		}
@@ -1103,18 +1758,20 @@ int calcChecksum(unsigned char* buffData, int msgSize, bool validate) {
  ***************************************************************************
  * Initialize the serial port 
  *
- * @return file descriptor for com port
+ * @param path  Serial device, e.g. /dev/ttyUSB0
+ * @return file descriptor for com port, -1 if it can't be opened
  ***************************************************************************
  */
-int initSerialPort()
+static int initSerialPort(const char *path)
 {
 	int tty_fd = -1;
+	struct termios tio;
 	
-	tty_fd = open("/dev/ttyUSB0", O_RDWR | O_NOCTTY | O_NDELAY);		//Open in non blocking read/write mode
+	tty_fd = open(path, O_RDWR | O_NOCTTY | O_NDELAY);		//Open in non blocking read/write mode
 	if (tty_fd == -1)
 	{
 		//ERROR - CAN'T OPEN SERIAL PORT
-		printf("Error - Unable to open UART.  Ensure it is not in use by another application\n");
+		return -1;
 	}
 	
 	tcgetattr(tty_fd, &tio);
@@ -1128,27 +1785,7 @@ int initSerialPort()
 	return tty_fd;
 }
 
-/**
- ***************************************************************************
- * This reads the keyboard input without blocking. Enter must be pressed 
- * to get input. 
- *
- * @return number of characters read
- ***************************************************************************
- */
-int kbhit()
-{
-	struct timeval tv;
-	fd_set fds;
-
-	tv.tv_sec = 0;
-	tv.tv_usec = 0;
-	FD_ZERO(&fds);
-	FD_SET(STDIN_FILENO, &fds); //STDIN_FILENO is 0
-	select(STDIN_FILENO+1, &fds, NULL, NULL, &tv);
-	return FD_ISSET(STDIN_FILENO, &fds);
-}
-
+#ifdef CEA2045_MAIN
 /**
  ***************************************************************************
  * This configures keyboard for non-blocking 
@@ -1156,7 +1793,7 @@ int kbhit()
  * @param state  A pointer to the message string string.
  ***************************************************************************
  */
-void nonblock(int state)
+static void nonblock(int state)
 {
 	struct termios ttystate;
 	
@@ -1176,3 +1813,4 @@ void nonblock(int state)
 	tcsetattr(STDIN_FILENO, TCSANOW, &ttystate);
 
 }
+#endif /* CEA2045_MAIN */
@@ -0,0 +1,219 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _CEA2045LIB_H_
+#define _CEA2045LIB_H_
+
+#define CEA2045_SHED 0x01
+#define CEA2045_END_SHED 0x02
+#define CEA2045_APP_ACK 0x03
+#define CEA2045_APP_NAK 0x04
+#define CEA2045_POWER_LEVEL 0x06
+#define CEA2045_PRESENT_RELATIVE_PRICE 0x07
+#define CEA2045_NEXT_RELATIVE_PRICE 0x08
+#define CEA2045_TIME_REMAINING_PRICE 0x09
+#define CEA2045_CPP 0x0a
+#define CEA2045_GRID_EMERGENCY 0x0b
+#define CEA2045_GRID_GUIDANCE 0x0c
+#define CEA2045_COMM_STATUS 0x0e
+#define CEA2045_CUST_OVERRIDE 0x11
+#define CEA2045_OPER_STATE_REQ 0x12
+#define CEA2045_OPER_STATE_RESP 0x13
+#define CEA2045_SLEEP_STATE 0x14
+#define CEA2045_WAKE_STATE 0x15
+#define CEA2045_SIMPLE_TIME_SYNC 0x16
+#define CEA2045_LOADUP 0x17
+#define CEA2045_INFO_REQ 0x01
+#define CEA2045_SET_UTC_TIME 0x02
+
+#define CEA2045_TIMEOUT 500			// 500 millisecond from first to last byte of message
+#define CEA2045_RX_MSG_TIMEOUT 100		// Milliseconds from first byte to complete message
+#define CEA2045_LINK_ACK_TIMEOUT 120		// Milliseconds to wait for link ack/nak after sending a message
+#define CEA2045_LINK_ACK_DELAY 40		// Milliseconds to wait before sending link ack/nak
+#define CEA2045_TX_BLOCK_TIME 100		// Milliseconds before a message can follow a link ack/nak
+#define CEA2045_TX_ACK_BLOCK_TIME 150		// Milliseconds before a message can follow a sent message without link ack
+#define CEA2045_MAX_EVENTS 4
+#define CEA2045_PASS_THROUGH 0x09		// Pass-through message type, second byte is the protocol
+#define CEA2045_PASS_THROUGH_MODBUS 0x01	// SunSpec Modbus RTU pass-through protocol
+#define CEA2045_MSG_BUFFER_SIZE 256		// Size of the transmit and receive message buffers
+#define CEA2045_CMD_QUEUE_SIZE 16		// Basic messages that can wait for the link
+#define CEA2045_APP_ACK_TIMEOUT 4		// Seconds to wait for an application ack
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Structure definitions */
+struct cea2045BasicStruct {
+	float	priceRatio;			// Present Relative Price ratio to send to SGD
+	time_t	endTime;			// Date/Time in OADR format converted to UTC
+	bool	overRide;			// Override status
+	bool	sleepState;			// Sleep status
+	bool	pendingOpState;		// Set to true if a OpState response is pending
+	bool 	pendingAppAck;		// Flag to show a Application Ack is waiting to be sent to SGD
+	bool 	pendingAppNak;		// Flag to show a Application Nak is waiting to be sent to SGD
+	unsigned char opState;		// Latest operationa state
+	unsigned char appAckSend;	// Application Ack/Nak Opcode 2 value to be sent to SGD in App Ack/Nak message
+	unsigned char appAckRtn;	// Return opcode expected on SGD application ack response
+	unsigned char opCode1;		// Last received OpCode1 from SGD
+	unsigned char opCode2;		// Last received OpCode2 from SGD
+	time_t timeoutTime;			// Time to wait for reply, 0 = not waiting for reply
+};
+
+struct cea2045InterStruct {
+	unsigned char respOpCode1;	// Expected response opcode 1, 0 if none pending
+	unsigned char respOpCode2;	// Expected response opcode 2
+	bool respPending;			// A reaponse is expected
+	time_t timeoutTime;			// Time to wait for reply, 0 = not waiting for reply
+	unsigned char lastOpCode1;	// Last successfully completed intermediate command
+	time_t completeTime;		// Time last command completed successfully
+};
+struct linkStruct {
+	int		txCount;			// App layer writes a value to this after filling the txBuffer
+								// Link layer clears this value after sending characters
+	int		rxCount;			// Link layer writes a value to this after all characters are received
+								// App layer clears this value after processing characters
+	int		nakVal;				// Value returned in link nak from SGD or -1 if link ack returned
+	bool	rxOverflow;			// Set by Link layer if rxCount exceeds rxBuffer size. Cleared on rxFlush
+	bool	rxFlush;			// App layer sets to true to flush rxBuffer.
+								// Link layer sets to false after setting rxCount to 0
+	bool	txFlush;			// App layer sets to true to flush txBuffer.
+								// Link layer sets to false after setting txCount to 0
+	bool	txBlock;			// Transmit must wait 100ms before sending message after link ack/nak.
+	bool	sunSpec;			// App layer sets to true to this is a SunSpec SGD
+};
+
+struct linkTimerStruct {		// Link layer deadlines in CLOCK_MONOTONIC milliseconds, 0 = not running
+	uint64_t rxDeadline;		// Receive message timeout
+	uint64_t ackDeadline;		// Link ack/nak wait timeout
+	uint64_t ackTxDeadline;		// Time to send pending link ack/nak
+	uint64_t txBlockDeadline;	// Time transmit block is cleared
+};
+
+struct linkStatsStruct {		// Link layer event counters
+	unsigned long wakeups;		// Number of times the event loop woke up
+	unsigned long rxWakeups;	// Wake-ups for received characters
+	unsigned long timerWakeups;	// Wake-ups for expired link timers
+	unsigned long rxMessages;	// Complete messages received
+	unsigned long txMessages;	// Messages sent
+};
+
+struct devInfoStruct {			// Device Information structure
+	unsigned char respCode;		// Response code
+	unsigned char ceaVer[2];	// ASCII CEA-2045 version
+	uint16_t vendorID;			// 16 bit vendor ID
+	uint16_t devType;			// 16 bit device type
+	uint16_t devRev;			// 16 bit device revision
+	uint32_t capBitmap;			// 32 bit capability bitmap
+	unsigned char reserve;		// Reserved (not currently used)
+	unsigned char modelNum[16];	// ASCII model number
+	unsigned char serialNum[16];	// ASCII serial number
+	unsigned char firmYear;		//Firmware year
+	unsigned char firmMonth;	//Firmware month
+	unsigned char firmDay;		//Firmware day
+	unsigned char firmMajor;	//Firmware major
+	unsigned char firmMinor;	//Firmware minor
+};
+
+struct	utcTimeStruct {
+	time_t lastTime;	//Last time sent or received
+	unsigned char tz;	//Time zone offset in 15 minute blocks
+	unsigned char dst;	//DST offset in 15 minute blocks
+};
+
+struct cea2045CmdStruct {		// Queued Basic message
+	unsigned char opCode1;
+	unsigned char opCode2;
+	long param;					// Command parameter, applied when the message is sent
+	time_t timeoutTime;			// Time to wait for the application ack once sent
+};
+
+struct cea2045CmdQueueStruct {	// Basic messages waiting for the link, oldest first
+	struct cea2045CmdStruct cmd[CEA2045_CMD_QUEUE_SIZE];
+	int count;					// Messages waiting
+	struct cea2045CmdStruct ackWait[CEA2045_CMD_QUEUE_SIZE];	// Sent messages waiting for an application ack, oldest first
+	int ackCount;
+	int maxCount;				// Deepest the queue has been
+	unsigned long queued;		// Messages accepted
+	unsigned long coalesced;	// Messages replaced or cancelled before being sent
+	unsigned long sent;			// Messages handed to the link layer
+	unsigned long acked;		// Sent messages matched to an application ack/nak
+	unsigned long ackTimeouts;	// Sent messages never acked
+};
+
+struct cea2045PortStruct {		// One UCM port, all link and app layer state for the port
+	int		fd;					// Serial port
+	int		epollFd;			// Event loop for the port and its link timer
+	int		timerFd;			// Link layer deadline timer
+	bool	rxWatch;			// Port is registered for received characters
+	bool	debug;				// Print link and app layer progress
+	unsigned char txBuffer[CEA2045_MSG_BUFFER_SIZE];	// Buffer for characters to be sent to SGD
+	unsigned char rxBuffer[CEA2045_MSG_BUFFER_SIZE];	// Buffer for characters received from SGD
+	unsigned char linkAckBuff[2];
+	struct cea2045BasicStruct basic;
+	struct cea2045InterStruct inter;
+	struct linkStruct linkData;
+	struct devInfoStruct devInfo;		// Device Information structure
+	struct utcTimeStruct utcTime;		// Set-Get utc time structure
+	struct linkTimerStruct linkTimer;	// Link layer deadlines
+	struct linkStatsStruct linkStats;	// Link layer wake-up counters
+	struct cea2045CmdQueueStruct cmdQueue;	// Basic messages waiting to be sent
+	time_t shedEndTime;
+	int expectedMsgSize;
+	int rxCount;
+	bool pendingTxLinkAck;
+	bool pendingLinkAck;
+	unsigned char rxChecksum[2];		// Checksum of a SunSpec message being received
+	unsigned char *ssTxBuf;				// SunSpec frame waiting to be sent, framed in place
+	uint16_t ssTxLen;
+	unsigned char *ssRxBuf;				// Buffer receiving the next SunSpec frame
+	uint16_t ssRxSize;
+	int ssRxCount;						// Length of the SunSpec frame received, 0 if none
+};
+
+// Function declorations
+struct cea2045PortStruct *cea2045Open(const char *path);
+void cea2045Close(struct cea2045PortStruct *port);
+int cea2045Poll(struct cea2045PortStruct *port, int timeout);
+int cea2045Flush(struct cea2045PortStruct *port, bool txClear, bool rxClear);
+int CEA2045basic(struct cea2045PortStruct *port, unsigned char cmd, long cmdparam, float cmdparamf);
+int CEA2045basicRx(struct cea2045PortStruct *port);
+int CEA2045queue(struct cea2045PortStruct *port, unsigned char cmd, long cmdparam, float cmdparamf);
+int cea2045QueueDepth(struct cea2045PortStruct *port);
+int CEA2045inter(struct cea2045PortStruct *port, unsigned char opcode1, unsigned char opcode2);
+int CEA2045interRx(struct cea2045PortStruct *port);
+int CEA2045ss_read(struct cea2045PortStruct *port, unsigned char *buf, uint16_t len, uint32_t timeout);
+int CEA2045ss_write(struct cea2045PortStruct *port, unsigned char *buf, uint16_t len, uint32_t timeout);
+unsigned char cea2045RelativePriceByte(float relativePrice);
+int cea2045Checksum(unsigned char* buffData, int msgSize, bool validate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CEA2045LIB_H_ */
@@ -28,6 +28,17 @@
 
 #include "sunspec_error.h"
 #include "sunspec_device.h"
+#include "sunspec_bus.h"
+#include "sunspec_exec.h"
+#include "sunspec_group.h"
+#include "sunspec_modbus_record.h"
+#include "sunspec_modbus_sim.h"
+#include "sunspec_ring.h"
+#include "sunspec_rollup.h"
+#include "sunspec_scan.h"
+#include "sunspec_sub.h"
+#include "sunspec_sched.h"
+#include "sunspec_tsc.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,12 +48,26 @@ extern "C" {
 
 suns_device_t * suns_device_alloc();
 void suns_device_free(suns_device_t *device);
-suns_err_t suns_device_rtu_cea2045(suns_device_t *device, uint16_t slave_id);
+suns_err_t suns_device_rtu_cea2045(suns_device_t *device, char *ifc_name, uint16_t slave_id);
 suns_err_t suns_device_rtu_serial(suns_device_t *device, char *ifc_name, uint16_t slave_id,
                                   uint32_t baudrate, uint8_t parity);
 suns_err_t suns_device_tcp(suns_device_t *device, uint8_t *ipaddr, uint16_t ipport, uint16_t slave_id);
 suns_err_t suns_device_sim(suns_device_t *device, uint16_t base_addr,
                            uint16_t *sim_map, uint16_t sim_map_len, uint16_t slave_id);
+suns_err_t suns_device_sim_file(suns_device_t *device, suns_modbus_sim_file_t *file, uint32_t index,
+                                uint16_t slave_id);
+suns_err_t suns_device_cache(suns_device_t *device, uint32_t ttl);
+suns_err_t suns_device_record_start(suns_device_t *device, const char *path);
+suns_err_t suns_device_record_stop(suns_device_t *device);
+suns_err_t suns_device_replay(suns_device_t *device, const char *path, uint8_t mode);
+suns_err_t suns_device_stats_get(suns_device_t *device, suns_stats_t *snapshot);
+suns_err_t suns_device_stats_reset(suns_device_t *device);
+suns_err_t suns_device_health_get(suns_device_t *device, suns_health_t *health);
+suns_err_t suns_device_health_config(suns_device_t *device, uint16_t threshold,
+                                     uint32_t backoff_min, uint32_t backoff_max);
+suns_err_t suns_device_health_reset(suns_device_t *device);
+uint16_t suns_device_req_max_get(suns_device_t *device);
+suns_err_t suns_device_req_max_set(suns_device_t *device, uint16_t req_max);
 suns_err_t suns_device_scan(suns_device_t *device);
 suns_model_t * suns_device_get_model(suns_device_t *device, uint16_t id, char *id_str, uint16_t index);
 suns_err_t suns_model_read(suns_model_t *model);
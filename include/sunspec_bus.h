@@ -0,0 +1,124 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_BUS_H_
+#define _SUNSPEC_BUS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+
+/* bus operations */
+#define SUNS_BUS_OP_MODEL_READ          1       /* suns_model_read(model) */
+#define SUNS_BUS_OP_MODEL_WRITE         2       /* suns_model_write(model), dirty points only */
+#define SUNS_BUS_OP_SCAN                3       /* suns_device_scan(device) */
+#define SUNS_BUS_OP_READ                4       /* read len registers at addr into buf */
+#define SUNS_BUS_OP_WRITE               5       /* write len registers at addr from buf */
+#define SUNS_BUS_OP_FUNC                6       /* func(device, arg) */
+
+/* intrusive queue link, first member of anything queued */
+typedef struct _suns_bus_node_t {
+    struct _suns_bus_node_t *next;
+} suns_bus_node_t;
+
+/*
+ * Lock-free multi-producer single-consumer queue. Producers only swap the
+ * head; the one consumer owns the tail. The stub node keeps the queue
+ * non-empty so a push never has to touch the consumer's end.
+ */
+typedef struct _suns_bus_queue_t {
+    suns_bus_node_t *head;              /* last pushed, shared by producers */
+    suns_bus_node_t *tail;              /* next to pop, consumer only */
+    suns_bus_node_t stub;
+    int event_fd;                       /* signaled when a push finds the consumer asleep */
+    int sleeping;
+} suns_bus_queue_t;
+
+/* completion queue, one consumer thread */
+typedef suns_bus_queue_t suns_bus_cq_t;
+
+struct _suns_bus_op_t;
+
+typedef suns_err_t (*suns_bus_func_t)(suns_device_t *device, void *arg);
+
+/*
+ * Operation submitted to a bus. The op is owned by the bus from submit
+ * until it comes back on its completion queue; the device, model and
+ * buffer it refers to must not be touched by other threads meanwhile
+ * (model snapshots excepted).
+ */
+typedef struct _suns_bus_op_t {
+    suns_bus_node_t node;
+    uint16_t type;
+    suns_device_t *device;
+    suns_model_t *model;                /* model ops */
+    uint16_t addr;                      /* register ops */
+    uint16_t len;
+    unsigned char *buf;
+    suns_bus_func_t func;               /* SUNS_BUS_OP_FUNC */
+    void *arg;
+    suns_bus_cq_t *cq;                  /* completion queue, NULL for none */
+    suns_err_t err;                     /* result */
+    uint64_t submitted;                 /* monotonic submit time in us */
+    uint64_t completed;                 /* monotonic completion time in us */
+} suns_bus_op_t;
+
+/*
+ * Bus worker. Every device on the bus is only ever used from the worker
+ * thread, so transports stay single threaded and submitters never
+ * contend for them.
+ */
+typedef struct _suns_bus_t {
+    suns_bus_queue_t queue;
+    pthread_t thread;
+    suns_bus_node_t stop;               /* queued behind pending ops to stop the worker */
+    uint32_t submitted;
+    uint32_t completed;
+} suns_bus_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_bus_queue_init(suns_bus_queue_t *queue);
+void suns_bus_queue_free(suns_bus_queue_t *queue);
+void suns_bus_queue_push(suns_bus_queue_t *queue, suns_bus_node_t *node);
+int suns_bus_queue_wake(suns_bus_queue_t *queue);
+suns_bus_node_t * suns_bus_queue_pop(suns_bus_queue_t *queue);
+suns_bus_node_t * suns_bus_queue_wait(suns_bus_queue_t *queue, int32_t timeout);
+
+suns_err_t suns_bus_start(suns_bus_t *bus);
+void suns_bus_stop(suns_bus_t *bus);
+void suns_bus_submit(suns_bus_t *bus, suns_bus_op_t *op, suns_bus_cq_t *cq);
+
+suns_err_t suns_bus_cq_init(suns_bus_cq_t *cq);
+void suns_bus_cq_free(suns_bus_cq_t *cq);
+suns_bus_op_t * suns_bus_cq_get(suns_bus_cq_t *cq, int32_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_BUS_H_ */
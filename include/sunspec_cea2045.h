@@ -33,7 +33,7 @@
 extern "C" {
 #endif
 
-suns_err_t suns_cea2045_open(suns_io_t *io);
+suns_err_t suns_cea2045_open(suns_io_t *io, char *ifc_name);
 
 #ifdef __cplusplus
 }
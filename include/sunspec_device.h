@@ -26,13 +26,19 @@
 
 #include <stdint.h>
 
+#include "sunspec_health.h"
 #include "sunspec_modbus.h"
+#include "sunspec_stats.h"
 #include "sunspec_value.h"
 
 #define SUNS_MODEL_LEN_MAX              0x8000
 #define SUNS_MODBUS_READ_MAX_LEN        (4 * 1024)
 #define SUNS_BASE_ADDR_UNKNOWN          0xffff
 #define SUNS_MODEL_ID_END               0xffff
+#define SUNS_DEVICE_REQ_PROBE_MS        600000  /* interval to retry a larger request size */
+
+/* errors returned by devices that reject the size of a read request */
+#define SUNS_DEVICE_REQ_SIZE_ERR(err)   ((err) == SUNS_ERR_MODBUS_EXCEPT_VALUE || (err) == SUNS_ERR_MODBUS_RESP)
 
 #define SUNS_MODEL_PATH_LEN             256
 #define SUNS_MODEL_BUF_SIZE             (4 * 1024)
@@ -144,8 +150,22 @@ typedef struct _suns_block_t {
     uint16_t index;
     suns_point_t *points;
     suns_point_t *points_sf;
+    uint8_t synced;                     /* point values match the model snapshot image */
 } suns_block_t;
 
+/*
+ * Register image of a model as last read from the device. Two copies are
+ * kept behind a sequence count: the writer updates one copy while readers
+ * use the other, so readers never block the poller. A reader retries its
+ * copy if any update is published while it copies. One writer per model.
+ */
+typedef struct _suns_model_snap_t {
+    uint32_t seq;                       /* copy readers use is seq & 1 */
+    uint32_t len;                       /* bytes in each copy, up to SUNS_MODEL_LEN_MAX * 2 */
+    unsigned char *buf[2];
+    uint64_t time[2];                   /* suns_time_ms() of the update */
+} suns_model_snap_t;
+
 typedef struct _suns_model_t {
     struct _suns_device_t *device;
     uint16_t id;
@@ -155,6 +175,12 @@ typedef struct _suns_model_t {
     uint16_t block_count;
     suns_model_def_t *model_def;
     struct _suns_model_t *next;
+    suns_model_snap_t snap;
+    struct _suns_sub_set_t *subs;       /* point subscriptions, see sunspec_sub.h */
+    struct _suns_ring_t *rings;         /* point history, see sunspec_ring.h */
+    struct _suns_rollup_set_t *rollups; /* point aggregates, see sunspec_rollup.h */
+    uint16_t blocks_changed;            /* blocks decoded by the last update */
+    uint16_t points_changed;            /* points decoded by the last update */
     suns_block_t *blocks[1];             /* array is sized during model allocation */
 } suns_model_t;
 
@@ -162,6 +188,12 @@ typedef struct _suns_device_t {
     uint16_t base_addr;
     suns_modbus_io_t modbus_io;
     suns_model_t *models;
+    suns_health_t health;
+    uint16_t req_count_max;             /* learned maximum registers per read request */
+    uint64_t req_probe_time;            /* monotonic time in ms to retry a larger request */
+    suns_stats_t stats;
+    uint32_t ring_budget;               /* bytes allowed for point rings, 0 for no limit */
+    uint32_t ring_bytes;                /* bytes used by point rings */
 } suns_device_t;
 
 #ifdef __cplusplus
@@ -173,18 +205,27 @@ suns_err_t suns_model_add(suns_device_t *device, uint16_t id, uint16_t len, uint
 void suns_model_dump(suns_model_t *model, char *str);
 void suns_model_free(suns_model_t *model);
 suns_model_def_t * suns_model_def_get(uint16_t id);
+void suns_model_def_load(const char *file_path);
 void suns_point_def_dump(suns_point_def_t *point, char *str);
 void suns_block_def_dump(suns_block_def_t *block, char *str);
 void suns_model_def_dump(suns_model_def_t *model, char *str);
 uint16_t suns_point_value_equals(suns_point_t *p1, suns_point_t *p2);
 void suns_device_free_models(suns_device_t *device);
+suns_err_t suns_device_modbus_read_req(suns_device_t *device, uint16_t addr, uint16_t len,
+                                       unsigned char *buf, uint32_t timeout);
 suns_err_t suns_device_modbus_read(suns_device_t *device, uint16_t addr, uint16_t len,
                                    unsigned char *buf, uint32_t timeout);
 suns_err_t suns_device_modbus_write(suns_device_t *device, uint16_t addr, uint16_t len,
                                     unsigned char *buf, uint32_t timeout);
 suns_err_t suns_block_write(suns_block_t *block);
 void suns_block_clear_write(suns_block_t *block);
+uint16_t suns_block_update_diff(suns_block_t *block, unsigned char *buf, unsigned char *prev);
 suns_err_t suns_model_update(suns_model_t *model, unsigned char *buf);
+void suns_model_publish(suns_model_t *model, uint16_t offset, unsigned char *buf, uint16_t len);
+void suns_model_points_update(suns_model_t *model, suns_point_t **points, uint16_t count);
+int suns_point_in(suns_point_t *point, suns_point_t **points, uint16_t count);
+suns_err_t suns_model_snapshot(suns_model_t *model, unsigned char *buf, uint32_t len, uint64_t *time);
+suns_err_t suns_model_snapshot_point(suns_point_t *point, unsigned char *buf, suns_value_t *value);
 void suns_device_dump(suns_device_t *device, char *str);
 suns_data_t * suns_data_type_find(const char *type);
 
@@ -46,6 +46,9 @@
 #define SUNS_ERR_MODBUS_CRC             17
 #define SUNS_ERR_BUSY                   18
 #define SUNS_ERR_UNIMPLEMENTED          19
+#define SUNS_ERR_CIRCUIT_OPEN           20
+#define SUNS_ERR_BUDGET                 21
+#define SUNS_ERR_MODBUS_EXCEPT_VALUE    22      /* illegal data value exception, request too large */
 /* errno base + errno if errno is returned */
 #define SUNS_ERR_ERRNO_BASE		1000
 
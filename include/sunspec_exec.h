@@ -0,0 +1,98 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_EXEC_H_
+#define _SUNSPEC_EXEC_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_bus.h"
+
+#define SUNS_EXEC_DEQUE_SIZE            1024    /* tasks per worker deque, power of 2 */
+#define SUNS_EXEC_LINE                  64      /* cache line size */
+
+struct _suns_exec_task_t;
+
+typedef void (*suns_exec_func_t)(struct _suns_exec_task_t *task, void *arg);
+
+/* task, owned by the executor from submit until func is called */
+typedef struct _suns_exec_task_t {
+    suns_bus_node_t node;               /* inbox link */
+    suns_exec_func_t func;
+    void *arg;
+    struct _suns_exec_worker_t *worker; /* worker running the task */
+} suns_exec_task_t;
+
+/*
+ * Chase-Lev work-stealing deque. The owning worker pushes and takes at
+ * the bottom without contention; other workers steal from the top with a
+ * compare and swap.
+ */
+typedef struct _suns_exec_deque_t {
+    int64_t top;
+    unsigned char top_pad[SUNS_EXEC_LINE - sizeof(int64_t)];
+    int64_t bottom;
+    unsigned char bottom_pad[SUNS_EXEC_LINE - sizeof(int64_t)];
+    suns_exec_task_t *tasks[SUNS_EXEC_DEQUE_SIZE];
+} suns_exec_deque_t;
+
+typedef struct _suns_exec_worker_t {
+    suns_exec_deque_t deque;
+    suns_bus_queue_t inbox;             /* tasks submitted from outside the pool */
+    suns_bus_node_t stop;
+    struct _suns_exec_t *exec;
+    uint16_t index;
+    pthread_t thread;
+    uint32_t rand;                      /* victim selection state */
+    uint64_t executed;                  /* tasks run by this worker */
+    uint64_t stolen;                    /* of which taken from other workers */
+} suns_exec_worker_t;
+
+typedef struct _suns_exec_t {
+    suns_exec_worker_t *workers;
+    uint16_t count;
+    uint32_t next;                      /* round robin inbox for the next submit */
+    int64_t pending;                    /* tasks submitted and not yet run */
+    int idle_fd;                        /* signaled when pending drops to 0 */
+    int sleepers;                       /* workers blocked on their inbox */
+    int stop;
+} suns_exec_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_exec_start(suns_exec_t *exec, uint16_t workers);
+void suns_exec_stop(suns_exec_t *exec);
+void suns_exec_submit(suns_exec_t *exec, suns_exec_task_t *task);
+void suns_exec_spawn(suns_exec_task_t *parent, suns_exec_task_t *task);
+suns_err_t suns_exec_wait(suns_exec_t *exec, int32_t timeout);
+uint64_t suns_exec_stolen(suns_exec_t *exec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_EXEC_H_ */
@@ -0,0 +1,84 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_GROUP_H_
+#define _SUNSPEC_GROUP_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+#include "sunspec_scan.h"
+
+#define SUNS_GROUP_POINT_MAX            16      /* points written by a group command */
+#define SUNS_GROUP_BUF_SIZE             256     /* encoded payload size in bytes */
+
+/* group command flags */
+/*
+ * Use the broadcast unit id on exclusive rtu buses. A broadcast reaches
+ * every slave on the bus, so the caller sets this only when the targets
+ * on each exclusive bus are all of the devices on that bus.
+ */
+#define SUNS_GROUP_BROADCAST            0x0001
+
+typedef struct _suns_group_point_t {
+    char *id;
+    float value;                        /* scaled by the point scale factor */
+    uint8_t optional;                   /* skipped on devices that do not implement it */
+} suns_group_point_t;
+
+/* point values written to the same model on each device in a group */
+typedef struct _suns_group_cmd_t {
+    uint16_t model_id;                  /* model id, or 0 to match on model_name */
+    char *model_name;
+    uint16_t block;                     /* block index within the model */
+    uint16_t flags;
+    uint16_t point_count;
+    suns_group_point_t points[SUNS_GROUP_POINT_MAX];
+} suns_group_cmd_t;
+
+typedef struct _suns_group_result_t {
+    uint32_t index;                     /* target index */
+    suns_device_t *device;
+    suns_err_t err;
+    uint8_t broadcast;                  /* sent as a broadcast, not confirmed by the device */
+    uint64_t start;                     /* monotonic start time in us */
+    uint64_t duration;                  /* write duration in us */
+} suns_group_result_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void suns_group_cmd_init(suns_group_cmd_t *cmd, uint16_t model_id, char *model_name,
+                         uint16_t block, uint16_t flags);
+suns_err_t suns_group_cmd_point(suns_group_cmd_t *cmd, char *id, float value);
+suns_err_t suns_group_cmd_point_optional(suns_group_cmd_t *cmd, char *id, float value);
+suns_err_t suns_group_write(suns_scan_target_t *targets, uint32_t count, uint16_t threads,
+                            suns_group_cmd_t *cmd, suns_group_result_t *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_GROUP_H_ */
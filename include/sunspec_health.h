@@ -0,0 +1,69 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_HEALTH_H_
+#define _SUNSPEC_HEALTH_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+
+/* circuit breaker states */
+#define SUNS_HEALTH_CLOSED              0       /* device is polled normally */
+#define SUNS_HEALTH_OPEN                1       /* device is skipped until next probe */
+#define SUNS_HEALTH_HALF_OPEN           2       /* single probe request in progress */
+
+#define SUNS_HEALTH_THRESHOLD           3       /* consecutive failures before opening */
+#define SUNS_HEALTH_BACKOFF_MIN         1000    /* first probe delay in ms */
+#define SUNS_HEALTH_BACKOFF_MAX         300000  /* probe delay limit in ms */
+
+typedef struct _suns_health_t {
+    uint16_t state;                     /* circuit breaker state */
+    uint16_t failures;                  /* consecutive timeout/crc failures */
+    uint16_t threshold;                 /* failures before the circuit opens */
+    uint32_t backoff;                   /* current probe delay in ms */
+    uint32_t backoff_min;               /* initial probe delay in ms */
+    uint32_t backoff_max;               /* probe delay limit in ms */
+    uint64_t next_probe;                /* monotonic time in ms of the next probe */
+    uint64_t last_change;               /* monotonic time in ms of the last state change */
+    uint32_t trips;                     /* number of times the circuit opened */
+    uint32_t probes;                    /* number of probe requests issued */
+    uint32_t rejected;                  /* requests rejected while open */
+} suns_health_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void suns_health_init(suns_health_t *health);
+void suns_health_reset(suns_health_t *health);
+suns_err_t suns_health_check(suns_health_t *health, uint64_t now);
+int suns_health_response(suns_err_t err);
+void suns_health_record(suns_health_t *health, suns_err_t err, uint64_t now);
+const char * suns_health_state_str(uint16_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_HEALTH_H_ */
@@ -40,6 +40,14 @@ typedef suns_err_t(*suns_modbus_close_func_t)(struct _suns_modbus_io_t *io);
 
 #define SUNS_MODBUS_IO_MAGIC    0x28945613
 
+#define SUNS_MODBUS_REQ_COUNT_MAX       125     /* maximum registers in a single read request */
+
+/* modbus exception codes */
+#define SUNS_MODBUS_EXCEPT_FUNC         0x01
+#define SUNS_MODBUS_EXCEPT_ADDR         0x02
+#define SUNS_MODBUS_EXCEPT_VALUE        0x03
+#define SUNS_MODBUS_EXCEPT_GATEWAY_PATH 0x0A
+
 typedef struct _suns_modbus_io_t {
     uint32_t magic;
     suns_modbus_connect_func_t connect;
@@ -60,6 +68,8 @@ uint64_t suns_modbus_to_64(const unsigned char *buf);
 void suns_modbus_from_16(uint16_t val, unsigned char *buf);
 void suns_modbus_from_32(uint32_t val, unsigned char *buf);
 void suns_modbus_from_64(uint64_t val, unsigned char *buf);
+uint16_t suns_modbus_crc16(const unsigned char *data, int16_t len);
+uint16_t suns_modbus_crc16_update(uint16_t crc, const unsigned char *data, int16_t len);
 
 void suns_modbus_to_int16(unsigned char *buf, suns_value_t *value, uint16_t len);
 void suns_modbus_to_uint16(unsigned char *buf, suns_value_t *value, uint16_t len);
@@ -0,0 +1,58 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_MODBUS_CACHE_H_
+#define _SUNSPEC_MODBUS_CACHE_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_modbus.h"
+
+#define SUNS_MODBUS_CACHE_ENTRY_MAX     64      /* cached register ranges */
+#define SUNS_MODBUS_CACHE_RULE_MAX      16      /* per-range ttl rules */
+#define SUNS_MODBUS_CACHE_TTL           1000    /* default ttl in ms */
+
+typedef struct _suns_modbus_cache_stats_t {
+    uint32_t hits;                      /* reads served from a cached range */
+    uint32_t misses;                    /* reads sent upstream */
+    uint32_t collapsed;                 /* reads that shared an in-flight upstream read */
+    uint32_t uncached;                  /* reads passed through with a ttl of 0 */
+    uint32_t evictions;                 /* valid ranges replaced before expiring */
+    uint32_t invalidations;             /* ranges dropped by an overlapping write */
+} suns_modbus_cache_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_modbus_cache_open(suns_modbus_io_t *io, uint32_t ttl);
+suns_err_t suns_modbus_cache_ttl_set(suns_modbus_io_t *io, uint16_t addr, uint16_t count, uint32_t ttl);
+suns_err_t suns_modbus_cache_stats_get(suns_modbus_io_t *io, suns_modbus_cache_stats_t *stats);
+suns_err_t suns_modbus_cache_flush(suns_modbus_io_t *io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_MODBUS_CACHE_H_ */
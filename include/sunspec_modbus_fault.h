@@ -0,0 +1,79 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_MODBUS_FAULT_H_
+#define _SUNSPEC_MODBUS_FAULT_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_modbus.h"
+
+/* latency distributions */
+#define SUNS_FAULT_LATENCY_FIXED        0       /* latency_min */
+#define SUNS_FAULT_LATENCY_UNIFORM      1       /* latency_min to latency_max */
+#define SUNS_FAULT_LATENCY_NORMAL       2       /* latency_mean, latency_dev, clamped to latency_min */
+#define SUNS_FAULT_LATENCY_EXP          3       /* latency_min plus exponential with latency_mean */
+
+#define SUNS_FAULT_CHAR_BITS            11      /* start, 8 data, parity, stop */
+#define SUNS_FAULT_PPM                  1000000 /* probabilities are in parts per million */
+#define SUNS_FAULT_TIMEOUT              1000    /* ms charged for a dropped request without a timeout */
+
+typedef struct _suns_modbus_fault_config_t {
+    uint64_t seed;
+    uint16_t latency_dist;
+    uint32_t latency_min;               /* us */
+    uint32_t latency_max;               /* us */
+    uint32_t latency_mean;              /* us */
+    uint32_t latency_dev;               /* us */
+    uint32_t baudrate;                  /* serialization delay, 0 for none */
+    uint16_t char_bits;                 /* bits per character on the wire */
+    uint32_t drop_ppm;                  /* request lost, reported as a timeout */
+    uint32_t crc_ppm;                   /* response corrupted */
+    uint32_t except_ppm;                /* request rejected with an exception */
+    uint8_t virtual_time;               /* account delays on a virtual clock instead of sleeping */
+} suns_modbus_fault_config_t;
+
+typedef struct _suns_modbus_fault_stats_t {
+    uint32_t requests;
+    uint32_t drops;
+    uint32_t crc_errors;
+    uint32_t exceptions;
+    uint64_t delay_total;               /* us */
+    uint32_t delay_max;                 /* us */
+    uint64_t clock;                     /* virtual time in us */
+} suns_modbus_fault_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void suns_modbus_fault_config_init(suns_modbus_fault_config_t *config);
+suns_err_t suns_modbus_fault_open(suns_modbus_io_t *io, suns_modbus_fault_config_t *config);
+suns_err_t suns_modbus_fault_stats_get(suns_modbus_io_t *io, suns_modbus_fault_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_MODBUS_FAULT_H_ */
@@ -0,0 +1,77 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_MODBUS_RECORD_H_
+#define _SUNSPEC_MODBUS_RECORD_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_modbus.h"
+
+/*
+ * Capture log format, all fields in modbus (big endian) byte order:
+ *
+ *   file header:  magic "SREC" (4), version (2), reserved (2), wall clock start in s (8)
+ *   record:       time in us (8), duration in us (4), err (4), addr (2), count (2), op (1), data
+ *
+ * Data is count registers for writes and successful reads, otherwise empty.
+ *
+ * The recorder wraps a suns_modbus_io_t, so it captures transactions as the
+ * transport returns them (address, count, register data and the error),
+ * not raw wire frames. That keeps captures independent of the transport,
+ * including simulators, and replayable through any device. Framing, CRC
+ * and exception responses appear only as their err value.
+ */
+#define SUNS_RECORD_MAGIC               0x53524543      /* "SREC" */
+#define SUNS_RECORD_VERSION             1
+#define SUNS_RECORD_FILE_HDR_LEN        16
+#define SUNS_RECORD_HDR_LEN             21
+
+#define SUNS_RECORD_OP_READ             1
+#define SUNS_RECORD_OP_WRITE            2
+
+/* replay modes */
+#define SUNS_REPLAY_FAST                0       /* serve captures as fast as possible */
+#define SUNS_REPLAY_REALTIME            1       /* keep the captured request timing */
+
+typedef struct _suns_modbus_replay_stats_t {
+    uint32_t records;                   /* records in the capture */
+    uint32_t served;                    /* requests answered from the capture */
+    uint32_t missed;                    /* requests with no matching capture */
+} suns_modbus_replay_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_modbus_record_open(suns_modbus_io_t *io, const char *path);
+suns_err_t suns_modbus_record_detach(suns_modbus_io_t *io);
+suns_err_t suns_modbus_replay_open(suns_modbus_io_t *io, const char *path, uint8_t mode);
+suns_err_t suns_modbus_replay_stats_get(suns_modbus_io_t *io, suns_modbus_replay_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_MODBUS_RECORD_H_ */
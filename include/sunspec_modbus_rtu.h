@@ -26,14 +26,20 @@
 
 #include <stdint.h>
 #include "sunspec_modbus.h"
+#include "sunspec_stats.h"
+
+#define SUNS_MODBUS_RTU_TURNAROUND      100     /* delay after a broadcast request in ms */
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-suns_err_t suns_modbus_rtu_cea2045_open(suns_modbus_io_t *io, uint16_t slave_id);
+suns_err_t suns_modbus_rtu_cea2045_open(suns_modbus_io_t *io, char *ifc_name, uint16_t slave_id);
 suns_err_t suns_modbus_rtu_serial_open(suns_modbus_io_t *io, char *ifc_name,
                                        uint16_t slave_id, uint32_t baudrate, uint8_t parity);
+suns_err_t suns_modbus_rtu_stats_get(suns_modbus_io_t *io, suns_stats_t *snapshot);
+suns_err_t suns_modbus_rtu_stats_reset(suns_modbus_io_t *io);
+suns_err_t suns_modbus_rtu_broadcast(suns_modbus_io_t *io, uint16_t addr, uint16_t count, unsigned char *buf);
 
 #ifdef __cplusplus
 }
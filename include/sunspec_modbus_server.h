@@ -0,0 +1,96 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_MODBUS_SERVER_H_
+#define _SUNSPEC_MODBUS_SERVER_H_
+
+#include <stdint.h>
+
+#include "sunspec_device.h"
+#include "sunspec_error.h"
+
+#define SUNS_SERVER_CONN_MAX            16
+#define SUNS_SERVER_ADU_MAX             260     /* MBAP header + maximum PDU */
+#define SUNS_SERVER_IMAGE_MAX           0x10000 /* registers */
+
+struct _suns_server_t;
+
+/* called once per model after a client write has updated its points */
+typedef void (*suns_server_write_func_t)(struct _suns_server_t *server, suns_model_t *model, void *arg);
+
+/* register map entry, start is the image offset of the first register of the point */
+typedef struct _suns_server_reg_t {
+    suns_point_t *point;
+    uint16_t start;
+} suns_server_reg_t;
+
+typedef struct _suns_server_model_t {
+    suns_model_t *model;
+    uint16_t offset;                    /* image offset of the model data */
+} suns_server_model_t;
+
+typedef struct _suns_server_conn_t {
+    int fd;
+    uint8_t rtu;
+    uint16_t len;
+    unsigned char buf[SUNS_SERVER_ADU_MAX];
+} suns_server_conn_t;
+
+typedef struct _suns_server_t {
+    uint16_t slave_id;
+    uint16_t base_addr;
+    uint32_t len;                       /* image length in registers */
+    unsigned char *image;               /* register image in modbus byte order */
+    suns_server_reg_t *reg_map;         /* register offset to point, NULL for a raw image */
+    suns_server_model_t *models;
+    uint16_t model_count;
+    suns_server_write_func_t write_func;
+    void *write_arg;
+    int listen_fd;
+    suns_server_conn_t conns[SUNS_SERVER_CONN_MAX];
+    uint32_t requests;
+    uint32_t exceptions;
+} suns_server_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_server_t * suns_server_alloc(uint16_t slave_id);
+void suns_server_free(suns_server_t *server);
+suns_err_t suns_server_model_add(suns_server_t *server, suns_model_t *model);
+suns_err_t suns_server_map_build(suns_server_t *server, uint16_t base_addr);
+suns_err_t suns_server_device_map(suns_server_t *server, suns_device_t *device, uint16_t base_addr);
+suns_err_t suns_server_image_set(suns_server_t *server, uint16_t base_addr, const unsigned char *image, uint16_t len);
+suns_err_t suns_server_model_update(suns_server_t *server, suns_model_t *model);
+void suns_server_write_func_set(suns_server_t *server, suns_server_write_func_t func, void *arg);
+suns_err_t suns_server_tcp_listen(suns_server_t *server, uint16_t ipport);
+suns_err_t suns_server_tcp_attach(suns_server_t *server, int fd);
+suns_err_t suns_server_rtu_attach(suns_server_t *server, int fd);
+suns_err_t suns_server_poll(suns_server_t *server, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_MODBUS_SERVER_H_ */
@@ -24,15 +24,44 @@
 #ifndef _SUNSPEC_MODBUS_SIM_H_
 #define _SUNSPEC_MODBUS_SIM_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include "sunspec_modbus.h"
 
+#define SUNS_MODBUS_SIM_MAGIC           0x53756e53      /* "SunS" */
+#define SUNS_MODBUS_SIM_VERSION         1
+
+/* register file header, followed by regs_per_device registers for each device */
+typedef struct _suns_modbus_sim_hdr_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t device_count;
+    uint32_t regs_per_device;
+    uint16_t base_addr;
+    uint16_t reserved[23];              /* pad header to 64 bytes */
+} suns_modbus_sim_hdr_t;
+
+typedef struct _suns_modbus_sim_file_t {
+    void *map;
+    size_t map_len;
+    suns_modbus_sim_hdr_t *hdr;
+    unsigned char *regs;
+    uint8_t shared;
+} suns_modbus_sim_file_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 suns_err_t suns_modbus_sim_open(suns_modbus_io_t *io, uint16_t base_addr, uint16_t *sim_map,
                                 uint16_t sim_map_len, uint16_t slave_id);
+suns_err_t suns_modbus_sim_file_create(const char *path, uint16_t base_addr, uint32_t device_count,
+                                       uint32_t regs_per_device);
+suns_err_t suns_modbus_sim_file_open(suns_modbus_sim_file_t **file_ptr, const char *path, uint8_t shared);
+void suns_modbus_sim_file_close(suns_modbus_sim_file_t *file);
+unsigned char * suns_modbus_sim_file_regs(suns_modbus_sim_file_t *file, uint32_t index);
+suns_err_t suns_modbus_sim_file_io_open(suns_modbus_io_t *io, suns_modbus_sim_file_t *file,
+                                        uint32_t index, uint16_t slave_id);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,81 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_RING_H_
+#define _SUNSPEC_RING_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+#include "sunspec_value.h"
+
+typedef struct _suns_ring_sample_t {
+    uint64_t time;                      /* suns_time_ms() of the update */
+    suns_value_t value;                 /* raw point value */
+    int16_t sf;
+} suns_ring_sample_t;
+
+/*
+ * Fixed capacity history of one point. Every suns_model_update(), and
+ * every scheduler point set read that includes the point, appends a
+ * sample, overwriting the oldest once the ring is full. Samples are
+ * allocated when the ring is attached and counted against the device's
+ * ring budget.
+ */
+typedef struct _suns_ring_t {
+    suns_point_t *point;
+    suns_ring_sample_t *samples;
+    uint32_t capacity;
+    uint32_t head;                      /* next sample written */
+    uint32_t count;
+    struct _suns_ring_t *next;
+} suns_ring_t;
+
+/* samples of a range in time order, split in two where the ring wraps */
+typedef struct _suns_ring_slice_t {
+    suns_ring_sample_t *samples;
+    uint32_t count;
+} suns_ring_slice_t;
+
+#define SUNS_RING_BYTES(capacity)       (sizeof(suns_ring_t) + ((capacity) * sizeof(suns_ring_sample_t)))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_ring_point(suns_model_t *model, char *id, uint16_t index, uint32_t capacity,
+                           suns_ring_t **ring_ptr);
+suns_err_t suns_ring_remove(suns_model_t *model, suns_ring_t *ring);
+void suns_ring_free(suns_model_t *model);
+void suns_ring_append(suns_ring_t *ring, uint64_t time);
+void suns_ring_update(suns_model_t *model, uint64_t time);
+void suns_ring_update_points(suns_model_t *model, uint64_t time, suns_point_t **points, uint16_t count);
+uint32_t suns_ring_range(suns_ring_t *ring, uint64_t start, uint64_t end, suns_ring_slice_t slices[2]);
+suns_err_t suns_device_ring_budget(suns_device_t *device, uint32_t budget);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_RING_H_ */
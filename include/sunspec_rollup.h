@@ -0,0 +1,104 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_ROLLUP_H_
+#define _SUNSPEC_ROLLUP_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+
+/*
+ * Aggregate of one point over the current window. Accumulator points are
+ * aggregated as the increase between updates, unwrapping rollovers, so
+ * min, max and avg describe the per-update increase and delta the total.
+ */
+typedef struct _suns_rollup_t {
+    suns_point_t *point;
+    void *arg;
+    uint8_t acc;                        /* point is an accumulator */
+    uint8_t prev_valid;
+    uint64_t prev;                      /* last accumulator reading */
+    uint32_t count;
+    float min;
+    float max;
+    double sum;
+    float last;
+    double delta;
+    uint16_t rollovers;
+    uint16_t resets;                    /* accumulator went back more than half its range */
+    struct _suns_rollup_t *next;
+} suns_rollup_t;
+
+typedef struct _suns_rollup_result_t {
+    suns_rollup_t *rollup;
+    suns_point_t *point;
+    void *arg;
+    uint64_t start;                     /* wall clock ms since the epoch the window starts */
+    uint32_t count;                     /* samples aggregated */
+    float min;
+    float max;
+    float avg;
+    float last;                         /* last value, for accumulators the reading */
+    float delta;                        /* accumulators, increase over the window */
+    uint16_t rollovers;
+    uint16_t resets;
+} suns_rollup_result_t;
+
+/* called once per closed window with the points that had samples in it */
+typedef void (*suns_rollup_func_t)(suns_model_t *model, suns_rollup_result_t *results, uint16_t count, void *arg);
+
+/*
+ * Rollups of one model. Windows are aligned to multiples of the window
+ * length on the time passed to suns_rollup_update(), which is the wall
+ * clock (suns_time_wall_ms()) when fed from suns_model_update().
+ */
+typedef struct _suns_rollup_set_t {
+    suns_rollup_func_t func;
+    void *arg;
+    uint32_t window;                    /* window length in ms */
+    uint8_t started;
+    uint64_t start;                     /* start of the current window */
+    suns_rollup_t *rollups;
+    uint16_t count;
+    suns_rollup_result_t *results;
+} suns_rollup_set_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_rollup_model(suns_model_t *model, uint32_t window, suns_rollup_func_t func, void *arg);
+suns_err_t suns_rollup_point(suns_model_t *model, char *id, uint16_t index, void *arg, suns_rollup_t **rollup_ptr);
+suns_err_t suns_rollup_remove(suns_model_t *model, suns_rollup_t *rollup);
+void suns_rollup_free(suns_model_t *model);
+void suns_rollup_update(suns_model_t *model, uint64_t time);
+void suns_rollup_update_points(suns_model_t *model, uint64_t time, suns_point_t **points, uint16_t count);
+void suns_rollup_flush(suns_model_t *model);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_ROLLUP_H_ */
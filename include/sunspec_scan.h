@@ -0,0 +1,75 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_SCAN_H_
+#define _SUNSPEC_SCAN_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+
+#define SUNS_SCAN_THREADS               8       /* default worker pool size */
+
+/* concurrent scans allowed on a bus */
+#define SUNS_SCAN_BUS_EXCLUSIVE         1       /* RS-485 bus, one transaction at a time */
+#define SUNS_SCAN_BUS_SHARED            0       /* TCP host, no limit beyond the pool size */
+
+/*
+ * Scan target. Targets with the same bus key share the bus concurrency
+ * limit; the limit of the first target seen on a bus is used for the bus.
+ */
+typedef struct _suns_scan_target_t {
+    suns_device_t *device;              /* device with an open transport and unit id */
+    uint32_t bus;                       /* physical bus or host key */
+    uint16_t bus_max;                   /* concurrent scans on the bus, 0 for no limit */
+} suns_scan_target_t;
+
+typedef struct _suns_scan_result_t {
+    uint32_t index;                     /* target index */
+    suns_device_t *device;
+    suns_err_t err;                     /* operation result */
+    uint64_t start;                     /* monotonic start time in us */
+    uint64_t duration;                  /* operation duration in us */
+} suns_scan_result_t;
+
+/* called from a worker thread as each target completes, calls are serialized */
+typedef void (*suns_scan_func_t)(suns_scan_result_t *result, void *arg);
+
+/* operation run on a worker thread for each target */
+typedef suns_err_t (*suns_scan_op_t)(uint32_t index, suns_device_t *device, void *arg);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_scan_run(suns_scan_target_t *targets, uint32_t count, uint16_t threads,
+                         suns_scan_op_t op, void *op_arg, suns_scan_func_t func, void *arg);
+suns_err_t suns_scan_many(suns_scan_target_t *targets, uint32_t count, uint16_t threads,
+                          suns_scan_func_t func, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_SCAN_H_ */
@@ -0,0 +1,107 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_SCHED_H_
+#define _SUNSPEC_SCHED_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+
+#define SUNS_SCHED_POINTS_MAX           16      /* points read by a point set job */
+#define SUNS_SCHED_GAP                  8       /* unused registers read to merge two point runs */
+#define SUNS_SCHED_SEED                 0x9e3779b97f4a7c15ULL
+
+/* contiguous register range read by a job */
+typedef struct _suns_sched_run_t {
+    uint16_t addr;
+    uint16_t len;
+} suns_sched_run_t;
+
+struct _suns_sched_job_t;
+
+/*
+ * Called after each read of a job. The callback may add jobs or remove any
+ * job, including its own, but must not free the scheduler.
+ */
+typedef void (*suns_sched_func_t)(struct _suns_sched_job_t *job, void *arg);
+
+/*
+ * Polling job. A job reads its whole model, or only the points added with
+ * suns_sched_job_point() (and their scale factors), every interval ms. Each
+ * deadline is pushed back by a random 0..jitter ms so jobs with the same
+ * interval don't stay in step. A point set read feeds the subscriptions,
+ * rings and rollups of its points, as suns_model_update() does for a
+ * whole model read.
+ */
+typedef struct _suns_sched_job_t {
+    suns_model_t *model;
+    suns_point_t *points[SUNS_SCHED_POINTS_MAX];
+    uint16_t point_count;               /* 0 reads the whole model */
+    suns_sched_run_t runs[SUNS_SCHED_POINTS_MAX];
+    uint16_t run_count;                 /* read plan for the point set */
+    uint32_t interval;                  /* ms between reads */
+    uint32_t jitter;                    /* ms of random delay added to each deadline */
+    uint64_t base;                      /* deadline before jitter, monotonic ms */
+    uint64_t due;                       /* deadline, monotonic ms */
+    suns_sched_func_t func;
+    void *arg;
+    suns_err_t err;                     /* result of the last read */
+    uint32_t reads;                     /* reads dispatched */
+    uint32_t errors;                    /* reads that failed */
+    uint32_t missed;                    /* deadlines skipped because the job ran late */
+    uint32_t late_max;                  /* worst dispatch delay past the deadline in ms */
+    uint32_t heap_index;
+    uint8_t removed;                    /* removed by its own callback, freed after it returns */
+} suns_sched_job_t;
+
+typedef struct _suns_sched_t {
+    suns_sched_job_t **heap;            /* min-heap on due */
+    uint32_t count;
+    uint32_t size;
+    uint64_t state;                     /* jitter random state */
+    suns_sched_job_t *running;          /* job whose callback is in progress */
+    uint32_t reads;
+    uint32_t missed;
+} suns_sched_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void suns_sched_init(suns_sched_t *sched);
+void suns_sched_free(suns_sched_t *sched);
+suns_err_t suns_sched_add(suns_sched_t *sched, suns_model_t *model, uint32_t interval, uint32_t jitter,
+                          suns_sched_func_t func, void *arg, uint64_t now, suns_sched_job_t **job_ptr);
+suns_err_t suns_sched_job_point(suns_sched_job_t *job, char *id, uint16_t index);
+suns_err_t suns_sched_remove(suns_sched_t *sched, suns_sched_job_t *job);
+int64_t suns_sched_next(suns_sched_t *sched, uint64_t now);
+uint32_t suns_sched_run(suns_sched_t *sched, uint64_t now);
+uint32_t suns_sched_poll(suns_sched_t *sched, uint32_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_SCHED_H_ */
@@ -0,0 +1,79 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_STATS_H_
+#define _SUNSPEC_STATS_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+
+/*
+ * Latency histogram buckets are log-linear: values below 16 us have their
+ * own bucket and every power of two above is split into 16 linear
+ * sub-buckets, so any recorded latency is within 1/16 of its bucket.
+ */
+#define SUNS_STATS_HIST_SUB_BITS        4
+#define SUNS_STATS_HIST_SUB             (1 << SUNS_STATS_HIST_SUB_BITS)
+#define SUNS_STATS_HIST_BUCKETS         (SUNS_STATS_HIST_SUB + ((32 - SUNS_STATS_HIST_SUB_BITS) * SUNS_STATS_HIST_SUB))
+
+#define SUNS_STATS_READ                 0
+#define SUNS_STATS_WRITE                1
+
+/* counters are updated with relaxed atomics and may be read while in use */
+typedef struct _suns_stats_t {
+    uint64_t requests;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t registers;                 /* registers transferred by successful requests */
+    uint64_t bytes;                     /* bytes on the wire, or register bytes at the device level */
+    uint64_t retries;                   /* requests repeated with a smaller size */
+    uint64_t broadcasts;                /* writes to the broadcast unit id, never confirmed */
+    uint64_t timeouts;
+    uint64_t crc_errors;
+    uint64_t exceptions;
+    uint64_t errors;                    /* other failures */
+    uint64_t latency_total;             /* us */
+    uint32_t latency_max;               /* us */
+    uint32_t hist[SUNS_STATS_HIST_BUCKETS];
+} suns_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void suns_stats_record(suns_stats_t *stats, uint8_t op, uint16_t count, uint32_t bytes,
+                       suns_err_t err, uint32_t latency);
+void suns_stats_retry(suns_stats_t *stats);
+void suns_stats_broadcast(suns_stats_t *stats);
+void suns_stats_snapshot(const suns_stats_t *stats, suns_stats_t *snapshot);
+void suns_stats_reset(suns_stats_t *stats);
+uint16_t suns_stats_hist_index(uint32_t latency);
+uint32_t suns_stats_hist_value(uint16_t index);
+uint32_t suns_stats_percentile(const suns_stats_t *snapshot, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_STATS_H_ */
@@ -0,0 +1,93 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_SUB_H_
+#define _SUNSPEC_SUB_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+
+/* deadband modes */
+#define SUNS_SUB_ANY                    0       /* any change of the register value */
+#define SUNS_SUB_ABS                    1       /* scaled value moved more than deadband */
+#define SUNS_SUB_PCT                    2       /* scaled value moved more than deadband percent */
+
+/* point subscription, compared against the value last reported */
+typedef struct _suns_sub_t {
+    suns_point_t *point;
+    uint8_t mode;
+    float deadband;
+    void *arg;
+    uint8_t reported;                   /* value and impl are valid */
+    uint8_t impl;                       /* last reported value was implemented */
+    float value;                        /* last reported scaled value */
+    struct _suns_sub_t *next;
+} suns_sub_t;
+
+typedef struct _suns_sub_change_t {
+    suns_sub_t *sub;
+    suns_point_t *point;
+    uint8_t first;                      /* first report for the subscription, prev is not valid */
+    uint8_t impl;                       /* new value is implemented */
+    float prev;                         /* previously reported scaled value */
+    float value;                        /* new scaled value */
+} suns_sub_change_t;
+
+/* called once per model update with the subscribed points that changed */
+typedef void (*suns_sub_func_t)(suns_model_t *model, suns_sub_change_t *changes, uint16_t count, void *arg);
+
+/*
+ * Subscriptions of one model. Each update is compared with the previous
+ * register image a block at a time, and only subscriptions in blocks
+ * that changed are checked against their deadband.
+ */
+typedef struct _suns_sub_set_t {
+    suns_sub_func_t func;
+    void *arg;
+    suns_sub_t *subs;
+    uint16_t count;
+    unsigned char *image;               /* registers of the previous update */
+    uint8_t image_valid;
+    uint8_t *block_changed;
+    suns_sub_change_t *changes;
+} suns_sub_set_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_sub_model(suns_model_t *model, suns_sub_func_t func, void *arg);
+suns_err_t suns_sub_point(suns_model_t *model, char *id, uint16_t index, uint8_t mode, float deadband,
+                          void *arg, suns_sub_t **sub_ptr);
+suns_err_t suns_sub_remove(suns_model_t *model, suns_sub_t *sub);
+void suns_sub_free(suns_model_t *model);
+void suns_sub_update(suns_model_t *model, unsigned char *buf);
+void suns_sub_update_points(suns_model_t *model, unsigned char *buf, suns_point_t **points, uint16_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_SUB_H_ */
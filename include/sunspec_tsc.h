@@ -0,0 +1,98 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _SUNSPEC_TSC_H_
+#define _SUNSPEC_TSC_H_
+
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_ring.h"
+#include "sunspec_value.h"
+
+#define SUNS_TSC_CHUNK_SIZE             1024    /* bytes of encoded samples per chunk */
+
+/*
+ * Encoder state after a sample. Timestamps are stored as the change of
+ * the interval between samples, integer values as the zigzag difference
+ * from the previous value and float values as the XOR with the previous
+ * value. The scale factor is only stored when it changes.
+ */
+typedef struct _suns_tsc_state_t {
+    uint64_t time;
+    int64_t delta;                      /* interval from the previous sample */
+    uint64_t value;                     /* raw value as an integer or float bits */
+    int16_t sf;
+    uint8_t lead;                       /* float XOR window, 32 if none yet */
+    uint8_t trail;
+} suns_tsc_state_t;
+
+/*
+ * Append-only block of samples. Each chunk starts with a full sample so
+ * it decodes without the chunks before it.
+ */
+typedef struct _suns_tsc_chunk_t {
+    uint64_t first_time;
+    uint64_t last_time;
+    uint32_t count;
+    uint32_t bits;                      /* bits used in data */
+    struct _suns_tsc_chunk_t *next;
+    unsigned char data[SUNS_TSC_CHUNK_SIZE];
+} suns_tsc_chunk_t;
+
+/* compressed history of one point */
+typedef struct _suns_tsc_t {
+    int16_t type;                       /* base type of the point */
+    suns_tsc_chunk_t *chunks;
+    suns_tsc_chunk_t *tail;
+    uint64_t count;
+    uint64_t bytes;                     /* memory used by chunks */
+    suns_tsc_state_t state;             /* encoder state at the end of tail */
+} suns_tsc_t;
+
+/* streaming decoder, decodes one sample at a time */
+typedef struct _suns_tsc_iter_t {
+    suns_tsc_t *tsc;
+    suns_tsc_chunk_t *chunk;
+    uint32_t index;                     /* next sample in chunk */
+    uint32_t pos;                       /* bit position in chunk */
+    uint64_t start;
+    suns_tsc_state_t state;
+} suns_tsc_iter_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+suns_err_t suns_tsc_init(suns_tsc_t *tsc, int16_t type);
+void suns_tsc_free(suns_tsc_t *tsc);
+suns_err_t suns_tsc_append(suns_tsc_t *tsc, suns_ring_sample_t *sample);
+suns_err_t suns_tsc_append_ring(suns_tsc_t *tsc, suns_ring_t *ring);
+void suns_tsc_iter_init(suns_tsc_iter_t *iter, suns_tsc_t *tsc, uint64_t start);
+int suns_tsc_next(suns_tsc_iter_t *iter, suns_ring_sample_t *sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SUNSPEC_TSC_H_ */
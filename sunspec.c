@@ -27,9 +27,12 @@
 #include "sunspec_device.h"
 #include "sunspec_error.h"
 #include "sunspec_cea2045.h"
+#include "sunspec_modbus_cache.h"
+#include "sunspec_modbus_record.h"
 #include "sunspec_modbus_rtu.h"
 #include "sunspec_modbus_sim.h"
 #include "sunspec_log.h"
+#include "sunspec_time.h"
 
 #define SUNS_BASE_ADDR_LIST_LEN         3
 uint16_t suns_base_addr_list[SUNS_BASE_ADDR_LIST_LEN] = {40000, 0, 50000};
@@ -45,6 +48,8 @@ suns_device_alloc()
     if (device != NULL) {
         device->base_addr = SUNS_BASE_ADDR_UNKNOWN;
         device->modbus_io.magic = SUNS_MODBUS_IO_MAGIC;
+        suns_health_init(&device->health);
+        device->req_count_max = SUNS_MODBUS_REQ_COUNT_MAX;
     }
 
     return device;
@@ -58,13 +63,13 @@ suns_device_free(suns_device_t *device)
 }
 
 suns_err_t
-suns_device_rtu_cea2045(suns_device_t *device, uint16_t slave_id)
+suns_device_rtu_cea2045(suns_device_t *device, char *ifc_name, uint16_t slave_id)
 {
     if (device == NULL) {
         return SUNS_ERR_INIT;
     }
 
-    return suns_modbus_rtu_cea2045_open(&device->modbus_io, slave_id);
+    return suns_modbus_rtu_cea2045_open(&device->modbus_io, ifc_name, slave_id);
 }
 
 suns_err_t
@@ -85,6 +90,156 @@ suns_device_sim(suns_device_t *device, uint16_t base_addr,
     return suns_modbus_sim_open(&device->modbus_io, base_addr, sim_map, sim_map_len, slave_id);
 }
 
+suns_err_t
+suns_device_sim_file(suns_device_t *device, suns_modbus_sim_file_t *file, uint32_t index, uint16_t slave_id)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return suns_modbus_sim_file_io_open(&device->modbus_io, file, index, slave_id);
+}
+
+/* serve repeated reads from a cache in front of the device transport */
+suns_err_t
+suns_device_cache(suns_device_t *device, uint32_t ttl)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return suns_modbus_cache_open(&device->modbus_io, ttl);
+}
+
+/* capture all device transactions to a log file */
+suns_err_t
+suns_device_record_start(suns_device_t *device, const char *path)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return suns_modbus_record_open(&device->modbus_io, path);
+}
+
+suns_err_t
+suns_device_record_stop(suns_device_t *device)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return suns_modbus_record_detach(&device->modbus_io);
+}
+
+/* serve device requests from a capture */
+suns_err_t
+suns_device_replay(suns_device_t *device, const char *path, uint8_t mode)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return suns_modbus_replay_open(&device->modbus_io, path, mode);
+}
+
+suns_err_t
+suns_device_stats_get(suns_device_t *device, suns_stats_t *snapshot)
+{
+    if (device == NULL || snapshot == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    suns_stats_snapshot(&device->stats, snapshot);
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_device_stats_reset(suns_device_t *device)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    suns_stats_reset(&device->stats);
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_device_health_get(suns_device_t *device, suns_health_t *health)
+{
+    if (device == NULL || health == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    *health = device->health;
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_device_health_config(suns_device_t *device, uint16_t threshold,
+                          uint32_t backoff_min, uint32_t backoff_max)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((threshold == 0) || (backoff_min == 0) || (backoff_min > backoff_max)) {
+        return SUNS_ERR_RANGE;
+    }
+
+    device->health.threshold = threshold;
+    device->health.backoff_min = backoff_min;
+    device->health.backoff_max = backoff_max;
+    if (device->health.backoff < backoff_min || device->health.backoff > backoff_max) {
+        device->health.backoff = backoff_min;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_device_health_reset(suns_device_t *device)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    suns_health_reset(&device->health);
+
+    return SUNS_ERR_OK;
+}
+
+uint16_t
+suns_device_req_max_get(suns_device_t *device)
+{
+    return device->req_count_max;
+}
+
+/* restore a previously learned request size limit, 0 resets to the default */
+suns_err_t
+suns_device_req_max_set(suns_device_t *device, uint16_t req_max)
+{
+    if (device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (req_max > SUNS_MODBUS_REQ_COUNT_MAX) {
+        return SUNS_ERR_RANGE;
+    }
+
+    if (req_max == 0) {
+        req_max = SUNS_MODBUS_REQ_COUNT_MAX;
+    }
+    device->req_count_max = req_max;
+    device->req_probe_time = suns_time_ms() + SUNS_DEVICE_REQ_PROBE_MS;
+
+    return SUNS_ERR_OK;
+}
+
 suns_err_t
 suns_device_scan(suns_device_t *device)
 {
@@ -0,0 +1,272 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "sunspec.h"
+#include "sunspec_bus.h"
+#include "sunspec_error.h"
+#include "sunspec_time.h"
+
+suns_err_t
+suns_bus_queue_init(suns_bus_queue_t *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+
+    if ((queue->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+void
+suns_bus_queue_free(suns_bus_queue_t *queue)
+{
+    if (queue->event_fd >= 0) {
+        close(queue->event_fd);
+        queue->event_fd = -1;
+    }
+}
+
+void
+suns_bus_queue_link(suns_bus_queue_t *queue, suns_bus_node_t *node)
+{
+    suns_bus_node_t *prev;
+
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_SEQ_CST);
+    /* until this store the consumer sees the queue end at prev */
+    __atomic_store_n(&prev->next, node, __ATOMIC_SEQ_CST);
+}
+
+/* push from any thread, never blocks; wakes the consumer only if it is asleep */
+void
+suns_bus_queue_push(suns_bus_queue_t *queue, suns_bus_node_t *node)
+{
+    suns_bus_queue_link(queue, node);
+    suns_bus_queue_wake(queue);
+}
+
+/* wake the consumer if it is asleep, returns 1 if it was */
+int
+suns_bus_queue_wake(suns_bus_queue_t *queue)
+{
+    uint64_t one = 1;
+
+    if (__atomic_exchange_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST)) {
+        if (write(queue->event_fd, &one, sizeof(one)) < 0) {
+            /* counter already set, the consumer wakes anyway */
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Pop, consumer thread only. Returns NULL when the queue is empty or the
+ * last node is still being linked by a producer; that producer wakes the
+ * consumer once it is done.
+ */
+suns_bus_node_t *
+suns_bus_queue_pop(suns_bus_queue_t *queue)
+{
+    suns_bus_node_t *tail = queue->tail;
+    suns_bus_node_t *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    /* tail is the only node, queue the stub behind it so tail can be taken */
+    suns_bus_queue_link(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+/* pop, sleeping up to timeout ms (-1 for no limit) for a push */
+suns_bus_node_t *
+suns_bus_queue_wait(suns_bus_queue_t *queue, int32_t timeout)
+{
+    suns_bus_node_t *node;
+    struct pollfd pfd;
+    uint64_t deadline = suns_time_ms() + (timeout > 0 ? timeout : 0);
+    uint64_t now;
+    uint64_t count;
+    int wait;
+
+    while ((node = suns_bus_queue_pop(queue)) == NULL) {
+        wait = -1;
+        if (timeout >= 0) {
+            if ((now = suns_time_ms()) >= deadline) {
+                break;
+            }
+            wait = (int) (deadline - now);
+        }
+
+        /* announce the sleep, then look again so a push can't slip between */
+        __atomic_store_n(&queue->sleeping, 1, __ATOMIC_SEQ_CST);
+        if ((node = suns_bus_queue_pop(queue)) != NULL) {
+            __atomic_store_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST);
+            break;
+        }
+
+        pfd.fd = queue->event_fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, wait);
+        if (read(queue->event_fd, &count, sizeof(count)) < 0) {
+            /* woken by the timeout */
+        }
+        __atomic_store_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+
+    return node;
+}
+
+suns_err_t
+suns_bus_op_run(suns_bus_op_t *op)
+{
+    switch (op->type) {
+    case SUNS_BUS_OP_MODEL_READ:
+        return op->model ? suns_model_read(op->model) : SUNS_ERR_INIT;
+    case SUNS_BUS_OP_MODEL_WRITE:
+        return op->model ? suns_model_write(op->model) : SUNS_ERR_INIT;
+    case SUNS_BUS_OP_SCAN:
+        return suns_device_scan(op->device);
+    case SUNS_BUS_OP_READ:
+        return suns_device_modbus_read(op->device, op->addr, op->len, op->buf, 0);
+    case SUNS_BUS_OP_WRITE:
+        return suns_device_modbus_write(op->device, op->addr, op->len, op->buf, 0);
+    case SUNS_BUS_OP_FUNC:
+        return op->func ? op->func(op->device, op->arg) : SUNS_ERR_INIT;
+    }
+
+    return SUNS_ERR_UNIMPL;
+}
+
+void *
+suns_bus_worker(void *arg)
+{
+    suns_bus_t *bus = (suns_bus_t *) arg;
+    suns_bus_node_t *node;
+    suns_bus_op_t *op;
+    suns_bus_cq_t *cq;
+
+    while ((node = suns_bus_queue_wait(&bus->queue, -1)) != &bus->stop) {
+        op = (suns_bus_op_t *) node;
+        op->err = suns_bus_op_run(op);
+        op->completed = suns_time_us();
+        __atomic_add_fetch(&bus->completed, 1, __ATOMIC_RELAXED);
+        /* the op belongs to the completion queue consumer from here on */
+        if ((cq = op->cq) != NULL) {
+            suns_bus_queue_push(cq, &op->node);
+        }
+    }
+
+    return NULL;
+}
+
+suns_err_t
+suns_bus_start(suns_bus_t *bus)
+{
+    suns_err_t err;
+
+    memset(bus, 0, sizeof(*bus));
+    if ((err = suns_bus_queue_init(&bus->queue)) != SUNS_ERR_OK) {
+        return err;
+    }
+    if ((err = pthread_create(&bus->thread, NULL, suns_bus_worker, bus)) != 0) {
+        suns_bus_queue_free(&bus->queue);
+        return SUNS_ERR_ERRNO_BASE + err;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+/* stop the worker once the ops already submitted are done */
+void
+suns_bus_stop(suns_bus_t *bus)
+{
+    suns_bus_queue_push(&bus->queue, &bus->stop);
+    pthread_join(bus->thread, NULL);
+    suns_bus_queue_free(&bus->queue);
+}
+
+/* queue op on the bus; it comes back on cq when done */
+void
+suns_bus_submit(suns_bus_t *bus, suns_bus_op_t *op, suns_bus_cq_t *cq)
+{
+    op->cq = cq;
+    op->err = SUNS_ERR_OK;
+    op->submitted = suns_time_us();
+    op->completed = 0;
+    __atomic_add_fetch(&bus->submitted, 1, __ATOMIC_RELAXED);
+    suns_bus_queue_push(&bus->queue, &op->node);
+}
+
+suns_err_t
+suns_bus_cq_init(suns_bus_cq_t *cq)
+{
+    return suns_bus_queue_init(cq);
+}
+
+void
+suns_bus_cq_free(suns_bus_cq_t *cq)
+{
+    suns_bus_queue_free(cq);
+}
+
+/* next completed op, waiting up to timeout ms (-1 for no limit), NULL on timeout */
+suns_bus_op_t *
+suns_bus_cq_get(suns_bus_cq_t *cq, int32_t timeout)
+{
+    return (suns_bus_op_t *) suns_bus_queue_wait(cq, timeout);
+}
@@ -21,22 +21,20 @@
  * IN THE SOFTWARE.
  */
 
+#include <errno.h>
 #include <malloc.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "cea2045lib.h"
 #include "sunspec_error.h"
 #include "sunspec_io.h"
 #include "sunspec_log.h"
 
-extern uint16_t cea2045_flush(bool txBufClear, bool rxBufClear, bool force);
-extern int16_t CEA2045ss_read(unsigned char *buf, uint16_t len, uint32_t timeout);
-extern int16_t CEA2045ss_write(unsigned char *buf, uint16_t len, uint32_t timeout);
-
 typedef struct _suns_cea2045_t {
-    uint16_t something;
+    struct cea2045PortStruct *port;
 } suns_cea2045_t;
 
 suns_err_t
@@ -47,6 +45,7 @@ suns_cea2045_close(void *io)
     }
 
     if (((suns_io_t *) io)->prot != NULL) {
+        cea2045Close(((suns_cea2045_t *) ((suns_io_t *) io)->prot)->port);
         free(((suns_io_t *) io)->prot);
     }
 
@@ -76,9 +75,9 @@ suns_cea2045_disconnect(void *prot)
 suns_err_t
 suns_cea2045_read(void *prot, unsigned char *buf, uint16_t *len, uint32_t timeout)
 {
-    uint16_t ret;
+    int ret;
 
-    if ((ret = CEA2045ss_read(buf, *len, timeout)) > 0) {
+    if ((ret = CEA2045ss_read(((suns_cea2045_t *) prot)->port, buf, *len, timeout)) > 0) {
         *len = ret;
         return SUNS_ERR_OK;
     }
@@ -90,10 +89,10 @@ suns_cea2045_read(void *prot, unsigned char *buf, uint16_t *len, uint32_t timeou
 suns_err_t
 suns_cea2045_write(void *prot, unsigned char *buf, uint16_t len, uint32_t timeout)
 {
-    uint16_t ret;
+    int ret;
     suns_err_t err = SUNS_ERR_OK;
 
-    if ((ret = CEA2045ss_write(buf, len, timeout)) != len) {
+    if ((ret = CEA2045ss_write(((suns_cea2045_t *) prot)->port, buf, len, timeout)) != len) {
         if (ret == -1) {
             err = SUNS_ERR_BUF_SIZE;
         } else {
@@ -106,26 +105,33 @@ suns_cea2045_write(void *prot, unsigned char *buf, uint16_t len, uint32_t timeou
 suns_err_t
 suns_cea2045_flush(void *prot, bool flush_tx, bool flush_rx)
 {
-    uint16_t ret;
+    int ret;
     suns_err_t err = SUNS_ERR_OK;
 
-    if ((ret = cea2045_flush(flush_tx, flush_rx, false)) != 0) {
+    if ((ret = cea2045Flush(((suns_cea2045_t *) prot)->port, flush_tx, flush_rx)) != 0) {
         err = SUNS_ERR_BUSY;
     }
     return err;
 }
 
 suns_err_t
-suns_cea2045_open(suns_io_t *io)
+suns_cea2045_open(suns_io_t *io, char *ifc_name)
 {
-    if (io == NULL) {
+    if (io == NULL || ifc_name == NULL) {
         return SUNS_ERR_INIT;
     }
 
     if ((io->prot = malloc(sizeof(suns_cea2045_t))) == NULL) {
         return SUNS_ERR_ALLOC;
     }
-    ((suns_cea2045_t *) io->prot)->something = 0;
+    /* each io owns its own UCM port */
+    if ((((suns_cea2045_t *) io->prot)->port = cea2045Open(ifc_name)) == NULL) {
+        free(io->prot);
+        io->prot = NULL;
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    /* modbus frames are carried as SunSpec pass through messages */
+    ((suns_cea2045_t *) io->prot)->port->linkData.sunSpec = true;
 
     io->connect = suns_cea2045_connect;
     io->disconnect = suns_cea2045_disconnect;
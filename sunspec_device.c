@@ -22,6 +22,7 @@
  */
 
 #include <malloc.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 
@@ -33,9 +34,20 @@
 #include "sunspec_modbus.h"
 #include "sunspec_modbus_rtu.h"
 #include "sunspec_modbus_sim.h"
+#include "sunspec_stats.h"
+#include "sunspec_ring.h"
+#include "sunspec_rollup.h"
+#include "sunspec_sub.h"
+#include "sunspec_time.h"
 #include "sunspec_value.h"
 
+/*
+ * Model definition registry. Definitions are never freed or changed once
+ * on the list, so lookups walk it without a lock; loads are serialized and
+ * publish new definitions with a single store of the list head.
+ */
 suns_model_def_t *suns_model_def_list = NULL;
+pthread_mutex_t suns_model_def_lock = PTHREAD_MUTEX_INITIALIZER;
 
 suns_data_t suns_data_types[] = {
     {"int16", SUNS_TYPE_INT16, SUNS_TYPE_INT16, 1, 1, {.s16 = 0x8000},
@@ -580,19 +592,41 @@ suns_models_load_exit:
     }
 }
 
+/* load file_path in front of the registry and publish it, called with suns_model_def_lock held */
+void
+suns_model_def_publish(const char *file_path)
+{
+    suns_model_def_t *list = suns_model_def_list;
+
+    suns_model_load(file_path, &list);
+    __atomic_store_n(&suns_model_def_list, list, __ATOMIC_RELEASE);
+}
+
+void
+suns_model_def_load(const char *file_path)
+{
+    pthread_mutex_lock(&suns_model_def_lock);
+    suns_model_def_publish(file_path);
+    pthread_mutex_unlock(&suns_model_def_lock);
+}
+
 suns_model_def_t *
 suns_model_def_get(uint16_t id)
 {
-    suns_model_def_t *list = suns_model_def_list;
-    suns_model_def_t *model_def = suns_model_def_find(list, id);
+    suns_model_def_t *model_def;
     char file_path[SUNS_MODEL_PATH_LEN];
 
-    if (model_def == NULL) {
-        if (strlen(SUNS_SMDX_PATH) > 0) {
+    model_def = suns_model_def_find(__atomic_load_n(&suns_model_def_list, __ATOMIC_ACQUIRE), id);
+
+    if (model_def == NULL && strlen(SUNS_SMDX_PATH) > 0) {
+        pthread_mutex_lock(&suns_model_def_lock);
+        /* another thread may have loaded it while we waited */
+        if ((model_def = suns_model_def_find(suns_model_def_list, id)) == NULL) {
             snprintf(file_path, SUNS_MODEL_PATH_LEN, "%ssmdx_%05d.xml", SUNS_SMDX_PATH, id);
-            suns_model_load(file_path, &list);
-            model_def = suns_model_def_find(list, id);
+            suns_model_def_publish(file_path);
+            model_def = suns_model_def_find(suns_model_def_list, id);
         }
+        pthread_mutex_unlock(&suns_model_def_lock);
     }
 
     return model_def;
@@ -674,6 +708,10 @@ suns_model_free(suns_model_t *model)
                 suns_block_free(model->blocks[i]);
             }
         }
+        suns_sub_free(model);
+        suns_ring_free(model);
+        suns_rollup_free(model);
+        free(model->snap.buf[0]);
         free(model);
     }
 }
@@ -956,6 +994,13 @@ suns_model_add(suns_device_t *device, uint16_t id, uint16_t len, uint16_t addr,
     model->block_count = repeating_count + 1;
     model->model_def = model_def;
 
+    if ((model->snap.buf[0] = calloc(2, len * 2)) == NULL) {
+        err = SUNS_ERR_ALLOC;
+        goto error_exit;
+    }
+    model->snap.buf[1] = model->snap.buf[0] + (len * 2);
+    model->snap.len = (uint32_t) len * 2;
+
     if (fixed) {
         if ((err= suns_block_add(model, 0, fixed, addr)) != SUNS_ERR_OK) {
             goto error_exit;
@@ -997,38 +1042,249 @@ error_exit:
 suns_err_t
 suns_block_update(suns_block_t *block, unsigned char *buf)
 {
-    suns_point_t *point = block->points;
+    suns_block_update_diff(block, buf, NULL);
 
-    /* printf("block update: model %d  block %d  buf %p\n", block->model->id, block->index, buf); */
+    return SUNS_ERR_OK;
+}
 
-    while (point) {
+/*
+ * Decode the points of block whose registers differ from prev, the block's
+ * registers from the previous update, or all of them if prev is NULL.
+ * Dirty points are always decoded so a read replaces unwritten values.
+ * Returns the number of points decoded.
+ */
+uint16_t
+suns_block_update_diff(suns_block_t *block, unsigned char *buf, unsigned char *prev)
+{
+    suns_point_t *point;
+    uint16_t offset;
+    uint16_t count = 0;
+
+    for (point = block->points; point; point = point->next) {
+        offset = point->point_def->offset * 2;
+        if (prev && !point->dirty && memcmp(prev + offset, buf + offset, point->point_def->len * 2) == 0) {
+            continue;
+        }
         if (point->point_def->type->modbus_to_value) {
-            point->point_def->type->modbus_to_value(buf + (point->point_def->offset * 2), &point->value_base, point->point_def->len);
+            point->point_def->type->modbus_to_value(buf + offset, &point->value_base, point->point_def->len);
         }
         point->dirty = 0;
-        point = point->next;
+        count++;
     }
 
-    return SUNS_ERR_OK;
+    return count;
 }
 
+int
+suns_block_dirty(suns_block_t *block)
+{
+    suns_point_t *point;
+
+    for (point = block->points; point; point = point->next) {
+        if (point->dirty) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Decode a model image read from the device. Blocks whose registers match
+ * the snapshot of the previous update are skipped, and only the changed
+ * points of the other blocks are decoded; blocks_changed and
+ * points_changed report what was decoded.
+ */
 suns_err_t
 suns_model_update(suns_model_t *model, unsigned char *buf)
 {
-    suns_err_t err;
+    suns_block_t *block;
+    unsigned char *prev = model->snap.buf[0];
     uint16_t i;
+    uint16_t len;
     uint16_t offset = 0;
 
+    model->blocks_changed = 0;
+    model->points_changed = 0;
+
     for (i = 0; i < model->block_count; i++) {
-        if ((err = suns_block_update(model->blocks[i], buf + offset)) != SUNS_ERR_OK) {
-            return err;
+        block = model->blocks[i];
+        len = block->block_def->len * 2;
+        /* the writer's own snapshot copy holds the previous image */
+        if (prev && block->synced && memcmp(prev + offset, buf + offset, len) == 0 && !suns_block_dirty(block)) {
+            offset += len;
+            continue;
+        }
+        model->blocks_changed++;
+        model->points_changed += suns_block_update_diff(block, buf + offset,
+                                                        (prev && block->synced) ? prev + offset : NULL);
+        block->synced = (prev != NULL);
+        offset += len;
+    }
+
+    suns_model_publish(model, 0, buf, model->len);
+    suns_sub_update(model, buf);
+    if (model->rings) {
+        suns_ring_update(model, suns_time_ms());
+    }
+    if (model->rollups) {
+        /* windows line up with the wall clock minute, hour, ... */
+        suns_rollup_update(model, suns_time_wall_ms());
+    }
+
+    return SUNS_ERR_OK;
+}
+
+/*
+ * Feed subscriptions, rings and rollups after only points were decoded
+ * and published, as a scheduler point set read does. Points outside the
+ * set are not sampled.
+ */
+void
+suns_model_points_update(suns_model_t *model, suns_point_t **points, uint16_t count)
+{
+    unsigned char buf[SUNS_MODEL_BUF_SIZE];
+
+    if (model->subs && suns_model_snapshot(model, buf, sizeof(buf), NULL) == SUNS_ERR_OK) {
+        suns_sub_update_points(model, buf, points, count);
+    }
+    if (model->rings) {
+        suns_ring_update_points(model, suns_time_ms(), points, count);
+    }
+    if (model->rollups) {
+        suns_rollup_update_points(model, suns_time_wall_ms(), points, count);
+    }
+}
+
+int
+suns_point_in(suns_point_t *point, suns_point_t **points, uint16_t count)
+{
+    uint16_t i;
+
+    for (i = 0; i < count; i++) {
+        if (points[i] == point) {
+            return 1;
         }
-        offset += (model->blocks[i]->block_def->len * 2);
+    }
+    return 0;
+}
+
+/*
+ * Snapshot copies are read and written with relaxed atomics, one register
+ * at a time, so readers racing the writer are well defined; the sequence
+ * count tells a reader whether what it copied is consistent.
+ */
+void
+suns_model_snap_store(unsigned char *snap, unsigned char *buf, uint16_t len)
+{
+    uint16_t *regs = (uint16_t *) snap;
+    uint16_t v;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        memcpy(&v, buf + (i * 2), sizeof(v));
+        __atomic_store_n(&regs[i], v, __ATOMIC_RELAXED);
+    }
+}
+
+void
+suns_model_snap_load(unsigned char *buf, unsigned char *snap, uint16_t len)
+{
+    uint16_t *regs = (uint16_t *) snap;
+    uint16_t v;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        v = __atomic_load_n(&regs[i], __ATOMIC_RELAXED);
+        memcpy(buf + (i * 2), &v, sizeof(v));
+    }
+}
+
+/*
+ * Copy len registers read at offset registers into the model into the
+ * model snapshot. Each copy is written while readers are steered to the
+ * other one.
+ */
+void
+suns_model_publish(suns_model_t *model, uint16_t offset, unsigned char *buf, uint16_t len)
+{
+    suns_model_snap_t *snap = &model->snap;
+    uint64_t now = suns_time_ms();
+    uint32_t seq;
+
+    if (snap->buf[0] == NULL || ((uint32_t) offset + len) * 2 > snap->len) {
+        return;
+    }
+
+    seq = __atomic_load_n(&snap->seq, __ATOMIC_RELAXED);
+
+    /* readers move to copy 1 while copy 0 is written */
+    __atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    suns_model_snap_store(snap->buf[0] + (offset * 2), buf, len);
+    __atomic_store_n(&snap->time[0], now, __ATOMIC_RELAXED);
+
+    /* and back to copy 0 while copy 1 is written */
+    __atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    suns_model_snap_store(snap->buf[1] + (offset * 2), buf, len);
+    __atomic_store_n(&snap->time[1], now, __ATOMIC_RELAXED);
+}
+
+/*
+ * Copy a consistent register image of the model into buf without taking
+ * a lock. The copy is retried whenever the sequence count changed while
+ * copying, i.e. after any update published during the copy. time, if set,
+ * gets the time of the last update (0 if the model has not been read yet).
+ */
+suns_err_t
+suns_model_snapshot(suns_model_t *model, unsigned char *buf, uint32_t len, uint64_t *time)
+{
+    suns_model_snap_t *snap = &model->snap;
+    uint32_t seq;
+    uint64_t t;
+
+    if (snap->buf[0] == NULL) {
+        return SUNS_ERR_INIT;
+    }
+    if (len < snap->len) {
+        return SUNS_ERR_BUF_SIZE;
+    }
+
+    do {
+        seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+        suns_model_snap_load(buf, snap->buf[seq & 1], snap->len / 2);
+        t = __atomic_load_n(&snap->time[seq & 1], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) != seq);
+
+    if (time) {
+        *time = t;
     }
 
     return SUNS_ERR_OK;
 }
 
+/*
+ * Decode a point from a register image returned by suns_model_snapshot().
+ * For string points value->str must point to at least len * 2 bytes.
+ */
+suns_err_t
+suns_model_snapshot_point(suns_point_t *point, unsigned char *buf, suns_value_t *value)
+{
+    suns_model_t *model = point->block->model;
+
+    if (point->point_def->type->modbus_to_value == NULL) {
+        return SUNS_ERR_TYPE;
+    }
+    if (point->addr < model->addr || point->addr + point->point_def->len > model->addr + model->len) {
+        return SUNS_ERR_RANGE;
+    }
+
+    point->point_def->type->modbus_to_value(buf + ((point->addr - model->addr) * 2), value, point->point_def->len);
+
+    return SUNS_ERR_OK;
+}
+
 suns_point_t *
 suns_model_point_find(suns_model_t *model, char *id, uint16_t index)
 {
@@ -1053,6 +1309,8 @@ suns_block_write(suns_block_t *block)
     while (point) {
         if (point->dirty) {
             point->dirty = 0;
+            /* local values may not be what the device ends up with */
+            block->synced = 0;
             if (err == SUNS_ERR_OK) {
                 if (index == 0) {
                     addr = point->addr;
@@ -1082,7 +1340,10 @@ suns_block_clear_write(suns_block_t *block)
     suns_point_t *point = block->points;
 
     while (point) {
-        point->dirty = 0;
+        if (point->dirty) {
+            point->dirty = 0;
+            block->synced = 0;
+        }
         point = point->next;
     }
 }
@@ -1156,6 +1417,7 @@ suns_device_free_models(suns_device_t *device)
         suns_model_free(model);
         model = next;
     }
+    device->models = NULL;
 }
 
 void
@@ -1172,13 +1434,89 @@ suns_device_dump(suns_device_t *device, char *str)
     }
 }
 
+/* single transport request, outcome is tracked by the device circuit breaker */
+suns_err_t
+suns_device_modbus_read_req(suns_device_t *device, uint16_t addr, uint16_t len, unsigned char *buf, uint32_t timeout)
+{
+    suns_err_t err;
+
+    uint64_t start;
+
+    if ((err = suns_health_check(&device->health, suns_time_ms())) != SUNS_ERR_OK) {
+        return err;
+    }
+    start = suns_time_us();
+    err = (device->modbus_io.read)(device->modbus_io.prot, addr, len, buf, timeout);
+    suns_stats_record(&device->stats, SUNS_STATS_READ, len, (err == SUNS_ERR_OK) ? len * 2 : 0, err,
+                      (uint32_t) (suns_time_us() - start));
+    suns_health_record(&device->health, err, suns_time_ms());
+
+    return err;
+}
+
 suns_err_t
 suns_device_modbus_read(suns_device_t *device, uint16_t addr, uint16_t len, unsigned char *buf, uint32_t timeout)
 {
     suns_err_t err = SUNS_ERR_INIT;
+    uint16_t req_count;
+    uint16_t req_max;
+    uint64_t now;
+    int probe;
 
     if (device && device->modbus_io.read && device->modbus_io.prot) {
-        err = (device->modbus_io.read)(device->modbus_io.prot, addr, len, buf, timeout);
+        while (len) {
+            req_max = device->req_count_max;
+            probe = 0;
+            if ((req_max < SUNS_MODBUS_REQ_COUNT_MAX) && (len > req_max) &&
+                ((now = suns_time_ms()) >= device->req_probe_time)) {
+                /* the learned limit may be stale, periodically try a larger request */
+                device->req_probe_time = now + SUNS_DEVICE_REQ_PROBE_MS;
+                req_max *= 2;
+                if (req_max > SUNS_MODBUS_REQ_COUNT_MAX) {
+                    req_max = SUNS_MODBUS_REQ_COUNT_MAX;
+                }
+                probe = 1;
+            }
+            if (len > req_max) {
+                req_count = req_max;
+            } else {
+                req_count = len;
+            }
+
+            err = suns_device_modbus_read_req(device, addr, req_count, buf, timeout);
+            if (probe) {
+                if (err == SUNS_ERR_OK) {
+                    suns_log(SUNS_LOG_NOTICE, "Device request size raised to %d registers", req_count);
+                    device->req_count_max = req_count;
+                } else if (SUNS_DEVICE_REQ_SIZE_ERR(err)) {
+                    req_count = device->req_count_max;
+                    err = suns_device_modbus_read_req(device, addr, req_count, buf, timeout);
+                }
+            }
+            if (SUNS_DEVICE_REQ_SIZE_ERR(err) && (req_count > 1)) {
+                /* device may reject large requests, retry with smaller requests */
+                req_max = req_count;
+                while (SUNS_DEVICE_REQ_SIZE_ERR(err) && (req_max > 1)) {
+                    req_max /= 2;
+                    suns_stats_retry(&device->stats);
+                    err = suns_device_modbus_read_req(device, addr, req_max, buf, timeout);
+                }
+                /* only remember the limit if a smaller request actually succeeded */
+                if (err == SUNS_ERR_OK) {
+                    suns_log(SUNS_LOG_NOTICE, "Device request size limited to %d registers", req_max);
+                    device->req_count_max = req_max;
+                    device->req_probe_time = suns_time_ms() + SUNS_DEVICE_REQ_PROBE_MS;
+                    req_count = req_max;
+                }
+            }
+            if (err != SUNS_ERR_OK) {
+                break;
+            }
+
+            addr += req_count;
+            buf += req_count * 2;
+            len -= req_count;
+        }
     }
 
     return err;
@@ -1188,10 +1526,18 @@ suns_err_t
 suns_device_modbus_write(suns_device_t *device, uint16_t addr, uint16_t len, unsigned char *buf, uint32_t timeout)
 {
     suns_err_t err = SUNS_ERR_INIT;
+    uint64_t start;
 
     /* printf("suns_device_modbus_write: %p %d %d %p %d\n", device, addr, len, buf, timeout); */
     if (device && device->modbus_io.write && device->modbus_io.prot) {
+        if ((err = suns_health_check(&device->health, suns_time_ms())) != SUNS_ERR_OK) {
+            return err;
+        }
+        start = suns_time_us();
         err = (device->modbus_io.write)(device->modbus_io.prot, addr, len, buf, timeout);
+        suns_stats_record(&device->stats, SUNS_STATS_WRITE, len, (err == SUNS_ERR_OK) ? len * 2 : 0, err,
+                          (uint32_t) (suns_time_us() - start));
+        suns_health_record(&device->health, err, suns_time_ms());
     }
 
     return err;
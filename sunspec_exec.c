@@ -0,0 +1,406 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "sunspec_bus.h"
+#include "sunspec_error.h"
+#include "sunspec_exec.h"
+#include "sunspec_time.h"
+
+#define SUNS_EXEC_MASK                  (SUNS_EXEC_DEQUE_SIZE - 1)
+
+/* push at the bottom, owner only; 0 if the deque is full */
+int
+suns_exec_deque_push(suns_exec_deque_t *deque, suns_exec_task_t *task)
+{
+    int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (b - t >= SUNS_EXEC_DEQUE_SIZE) {
+        return 0;
+    }
+    __atomic_store_n(&deque->tasks[b & SUNS_EXEC_MASK], task, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+/* take from the bottom, owner only */
+suns_exec_task_t *
+suns_exec_deque_take(suns_exec_deque_t *deque)
+{
+    int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    int64_t t;
+    suns_exec_task_t *task = NULL;
+
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (t <= b) {
+        task = __atomic_load_n(&deque->tasks[b & SUNS_EXEC_MASK], __ATOMIC_RELAXED);
+        if (t == b) {
+            /* last task, race thieves for it */
+            if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                task = NULL;
+            }
+            __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return task;
+}
+
+/* steal from the top, any thread */
+suns_exec_task_t *
+suns_exec_deque_steal(suns_exec_deque_t *deque)
+{
+    int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    int64_t b;
+    suns_exec_task_t *task;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b) {
+        return NULL;
+    }
+    task = __atomic_load_n(&deque->tasks[t & SUNS_EXEC_MASK], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        /* lost to the owner or another thief */
+        return NULL;
+    }
+
+    return task;
+}
+
+void
+suns_exec_run(suns_exec_worker_t *worker, suns_exec_task_t *task)
+{
+    uint64_t one = 1;
+
+    task->worker = worker;
+    task->func(task, task->arg);
+    /* task may be gone now */
+    __atomic_add_fetch(&worker->executed, 1, __ATOMIC_RELAXED);
+    if (__atomic_sub_fetch(&worker->exec->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (write(worker->exec->idle_fd, &one, sizeof(one)) < 0) {
+            /* counter already set */
+        }
+    }
+}
+
+/* wake one sleeping worker to steal a task just pushed to the deque of self */
+void
+suns_exec_wake(suns_exec_t *exec, suns_exec_worker_t *self)
+{
+    uint16_t i;
+
+    /* pairs with the sleeper announcing itself before it looks at the deques */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&exec->sleepers, __ATOMIC_SEQ_CST) == 0) {
+        return;
+    }
+    for (i = 0; i < exec->count; i++) {
+        if (&exec->workers[i] != self && suns_bus_queue_wake(&exec->workers[i].inbox)) {
+            return;
+        }
+    }
+}
+
+/* move submitted tasks to the deque where idle workers can steal them */
+void
+suns_exec_inbox(suns_exec_worker_t *worker, suns_bus_node_t *node)
+{
+    uint32_t pushed = 0;
+
+    do {
+        if (node == &worker->stop) {
+            continue;
+        }
+        if (suns_exec_deque_push(&worker->deque, (suns_exec_task_t *) node)) {
+            pushed++;
+        } else {
+            suns_exec_run(worker, (suns_exec_task_t *) node);
+        }
+    } while ((node = suns_bus_queue_pop(&worker->inbox)) != NULL);
+
+    /* this worker takes one, the rest are there to steal */
+    if (pushed > 1) {
+        suns_exec_wake(worker->exec, worker);
+    }
+}
+
+/* whether another worker has tasks that could be stolen */
+int
+suns_exec_stealable(suns_exec_worker_t *worker)
+{
+    suns_exec_t *exec = worker->exec;
+    suns_exec_deque_t *deque;
+    uint16_t i;
+
+    for (i = 0; i < exec->count; i++) {
+        deque = &exec->workers[i].deque;
+        if (i != worker->index &&
+            __atomic_load_n(&deque->top, __ATOMIC_SEQ_CST) < __atomic_load_n(&deque->bottom, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Block until a submit to this worker's inbox, a spawn or inbox batch on
+ * another worker, or the stop. The sleep is announced before the last
+ * look at the inbox and deques, so work pushed in between is not missed.
+ */
+void
+suns_exec_idle(suns_exec_worker_t *worker)
+{
+    suns_exec_t *exec = worker->exec;
+    suns_bus_node_t *node;
+    struct pollfd pfd;
+    uint64_t count;
+
+    __atomic_add_fetch(&exec->sleepers, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&worker->inbox.sleeping, 1, __ATOMIC_SEQ_CST);
+    if ((node = suns_bus_queue_pop(&worker->inbox)) == NULL && !suns_exec_stealable(worker)) {
+        pfd.fd = worker->inbox.event_fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, -1);
+        if (read(worker->inbox.event_fd, &count, sizeof(count)) < 0) {
+            /* interrupted */
+        }
+    }
+    __atomic_store_n(&worker->inbox.sleeping, 0, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&exec->sleepers, 1, __ATOMIC_SEQ_CST);
+
+    if (node) {
+        suns_exec_inbox(worker, node);
+    }
+}
+
+suns_exec_task_t *
+suns_exec_steal(suns_exec_worker_t *worker)
+{
+    suns_exec_t *exec = worker->exec;
+    suns_exec_task_t *task;
+    uint16_t start;
+    uint16_t i;
+
+    if (exec->count < 2) {
+        return NULL;
+    }
+
+    /* xorshift32, random first victim so thieves spread out */
+    worker->rand ^= worker->rand << 13;
+    worker->rand ^= worker->rand >> 17;
+    worker->rand ^= worker->rand << 5;
+    start = worker->rand % exec->count;
+
+    for (i = 0; i < exec->count; i++) {
+        if ((start + i) % exec->count == worker->index) {
+            continue;
+        }
+        if ((task = suns_exec_deque_steal(&exec->workers[(start + i) % exec->count].deque)) != NULL) {
+            __atomic_add_fetch(&worker->stolen, 1, __ATOMIC_RELAXED);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+void *
+suns_exec_worker(void *arg)
+{
+    suns_exec_worker_t *worker = (suns_exec_worker_t *) arg;
+    suns_exec_task_t *task;
+    suns_bus_node_t *node;
+
+    while (!__atomic_load_n(&worker->exec->stop, __ATOMIC_ACQUIRE)) {
+        if ((node = suns_bus_queue_pop(&worker->inbox)) != NULL) {
+            suns_exec_inbox(worker, node);
+        }
+        if ((task = suns_exec_deque_take(&worker->deque)) != NULL ||
+            (task = suns_exec_steal(worker)) != NULL) {
+            suns_exec_run(worker, task);
+            continue;
+        }
+        /* nothing local or to steal */
+        suns_exec_idle(worker);
+    }
+
+    return NULL;
+}
+
+/* start worker threads, one per online cpu if workers is 0 */
+suns_err_t
+suns_exec_start(suns_exec_t *exec, uint16_t workers)
+{
+    suns_exec_worker_t *worker;
+    suns_err_t err = SUNS_ERR_OK;
+    long cpus;
+    int rc;
+    uint16_t i;
+
+    memset(exec, 0, sizeof(*exec));
+    if (workers == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (uint16_t) cpus : 1;
+    }
+
+    if ((exec->idle_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    if ((exec->workers = calloc(workers, sizeof(suns_exec_worker_t))) == NULL) {
+        close(exec->idle_fd);
+        return SUNS_ERR_ALLOC;
+    }
+
+    for (i = 0; i < workers; i++) {
+        worker = &exec->workers[i];
+        worker->exec = exec;
+        worker->index = i;
+        worker->rand = 0x9e3779b9 ^ (i + 1);
+        if ((err = suns_bus_queue_init(&worker->inbox)) != SUNS_ERR_OK) {
+            break;
+        }
+    }
+    exec->count = i;
+
+    for (i = 0; err == SUNS_ERR_OK && i < exec->count; i++) {
+        if ((rc = pthread_create(&exec->workers[i].thread, NULL, suns_exec_worker, &exec->workers[i])) != 0) {
+            err = SUNS_ERR_ERRNO_BASE + rc;
+        }
+    }
+
+    if (err != SUNS_ERR_OK) {
+        suns_exec_stop(exec);
+    }
+
+    return err;
+}
+
+/* stop the workers, tasks not yet run are dropped */
+void
+suns_exec_stop(suns_exec_t *exec)
+{
+    uint16_t i;
+
+    __atomic_store_n(&exec->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < exec->count; i++) {
+        suns_bus_queue_push(&exec->workers[i].inbox, &exec->workers[i].stop);
+    }
+    for (i = 0; i < exec->count; i++) {
+        if (exec->workers[i].thread) {
+            pthread_join(exec->workers[i].thread, NULL);
+        }
+        suns_bus_queue_free(&exec->workers[i].inbox);
+    }
+    free(exec->workers);
+    exec->workers = NULL;
+    exec->count = 0;
+    if (exec->idle_fd >= 0) {
+        close(exec->idle_fd);
+        exec->idle_fd = -1;
+    }
+}
+
+/* submit from outside the pool, tasks are spread over the workers */
+void
+suns_exec_submit(suns_exec_t *exec, suns_exec_task_t *task)
+{
+    uint32_t i = __atomic_fetch_add(&exec->next, 1, __ATOMIC_RELAXED) % exec->count;
+
+    __atomic_add_fetch(&exec->pending, 1, __ATOMIC_RELAXED);
+    suns_bus_queue_push(&exec->workers[i].inbox, &task->node);
+}
+
+/* submit from a running task, the task goes to the front of its worker's deque */
+void
+suns_exec_spawn(suns_exec_task_t *parent, suns_exec_task_t *task)
+{
+    suns_exec_worker_t *worker = parent->worker;
+
+    __atomic_add_fetch(&worker->exec->pending, 1, __ATOMIC_RELAXED);
+    if (suns_exec_deque_push(&worker->deque, task)) {
+        suns_exec_wake(worker->exec, worker);
+    } else {
+        suns_exec_run(worker, task);
+    }
+}
+
+/* wait up to timeout ms (-1 for no limit) for all submitted tasks to run */
+suns_err_t
+suns_exec_wait(suns_exec_t *exec, int32_t timeout)
+{
+    struct pollfd pfd;
+    uint64_t deadline = suns_time_ms() + (timeout > 0 ? timeout : 0);
+    uint64_t now;
+    uint64_t count;
+    int wait;
+
+    while (__atomic_load_n(&exec->pending, __ATOMIC_ACQUIRE) != 0) {
+        wait = -1;
+        if (timeout >= 0) {
+            if ((now = suns_time_ms()) >= deadline) {
+                return SUNS_ERR_TIMEOUT;
+            }
+            wait = (int) (deadline - now);
+        }
+        /* the last task signals, recheck in case it ran before the poll */
+        pfd.fd = exec->idle_fd;
+        pfd.events = POLLIN;
+        poll(&pfd, 1, wait < 0 || wait > 10 ? 10 : wait);
+        if (read(exec->idle_fd, &count, sizeof(count)) < 0) {
+            /* not signaled yet */
+        }
+    }
+
+    return SUNS_ERR_OK;
+}
+
+uint64_t
+suns_exec_stolen(suns_exec_t *exec)
+{
+    uint64_t stolen = 0;
+    uint16_t i;
+
+    for (i = 0; i < exec->count; i++) {
+        stolen += __atomic_load_n(&exec->workers[i].stolen, __ATOMIC_RELAXED);
+    }
+
+    return stolen;
+}
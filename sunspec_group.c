@@ -0,0 +1,506 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec_error.h"
+#include "sunspec.h"
+#include "sunspec_group.h"
+#include "sunspec_modbus_rtu.h"
+#include "sunspec_time.h"
+
+#define SUNS_GROUP_NONE                 0xffffffff
+
+/*
+ * Encoded register values for one model definition and set of scale
+ * factors. Values are stored in register address order.
+ */
+typedef struct _suns_group_payload_t {
+    suns_model_def_t *model_def;
+    int16_t sf[SUNS_GROUP_POINT_MAX];   /* in command point order */
+    uint16_t mask;                      /* command points written */
+    suns_err_t err;
+    suns_value_t values[SUNS_GROUP_POINT_MAX];
+    uint16_t offsets[SUNS_GROUP_POINT_MAX];
+    unsigned char buf[SUNS_GROUP_BUF_SIZE];
+} suns_group_payload_t;
+
+typedef struct _suns_group_dev_t {
+    suns_err_t err;
+    suns_model_t *model;
+    suns_point_t *points[SUNS_GROUP_POINT_MAX];  /* NULL for optional points not implemented */
+    uint16_t order[SUNS_GROUP_POINT_MAX];  /* command point indexes in register address order */
+    uint16_t count;                     /* command points written to the device */
+    uint16_t mask;
+    int16_t sf[SUNS_GROUP_POINT_MAX];
+    suns_group_payload_t *payload;
+    uint32_t next;                      /* next member of a broadcast */
+    uint8_t member;                     /* written by the broadcast of an earlier device */
+    uint8_t checked;                    /* bus already considered for broadcast */
+} suns_group_dev_t;
+
+typedef struct _suns_group_t {
+    suns_group_cmd_t *cmd;
+    suns_scan_target_t *targets;
+    suns_group_dev_t *devs;
+    suns_group_result_t *results;
+    suns_group_payload_t *payloads;
+    uint32_t payload_count;
+    uint32_t *tasks;                    /* task index to target index */
+} suns_group_t;
+
+void
+suns_group_cmd_init(suns_group_cmd_t *cmd, uint16_t model_id, char *model_name,
+                    uint16_t block, uint16_t flags)
+{
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->model_id = model_id;
+    cmd->model_name = model_name;
+    cmd->block = block;
+    cmd->flags = flags;
+}
+
+suns_err_t
+suns_group_cmd_point(suns_group_cmd_t *cmd, char *id, float value)
+{
+    if (cmd->point_count >= SUNS_GROUP_POINT_MAX) {
+        return SUNS_ERR_RANGE;
+    }
+
+    cmd->points[cmd->point_count].id = id;
+    cmd->points[cmd->point_count].value = value;
+    cmd->points[cmd->point_count].optional = 0;
+    cmd->point_count++;
+
+    return SUNS_ERR_OK;
+}
+
+/* add a point that is skipped on devices that do not implement it */
+suns_err_t
+suns_group_cmd_point_optional(suns_group_cmd_t *cmd, char *id, float value)
+{
+    suns_err_t err;
+
+    if ((err = suns_group_cmd_point(cmd, id, value)) == SUNS_ERR_OK) {
+        cmd->points[cmd->point_count - 1].optional = 1;
+    }
+
+    return err;
+}
+
+/* read the model of a device so scale factors and implemented points are current */
+suns_err_t
+suns_group_read(uint32_t task, suns_device_t *device, void *arg)
+{
+    suns_group_t *group = (suns_group_t *) arg;
+    suns_group_dev_t *dev = &group->devs[group->tasks[task]];
+
+    dev->err = suns_model_read(dev->model);
+
+    return dev->err;
+}
+
+/*
+ * Resolve the command points on a device from its model as just read,
+ * and their register order. As with the single device setters, optional
+ * points the device does not implement are not written; any other point
+ * the device does not implement fails the device.
+ */
+suns_err_t
+suns_group_resolve(suns_group_t *group, suns_group_dev_t *dev)
+{
+    suns_group_cmd_t *cmd = group->cmd;
+    suns_block_t *block;
+    suns_point_t *point;
+    uint16_t i;
+    uint16_t j;
+    uint16_t k;
+
+    if (cmd->block >= dev->model->block_count) {
+        return SUNS_ERR_RANGE;
+    }
+    block = dev->model->blocks[cmd->block];
+
+    dev->count = 0;
+    dev->mask = 0;
+    for (i = 0; i < cmd->point_count; i++) {
+        dev->points[i] = NULL;
+        dev->sf[i] = 0;
+        point = suns_block_point_find(block, cmd->points[i].id);
+        if (point == NULL || !point->point_def->type->is_implemented(point->value_base)) {
+            if (cmd->points[i].optional) {
+                continue;
+            }
+            return (point == NULL) ? SUNS_ERR_NOT_FOUND : SUNS_ERR_UNIMPLEMENTED;
+        }
+        dev->points[i] = point;
+        dev->mask |= 1 << i;
+        if (point->sf_point) {
+            if (!point->sf_point->point_def->type->is_implemented(point->sf_point->value_base)) {
+                return SUNS_ERR_SF_RESOLVE;
+            }
+            dev->sf[i] = point->sf_point->value_base.s16;
+        }
+        /* insertion sort on register address */
+        for (j = dev->count; j > 0 && dev->points[dev->order[j - 1]]->addr > point->addr; j--) {
+            dev->order[j] = dev->order[j - 1];
+        }
+        dev->order[j] = i;
+        dev->count++;
+    }
+
+    for (k = 1; k < dev->count; k++) {
+        if (dev->points[dev->order[k]]->addr == dev->points[dev->order[k - 1]]->addr) {
+            return SUNS_ERR_RANGE;
+        }
+    }
+
+    return SUNS_ERR_OK;
+}
+
+/* encode the command values for the scale factors of a device */
+void
+suns_group_encode(suns_group_t *group, suns_group_dev_t *dev, suns_group_payload_t *payload)
+{
+    suns_point_def_t *point_def;
+    uint16_t offset = 0;
+    uint16_t i;
+    uint16_t k;
+
+    payload->model_def = dev->model->model_def;
+    memcpy(payload->sf, dev->sf, sizeof(payload->sf));
+    payload->mask = dev->mask;
+    payload->err = SUNS_ERR_OK;
+
+    for (k = 0; k < dev->count; k++) {
+        i = dev->order[k];
+        point_def = dev->points[i]->point_def;
+        if (offset + point_def->len * 2 > SUNS_GROUP_BUF_SIZE) {
+            payload->err = SUNS_ERR_BUF_SIZE;
+            return;
+        }
+        if (point_def->type->base_type == SUNS_TYPE_FLOAT32) {
+            payload->values[k].f32 = group->cmd->points[i].value;
+        } else if (point_def->type->from_float != NULL) {
+            point_def->type->from_float(&payload->values[k], dev->sf[i], group->cmd->points[i].value);
+        } else {
+            payload->err = SUNS_ERR_TYPE;
+            return;
+        }
+        point_def->type->modbus_from_value(&payload->buf[offset], payload->values[k], point_def->len);
+        payload->offsets[k] = offset;
+        offset += point_def->len * 2;
+    }
+}
+
+/*
+ * find or build the payload shared by devices with the same model, scale
+ * factors and implemented points
+ */
+suns_group_payload_t *
+suns_group_payload(suns_group_t *group, suns_group_dev_t *dev)
+{
+    suns_group_payload_t *payload;
+    uint32_t i;
+
+    for (i = 0; i < group->payload_count; i++) {
+        payload = &group->payloads[i];
+        if (payload->model_def == dev->model->model_def && payload->mask == dev->mask &&
+            memcmp(payload->sf, dev->sf, sizeof(payload->sf)) == 0) {
+            return payload;
+        }
+    }
+
+    payload = &group->payloads[group->payload_count++];
+    suns_group_encode(group, dev, payload);
+
+    return payload;
+}
+
+/* true if both devices would receive the same registers at the same addresses */
+int
+suns_group_same(suns_group_t *group, suns_group_dev_t *a, suns_group_dev_t *b)
+{
+    uint16_t i;
+
+    if (a->payload != b->payload) {
+        return 0;
+    }
+    for (i = 0; i < group->cmd->point_count; i++) {
+        if (a->points[i] != NULL && a->points[i]->addr != b->points[i]->addr) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Write the payload in runs of contiguous registers, using the device
+ * transport or the rtu broadcast unit id.
+ */
+suns_err_t
+suns_group_send(suns_group_t *group, suns_device_t *device, suns_group_dev_t *dev, int broadcast)
+{
+    suns_group_payload_t *payload = dev->payload;
+    suns_point_t *point;
+    suns_err_t err = SUNS_ERR_OK;
+    uint16_t count = dev->count;
+    uint16_t start;
+    uint16_t regs;
+    uint16_t k;
+
+    for (start = 0; start < count && err == SUNS_ERR_OK; start = k) {
+        point = dev->points[dev->order[start]];
+        regs = point->point_def->len;
+        for (k = start + 1; k < count; k++) {
+            point = dev->points[dev->order[k]];
+            if (point->addr != dev->points[dev->order[start]]->addr + regs) {
+                break;
+            }
+            regs += point->point_def->len;
+        }
+        point = dev->points[dev->order[start]];
+        if (broadcast) {
+            err = suns_modbus_rtu_broadcast(&device->modbus_io, point->addr, regs, &payload->buf[payload->offsets[start]]);
+        } else {
+            err = suns_device_modbus_write(device, point->addr, regs, &payload->buf[payload->offsets[start]], 0);
+        }
+    }
+
+    return err;
+}
+
+/* update the cached point values of a device after a successful write */
+void
+suns_group_commit(suns_group_t *group, suns_group_dev_t *dev)
+{
+    suns_point_t *point;
+    uint16_t k;
+
+    for (k = 0; k < dev->count; k++) {
+        point = dev->points[dev->order[k]];
+        point->value_base = dev->payload->values[k];
+        /* local values may not be what the device ends up with */
+        point->block->synced = 0;
+    }
+}
+
+void
+suns_group_unicast(suns_group_t *group, uint32_t index)
+{
+    suns_group_result_t *result = &group->results[index];
+    suns_group_dev_t *dev = &group->devs[index];
+
+    result->start = suns_time_us();
+    result->err = suns_group_send(group, result->device, dev, 0);
+    result->duration = suns_time_us() - result->start;
+    if (result->err == SUNS_ERR_OK) {
+        suns_group_commit(group, dev);
+    }
+}
+
+suns_err_t
+suns_group_op(uint32_t task, suns_device_t *device, void *arg)
+{
+    suns_group_t *group = (suns_group_t *) arg;
+    uint32_t index = group->tasks[task];
+    suns_group_dev_t *dev = &group->devs[index];
+    suns_group_result_t *result;
+    uint64_t start;
+    suns_err_t err;
+    uint32_t regs = 0;
+    uint32_t i;
+
+    if (dev->next == SUNS_GROUP_NONE) {
+        suns_group_unicast(group, index);
+        return group->results[index].err;
+    }
+
+    /* one broadcast for all members on the bus */
+    start = suns_time_us();
+    err = suns_group_send(group, device, dev, 1);
+    if (err == SUNS_ERR_UNIMPL) {
+        /* transport has no broadcast support, members share an exclusive bus */
+        for (i = index; i != SUNS_GROUP_NONE; i = group->devs[i].next) {
+            suns_group_unicast(group, i);
+        }
+        return SUNS_ERR_OK;
+    }
+
+    /* members see the broadcast in their stats, their circuit breakers are bypassed */
+    for (i = 0; i < dev->count; i++) {
+        regs += dev->points[dev->order[i]]->point_def->len;
+    }
+    for (i = index; i != SUNS_GROUP_NONE; i = group->devs[i].next) {
+        result = &group->results[i];
+        result->err = err;
+        result->broadcast = 1;
+        result->start = start;
+        result->duration = suns_time_us() - start;
+        suns_stats_record(&result->device->stats, SUNS_STATS_WRITE, regs, (err == SUNS_ERR_OK) ? regs * 2 : 0, err,
+                          (uint32_t) result->duration);
+        suns_stats_broadcast(&result->device->stats);
+        if (err == SUNS_ERR_OK) {
+            suns_group_commit(group, &group->devs[i]);
+        }
+    }
+
+    return err;
+}
+
+/*
+ * Write the same point values to a group of devices. The models are read
+ * first for their scale factors and implemented points. Points added with
+ * suns_group_cmd_point_optional() are skipped on devices that do not
+ * implement them. Values are encoded once for each distinct model
+ * definition, scale factor and implemented point combination and written
+ * concurrently on the scan worker pool, so exclusive buses still see one
+ * request at a time. With SUNS_GROUP_BROADCAST, devices on an exclusive
+ * rtu bus that take identical registers are sent a single broadcast write;
+ * the flag asserts the targets are every device on their bus, and a bus
+ * where any target could not be resolved is written device by device.
+ * Broadcasts bypass the device circuit breakers; they are recorded in the
+ * stats of every member and of the transport that sent them.
+ * results must hold count entries and receives the outcome and timing for
+ * each target.
+ */
+suns_err_t
+suns_group_write(suns_scan_target_t *targets, uint32_t count, uint16_t threads,
+                 suns_group_cmd_t *cmd, suns_group_result_t *results)
+{
+    suns_group_t group;
+    suns_scan_target_t *tasks = NULL;
+    suns_group_dev_t *dev;
+    suns_err_t err = SUNS_ERR_OK;
+    uint32_t task_count = 0;
+    uint32_t members;
+    uint32_t last;
+    uint32_t i;
+    uint32_t j;
+
+    if (targets == NULL || results == NULL || cmd == NULL) {
+        return SUNS_ERR_INIT;
+    }
+    if (count == 0) {
+        return SUNS_ERR_OK;
+    }
+
+    memset(&group, 0, sizeof(group));
+    group.cmd = cmd;
+    group.targets = targets;
+    group.results = results;
+    group.devs = (suns_group_dev_t *) calloc(count, sizeof(suns_group_dev_t));
+    group.payloads = (suns_group_payload_t *) calloc(count, sizeof(suns_group_payload_t));
+    group.tasks = (uint32_t *) malloc(count * sizeof(uint32_t));
+    tasks = (suns_scan_target_t *) malloc(count * sizeof(suns_scan_target_t));
+    if (group.devs == NULL || group.payloads == NULL || group.tasks == NULL || tasks == NULL) {
+        err = SUNS_ERR_ALLOC;
+        goto suns_group_write_exit;
+    }
+
+    /* read the models concurrently, scale factors come from the devices */
+    for (i = 0; i < count; i++) {
+        dev = &group.devs[i];
+        dev->next = SUNS_GROUP_NONE;
+        dev->model = suns_device_get_model(targets[i].device, cmd->model_id, cmd->model_name, 1);
+        if (dev->model == NULL) {
+            dev->err = SUNS_ERR_NOT_FOUND;
+        } else {
+            tasks[task_count] = targets[i];
+            group.tasks[task_count++] = i;
+        }
+    }
+    if (task_count > 0) {
+        suns_scan_run(tasks, task_count, threads, suns_group_read, &group, NULL, NULL);
+    }
+
+    for (i = 0; i < count; i++) {
+        dev = &group.devs[i];
+        memset(&results[i], 0, sizeof(suns_group_result_t));
+        results[i].index = i;
+        results[i].device = targets[i].device;
+        if (dev->err == SUNS_ERR_OK && (dev->err = suns_group_resolve(&group, dev)) == SUNS_ERR_OK) {
+            dev->payload = suns_group_payload(&group, dev);
+            dev->err = dev->payload->err;
+        }
+        results[i].err = dev->err;
+    }
+
+    /* chain devices on exclusive buses into broadcasts where the writes match */
+    if (cmd->flags & SUNS_GROUP_BROADCAST) {
+        for (i = 0; i < count; i++) {
+            dev = &group.devs[i];
+            if (dev->checked || targets[i].bus_max != SUNS_SCAN_BUS_EXCLUSIVE) {
+                continue;
+            }
+            last = i;
+            /* a broadcast would also reach a device that failed to resolve */
+            members = (dev->err == SUNS_ERR_OK);
+            for (j = i + 1; j < count; j++) {
+                if (targets[j].bus == targets[i].bus) {
+                    group.devs[j].checked = 1;
+                    if (!members || group.devs[j].err != SUNS_ERR_OK || !suns_group_same(&group, dev, &group.devs[j])) {
+                        members = 0;
+                    } else {
+                        group.devs[last].next = j;
+                        last = j;
+                        members++;
+                    }
+                }
+            }
+            if (members < 2) {
+                /* single device or mixed writes, write each device separately */
+                for (j = i; j != SUNS_GROUP_NONE; j = last) {
+                    last = group.devs[j].next;
+                    group.devs[j].next = SUNS_GROUP_NONE;
+                }
+            } else {
+                for (j = dev->next; j != SUNS_GROUP_NONE; j = group.devs[j].next) {
+                    group.devs[j].member = 1;
+                }
+            }
+        }
+    }
+
+    task_count = 0;
+    for (i = 0; i < count; i++) {
+        if (group.devs[i].err == SUNS_ERR_OK && !group.devs[i].member) {
+            tasks[task_count] = targets[i];
+            group.tasks[task_count++] = i;
+        }
+    }
+
+    err = suns_scan_run(tasks, task_count, threads, suns_group_op, &group, NULL, NULL);
+
+suns_group_write_exit:
+
+    free(tasks);
+    free(group.tasks);
+    free(group.payloads);
+    free(group.devs);
+
+    return err;
+}
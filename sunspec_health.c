@@ -0,0 +1,140 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sunspec_error.h"
+#include "sunspec_health.h"
+#include "sunspec_log.h"
+
+char *suns_health_state_names[] = {"closed", "open", "half-open"};
+
+void
+suns_health_init(suns_health_t *health)
+{
+    health->threshold = SUNS_HEALTH_THRESHOLD;
+    health->backoff_min = SUNS_HEALTH_BACKOFF_MIN;
+    health->backoff_max = SUNS_HEALTH_BACKOFF_MAX;
+    suns_health_reset(health);
+}
+
+void
+suns_health_reset(suns_health_t *health)
+{
+    health->state = SUNS_HEALTH_CLOSED;
+    health->failures = 0;
+    health->backoff = health->backoff_min;
+    health->next_probe = 0;
+    health->last_change = 0;
+    health->trips = 0;
+    health->probes = 0;
+    health->rejected = 0;
+}
+
+/*
+ * Returns SUNS_ERR_OK if a request may be sent to the device. While the
+ * circuit is open requests are rejected until the probe time is reached,
+ * at which point a single request is let through as a probe.
+ */
+suns_err_t
+suns_health_check(suns_health_t *health, uint64_t now)
+{
+    switch (health->state) {
+        case SUNS_HEALTH_CLOSED:
+            return SUNS_ERR_OK;
+        case SUNS_HEALTH_OPEN:
+            if (now >= health->next_probe) {
+                health->state = SUNS_HEALTH_HALF_OPEN;
+                health->last_change = now;
+                health->probes++;
+                return SUNS_ERR_OK;
+            }
+            break;
+        case SUNS_HEALTH_HALF_OPEN:
+            /* probe already in progress */
+            break;
+    }
+
+    health->rejected++;
+
+    return SUNS_ERR_CIRCUIT_OPEN;
+}
+
+/* request outcomes that show the device answered */
+int
+suns_health_response(suns_err_t err)
+{
+    return (err == SUNS_ERR_OK || err == SUNS_ERR_MODBUS_EXCEPT ||
+            err == SUNS_ERR_MODBUS_EXCEPT_VALUE || err == SUNS_ERR_MODBUS_RESP);
+}
+
+void
+suns_health_record(suns_health_t *health, suns_err_t err, uint64_t now)
+{
+    uint32_t backoff;
+
+    if (err == SUNS_ERR_CIRCUIT_OPEN) {
+        /* request never reached the device */
+        return;
+    }
+
+    if (suns_health_response(err)) {
+        /* any response from the device closes the circuit */
+        if (health->state != SUNS_HEALTH_CLOSED) {
+            suns_log(SUNS_LOG_INFO, "Device responding, circuit closed");
+            health->state = SUNS_HEALTH_CLOSED;
+            health->last_change = now;
+        }
+        health->failures = 0;
+        health->backoff = health->backoff_min;
+    } else if (health->state == SUNS_HEALTH_HALF_OPEN) {
+        /* failed probe, whatever the cause, double the delay before the next one */
+        backoff = health->backoff * 2;
+        if (backoff > health->backoff_max || backoff < health->backoff) {
+            backoff = health->backoff_max;
+        }
+        health->backoff = backoff;
+        health->state = SUNS_HEALTH_OPEN;
+        health->last_change = now;
+        health->next_probe = now + health->backoff;
+    } else if (health->state == SUNS_HEALTH_CLOSED && (err == SUNS_ERR_TIMEOUT || err == SUNS_ERR_MODBUS_CRC)) {
+        if (++health->failures >= health->threshold) {
+            health->state = SUNS_HEALTH_OPEN;
+            health->last_change = now;
+            health->backoff = health->backoff_min;
+            health->next_probe = now + health->backoff;
+            health->trips++;
+            suns_log(SUNS_LOG_WARN, "Device unresponsive after %d failures, circuit open", health->failures);
+        }
+    }
+}
+
+const char *
+suns_health_state_str(uint16_t state)
+{
+    if (state <= SUNS_HEALTH_HALF_OPEN) {
+        return suns_health_state_names[state];
+    }
+    return "unknown";
+}
@@ -39,8 +39,11 @@ suns_log(int priority, const char *format, ...)
     if ((priority >= SUNS_LOG_EMERG) || (priority <= SUNS_LOG_DEBUG)) {
         priority_str = suns_log_priority[priority];
     }
+    /* keep lines from different threads whole */
+    flockfile(stdout);
     printf("%s ", priority_str);
     vprintf(format, args);
     printf("\n");
+    funlockfile(stdout);
     va_end(args);
 }
@@ -0,0 +1,469 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec_error.h"
+#include "sunspec_modbus.h"
+#include "sunspec_modbus_cache.h"
+#include "sunspec_time.h"
+
+/* cache entry states */
+#define SUNS_MODBUS_CACHE_EMPTY         0
+#define SUNS_MODBUS_CACHE_PENDING       1       /* upstream read in flight */
+#define SUNS_MODBUS_CACHE_VALID         2
+#define SUNS_MODBUS_CACHE_FAILED        3       /* upstream read failed, waiters collect the error */
+
+typedef struct _suns_modbus_cache_entry_t {
+    uint16_t state;
+    uint16_t addr;
+    uint16_t count;
+    uint16_t size;                      /* allocated data size in registers */
+    uint16_t waiters;
+    uint8_t stale;                      /* written while pending, do not keep */
+    suns_err_t err;
+    uint64_t expires;
+    unsigned char *data;
+} suns_modbus_cache_entry_t;
+
+typedef struct _suns_modbus_cache_rule_t {
+    uint16_t addr;
+    uint16_t count;
+    uint32_t ttl;
+} suns_modbus_cache_rule_t;
+
+typedef struct _suns_modbus_cache_t {
+    suns_modbus_io_t upstream;
+    uint32_t ttl;
+    pthread_mutex_t lock;               /* protects entries, rules and stats */
+    pthread_cond_t done;                /* signaled when a pending read completes */
+    pthread_mutex_t io_lock;            /* serializes upstream transactions */
+    suns_modbus_cache_entry_t entries[SUNS_MODBUS_CACHE_ENTRY_MAX];
+    suns_modbus_cache_rule_t rules[SUNS_MODBUS_CACHE_RULE_MAX];
+    uint16_t rule_count;
+    suns_modbus_cache_stats_t stats;
+} suns_modbus_cache_t;
+
+suns_err_t
+suns_modbus_cache_connect(void *prot, uint32_t timeout)
+{
+    suns_modbus_cache_t *cache = (suns_modbus_cache_t *) prot;
+
+    if (cache == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (cache->upstream.connect == NULL) {
+        return SUNS_ERR_OK;
+    }
+
+    return cache->upstream.connect(cache->upstream.prot, timeout);
+}
+
+suns_err_t
+suns_modbus_cache_disconnect(void *prot)
+{
+    suns_modbus_cache_t *cache = (suns_modbus_cache_t *) prot;
+
+    if (cache == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (cache->upstream.disconnect == NULL) {
+        return SUNS_ERR_OK;
+    }
+
+    return cache->upstream.disconnect(cache->upstream.prot);
+}
+
+uint32_t
+suns_modbus_cache_ttl(suns_modbus_cache_t *cache, uint16_t addr, uint16_t count)
+{
+    suns_modbus_cache_rule_t *rule;
+    uint16_t i;
+
+    /* first rule overlapping the request applies */
+    for (i = 0; i < cache->rule_count; i++) {
+        rule = &cache->rules[i];
+        if ((addr < (uint32_t) rule->addr + rule->count) && (rule->addr < (uint32_t) addr + count)) {
+            return rule->ttl;
+        }
+    }
+
+    return cache->ttl;
+}
+
+suns_modbus_cache_entry_t *
+suns_modbus_cache_find(suns_modbus_cache_t *cache, uint16_t addr, uint16_t count, uint64_t now)
+{
+    suns_modbus_cache_entry_t *entry;
+    uint16_t i;
+
+    for (i = 0; i < SUNS_MODBUS_CACHE_ENTRY_MAX; i++) {
+        entry = &cache->entries[i];
+        if ((entry->state == SUNS_MODBUS_CACHE_VALID && entry->expires > now) ||
+            (entry->state == SUNS_MODBUS_CACHE_PENDING && !entry->stale)) {
+            if ((addr >= entry->addr) && ((uint32_t) addr + count <= (uint32_t) entry->addr + entry->count)) {
+                return entry;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Pick an empty or expired entry, otherwise the valid entry closest to
+ * expiring. Entries with waiters are never reused, a woken waiter still
+ * copies its result out of the entry's range and data.
+ */
+suns_modbus_cache_entry_t *
+suns_modbus_cache_alloc(suns_modbus_cache_t *cache, uint16_t addr, uint16_t count, uint64_t now)
+{
+    suns_modbus_cache_entry_t *entry;
+    suns_modbus_cache_entry_t *victim = NULL;
+    unsigned char *data;
+    uint16_t i;
+
+    for (i = 0; i < SUNS_MODBUS_CACHE_ENTRY_MAX; i++) {
+        entry = &cache->entries[i];
+        if (entry->waiters) {
+            continue;
+        }
+        if ((entry->state == SUNS_MODBUS_CACHE_EMPTY) ||
+            (entry->state == SUNS_MODBUS_CACHE_VALID && entry->expires <= now)) {
+            victim = entry;
+            break;
+        }
+        if ((entry->state == SUNS_MODBUS_CACHE_VALID) && ((victim == NULL) || (entry->expires < victim->expires))) {
+            victim = entry;
+        }
+    }
+
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    if (victim->size < count) {
+        if ((data = (unsigned char *) realloc(victim->data, count * 2)) == NULL) {
+            return NULL;
+        }
+        victim->data = data;
+        victim->size = count;
+    }
+
+    if ((victim->state == SUNS_MODBUS_CACHE_VALID) && (victim->expires > now)) {
+        cache->stats.evictions++;
+    }
+
+    victim->state = SUNS_MODBUS_CACHE_PENDING;
+    victim->addr = addr;
+    victim->count = count;
+    victim->waiters = 0;
+    victim->stale = 0;
+    victim->err = SUNS_ERR_OK;
+
+    return victim;
+}
+
+suns_err_t
+suns_modbus_cache_upstream_read(suns_modbus_cache_t *cache, uint16_t addr, uint16_t count,
+                                unsigned char *buf, uint32_t timeout)
+{
+    suns_err_t err;
+
+    if (cache->upstream.read == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    pthread_mutex_lock(&cache->io_lock);
+    err = cache->upstream.read(cache->upstream.prot, addr, count, buf, timeout);
+    pthread_mutex_unlock(&cache->io_lock);
+
+    return err;
+}
+
+/*
+ * Reads contained in a fresh cached range are served from the cache. Reads
+ * contained in a range already being fetched wait for that transaction
+ * instead of issuing their own.
+ */
+suns_err_t
+suns_modbus_cache_read(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_cache_t *cache = (suns_modbus_cache_t *) prot;
+    suns_modbus_cache_entry_t *entry;
+    suns_err_t err;
+    uint32_t ttl;
+    uint64_t now;
+
+    if (cache == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    if ((ttl = suns_modbus_cache_ttl(cache, addr, count)) == 0) {
+        cache->stats.uncached++;
+        pthread_mutex_unlock(&cache->lock);
+        return suns_modbus_cache_upstream_read(cache, addr, count, buf, timeout);
+    }
+
+    now = suns_time_ms();
+    if ((entry = suns_modbus_cache_find(cache, addr, count, now)) != NULL) {
+        if (entry->state == SUNS_MODBUS_CACHE_PENDING) {
+            cache->stats.collapsed++;
+            entry->waiters++;
+            while (entry->state == SUNS_MODBUS_CACHE_PENDING) {
+                pthread_cond_wait(&cache->done, &cache->lock);
+            }
+            entry->waiters--;
+        } else {
+            cache->stats.hits++;
+        }
+
+        err = entry->err;
+        if (err == SUNS_ERR_OK) {
+            memcpy(buf, &entry->data[(addr - entry->addr) * 2], count * 2);
+        }
+        if ((entry->state != SUNS_MODBUS_CACHE_VALID) && (entry->waiters == 0)) {
+            entry->state = SUNS_MODBUS_CACHE_EMPTY;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        return err;
+    }
+
+    cache->stats.misses++;
+    if ((entry = suns_modbus_cache_alloc(cache, addr, count, now)) == NULL) {
+        /* every entry is in flight */
+        pthread_mutex_unlock(&cache->lock);
+        return suns_modbus_cache_upstream_read(cache, addr, count, buf, timeout);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    err = suns_modbus_cache_upstream_read(cache, addr, count, entry->data, timeout);
+
+    pthread_mutex_lock(&cache->lock);
+    entry->err = err;
+    if (err == SUNS_ERR_OK) {
+        memcpy(buf, entry->data, count * 2);
+        entry->expires = suns_time_ms() + ttl;
+    }
+    /* failed or invalidated results are only kept until the waiters collect them */
+    if ((err == SUNS_ERR_OK) && !entry->stale) {
+        entry->state = SUNS_MODBUS_CACHE_VALID;
+    } else if (entry->waiters) {
+        entry->state = SUNS_MODBUS_CACHE_FAILED;
+    } else {
+        entry->state = SUNS_MODBUS_CACHE_EMPTY;
+    }
+    pthread_cond_broadcast(&cache->done);
+    pthread_mutex_unlock(&cache->lock);
+
+    return err;
+}
+
+/* writes go straight upstream and drop any cached range they overlap */
+suns_err_t
+suns_modbus_cache_write(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_cache_t *cache = (suns_modbus_cache_t *) prot;
+    suns_modbus_cache_entry_t *entry;
+    suns_err_t err;
+    uint16_t i;
+
+    if (cache == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (cache->upstream.write == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    pthread_mutex_lock(&cache->io_lock);
+    err = cache->upstream.write(cache->upstream.prot, addr, count, buf, timeout);
+    pthread_mutex_unlock(&cache->io_lock);
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < SUNS_MODBUS_CACHE_ENTRY_MAX; i++) {
+        entry = &cache->entries[i];
+        if ((addr < (uint32_t) entry->addr + entry->count) && (entry->addr < (uint32_t) addr + count)) {
+            if (entry->state == SUNS_MODBUS_CACHE_VALID) {
+                entry->state = SUNS_MODBUS_CACHE_EMPTY;
+                cache->stats.invalidations++;
+            } else if (entry->state == SUNS_MODBUS_CACHE_PENDING) {
+                entry->stale = 1;
+                cache->stats.invalidations++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return err;
+}
+
+/* closes the wrapped transport as well */
+suns_err_t
+suns_modbus_cache_close(suns_modbus_io_t *io)
+{
+    suns_modbus_cache_t *cache;
+    suns_err_t err = SUNS_ERR_OK;
+    uint16_t i;
+
+    if (io == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((cache = (suns_modbus_cache_t *) io->prot) != NULL) {
+        if (cache->upstream.close) {
+            err = cache->upstream.close(&cache->upstream);
+        }
+        for (i = 0; i < SUNS_MODBUS_CACHE_ENTRY_MAX; i++) {
+            free(cache->entries[i].data);
+        }
+        pthread_cond_destroy(&cache->done);
+        pthread_mutex_destroy(&cache->io_lock);
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+    }
+
+    io->prot = NULL;
+    io->connect = NULL;
+    io->disconnect = NULL;
+    io->read = NULL;
+    io->write = NULL;
+    io->close = NULL;
+
+    return err;
+}
+
+/* wrap an open transport in place, reads are cached for ttl ms by default */
+suns_err_t
+suns_modbus_cache_open(suns_modbus_io_t *io, uint32_t ttl)
+{
+    suns_modbus_cache_t *cache;
+
+    if (io == NULL || io->read == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((cache = (suns_modbus_cache_t *) calloc(1, sizeof(suns_modbus_cache_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    cache->upstream = *io;
+    cache->ttl = ttl;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_mutex_init(&cache->io_lock, NULL);
+    pthread_cond_init(&cache->done, NULL);
+
+    io->prot = cache;
+    io->connect = suns_modbus_cache_connect;
+    io->disconnect = suns_modbus_cache_disconnect;
+    io->read = suns_modbus_cache_read;
+    io->write = suns_modbus_cache_write;
+    io->close = suns_modbus_cache_close;
+
+    return SUNS_ERR_OK;
+}
+
+/* set the ttl for reads overlapping a register range, 0 disables caching for the range */
+suns_err_t
+suns_modbus_cache_ttl_set(suns_modbus_io_t *io, uint16_t addr, uint16_t count, uint32_t ttl)
+{
+    suns_modbus_cache_t *cache;
+    suns_modbus_cache_rule_t *rule = NULL;
+    uint16_t i;
+
+    if (io == NULL || io->read != suns_modbus_cache_read) {
+        return SUNS_ERR_INIT;
+    }
+    cache = (suns_modbus_cache_t *) io->prot;
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < cache->rule_count; i++) {
+        if ((cache->rules[i].addr == addr) && (cache->rules[i].count == count)) {
+            rule = &cache->rules[i];
+            break;
+        }
+    }
+    if ((rule == NULL) && (cache->rule_count < SUNS_MODBUS_CACHE_RULE_MAX)) {
+        rule = &cache->rules[cache->rule_count++];
+    }
+    if (rule) {
+        rule->addr = addr;
+        rule->count = count;
+        rule->ttl = ttl;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (rule == NULL) {
+        return SUNS_ERR_BUF_SIZE;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_cache_stats_get(suns_modbus_io_t *io, suns_modbus_cache_stats_t *stats)
+{
+    suns_modbus_cache_t *cache;
+
+    if (io == NULL || stats == NULL || io->read != suns_modbus_cache_read) {
+        return SUNS_ERR_INIT;
+    }
+    cache = (suns_modbus_cache_t *) io->prot;
+
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+
+    return SUNS_ERR_OK;
+}
+
+/* drop all cached ranges, in-flight reads complete but are not kept */
+suns_err_t
+suns_modbus_cache_flush(suns_modbus_io_t *io)
+{
+    suns_modbus_cache_t *cache;
+    uint16_t i;
+
+    if (io == NULL || io->read != suns_modbus_cache_read) {
+        return SUNS_ERR_INIT;
+    }
+    cache = (suns_modbus_cache_t *) io->prot;
+
+    pthread_mutex_lock(&cache->lock);
+    for (i = 0; i < SUNS_MODBUS_CACHE_ENTRY_MAX; i++) {
+        if (cache->entries[i].state == SUNS_MODBUS_CACHE_VALID) {
+            cache->entries[i].state = SUNS_MODBUS_CACHE_EMPTY;
+        } else if (cache->entries[i].state == SUNS_MODBUS_CACHE_PENDING) {
+            cache->entries[i].stale = 1;
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return SUNS_ERR_OK;
+}
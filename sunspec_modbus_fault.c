@@ -0,0 +1,327 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "sunspec_error.h"
+#include "sunspec_modbus.h"
+#include "sunspec_modbus_fault.h"
+
+#define SUNS_FAULT_FRAME_GAP            7       /* 3.5 character silence before request and response */
+#define SUNS_FAULT_READ_REQ_LEN         8
+#define SUNS_FAULT_READ_RSP_LEN         5       /* plus data */
+#define SUNS_FAULT_WRITE_REQ_LEN        9       /* plus data */
+#define SUNS_FAULT_WRITE_RSP_LEN        8
+#define SUNS_FAULT_SEED                 0x9e3779b97f4a7c15ULL
+
+typedef struct _suns_modbus_fault_t {
+    suns_modbus_io_t upstream;
+    suns_modbus_fault_config_t config;
+    uint64_t state;
+    suns_modbus_fault_stats_t stats;
+} suns_modbus_fault_t;
+
+void
+suns_modbus_fault_config_init(suns_modbus_fault_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->seed = 1;
+    config->char_bits = SUNS_FAULT_CHAR_BITS;
+}
+
+/* xorshift64* */
+uint64_t
+suns_modbus_fault_rand(suns_modbus_fault_t *fault)
+{
+    fault->state ^= fault->state >> 12;
+    fault->state ^= fault->state << 25;
+    fault->state ^= fault->state >> 27;
+
+    return fault->state * 0x2545f4914f6cdd1dULL;
+}
+
+/* uniform in (0, 1) */
+double
+suns_modbus_fault_uniform(suns_modbus_fault_t *fault)
+{
+    return ((suns_modbus_fault_rand(fault) >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+ * Every request consumes the same number of random values whatever the
+ * configuration, so a seed always produces the same fault sequence.
+ */
+uint32_t
+suns_modbus_fault_latency(suns_modbus_fault_t *fault)
+{
+    suns_modbus_fault_config_t *config = &fault->config;
+    double u1 = suns_modbus_fault_uniform(fault);
+    double u2 = suns_modbus_fault_uniform(fault);
+    double latency;
+
+    switch (config->latency_dist) {
+        case SUNS_FAULT_LATENCY_UNIFORM:
+            if (config->latency_max <= config->latency_min) {
+                return config->latency_min;
+            }
+            return config->latency_min + (uint32_t) (u1 * (config->latency_max - config->latency_min));
+        case SUNS_FAULT_LATENCY_NORMAL:
+            /* box-muller */
+            latency = config->latency_mean + config->latency_dev * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+            if (latency < config->latency_min) {
+                return config->latency_min;
+            }
+            return (uint32_t) latency;
+        case SUNS_FAULT_LATENCY_EXP:
+            return config->latency_min + (uint32_t) (-log(u1) * config->latency_mean);
+        default:
+            return config->latency_min;
+    }
+}
+
+/* time in us to transfer the request and response on a serial line */
+uint32_t
+suns_modbus_fault_wire_time(suns_modbus_fault_t *fault, uint32_t bytes)
+{
+    if (fault->config.baudrate == 0) {
+        return 0;
+    }
+
+    return (uint32_t) (((uint64_t) (bytes + SUNS_FAULT_FRAME_GAP) * fault->config.char_bits * 1000000) /
+                       fault->config.baudrate);
+}
+
+void
+suns_modbus_fault_delay(suns_modbus_fault_t *fault, uint64_t delay)
+{
+    struct timespec ts;
+
+    fault->stats.delay_total += delay;
+    if (delay > fault->stats.delay_max) {
+        fault->stats.delay_max = delay;
+    }
+    fault->stats.clock += delay;
+
+    if (!fault->config.virtual_time && delay) {
+        ts.tv_sec = delay / 1000000;
+        ts.tv_nsec = (delay % 1000000) * 1000;
+        while (nanosleep(&ts, &ts) != 0) {
+            ;
+        }
+    }
+}
+
+/*
+ * Decide the outcome of a request. Dropped requests cost the full timeout
+ * and exceptions are returned without reaching the device. Corrupted
+ * responses are generated after the device has handled the request.
+ */
+suns_err_t
+suns_modbus_fault_request(suns_modbus_fault_t *fault, uint32_t bytes, uint32_t timeout, uint8_t *forward)
+{
+    uint64_t r_drop = suns_modbus_fault_rand(fault) % SUNS_FAULT_PPM;
+    uint64_t r_crc = suns_modbus_fault_rand(fault) % SUNS_FAULT_PPM;
+    uint64_t r_except = suns_modbus_fault_rand(fault) % SUNS_FAULT_PPM;
+    uint32_t latency = suns_modbus_fault_latency(fault);
+
+    fault->stats.requests++;
+    *forward = 0;
+
+    if (r_drop < fault->config.drop_ppm) {
+        fault->stats.drops++;
+        suns_modbus_fault_delay(fault, (uint64_t) (timeout ? timeout : SUNS_FAULT_TIMEOUT) * 1000);
+        return SUNS_ERR_TIMEOUT;
+    }
+
+    suns_modbus_fault_delay(fault, (uint64_t) latency + suns_modbus_fault_wire_time(fault, bytes));
+
+    if (r_except < fault->config.except_ppm) {
+        fault->stats.exceptions++;
+        return SUNS_ERR_MODBUS_EXCEPT;
+    }
+
+    *forward = 1;
+    if (r_crc < fault->config.crc_ppm) {
+        fault->stats.crc_errors++;
+        return SUNS_ERR_MODBUS_CRC;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_fault_connect(void *prot, uint32_t timeout)
+{
+    suns_modbus_fault_t *fault = (suns_modbus_fault_t *) prot;
+
+    if (fault == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (fault->upstream.connect == NULL) {
+        return SUNS_ERR_OK;
+    }
+
+    return fault->upstream.connect(fault->upstream.prot, timeout);
+}
+
+suns_err_t
+suns_modbus_fault_disconnect(void *prot)
+{
+    suns_modbus_fault_t *fault = (suns_modbus_fault_t *) prot;
+
+    if (fault == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (fault->upstream.disconnect == NULL) {
+        return SUNS_ERR_OK;
+    }
+
+    return fault->upstream.disconnect(fault->upstream.prot);
+}
+
+suns_err_t
+suns_modbus_fault_read(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_fault_t *fault = (suns_modbus_fault_t *) prot;
+    suns_err_t err;
+    suns_err_t upstream_err;
+    uint8_t forward;
+
+    if (fault == NULL || fault->upstream.read == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    err = suns_modbus_fault_request(fault, SUNS_FAULT_READ_REQ_LEN + SUNS_FAULT_READ_RSP_LEN + count * 2,
+                                    timeout, &forward);
+    if (forward) {
+        upstream_err = fault->upstream.read(fault->upstream.prot, addr, count, buf, timeout);
+        if (err == SUNS_ERR_OK) {
+            err = upstream_err;
+        }
+    }
+
+    return err;
+}
+
+suns_err_t
+suns_modbus_fault_write(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_fault_t *fault = (suns_modbus_fault_t *) prot;
+    suns_err_t err;
+    suns_err_t upstream_err;
+    uint8_t forward;
+
+    if (fault == NULL || fault->upstream.write == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    err = suns_modbus_fault_request(fault, SUNS_FAULT_WRITE_REQ_LEN + count * 2 + SUNS_FAULT_WRITE_RSP_LEN,
+                                    timeout, &forward);
+    if (forward) {
+        upstream_err = fault->upstream.write(fault->upstream.prot, addr, count, buf, timeout);
+        if (err == SUNS_ERR_OK) {
+            err = upstream_err;
+        }
+    }
+
+    return err;
+}
+
+/* closes the wrapped transport as well */
+suns_err_t
+suns_modbus_fault_close(suns_modbus_io_t *io)
+{
+    suns_modbus_fault_t *fault;
+    suns_err_t err = SUNS_ERR_OK;
+
+    if (io == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((fault = (suns_modbus_fault_t *) io->prot) != NULL) {
+        if (fault->upstream.close) {
+            err = fault->upstream.close(&fault->upstream);
+        }
+        free(fault);
+    }
+
+    io->prot = NULL;
+    io->connect = NULL;
+    io->disconnect = NULL;
+    io->read = NULL;
+    io->write = NULL;
+    io->close = NULL;
+
+    return err;
+}
+
+/* wrap an open transport in place */
+suns_err_t
+suns_modbus_fault_open(suns_modbus_io_t *io, suns_modbus_fault_config_t *config)
+{
+    suns_modbus_fault_t *fault;
+
+    if (io == NULL || config == NULL || io->read == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((config->drop_ppm > SUNS_FAULT_PPM) || (config->crc_ppm > SUNS_FAULT_PPM) ||
+        (config->except_ppm > SUNS_FAULT_PPM) || (config->baudrate && (config->char_bits == 0))) {
+        return SUNS_ERR_RANGE;
+    }
+
+    if ((fault = (suns_modbus_fault_t *) calloc(1, sizeof(suns_modbus_fault_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    fault->upstream = *io;
+    fault->config = *config;
+    /* xorshift state must not be zero */
+    fault->state = config->seed ? config->seed : SUNS_FAULT_SEED;
+
+    io->prot = fault;
+    io->connect = suns_modbus_fault_connect;
+    io->disconnect = suns_modbus_fault_disconnect;
+    io->read = suns_modbus_fault_read;
+    io->write = suns_modbus_fault_write;
+    io->close = suns_modbus_fault_close;
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_fault_stats_get(suns_modbus_io_t *io, suns_modbus_fault_stats_t *stats)
+{
+    if (io == NULL || stats == NULL || io->read != suns_modbus_fault_read) {
+        return SUNS_ERR_INIT;
+    }
+
+    *stats = ((suns_modbus_fault_t *) io->prot)->stats;
+
+    return SUNS_ERR_OK;
+}
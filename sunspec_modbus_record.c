@@ -0,0 +1,500 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sunspec_error.h"
+#include "sunspec_modbus.h"
+#include "sunspec_modbus_record.h"
+#include "sunspec_time.h"
+
+typedef struct _suns_modbus_record_t {
+    suns_modbus_io_t upstream;
+    FILE *file;
+    suns_err_t err;                     /* first capture write error, the capture stops there */
+} suns_modbus_record_t;
+
+typedef struct _suns_modbus_replay_t {
+    unsigned char *log;                 /* capture file contents */
+    unsigned char **records;            /* record offsets in the log */
+    uint32_t record_count;
+    uint32_t cursor;                    /* next record to match */
+    uint8_t mode;
+    uint64_t start;                     /* replay start time in us */
+    uint64_t first;                     /* time of the first record in us */
+    suns_modbus_replay_stats_t stats;
+} suns_modbus_replay_t;
+
+uint16_t
+suns_modbus_record_data_len(uint8_t op, uint16_t count, suns_err_t err)
+{
+    if ((op == SUNS_RECORD_OP_WRITE) || (err == SUNS_ERR_OK)) {
+        return count * 2;
+    }
+
+    return 0;
+}
+
+void
+suns_modbus_record_write(suns_modbus_record_t *record, uint8_t op, uint64_t start, suns_err_t err,
+                         uint16_t addr, uint16_t count, unsigned char *buf)
+{
+    unsigned char hdr[SUNS_RECORD_HDR_LEN];
+    uint16_t data_len = suns_modbus_record_data_len(op, count, err);
+
+    /* a partial record would misalign the rest of the capture */
+    if (record->err != SUNS_ERR_OK) {
+        return;
+    }
+
+    suns_modbus_from_64(start, &hdr[0]);
+    suns_modbus_from_32((uint32_t) (suns_time_us() - start), &hdr[8]);
+    suns_modbus_from_32(err, &hdr[12]);
+    suns_modbus_from_16(addr, &hdr[16]);
+    suns_modbus_from_16(count, &hdr[18]);
+    hdr[20] = op;
+
+    if ((fwrite(hdr, 1, sizeof(hdr), record->file) != sizeof(hdr)) ||
+        (data_len && (fwrite(buf, 1, data_len, record->file) != data_len))) {
+        record->err = SUNS_ERR_ERRNO_BASE + errno;
+    }
+}
+
+suns_err_t
+suns_modbus_record_connect(void *prot, uint32_t timeout)
+{
+    suns_modbus_record_t *record = (suns_modbus_record_t *) prot;
+
+    if (record == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (record->upstream.connect == NULL) {
+        return SUNS_ERR_OK;
+    }
+
+    return record->upstream.connect(record->upstream.prot, timeout);
+}
+
+suns_err_t
+suns_modbus_record_disconnect(void *prot)
+{
+    suns_modbus_record_t *record = (suns_modbus_record_t *) prot;
+
+    if (record == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (record->upstream.disconnect == NULL) {
+        return SUNS_ERR_OK;
+    }
+
+    return record->upstream.disconnect(record->upstream.prot);
+}
+
+suns_err_t
+suns_modbus_record_read(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_record_t *record = (suns_modbus_record_t *) prot;
+    suns_err_t err;
+    uint64_t start;
+
+    if (record == NULL || record->upstream.read == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    start = suns_time_us();
+    err = record->upstream.read(record->upstream.prot, addr, count, buf, timeout);
+    suns_modbus_record_write(record, SUNS_RECORD_OP_READ, start, err, addr, count, buf);
+
+    return err;
+}
+
+suns_err_t
+suns_modbus_record_write_req(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_record_t *record = (suns_modbus_record_t *) prot;
+    suns_err_t err;
+    uint64_t start;
+
+    if (record == NULL || record->upstream.write == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    start = suns_time_us();
+    err = record->upstream.write(record->upstream.prot, addr, count, buf, timeout);
+    suns_modbus_record_write(record, SUNS_RECORD_OP_WRITE, start, err, addr, count, buf);
+
+    return err;
+}
+
+/*
+ * Restore the wrapped transport in io and finish the capture. Capture
+ * write errors don't fail the requests being recorded, they are returned
+ * here.
+ */
+suns_err_t
+suns_modbus_record_detach(suns_modbus_io_t *io)
+{
+    suns_modbus_record_t *record;
+    suns_err_t err;
+
+    if (io == NULL || io->read != suns_modbus_record_read) {
+        return SUNS_ERR_INIT;
+    }
+
+    record = (suns_modbus_record_t *) io->prot;
+    err = record->err;
+    if ((fclose(record->file) != 0) && (err == SUNS_ERR_OK)) {
+        err = SUNS_ERR_ERRNO_BASE + errno;
+    }
+    *io = record->upstream;
+    free(record);
+
+    return err;
+}
+
+/*
+ * closes the wrapped transport as well, even if the capture failed; the
+ * capture error is returned first
+ */
+suns_err_t
+suns_modbus_record_close(suns_modbus_io_t *io)
+{
+    suns_err_t err;
+    suns_err_t close_err = SUNS_ERR_OK;
+
+    if (io == NULL || io->read != suns_modbus_record_read) {
+        return SUNS_ERR_INIT;
+    }
+
+    err = suns_modbus_record_detach(io);
+
+    if (io->close) {
+        close_err = io->close(io);
+    }
+
+    return (err != SUNS_ERR_OK) ? err : close_err;
+}
+
+/* wrap an open transport in place and capture every transaction to path */
+suns_err_t
+suns_modbus_record_open(suns_modbus_io_t *io, const char *path)
+{
+    suns_modbus_record_t *record;
+    unsigned char hdr[SUNS_RECORD_FILE_HDR_LEN];
+
+    if (io == NULL || io->read == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((record = (suns_modbus_record_t *) calloc(1, sizeof(suns_modbus_record_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+
+    if ((record->file = fopen(path, "wb")) == NULL) {
+        free(record);
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+
+    memset(hdr, 0, sizeof(hdr));
+    suns_modbus_from_32(SUNS_RECORD_MAGIC, &hdr[0]);
+    suns_modbus_from_16(SUNS_RECORD_VERSION, &hdr[4]);
+    suns_modbus_from_64((uint64_t) time(NULL), &hdr[8]);
+    if (fwrite(hdr, 1, sizeof(hdr), record->file) != sizeof(hdr)) {
+        fclose(record->file);
+        free(record);
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+
+    record->upstream = *io;
+    io->prot = record;
+    io->connect = suns_modbus_record_connect;
+    io->disconnect = suns_modbus_record_disconnect;
+    io->read = suns_modbus_record_read;
+    io->write = suns_modbus_record_write_req;
+    io->close = suns_modbus_record_close;
+
+    return SUNS_ERR_OK;
+}
+
+/*
+ * Find the next capture for a request. Requests are matched in capture
+ * order starting at the cursor, wrapping to the start of the capture so a
+ * capture can be replayed repeatedly.
+ */
+unsigned char *
+suns_modbus_replay_find(suns_modbus_replay_t *replay, uint8_t op, uint16_t addr, uint16_t count)
+{
+    unsigned char *rec;
+    uint32_t i;
+    uint32_t index;
+
+    for (i = 0; i < replay->record_count; i++) {
+        index = (replay->cursor + i) % replay->record_count;
+        rec = replay->records[index];
+        if ((rec[20] == op) && (suns_modbus_to_16(&rec[16]) == addr) && (suns_modbus_to_16(&rec[18]) == count)) {
+            /* realtime pacing restarts when the capture wraps */
+            if (index < replay->cursor) {
+                replay->start = 0;
+            }
+            replay->cursor = index + 1;
+            return rec;
+        }
+    }
+
+    return NULL;
+}
+
+/* wait until the capture time of the response relative to the start of the replay */
+void
+suns_modbus_replay_wait(suns_modbus_replay_t *replay, unsigned char *rec)
+{
+    uint64_t now = suns_time_us();
+    uint64_t due;
+    struct timespec ts;
+
+    if (replay->start == 0) {
+        replay->start = now;
+        replay->first = suns_modbus_to_64(&rec[0]);
+    }
+
+    due = replay->start + (suns_modbus_to_64(&rec[0]) - replay->first) + suns_modbus_to_32(&rec[8]);
+    if (due > now) {
+        /* capture gaps can be longer than a useconds_t holds */
+        ts.tv_sec = (due - now) / 1000000;
+        ts.tv_nsec = ((due - now) % 1000000) * 1000;
+        while (nanosleep(&ts, &ts) != 0) {
+            ;
+        }
+    }
+}
+
+suns_err_t
+suns_modbus_replay_request(suns_modbus_replay_t *replay, uint8_t op, uint16_t addr, uint16_t count, unsigned char *buf)
+{
+    unsigned char *rec;
+    suns_err_t err;
+
+    if ((rec = suns_modbus_replay_find(replay, op, addr, count)) == NULL) {
+        replay->stats.missed++;
+        return SUNS_ERR_NOT_FOUND;
+    }
+    replay->stats.served++;
+
+    if (replay->mode == SUNS_REPLAY_REALTIME) {
+        suns_modbus_replay_wait(replay, rec);
+    }
+
+    err = suns_modbus_to_32(&rec[12]);
+    if ((op == SUNS_RECORD_OP_READ) && (err == SUNS_ERR_OK)) {
+        memcpy(buf, &rec[SUNS_RECORD_HDR_LEN], count * 2);
+    }
+
+    return err;
+}
+
+suns_err_t
+suns_modbus_replay_connect(void *prot, uint32_t timeout)
+{
+    if (prot == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_replay_disconnect(void *prot)
+{
+    if (prot == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_replay_read(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    if (prot == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return suns_modbus_replay_request((suns_modbus_replay_t *) prot, SUNS_RECORD_OP_READ, addr, count, buf);
+}
+
+suns_err_t
+suns_modbus_replay_write(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    if (prot == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    return suns_modbus_replay_request((suns_modbus_replay_t *) prot, SUNS_RECORD_OP_WRITE, addr, count, buf);
+}
+
+suns_err_t
+suns_modbus_replay_close(suns_modbus_io_t *io)
+{
+    suns_modbus_replay_t *replay;
+
+    if (io == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((replay = (suns_modbus_replay_t *) io->prot) != NULL) {
+        free(replay->records);
+        free(replay->log);
+        free(replay);
+    }
+
+    io->prot = NULL;
+    io->connect = NULL;
+    io->disconnect = NULL;
+    io->read = NULL;
+    io->write = NULL;
+    io->close = NULL;
+
+    return SUNS_ERR_OK;
+}
+
+/* load a capture and index its records */
+suns_err_t
+suns_modbus_replay_load(suns_modbus_replay_t *replay, const char *path)
+{
+    FILE *file;
+    struct stat st;
+    long size = 0;
+    uint32_t offset;
+    uint32_t count = 0;
+    unsigned char *rec;
+    suns_err_t err = SUNS_ERR_OK;
+
+    if ((file = fopen(path, "rb")) == NULL) {
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+
+    if (fstat(fileno(file), &st) != 0) {
+        err = SUNS_ERR_ERRNO_BASE + errno;
+    } else if (!S_ISREG(st.st_mode)) {
+        /* size of anything else is meaningless */
+        err = SUNS_ERR_ERRNO_BASE + (S_ISDIR(st.st_mode) ? EISDIR : EINVAL);
+    } else if ((size = st.st_size) < SUNS_RECORD_FILE_HDR_LEN) {
+        err = SUNS_ERR_RANGE;
+    } else if ((replay->log = (unsigned char *) malloc(size)) == NULL) {
+        err = SUNS_ERR_ALLOC;
+    } else if (fread(replay->log, 1, size, file) != size) {
+        /* the file shrank if there was no read error */
+        err = SUNS_ERR_ERRNO_BASE + (ferror(file) ? errno : EIO);
+    }
+    fclose(file);
+    if (err != SUNS_ERR_OK) {
+        return err;
+    }
+
+    if ((suns_modbus_to_32(replay->log) != SUNS_RECORD_MAGIC) ||
+        (suns_modbus_to_16(&replay->log[4]) != SUNS_RECORD_VERSION)) {
+        return SUNS_ERR_TYPE;
+    }
+
+    /* count records, a truncated final record is ignored */
+    for (offset = SUNS_RECORD_FILE_HDR_LEN; offset + SUNS_RECORD_HDR_LEN <= size; count++) {
+        rec = &replay->log[offset];
+        offset += SUNS_RECORD_HDR_LEN + suns_modbus_record_data_len(rec[20], suns_modbus_to_16(&rec[18]),
+                                                                     suns_modbus_to_32(&rec[12]));
+        if (offset > size) {
+            break;
+        }
+    }
+
+    if ((replay->records = (unsigned char **) malloc(sizeof(unsigned char *) * (count + 1))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+
+    offset = SUNS_RECORD_FILE_HDR_LEN;
+    for (replay->record_count = 0; replay->record_count < count; replay->record_count++) {
+        rec = &replay->log[offset];
+        offset += SUNS_RECORD_HDR_LEN + suns_modbus_record_data_len(rec[20], suns_modbus_to_16(&rec[18]),
+                                                                     suns_modbus_to_32(&rec[12]));
+        if (offset > size) {
+            break;
+        }
+        replay->records[replay->record_count] = rec;
+    }
+    replay->stats.records = replay->record_count;
+
+    return SUNS_ERR_OK;
+}
+
+/* serve requests from a capture made with suns_modbus_record_open */
+suns_err_t
+suns_modbus_replay_open(suns_modbus_io_t *io, const char *path, uint8_t mode)
+{
+    suns_modbus_replay_t *replay;
+    suns_err_t err;
+
+    if (io == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((replay = (suns_modbus_replay_t *) calloc(1, sizeof(suns_modbus_replay_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    replay->mode = mode;
+
+    if ((err = suns_modbus_replay_load(replay, path)) != SUNS_ERR_OK) {
+        free(replay->records);
+        free(replay->log);
+        free(replay);
+        return err;
+    }
+
+    io->prot = replay;
+    io->connect = suns_modbus_replay_connect;
+    io->disconnect = suns_modbus_replay_disconnect;
+    io->read = suns_modbus_replay_read;
+    io->write = suns_modbus_replay_write;
+    io->close = suns_modbus_replay_close;
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_replay_stats_get(suns_modbus_io_t *io, suns_modbus_replay_stats_t *stats)
+{
+    if (io == NULL || stats == NULL || io->read != suns_modbus_replay_read) {
+        return SUNS_ERR_INIT;
+    }
+
+    *stats = ((suns_modbus_replay_t *) io->prot)->stats;
+
+    return SUNS_ERR_OK;
+}
@@ -24,11 +24,15 @@
 #include <malloc.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "sunspec_cea2045.h"
 #include "sunspec_error.h"
 #include "sunspec_io.h"
 #include "sunspec_modbus.h"
+#include "sunspec_modbus_rtu.h"
+#include "sunspec_stats.h"
+#include "sunspec_time.h"
 
 typedef struct _suns_modbus_rtu_t {
     char *ifc_name;
@@ -36,10 +40,11 @@ typedef struct _suns_modbus_rtu_t {
     uint8_t parity;
     uint16_t slave_id;
     suns_io_t io;
+    suns_stats_t stats;
 } suns_modbus_rtu_t;
 
 uint16_t
-suns_modbus_crc16(const unsigned char *data, int16_t len)
+suns_modbus_crc16_update(uint16_t crc, const unsigned char *data, int16_t len)
 {
     static const unsigned short crc_table[] = {
         0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
@@ -76,7 +81,6 @@ suns_modbus_crc16(const unsigned char *data, int16_t len)
         0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040};
 
     uint16_t temp;
-    uint16_t crc = 0xFFFF;
     const unsigned char *buf = data;
 
     while (len--) {
@@ -88,12 +92,19 @@ suns_modbus_crc16(const unsigned char *data, int16_t len)
     return crc;
 }
 
+uint16_t
+suns_modbus_crc16(const unsigned char *data, int16_t len)
+{
+    return suns_modbus_crc16_update(0xFFFF, data, len);
+}
+
 #define SUNS_MODBUS_HDR_LEN             3
 #define SUNS_MODBUS_CRC_LEN             2
 #define SUNS_MODBUS_BUF_SIZE            512
 #define SUNS_MODBUS_HOLDING_READ        3
 #define SUNS_MODBUS_WRITE               16
 #define SUNS_MODBUS_REQ_TIMEOUT         1000    /* default timeout in ms */
+#define SUNS_MODBUS_BROADCAST_ID        0       /* unit id addressing all slaves, no response */
 
 #define SUNS_MODBUS_RSP_ID              0
 #define SUNS_MODBUS_RSP_FUNC            1
@@ -104,7 +115,6 @@ suns_modbus_crc16(const unsigned char *data, int16_t len)
 #define SUNS_MODBUS_RSP_WRITE_ADDR      2
 #define SUNS_MODBUS_RSP_WRITE_COUNT     4
 #define SUNS_MODBUS_RSP_WRITE_DATA_LEN  3
-#define SUNS_MODBUS_REQ_COUNT_MAX       125
 
 suns_err_t
 suns_modbus_rtu_connect(void *prot, uint32_t timeout)
@@ -127,7 +137,8 @@ suns_modbus_rtu_disconnect(void *prot)
 }
 
 suns_err_t
-suns_modbus_rtu_read_block(suns_modbus_rtu_t *prot, uint16_t addr, unsigned char *buf, uint16_t count, uint32_t timeout)
+suns_modbus_rtu_read_frame(suns_modbus_rtu_t *prot, uint16_t addr, unsigned char *buf, uint16_t count,
+                           uint32_t timeout, uint32_t *bytes)
 {
     suns_err_t ret;
     uint16_t len;
@@ -160,6 +171,7 @@ suns_modbus_rtu_read_block(suns_modbus_rtu_t *prot, uint16_t addr, unsigned char
     if ((ret = prot->io.write(prot->io.prot, req_buf, index, timeout)) != SUNS_ERR_OK) {
         return ret;
     }
+    *bytes = index;
 
     /* read response */
     index = 0;
@@ -169,6 +181,7 @@ suns_modbus_rtu_read_block(suns_modbus_rtu_t *prot, uint16_t addr, unsigned char
             return ret;
         }
         index += len;
+        *bytes += len;
 
         if (min_len && index >= min_len) {
             min_len = 0;
@@ -190,11 +203,16 @@ suns_modbus_rtu_read_block(suns_modbus_rtu_t *prot, uint16_t addr, unsigned char
                (((unsigned char) resp_buf[crc_offset + 1]) << 8);
 
     if (crc == resp_crc) {
-        if (exception) {
+        if (exception == SUNS_MODBUS_EXCEPT_VALUE) {
+            /* quantity rejected, the caller may retry with a smaller request */
+            return SUNS_ERR_MODBUS_EXCEPT_VALUE;
+        } else if (exception) {
             return SUNS_ERR_MODBUS_EXCEPT;
         } else {
+            /* short responses are returned by some devices for oversized requests */
             if ((resp_buf[SUNS_MODBUS_RSP_ID] != prot->slave_id) || 
-                (resp_buf[SUNS_MODBUS_RSP_FUNC] != SUNS_MODBUS_HOLDING_READ)) {
+                (resp_buf[SUNS_MODBUS_RSP_FUNC] != SUNS_MODBUS_HOLDING_READ) ||
+                (data_len != count * 2)) {
                 return SUNS_ERR_MODBUS_RESP;
             }
         }
@@ -210,6 +228,19 @@ suns_modbus_rtu_read_block(suns_modbus_rtu_t *prot, uint16_t addr, unsigned char
     return SUNS_ERR_OK;
 }
 
+suns_err_t
+suns_modbus_rtu_read_block(suns_modbus_rtu_t *prot, uint16_t addr, unsigned char *buf, uint16_t count, uint32_t timeout)
+{
+    suns_err_t err;
+    uint32_t bytes = 0;
+    uint64_t start = suns_time_us();
+
+    err = suns_modbus_rtu_read_frame(prot, addr, buf, count, timeout, &bytes);
+    suns_stats_record(&prot->stats, SUNS_STATS_READ, count, bytes, err, (uint32_t) (suns_time_us() - start));
+
+    return err;
+}
+
 suns_err_t
 suns_modbus_rtu_read(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
 {
@@ -244,7 +275,8 @@ suns_modbus_rtu_read(void *prot, uint16_t addr, uint16_t count, unsigned char *b
 }
 
 suns_err_t
-suns_modbus_rtu_write(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+suns_modbus_rtu_write_frame(void *prot, uint16_t addr, uint16_t count, unsigned char *buf,
+                            uint32_t timeout, uint32_t *bytes)
 {
     suns_err_t ret;
     uint16_t len;
@@ -294,6 +326,12 @@ suns_modbus_rtu_write(void *prot, uint16_t addr, uint16_t count, unsigned char *
     if ((ret = rtu_prot->io.write(rtu_prot->io.prot, req_buf, index, req_timeout)) != SUNS_ERR_OK) {
         return ret;
     }
+    *bytes = index;
+
+    /* slaves do not respond to broadcast requests */
+    if (rtu_prot->slave_id == SUNS_MODBUS_BROADCAST_ID) {
+        return SUNS_ERR_OK;
+    }
 
     /* read response */
     index = 0;
@@ -303,6 +341,7 @@ suns_modbus_rtu_write(void *prot, uint16_t addr, uint16_t count, unsigned char *
             return ret;
         }
         index += len;
+        *bytes += len;
 
         if (min_len && index >= min_len) {
             min_len = 0;
@@ -341,6 +380,56 @@ suns_modbus_rtu_write(void *prot, uint16_t addr, uint16_t count, unsigned char *
     return SUNS_ERR_OK;
 }
 
+suns_err_t
+suns_modbus_rtu_write(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    suns_err_t err;
+    uint32_t bytes = 0;
+    uint64_t start = suns_time_us();
+
+    err = suns_modbus_rtu_write_frame(prot, addr, count, buf, timeout, &bytes);
+    if (prot) {
+        suns_stats_record(&((suns_modbus_rtu_t *) prot)->stats, SUNS_STATS_WRITE, count, bytes, err,
+                          (uint32_t) (suns_time_us() - start));
+    }
+
+    return err;
+}
+
+/*
+ * Write to all slaves on the bus of an rtu transport using the broadcast
+ * unit id. No response is returned, so success only means the request was
+ * sent. Waits the turnaround delay so slaves can process the request before
+ * the bus is used again. The write is recorded in the stats of the io
+ * transport and counted as a broadcast. No device circuit breaker is
+ * checked or updated, a slave whose circuit is open is still written.
+ * Returns SUNS_ERR_UNIMPL if io is not an rtu transport.
+ */
+suns_err_t
+suns_modbus_rtu_broadcast(suns_modbus_io_t *io, uint16_t addr, uint16_t count, unsigned char *buf)
+{
+    suns_err_t err;
+    suns_modbus_rtu_t *rtu_prot;
+    uint16_t slave_id;
+
+    if (io == NULL || io->write != suns_modbus_rtu_write || io->prot == NULL) {
+        return SUNS_ERR_UNIMPL;
+    }
+
+    rtu_prot = (suns_modbus_rtu_t *) io->prot;
+    slave_id = rtu_prot->slave_id;
+    rtu_prot->slave_id = SUNS_MODBUS_BROADCAST_ID;
+    err = suns_modbus_rtu_write(rtu_prot, addr, count, buf, 0);
+    rtu_prot->slave_id = slave_id;
+    suns_stats_broadcast(&rtu_prot->stats);
+
+    if (err == SUNS_ERR_OK) {
+        usleep(SUNS_MODBUS_RTU_TURNAROUND * 1000);
+    }
+
+    return err;
+}
+
 suns_err_t
 suns_modbus_rtu_close(suns_modbus_io_t *io)
 {
@@ -349,6 +438,10 @@ suns_modbus_rtu_close(suns_modbus_io_t *io)
     }
 
     if (io->prot != NULL) {
+        /* release the underlying port */
+        if (((suns_modbus_rtu_t *) io->prot)->io.close != NULL) {
+            ((suns_modbus_rtu_t *) io->prot)->io.close(&((suns_modbus_rtu_t *) io->prot)->io);
+        }
         free(io->prot);
     }
 
@@ -363,7 +456,7 @@ suns_modbus_rtu_close(suns_modbus_io_t *io)
 }
 
 suns_err_t
-suns_modbus_rtu_cea2045_open(suns_modbus_io_t *io, uint16_t slave_id)
+suns_modbus_rtu_cea2045_open(suns_modbus_io_t *io, char *ifc_name, uint16_t slave_id)
 {
     suns_err_t err;
 
@@ -375,9 +468,12 @@ suns_modbus_rtu_cea2045_open(suns_modbus_io_t *io, uint16_t slave_id)
         return SUNS_ERR_ALLOC;
     }
     ((suns_modbus_rtu_t *) io->prot)->slave_id = slave_id;
+    ((suns_modbus_rtu_t *) io->prot)->ifc_name = ifc_name;
 
     /* initialize cea2045 layer */
-    if ((err = suns_cea2045_open(&((suns_modbus_rtu_t *) io->prot)->io)) != SUNS_ERR_OK) {
+    if ((err = suns_cea2045_open(&((suns_modbus_rtu_t *) io->prot)->io, ifc_name)) != SUNS_ERR_OK) {
+        free(io->prot);
+        io->prot = NULL;
         return err;
     }
 
@@ -398,7 +494,7 @@ suns_modbus_rtu_serial_open(suns_modbus_io_t *io, char *ifc_name,
         return SUNS_ERR_INIT;
     }
 
-    if ((io->prot = malloc(sizeof(suns_modbus_rtu_t))) == NULL) {
+    if ((io->prot = calloc(1, sizeof(suns_modbus_rtu_t))) == NULL) {
         return SUNS_ERR_ALLOC;
     }
     ((suns_modbus_rtu_t *) io->prot)->slave_id = slave_id;
@@ -417,3 +513,27 @@ suns_modbus_rtu_serial_open(suns_modbus_io_t *io, char *ifc_name,
 
     return SUNS_ERR_OK;
 }
+
+suns_err_t
+suns_modbus_rtu_stats_get(suns_modbus_io_t *io, suns_stats_t *snapshot)
+{
+    if (io == NULL || snapshot == NULL || io->read != suns_modbus_rtu_read) {
+        return SUNS_ERR_INIT;
+    }
+
+    suns_stats_snapshot(&((suns_modbus_rtu_t *) io->prot)->stats, snapshot);
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_rtu_stats_reset(suns_modbus_io_t *io)
+{
+    if (io == NULL || io->read != suns_modbus_rtu_read) {
+        return SUNS_ERR_INIT;
+    }
+
+    suns_stats_reset(&((suns_modbus_rtu_t *) io->prot)->stats);
+
+    return SUNS_ERR_OK;
+}
@@ -0,0 +1,846 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "sunspec_device.h"
+#include "sunspec_error.h"
+#include "sunspec_log.h"
+#include "sunspec_modbus.h"
+#include "sunspec_modbus_server.h"
+
+#define SUNS_SERVER_MAGIC_LEN           4
+#define SUNS_SERVER_FUNC_HOLDING_READ   3
+#define SUNS_SERVER_FUNC_INPUT_READ     4
+#define SUNS_SERVER_FUNC_WRITE          16
+#define SUNS_SERVER_FUNC_READ_WRITE     23
+#define SUNS_SERVER_FUNC_EXCEPT         0x80
+#define SUNS_SERVER_READ_COUNT_MAX      125
+#define SUNS_SERVER_WRITE_COUNT_MAX     123
+#define SUNS_SERVER_RW_WRITE_COUNT_MAX  121
+#define SUNS_SERVER_RSP_HDR_LEN         6       /* largest response header after the unit id */
+#define SUNS_SERVER_MBAP_LEN            7
+#define SUNS_SERVER_RTU_CRC_LEN         2
+#define SUNS_SERVER_RTU_FRAME_MIN       4       /* slave id, function code and crc */
+#define SUNS_SERVER_SEND_TIMEOUT        1000    /* ms to wait for a full socket buffer */
+#define SUNS_SERVER_UNIT_BROADCAST      0
+#define SUNS_SERVER_UNIT_ANY            0xff
+#define SUNS_SERVER_LISTEN_BACKLOG      8
+
+unsigned char suns_server_magic[SUNS_SERVER_MAGIC_LEN] = {'S','u','n','S'};
+
+suns_server_t *
+suns_server_alloc(uint16_t slave_id)
+{
+    suns_server_t *server = (suns_server_t *) calloc(1, sizeof(suns_server_t));
+    uint16_t i;
+
+    if (server != NULL) {
+        server->slave_id = slave_id;
+        server->listen_fd = -1;
+        for (i = 0; i < SUNS_SERVER_CONN_MAX; i++) {
+            server->conns[i].fd = -1;
+        }
+    }
+
+    return server;
+}
+
+/* closes the listener and all attached descriptors */
+void
+suns_server_free(suns_server_t *server)
+{
+    uint16_t i;
+
+    if (server) {
+        if (server->listen_fd >= 0) {
+            close(server->listen_fd);
+        }
+        for (i = 0; i < SUNS_SERVER_CONN_MAX; i++) {
+            if (server->conns[i].fd >= 0) {
+                close(server->conns[i].fd);
+            }
+        }
+        free(server->image);
+        free(server->reg_map);
+        free(server->models);
+        free(server);
+    }
+}
+
+suns_err_t
+suns_server_model_add(suns_server_t *server, suns_model_t *model)
+{
+    suns_server_model_t *models;
+
+    if (server == NULL || model == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    models = (suns_server_model_t *) realloc(server->models, sizeof(suns_server_model_t) * (server->model_count + 1));
+    if (models == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    models[server->model_count].model = model;
+    models[server->model_count].offset = 0;
+    server->models = models;
+    server->model_count++;
+
+    return SUNS_ERR_OK;
+}
+
+suns_server_model_t *
+suns_server_model_find(suns_server_t *server, suns_model_t *model)
+{
+    uint16_t i;
+
+    for (i = 0; i < server->model_count; i++) {
+        if (server->models[i].model == model) {
+            return &server->models[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Build the register image and register map from the added models. Models are
+ * laid out back to back after the SunSpec marker in the order they were added
+ * and the map is terminated with an end model.
+ */
+suns_err_t
+suns_server_map_build(suns_server_t *server, uint16_t base_addr)
+{
+    unsigned char *image;
+    suns_server_reg_t *reg_map;
+    suns_model_t *model;
+    suns_block_t *block;
+    suns_point_t *point;
+    uint32_t len = SUNS_SERVER_MAGIC_LEN/2 + 2;
+    uint32_t offset;
+    uint32_t start;
+    uint16_t i;
+    uint16_t j;
+    uint16_t r;
+
+    if (server == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    for (i = 0; i < server->model_count; i++) {
+        len += server->models[i].model->len + 2;
+    }
+
+    if (base_addr + len > SUNS_SERVER_IMAGE_MAX) {
+        return SUNS_ERR_RANGE;
+    }
+
+    image = (unsigned char *) calloc(len, 2);
+    reg_map = (suns_server_reg_t *) calloc(len, sizeof(suns_server_reg_t));
+    if (image == NULL || reg_map == NULL) {
+        free(image);
+        free(reg_map);
+        return SUNS_ERR_ALLOC;
+    }
+
+    memcpy(image, suns_server_magic, SUNS_SERVER_MAGIC_LEN);
+    offset = SUNS_SERVER_MAGIC_LEN/2;
+
+    for (i = 0; i < server->model_count; i++) {
+        model = server->models[i].model;
+        suns_modbus_from_16(model->id, &image[offset * 2]);
+        suns_modbus_from_16(model->len, &image[(offset + 1) * 2]);
+        offset += 2;
+        server->models[i].offset = offset;
+
+        for (j = 0; j < model->block_count; j++) {
+            if ((block = model->blocks[j]) == NULL) {
+                continue;
+            }
+            for (point = block->points; point; point = point->next) {
+                start = offset + (point->addr - model->addr);
+                if (start + point->point_def->len > offset + model->len) {
+                    continue;
+                }
+                for (r = 0; r < point->point_def->len; r++) {
+                    reg_map[start + r].point = point;
+                    reg_map[start + r].start = start;
+                }
+            }
+        }
+        offset += model->len;
+    }
+
+    suns_modbus_from_16(SUNS_MODEL_ID_END, &image[offset * 2]);
+    suns_modbus_from_16(0, &image[(offset + 1) * 2]);
+
+    free(server->image);
+    free(server->reg_map);
+    server->image = image;
+    server->reg_map = reg_map;
+    server->base_addr = base_addr;
+    server->len = len;
+
+    for (i = 0; i < server->model_count; i++) {
+        suns_server_model_update(server, server->models[i].model);
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_server_device_map(suns_server_t *server, suns_device_t *device, uint16_t base_addr)
+{
+    suns_err_t err;
+    suns_model_t *model;
+
+    if (server == NULL || device == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    for (model = device->models; model; model = model->next) {
+        if ((err = suns_server_model_add(server, model)) != SUNS_ERR_OK) {
+            return err;
+        }
+    }
+
+    return suns_server_map_build(server, base_addr);
+}
+
+/* serve a raw register image in modbus byte order, any register is writable */
+suns_err_t
+suns_server_image_set(suns_server_t *server, uint16_t base_addr, const unsigned char *image, uint16_t len)
+{
+    unsigned char *copy;
+
+    if (server == NULL || image == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (base_addr + (uint32_t) len > SUNS_SERVER_IMAGE_MAX) {
+        return SUNS_ERR_RANGE;
+    }
+
+    if ((copy = (unsigned char *) malloc(len * 2)) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    memcpy(copy, image, len * 2);
+
+    free(server->image);
+    free(server->reg_map);
+    free(server->models);
+    server->image = copy;
+    server->reg_map = NULL;
+    server->models = NULL;
+    server->model_count = 0;
+    server->base_addr = base_addr;
+    server->len = len;
+
+    return SUNS_ERR_OK;
+}
+
+/* re-encode the current point values of a mapped model into the register image */
+suns_err_t
+suns_server_model_update(suns_server_t *server, suns_model_t *model)
+{
+    suns_server_model_t *entry;
+    suns_block_t *block;
+    suns_point_t *point;
+    suns_data_t *type;
+    uint32_t start;
+    uint16_t i;
+
+    if (server == NULL || model == NULL || server->image == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((entry = suns_server_model_find(server, model)) == NULL) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+
+    for (i = 0; i < model->block_count; i++) {
+        if ((block = model->blocks[i]) == NULL) {
+            continue;
+        }
+        for (point = block->points; point; point = point->next) {
+            type = point->point_def->type;
+            start = entry->offset + (point->addr - model->addr);
+            if (type->modbus_from_value && (start + point->point_def->len <= entry->offset + model->len)) {
+                type->modbus_from_value(&server->image[start * 2], point->value_base, point->point_def->len);
+            }
+        }
+    }
+
+    return SUNS_ERR_OK;
+}
+
+void
+suns_server_write_func_set(suns_server_t *server, suns_server_write_func_t func, void *arg)
+{
+    server->write_func = func;
+    server->write_arg = arg;
+}
+
+uint8_t
+suns_server_range_check(suns_server_t *server, uint16_t addr, uint16_t count)
+{
+    if ((addr < server->base_addr) || ((uint32_t) (addr - server->base_addr) + count > server->len)) {
+        return SUNS_MODBUS_EXCEPT_ADDR;
+    }
+
+    return 0;
+}
+
+/*
+ * Apply a client write to the register image. With a register map only
+ * registers that belong to points are writable, the affected points are
+ * decoded and marked dirty and the write callback is called for each model.
+ */
+uint8_t
+suns_server_write(suns_server_t *server, uint16_t addr, uint16_t count, unsigned char *buf)
+{
+    uint32_t offset = addr - server->base_addr;
+    suns_server_reg_t *reg;
+    suns_point_t *point = NULL;
+    suns_model_t *model = NULL;
+    uint16_t i;
+
+    if (server->reg_map) {
+        for (i = 0; i < count; i++) {
+            if (server->reg_map[offset + i].point == NULL) {
+                return SUNS_MODBUS_EXCEPT_ADDR;
+            }
+        }
+    }
+
+    memcpy(&server->image[offset * 2], buf, count * 2);
+
+    if (server->reg_map == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        reg = &server->reg_map[offset + i];
+        if (reg->point == point) {
+            continue;
+        }
+        point = reg->point;
+        if (point->point_def->type->modbus_to_value) {
+            point->point_def->type->modbus_to_value(&server->image[reg->start * 2], &point->value_base,
+                                                    point->point_def->len);
+        }
+        point->dirty = 1;
+        if (point->block->model != model) {
+            if (model && server->write_func) {
+                server->write_func(server, model, server->write_arg);
+            }
+            model = point->block->model;
+        }
+    }
+
+    if (model && server->write_func) {
+        server->write_func(server, model, server->write_arg);
+    }
+
+    return 0;
+}
+
+/*
+ * Process a request PDU. The response header is built in rsp and read data is
+ * returned as a pointer into the register image so it is sent without a copy.
+ * Returns 0 or a modbus exception code.
+ */
+uint8_t
+suns_server_pdu(suns_server_t *server, unsigned char *pdu, uint16_t pdu_len,
+                unsigned char *rsp, uint16_t *rsp_len, unsigned char **data, uint16_t *data_len)
+{
+    uint8_t func = pdu[0];
+    uint8_t except;
+    uint16_t addr = 0;
+    uint16_t count = 0;
+    uint16_t waddr;
+    uint16_t wcount;
+
+    *rsp_len = 0;
+    *data = NULL;
+    *data_len = 0;
+    server->requests++;
+
+    switch (func) {
+        case SUNS_SERVER_FUNC_HOLDING_READ:
+        case SUNS_SERVER_FUNC_INPUT_READ:
+            if (pdu_len < 5) {
+                return SUNS_MODBUS_EXCEPT_VALUE;
+            }
+            addr = suns_modbus_to_16(&pdu[1]);
+            count = suns_modbus_to_16(&pdu[3]);
+            if ((count < 1) || (count > SUNS_SERVER_READ_COUNT_MAX)) {
+                return SUNS_MODBUS_EXCEPT_VALUE;
+            }
+            if ((except = suns_server_range_check(server, addr, count)) != 0) {
+                return except;
+            }
+            break;
+        case SUNS_SERVER_FUNC_WRITE:
+            if (pdu_len < 6) {
+                return SUNS_MODBUS_EXCEPT_VALUE;
+            }
+            waddr = suns_modbus_to_16(&pdu[1]);
+            wcount = suns_modbus_to_16(&pdu[3]);
+            if ((wcount < 1) || (wcount > SUNS_SERVER_WRITE_COUNT_MAX) ||
+                (pdu[5] != wcount * 2) || (pdu_len < 6 + wcount * 2)) {
+                return SUNS_MODBUS_EXCEPT_VALUE;
+            }
+            if (((except = suns_server_range_check(server, waddr, wcount)) != 0) ||
+                ((except = suns_server_write(server, waddr, wcount, &pdu[6])) != 0)) {
+                return except;
+            }
+            rsp[0] = func;
+            memcpy(&rsp[1], &pdu[1], 4);
+            *rsp_len = 5;
+            return 0;
+        case SUNS_SERVER_FUNC_READ_WRITE:
+            if (pdu_len < 10) {
+                return SUNS_MODBUS_EXCEPT_VALUE;
+            }
+            addr = suns_modbus_to_16(&pdu[1]);
+            count = suns_modbus_to_16(&pdu[3]);
+            waddr = suns_modbus_to_16(&pdu[5]);
+            wcount = suns_modbus_to_16(&pdu[7]);
+            if ((count < 1) || (count > SUNS_SERVER_READ_COUNT_MAX) ||
+                (wcount < 1) || (wcount > SUNS_SERVER_RW_WRITE_COUNT_MAX) ||
+                (pdu[9] != wcount * 2) || (pdu_len < 10 + wcount * 2)) {
+                return SUNS_MODBUS_EXCEPT_VALUE;
+            }
+            /* write is performed before the read */
+            if (((except = suns_server_range_check(server, addr, count)) != 0) ||
+                ((except = suns_server_range_check(server, waddr, wcount)) != 0) ||
+                ((except = suns_server_write(server, waddr, wcount, &pdu[10])) != 0)) {
+                return except;
+            }
+            break;
+        default:
+            return SUNS_MODBUS_EXCEPT_FUNC;
+    }
+
+    rsp[0] = func;
+    rsp[1] = count * 2;
+    *rsp_len = 2;
+    *data = &server->image[(addr - server->base_addr) * 2];
+    *data_len = count * 2;
+
+    return 0;
+}
+
+/* send the whole response, the iovec array is consumed by short writes */
+suns_err_t
+suns_server_send(suns_server_conn_t *conn, struct iovec *iov, int iovcnt)
+{
+    struct pollfd pfd;
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        n = writev(conn->fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                pfd.fd = conn->fd;
+                pfd.events = POLLOUT;
+                if ((poll(&pfd, 1, SUNS_SERVER_SEND_TIMEOUT) > 0) || (errno == EINTR)) {
+                    continue;
+                }
+            }
+            return SUNS_ERR_ERRNO_BASE + errno;
+        }
+
+        while ((iovcnt > 0) && ((size_t) n >= iov->iov_len)) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (unsigned char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return SUNS_ERR_OK;
+}
+
+/*
+ * Process one MBAP framed request from the connection buffer. Returns the
+ * number of bytes consumed, 0 if the frame is incomplete or -1 if the
+ * connection should be closed.
+ */
+int
+suns_server_tcp_frame(suns_server_t *server, suns_server_conn_t *conn)
+{
+    unsigned char *adu = conn->buf;
+    unsigned char hdr[SUNS_SERVER_MBAP_LEN + SUNS_SERVER_RSP_HDR_LEN];
+    unsigned char *data;
+    uint16_t data_len;
+    uint16_t rsp_len;
+    uint16_t len;
+    uint8_t except;
+    struct iovec iov[2];
+
+    if (conn->len < SUNS_SERVER_MBAP_LEN) {
+        return 0;
+    }
+
+    /* length covers the unit id and pdu */
+    len = suns_modbus_to_16(&adu[4]);
+    if ((suns_modbus_to_16(&adu[2]) != 0) || (len < 2) || (len > SUNS_SERVER_ADU_MAX - 6)) {
+        return -1;
+    }
+    if (conn->len < 6 + len) {
+        return 0;
+    }
+
+    if ((adu[6] != server->slave_id) && (adu[6] != SUNS_SERVER_UNIT_ANY)) {
+        except = SUNS_MODBUS_EXCEPT_GATEWAY_PATH;
+    } else {
+        except = suns_server_pdu(server, &adu[SUNS_SERVER_MBAP_LEN], len - 1,
+                                 &hdr[SUNS_SERVER_MBAP_LEN], &rsp_len, &data, &data_len);
+    }
+    if (except) {
+        hdr[SUNS_SERVER_MBAP_LEN] = adu[SUNS_SERVER_MBAP_LEN] | SUNS_SERVER_FUNC_EXCEPT;
+        hdr[SUNS_SERVER_MBAP_LEN + 1] = except;
+        rsp_len = 2;
+        data = NULL;
+        data_len = 0;
+        server->exceptions++;
+    }
+
+    /* transaction and protocol id are echoed */
+    memcpy(hdr, adu, 4);
+    suns_modbus_from_16(1 + rsp_len + data_len, &hdr[4]);
+    hdr[6] = adu[6];
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = SUNS_SERVER_MBAP_LEN + rsp_len;
+    iov[1].iov_base = data;
+    iov[1].iov_len = data_len;
+    if (suns_server_send(conn, iov, data_len ? 2 : 1) != SUNS_ERR_OK) {
+        return -1;
+    }
+
+    return 6 + len;
+}
+
+/*
+ * Process one RTU request from the connection buffer. Frames are delimited by
+ * the function code length rules since inter-frame timing is not visible on a
+ * descriptor. Unsupported functions are framed by their crc and answered
+ * with an illegal function exception. Returns the number of bytes consumed,
+ * 0 if the frame is incomplete or -1 if the buffer should be discarded to
+ * resynchronize.
+ */
+int
+suns_server_rtu_frame(suns_server_t *server, suns_server_conn_t *conn)
+{
+    unsigned char *adu = conn->buf;
+    unsigned char hdr[1 + SUNS_SERVER_RSP_HDR_LEN];
+    unsigned char crc_buf[SUNS_SERVER_RTU_CRC_LEN];
+    unsigned char *data;
+    uint16_t data_len;
+    uint16_t rsp_len;
+    uint16_t frame_len;
+    uint16_t crc;
+    uint8_t except;
+    struct iovec iov[3];
+
+    if (conn->len < 2) {
+        return 0;
+    }
+
+    switch (adu[1]) {
+        case SUNS_SERVER_FUNC_HOLDING_READ:
+        case SUNS_SERVER_FUNC_INPUT_READ:
+            frame_len = 8;
+            break;
+        case SUNS_SERVER_FUNC_WRITE:
+            if (conn->len < 7) {
+                return 0;
+            }
+            frame_len = 9 + adu[6];
+            break;
+        case SUNS_SERVER_FUNC_READ_WRITE:
+            if (conn->len < 11) {
+                return 0;
+            }
+            frame_len = 13 + adu[10];
+            break;
+        default:
+            /* length rules are unknown, the frame ends at the first matching crc */
+            for (frame_len = SUNS_SERVER_RTU_FRAME_MIN; frame_len <= conn->len; frame_len++) {
+                crc = suns_modbus_crc16(adu, frame_len - SUNS_SERVER_RTU_CRC_LEN);
+                if ((adu[frame_len - 2] == (crc & 0xff)) && (adu[frame_len - 1] == ((crc >> 8) & 0xff))) {
+                    break;
+                }
+            }
+            if (frame_len > conn->len) {
+                return (conn->len < SUNS_SERVER_ADU_MAX) ? 0 : -1;
+            }
+            break;
+    }
+
+    if (frame_len > SUNS_SERVER_ADU_MAX) {
+        return -1;
+    }
+    if (conn->len < frame_len) {
+        return 0;
+    }
+
+    crc = suns_modbus_crc16(adu, frame_len - SUNS_SERVER_RTU_CRC_LEN);
+    if ((adu[frame_len - 2] != (crc & 0xff)) || (adu[frame_len - 1] != ((crc >> 8) & 0xff))) {
+        return -1;
+    }
+
+    if ((adu[0] != server->slave_id) && (adu[0] != SUNS_SERVER_UNIT_BROADCAST)) {
+        return frame_len;
+    }
+
+    except = suns_server_pdu(server, &adu[1], frame_len - 1 - SUNS_SERVER_RTU_CRC_LEN,
+                             &hdr[1], &rsp_len, &data, &data_len);
+
+    /* broadcast requests are not answered */
+    if (adu[0] == SUNS_SERVER_UNIT_BROADCAST) {
+        return frame_len;
+    }
+
+    if (except) {
+        hdr[1] = adu[1] | SUNS_SERVER_FUNC_EXCEPT;
+        hdr[2] = except;
+        rsp_len = 2;
+        data = NULL;
+        data_len = 0;
+        server->exceptions++;
+    }
+    hdr[0] = adu[0];
+
+    crc = suns_modbus_crc16_update(0xFFFF, hdr, 1 + rsp_len);
+    crc = suns_modbus_crc16_update(crc, data, data_len);
+    crc_buf[0] = crc & 0xff;
+    crc_buf[1] = (crc >> 8) & 0xff;
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = 1 + rsp_len;
+    iov[1].iov_base = data;
+    iov[1].iov_len = data_len;
+    iov[2].iov_base = crc_buf;
+    iov[2].iov_len = SUNS_SERVER_RTU_CRC_LEN;
+    if (suns_server_send(conn, iov, 3) != SUNS_ERR_OK) {
+        suns_log(SUNS_LOG_WARN, "Modbus server RTU response failed\n");
+    }
+
+    return frame_len;
+}
+
+void
+suns_server_conn_close(suns_server_conn_t *conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+    conn->len = 0;
+}
+
+void
+suns_server_conn_read(suns_server_t *server, suns_server_conn_t *conn)
+{
+    ssize_t n;
+    int consumed;
+
+    n = read(conn->fd, &conn->buf[conn->len], SUNS_SERVER_ADU_MAX - conn->len);
+    if (n <= 0) {
+        if ((n < 0) && ((errno == EINTR) || (errno == EAGAIN))) {
+            return;
+        }
+        suns_server_conn_close(conn);
+        return;
+    }
+    conn->len += n;
+
+    while (conn->len > 0) {
+        if (conn->rtu) {
+            consumed = suns_server_rtu_frame(server, conn);
+        } else {
+            consumed = suns_server_tcp_frame(server, conn);
+        }
+
+        if (consumed < 0) {
+            if (conn->rtu) {
+                conn->len = 0;
+            } else {
+                suns_server_conn_close(conn);
+            }
+            break;
+        } else if (consumed == 0) {
+            break;
+        }
+
+        memmove(conn->buf, &conn->buf[consumed], conn->len - consumed);
+        conn->len -= consumed;
+    }
+}
+
+suns_err_t
+suns_server_conn_add(suns_server_t *server, int fd, uint8_t rtu)
+{
+    uint16_t i;
+
+    if (server == NULL || fd < 0) {
+        return SUNS_ERR_INIT;
+    }
+
+    for (i = 0; i < SUNS_SERVER_CONN_MAX; i++) {
+        if (server->conns[i].fd < 0) {
+            server->conns[i].fd = fd;
+            server->conns[i].rtu = rtu;
+            server->conns[i].len = 0;
+            return SUNS_ERR_OK;
+        }
+    }
+
+    return SUNS_ERR_BUSY;
+}
+
+suns_err_t
+suns_server_tcp_attach(suns_server_t *server, int fd)
+{
+    return suns_server_conn_add(server, fd, 0);
+}
+
+/* serve RTU requests on an already configured serial descriptor */
+suns_err_t
+suns_server_rtu_attach(suns_server_t *server, int fd)
+{
+    return suns_server_conn_add(server, fd, 1);
+}
+
+suns_err_t
+suns_server_tcp_listen(suns_server_t *server, uint16_t ipport)
+{
+    struct sockaddr_in addr;
+    int fd;
+    int on = 1;
+
+    if (server == NULL || server->listen_fd >= 0) {
+        return SUNS_ERR_INIT;
+    }
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(ipport);
+
+    if ((bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+        (listen(fd, SUNS_SERVER_LISTEN_BACKLOG) < 0)) {
+        close(fd);
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    server->listen_fd = fd;
+
+    return SUNS_ERR_OK;
+}
+
+void
+suns_server_accept(suns_server_t *server)
+{
+    int fd;
+
+    if ((fd = accept(server->listen_fd, NULL, NULL)) < 0) {
+        return;
+    }
+
+    if (suns_server_conn_add(server, fd, 0) != SUNS_ERR_OK) {
+        suns_log(SUNS_LOG_WARN, "Modbus server connection limit reached\n");
+        close(fd);
+    }
+}
+
+/* wait up to timeout ms for requests and process all that are ready */
+suns_err_t
+suns_server_poll(suns_server_t *server, int timeout)
+{
+    struct pollfd fds[SUNS_SERVER_CONN_MAX + 1];
+    suns_server_conn_t *conns[SUNS_SERVER_CONN_MAX + 1];
+    int nfds = 0;
+    int i;
+
+    if (server == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (server->listen_fd >= 0) {
+        fds[nfds].fd = server->listen_fd;
+        fds[nfds].events = POLLIN;
+        conns[nfds++] = NULL;
+    }
+    for (i = 0; i < SUNS_SERVER_CONN_MAX; i++) {
+        if (server->conns[i].fd >= 0) {
+            fds[nfds].fd = server->conns[i].fd;
+            fds[nfds].events = POLLIN;
+            conns[nfds++] = &server->conns[i];
+        }
+    }
+
+    if (nfds == 0) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (poll(fds, nfds, timeout) < 0) {
+        if (errno == EINTR) {
+            return SUNS_ERR_OK;
+        }
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+
+    for (i = 0; i < nfds; i++) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        if (conns[i] == NULL) {
+            suns_server_accept(server);
+        } else {
+            suns_server_conn_read(server, conns[i]);
+        }
+    }
+
+    return SUNS_ERR_OK;
+}
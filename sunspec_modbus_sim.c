@@ -21,14 +21,19 @@
  * IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <malloc.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
-#include <netinet/in.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "sunspec_error.h"
 #include "sunspec_modbus.h"
+#include "sunspec_modbus_sim.h"
 #include "sunspec_log.h"
 
 typedef struct _suns_modbus_sim_t {
@@ -58,22 +63,33 @@ suns_modbus_sim_disconnect(void *prot)
     return SUNS_ERR_OK;
 }
 
+/* copy registers between host and modbus byte order */
+void
+suns_modbus_sim_swap(uint16_t *dest, const uint16_t *src, uint32_t count)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(dest, src, count * 2);
+#else
+    uint32_t i;
+
+    /* simple enough for the compiler to vectorize */
+    for (i = 0; i < count; i++) {
+        dest[i] = __builtin_bswap16(src[i]);
+    }
+#endif
+}
+
 suns_err_t
 suns_modbus_sim_read(void *prot, uint16_t addr, uint16_t len, unsigned char *buf, uint32_t timeout)
 {
-    uint16_t offset;
     suns_modbus_sim_t *sim = (suns_modbus_sim_t *) prot;
-    uint16_t *dest = (uint16_t *) buf;
-    uint16_t i;
 
-    if ((addr < sim->base_addr) || ((addr + (len * 2)) > (sim->base_addr + sim->sim_map_len))) {
+    /* sim_map_len is in bytes */
+    if ((addr < sim->base_addr) || (((uint32_t) (addr - sim->base_addr) + len) * 2 > sim->sim_map_len)) {
         return SUNS_ERR_RANGE;
     }
 
-    offset = addr - sim->base_addr;
-    for (i = 0; i < len; i++) {
-        dest[i] = htons(sim->sim_map[offset + i]);
-    }
+    suns_modbus_sim_swap((uint16_t *) buf, &sim->sim_map[addr - sim->base_addr], len);
 
     return SUNS_ERR_OK;
 }
@@ -81,19 +97,13 @@ suns_modbus_sim_read(void *prot, uint16_t addr, uint16_t len, unsigned char *buf
 suns_err_t
 suns_modbus_sim_write(void *prot, uint16_t addr, uint16_t len, unsigned char *buf, uint32_t timeout)
 {
-    uint16_t offset;
     suns_modbus_sim_t *sim = (suns_modbus_sim_t *) prot;
-    uint16_t *dest = (uint16_t *) buf;
-    uint16_t i;
 
-    if ((addr < sim->base_addr) || ((addr + (len * 2)) > (sim->base_addr + sim->sim_map_len))) {
+    if ((addr < sim->base_addr) || (((uint32_t) (addr - sim->base_addr) + len) * 2 > sim->sim_map_len)) {
         return SUNS_ERR_RANGE;
     }
 
-    offset = addr - sim->base_addr;
-    for (i = 0; i < len; i++) {
-        sim->sim_map[offset + i] = ntohs(dest[i]);
-    }
+    suns_modbus_sim_swap(&sim->sim_map[addr - sim->base_addr], (uint16_t *) buf, len);
 
     return SUNS_ERR_OK;
 }
@@ -106,6 +116,7 @@ suns_modbus_sim_close(suns_modbus_io_t *io)
     }
 
     if (io->prot != NULL) {
+        free(((suns_modbus_sim_t *) io->prot)->sim_map);
         free(io->prot);
     }
 
@@ -130,7 +141,11 @@ suns_modbus_sim_open(suns_modbus_io_t *io, uint16_t base_addr, uint16_t *sim_map
         return SUNS_ERR_ALLOC;
     }
     ((suns_modbus_sim_t *) io->prot)->base_addr = base_addr;
-    ((suns_modbus_sim_t *) io->prot)->sim_map = (uint16_t *) malloc(sim_map_len);
+    if ((((suns_modbus_sim_t *) io->prot)->sim_map = (uint16_t *) malloc(sim_map_len)) == NULL) {
+        free(io->prot);
+        io->prot = NULL;
+        return SUNS_ERR_ALLOC;
+    }
     memcpy((char *)((suns_modbus_sim_t *) io->prot)->sim_map, (char *) sim_map, sim_map_len);
     ((suns_modbus_sim_t *) io->prot)->sim_map_len = sim_map_len;
     ((suns_modbus_sim_t *) io->prot)->slave_id = slave_id;
@@ -143,3 +158,205 @@ suns_modbus_sim_open(suns_modbus_io_t *io, uint16_t base_addr, uint16_t *sim_map
 
     return SUNS_ERR_OK;
 }
+
+/*
+ * Register file backed simulator. The file holds a fixed size register
+ * image per device in modbus byte order so reads and writes are plain
+ * copies out of the mapping.
+ */
+typedef struct _suns_modbus_sim_dev_t {
+    uint16_t base_addr;
+    unsigned char *regs;
+    uint32_t reg_count;
+    uint16_t slave_id;
+} suns_modbus_sim_dev_t;
+
+suns_err_t
+suns_modbus_sim_file_create(const char *path, uint16_t base_addr, uint32_t device_count, uint32_t regs_per_device)
+{
+    suns_modbus_sim_hdr_t hdr;
+    off_t size;
+    int fd;
+
+    if ((device_count == 0) || (regs_per_device == 0) || (base_addr + regs_per_device > 0x10000)) {
+        return SUNS_ERR_RANGE;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SUNS_MODBUS_SIM_MAGIC;
+    hdr.version = SUNS_MODBUS_SIM_VERSION;
+    hdr.device_count = device_count;
+    hdr.regs_per_device = regs_per_device;
+    hdr.base_addr = base_addr;
+    size = sizeof(hdr) + ((off_t) device_count * regs_per_device * 2);
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    if ((ftruncate(fd, size) < 0) || (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))) {
+        close(fd);
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    close(fd);
+
+    return SUNS_ERR_OK;
+}
+
+/*
+ * Map a register file. With shared set device writes are written back to
+ * the file and visible to other processes mapping it, otherwise they are
+ * private to this mapping.
+ */
+suns_err_t
+suns_modbus_sim_file_open(suns_modbus_sim_file_t **file_ptr, const char *path, uint8_t shared)
+{
+    suns_modbus_sim_file_t *file;
+    suns_modbus_sim_hdr_t *hdr;
+    struct stat st;
+    void *map;
+    int fd;
+
+    *file_ptr = NULL;
+
+    if ((fd = open(path, O_RDWR)) < 0) {
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+    if (st.st_size < sizeof(suns_modbus_sim_hdr_t)) {
+        close(fd);
+        return SUNS_ERR_RANGE;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return SUNS_ERR_ERRNO_BASE + errno;
+    }
+
+    hdr = (suns_modbus_sim_hdr_t *) map;
+    if ((hdr->magic != SUNS_MODBUS_SIM_MAGIC) || (hdr->version != SUNS_MODBUS_SIM_VERSION)) {
+        munmap(map, st.st_size);
+        return SUNS_ERR_TYPE;
+    }
+    if (sizeof(*hdr) + ((off_t) hdr->device_count * hdr->regs_per_device * 2) != st.st_size) {
+        munmap(map, st.st_size);
+        return SUNS_ERR_RANGE;
+    }
+
+    if ((file = (suns_modbus_sim_file_t *) calloc(1, sizeof(suns_modbus_sim_file_t))) == NULL) {
+        munmap(map, st.st_size);
+        return SUNS_ERR_ALLOC;
+    }
+    file->map = map;
+    file->map_len = st.st_size;
+    file->hdr = hdr;
+    file->regs = (unsigned char *) map + sizeof(*hdr);
+    file->shared = shared;
+    *file_ptr = file;
+
+    return SUNS_ERR_OK;
+}
+
+/* devices opened on the file must be closed first */
+void
+suns_modbus_sim_file_close(suns_modbus_sim_file_t *file)
+{
+    if (file) {
+        munmap(file->map, file->map_len);
+        free(file);
+    }
+}
+
+/* register image of a device in modbus byte order */
+unsigned char *
+suns_modbus_sim_file_regs(suns_modbus_sim_file_t *file, uint32_t index)
+{
+    if (index >= file->hdr->device_count) {
+        return NULL;
+    }
+
+    return file->regs + ((size_t) index * file->hdr->regs_per_device * 2);
+}
+
+suns_err_t
+suns_modbus_sim_dev_read(void *prot, uint16_t addr, uint16_t len, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_sim_dev_t *dev = (suns_modbus_sim_dev_t *) prot;
+
+    if ((addr < dev->base_addr) || ((uint32_t) (addr - dev->base_addr) + len > dev->reg_count)) {
+        return SUNS_ERR_RANGE;
+    }
+
+    memcpy(buf, &dev->regs[(addr - dev->base_addr) * 2], len * 2);
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_sim_dev_write(void *prot, uint16_t addr, uint16_t len, unsigned char *buf, uint32_t timeout)
+{
+    suns_modbus_sim_dev_t *dev = (suns_modbus_sim_dev_t *) prot;
+
+    if ((addr < dev->base_addr) || ((uint32_t) (addr - dev->base_addr) + len > dev->reg_count)) {
+        return SUNS_ERR_RANGE;
+    }
+
+    memcpy(&dev->regs[(addr - dev->base_addr) * 2], buf, len * 2);
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_sim_dev_close(suns_modbus_io_t *io)
+{
+    if (io == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (io->prot != NULL) {
+        free(io->prot);
+    }
+
+    io->prot = NULL;
+    io->connect = NULL;
+    io->disconnect = NULL;
+    io->read = NULL;
+    io->write = NULL;
+    io->close = NULL;
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_modbus_sim_file_io_open(suns_modbus_io_t *io, suns_modbus_sim_file_t *file, uint32_t index, uint16_t slave_id)
+{
+    suns_modbus_sim_dev_t *dev;
+
+    if (io == NULL || file == NULL) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (index >= file->hdr->device_count) {
+        return SUNS_ERR_RANGE;
+    }
+
+    if ((dev = (suns_modbus_sim_dev_t *) malloc(sizeof(suns_modbus_sim_dev_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    dev->base_addr = file->hdr->base_addr;
+    dev->regs = suns_modbus_sim_file_regs(file, index);
+    dev->reg_count = file->hdr->regs_per_device;
+    dev->slave_id = slave_id;
+
+    io->prot = dev;
+    io->connect = suns_modbus_sim_connect;
+    io->disconnect = suns_modbus_sim_disconnect;
+    io->read = suns_modbus_sim_dev_read;
+    io->write = suns_modbus_sim_dev_write;
+    io->close = suns_modbus_sim_dev_close;
+
+    return SUNS_ERR_OK;
+}
@@ -0,0 +1,227 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec.h"
+#include "sunspec_device.h"
+#include "sunspec_error.h"
+#include "sunspec_ring.h"
+
+/* keep a history of the last capacity updates of a point */
+suns_err_t
+suns_ring_point(suns_model_t *model, char *id, uint16_t index, uint32_t capacity,
+                suns_ring_t **ring_ptr)
+{
+    suns_device_t *device = model->device;
+    suns_point_t *point;
+    suns_ring_t *ring;
+
+    if (capacity == 0) {
+        return SUNS_ERR_RANGE;
+    }
+    if ((point = suns_model_get_point(model, id, index)) == NULL) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+    /* string values point into the model and do not survive the next update */
+    if (point->point_def->type->base_type == SUNS_TYPE_STR) {
+        return SUNS_ERR_TYPE;
+    }
+    if (device->ring_budget && device->ring_bytes + SUNS_RING_BYTES(capacity) > device->ring_budget) {
+        return SUNS_ERR_BUDGET;
+    }
+
+    if ((ring = calloc(1, sizeof(suns_ring_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    if ((ring->samples = calloc(capacity, sizeof(suns_ring_sample_t))) == NULL) {
+        free(ring);
+        return SUNS_ERR_ALLOC;
+    }
+    ring->point = point;
+    ring->capacity = capacity;
+    ring->next = model->rings;
+    model->rings = ring;
+    device->ring_bytes += SUNS_RING_BYTES(capacity);
+
+    if (ring_ptr) {
+        *ring_ptr = ring;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_ring_remove(suns_model_t *model, suns_ring_t *ring)
+{
+    suns_ring_t **ring_list;
+
+    for (ring_list = &model->rings; *ring_list; ring_list = &(*ring_list)->next) {
+        if (*ring_list == ring) {
+            *ring_list = ring->next;
+            model->device->ring_bytes -= SUNS_RING_BYTES(ring->capacity);
+            free(ring->samples);
+            free(ring);
+            return SUNS_ERR_OK;
+        }
+    }
+
+    return SUNS_ERR_NOT_FOUND;
+}
+
+void
+suns_ring_free(suns_model_t *model)
+{
+    while (model->rings) {
+        suns_ring_remove(model, model->rings);
+    }
+}
+
+void
+suns_ring_append(suns_ring_t *ring, uint64_t time)
+{
+    suns_point_t *point = ring->point;
+    suns_ring_sample_t *sample = &ring->samples[ring->head];
+
+    sample->time = time;
+    sample->value = point->value_base;
+    if (point->sf_point && point->sf_point->point_def->type->is_implemented(point->sf_point->value_base)) {
+        sample->sf = point->sf_point->value_base.s16;
+    } else {
+        sample->sf = 0;
+    }
+
+    if (++ring->head == ring->capacity) {
+        ring->head = 0;
+    }
+    if (ring->count < ring->capacity) {
+        ring->count++;
+    }
+}
+
+void
+suns_ring_update(suns_model_t *model, uint64_t time)
+{
+    suns_ring_t *ring;
+
+    for (ring = model->rings; ring; ring = ring->next) {
+        suns_ring_append(ring, time);
+    }
+}
+
+/* append only to the rings of points that were just decoded */
+void
+suns_ring_update_points(suns_model_t *model, uint64_t time, suns_point_t **points, uint16_t count)
+{
+    suns_ring_t *ring;
+
+    for (ring = model->rings; ring; ring = ring->next) {
+        if (suns_point_in(ring->point, points, count)) {
+            suns_ring_append(ring, time);
+        }
+    }
+}
+
+/* sample at position i counting from the oldest */
+suns_ring_sample_t *
+suns_ring_sample(suns_ring_t *ring, uint32_t i)
+{
+    i += ring->head + ring->capacity - ring->count;
+    if (i >= ring->capacity) {
+        i -= ring->capacity;
+    }
+    return &ring->samples[i];
+}
+
+/* position of the first sample at or after time */
+uint32_t
+suns_ring_search(suns_ring_t *ring, uint64_t time)
+{
+    uint32_t lo = 0;
+    uint32_t hi = ring->count;
+    uint32_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (suns_ring_sample(ring, mid)->time < time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Find the samples with start <= time <= end. The samples stay in the
+ * ring and are valid until the next update of the model. Returns the
+ * number of samples in both slices.
+ */
+uint32_t
+suns_ring_range(suns_ring_t *ring, uint64_t start, uint64_t end, suns_ring_slice_t slices[2])
+{
+    suns_ring_sample_t *first;
+    uint32_t from;
+    uint32_t to;
+    uint32_t count;
+    uint32_t tail;
+
+    memset(slices, 0, 2 * sizeof(suns_ring_slice_t));
+    if (start > end) {
+        return 0;
+    }
+
+    from = suns_ring_search(ring, start);
+    to = (end == UINT64_MAX) ? ring->count : suns_ring_search(ring, end + 1);
+    if (from >= to) {
+        return 0;
+    }
+    count = to - from;
+
+    first = suns_ring_sample(ring, from);
+    tail = ring->capacity - (uint32_t) (first - ring->samples);
+    slices[0].samples = first;
+    if (count <= tail) {
+        slices[0].count = count;
+    } else {
+        slices[0].count = tail;
+        slices[1].samples = ring->samples;
+        slices[1].count = count - tail;
+    }
+
+    return count;
+}
+
+/* limit the memory used by rings of device, 0 for no limit */
+suns_err_t
+suns_device_ring_budget(suns_device_t *device, uint32_t budget)
+{
+    if (budget && device->ring_bytes > budget) {
+        return SUNS_ERR_BUDGET;
+    }
+    device->ring_budget = budget;
+
+    return SUNS_ERR_OK;
+}
@@ -0,0 +1,314 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec.h"
+#include "sunspec_device.h"
+#include "sunspec_error.h"
+#include "sunspec_rollup.h"
+
+/* set the window length and result callback for model, points are added with suns_rollup_point() */
+suns_err_t
+suns_rollup_model(suns_model_t *model, uint32_t window, suns_rollup_func_t func, void *arg)
+{
+    suns_rollup_set_t *set = model->rollups;
+
+    if (window == 0) {
+        return SUNS_ERR_RANGE;
+    }
+    if (set == NULL) {
+        if ((set = calloc(1, sizeof(suns_rollup_set_t))) == NULL) {
+            return SUNS_ERR_ALLOC;
+        }
+        model->rollups = set;
+    } else if (set->window != window) {
+        /* don't mix window lengths in one result */
+        suns_rollup_flush(model);
+    }
+    set->window = window;
+    set->func = func;
+    set->arg = arg;
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_rollup_point(suns_model_t *model, char *id, uint16_t index, void *arg, suns_rollup_t **rollup_ptr)
+{
+    suns_rollup_set_t *set = model->rollups;
+    suns_rollup_result_t *results;
+    suns_rollup_t *rollup;
+    suns_point_t *point;
+    int16_t type;
+
+    if (set == NULL) {
+        return SUNS_ERR_INIT;
+    }
+    if ((point = suns_model_get_point(model, id, index)) == NULL) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+    if (point->point_def->type->to_float == NULL) {
+        return SUNS_ERR_TYPE;
+    }
+
+    if ((results = realloc(set->results, (set->count + 1) * sizeof(suns_rollup_result_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    set->results = results;
+    if ((rollup = calloc(1, sizeof(suns_rollup_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    type = point->point_def->type->type;
+    rollup->point = point;
+    rollup->arg = arg;
+    rollup->acc = (type == SUNS_TYPE_ACC16 || type == SUNS_TYPE_ACC32 || type == SUNS_TYPE_ACC64);
+    rollup->next = set->rollups;
+    set->rollups = rollup;
+    set->count++;
+
+    if (rollup_ptr) {
+        *rollup_ptr = rollup;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_rollup_remove(suns_model_t *model, suns_rollup_t *rollup)
+{
+    suns_rollup_t **rollup_list;
+
+    if (model->rollups == NULL) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+    for (rollup_list = &model->rollups->rollups; *rollup_list; rollup_list = &(*rollup_list)->next) {
+        if (*rollup_list == rollup) {
+            *rollup_list = rollup->next;
+            model->rollups->count--;
+            free(rollup);
+            return SUNS_ERR_OK;
+        }
+    }
+
+    return SUNS_ERR_NOT_FOUND;
+}
+
+void
+suns_rollup_free(suns_model_t *model)
+{
+    suns_rollup_set_t *set = model->rollups;
+    suns_rollup_t *rollup;
+
+    if (set) {
+        while ((rollup = set->rollups) != NULL) {
+            set->rollups = rollup->next;
+            free(rollup);
+        }
+        free(set->results);
+        free(set);
+        model->rollups = NULL;
+    }
+}
+
+/* accumulator reading of point as an unsigned integer */
+uint64_t
+suns_rollup_acc_raw(suns_point_t *point)
+{
+    switch (point->point_def->type->base_type) {
+    case SUNS_TYPE_UINT16:
+        return point->value_base.u16;
+    case SUNS_TYPE_UINT32:
+        return point->value_base.u32;
+    default:
+        return point->value_base.u64;
+    }
+}
+
+/*
+ * Increase of an accumulator from prev to raw. A reading below prev is a
+ * rollover if unwrapping it gives less than half the range, otherwise the
+ * device was reset and counted up from zero.
+ */
+uint64_t
+suns_rollup_acc_delta(suns_rollup_t *rollup, uint64_t raw)
+{
+    uint64_t mask;
+    uint64_t delta;
+
+    switch (rollup->point->point_def->type->base_type) {
+    case SUNS_TYPE_UINT16:
+        mask = 0xFFFF;
+        break;
+    case SUNS_TYPE_UINT32:
+        mask = 0xFFFFFFFF;
+        break;
+    default:
+        mask = 0xFFFFFFFFFFFFFFFFULL;
+        break;
+    }
+
+    delta = (raw - rollup->prev) & mask;
+    if (raw < rollup->prev) {
+        if (delta <= mask / 2) {
+            rollup->rollovers++;
+        } else {
+            rollup->resets++;
+            delta = raw;
+        }
+    }
+
+    return delta;
+}
+
+void
+suns_rollup_sample(suns_rollup_t *rollup)
+{
+    suns_point_t *point = rollup->point;
+    suns_data_t *type = point->point_def->type;
+    suns_value_t value;
+    uint64_t raw;
+    int16_t sf = 0;
+    float f;
+
+    if (type->is_implemented && !type->is_implemented(point->value_base)) {
+        return;
+    }
+    if (point->sf_point && point->sf_point->point_def->type->is_implemented(point->sf_point->value_base)) {
+        sf = point->sf_point->value_base.s16;
+    }
+
+    type->to_float(point->value_base, sf, &rollup->last);
+    if (rollup->acc) {
+        raw = suns_rollup_acc_raw(point);
+        if (!rollup->prev_valid) {
+            /* first reading only sets the base */
+            rollup->prev = raw;
+            rollup->prev_valid = 1;
+            return;
+        }
+        value.u64 = suns_rollup_acc_delta(rollup, raw);
+        rollup->prev = raw;
+        if (type->base_type == SUNS_TYPE_UINT16) {
+            value.u16 = (uint16_t) value.u64;
+        } else if (type->base_type == SUNS_TYPE_UINT32) {
+            value.u32 = (uint32_t) value.u64;
+        }
+        type->to_float(value, sf, &f);
+        rollup->delta += f;
+    } else {
+        f = rollup->last;
+    }
+
+    if (rollup->count == 0 || f < rollup->min) {
+        rollup->min = f;
+    }
+    if (rollup->count == 0 || f > rollup->max) {
+        rollup->max = f;
+    }
+    rollup->sum += f;
+    rollup->count++;
+}
+
+/* report the current window and start a new one */
+void
+suns_rollup_flush(suns_model_t *model)
+{
+    suns_rollup_set_t *set = model->rollups;
+    suns_rollup_result_t *result;
+    suns_rollup_t *rollup;
+    uint16_t count = 0;
+
+    if (set == NULL || !set->started) {
+        return;
+    }
+
+    for (rollup = set->rollups; rollup; rollup = rollup->next) {
+        if (rollup->count) {
+            result = &set->results[count++];
+            result->rollup = rollup;
+            result->point = rollup->point;
+            result->arg = rollup->arg;
+            result->start = set->start;
+            result->count = rollup->count;
+            result->min = rollup->min;
+            result->max = rollup->max;
+            result->avg = (float) (rollup->sum / rollup->count);
+            result->last = rollup->last;
+            result->delta = (float) rollup->delta;
+            result->rollovers = rollup->rollovers;
+            result->resets = rollup->resets;
+        }
+        rollup->count = 0;
+        rollup->sum = 0;
+        rollup->delta = 0;
+        rollup->rollovers = 0;
+        rollup->resets = 0;
+    }
+    set->started = 0;
+
+    if (count && set->func) {
+        set->func(model, set->results, count, set->arg);
+    }
+}
+
+/*
+ * Called by suns_model_update() after the points are decoded, time is
+ * wall clock ms since the epoch. Callers with their own sample timestamps
+ * can call it directly. The first update in a different window, including
+ * one reached by a clock step backwards, reports the current window before
+ * adding its samples to the next one.
+ */
+void
+suns_rollup_update(suns_model_t *model, uint64_t time)
+{
+    suns_rollup_update_points(model, time, NULL, 0);
+}
+
+/* as suns_rollup_update() but only points is sampled, all of them if NULL */
+void
+suns_rollup_update_points(suns_model_t *model, uint64_t time, suns_point_t **points, uint16_t count)
+{
+    suns_rollup_set_t *set = model->rollups;
+    suns_rollup_t *rollup;
+    uint64_t start;
+
+    if (set == NULL) {
+        return;
+    }
+
+    start = time - (time % set->window);
+    if (set->started && start != set->start) {
+        suns_rollup_flush(model);
+    }
+    set->start = start;
+    set->started = 1;
+
+    for (rollup = set->rollups; rollup; rollup = rollup->next) {
+        if (points == NULL || suns_point_in(rollup->point, points, count)) {
+            suns_rollup_sample(rollup);
+        }
+    }
+}
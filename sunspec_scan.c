@@ -0,0 +1,248 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec_error.h"
+#include "sunspec.h"
+#include "sunspec_scan.h"
+#include "sunspec_time.h"
+
+#define SUNS_SCAN_NONE                  0xffffffff
+
+/* targets waiting on one bus, linked through suns_scan_t.next */
+typedef struct _suns_scan_bus_t {
+    uint32_t bus;
+    uint16_t max;
+    uint16_t in_flight;
+    uint32_t head;
+    uint32_t tail;
+} suns_scan_bus_t;
+
+typedef struct _suns_scan_t {
+    suns_scan_target_t *targets;
+    uint32_t count;
+    suns_scan_bus_t *buses;
+    uint32_t bus_count;
+    uint32_t bus_next;                  /* round robin start for the next pick */
+    uint32_t *next;
+    uint32_t pending;
+    pthread_mutex_t lock;               /* protects the bus queues */
+    pthread_cond_t ready;               /* signaled when a bus slot is released */
+    pthread_mutex_t func_lock;          /* serializes result callbacks */
+    suns_scan_op_t op;
+    void *op_arg;
+    suns_scan_func_t func;
+    void *arg;
+} suns_scan_t;
+
+/*
+ * Take the next target from a bus with a free slot, waiting for a running
+ * scan to complete if all buses with pending targets are busy. Returns
+ * SUNS_SCAN_NONE when nothing is left to scan. Called with the lock held.
+ */
+uint32_t
+suns_scan_take(suns_scan_t *scan, suns_scan_bus_t **bus_ptr)
+{
+    suns_scan_bus_t *bus;
+    uint32_t index;
+    uint32_t i;
+
+    while (scan->pending) {
+        for (i = 0; i < scan->bus_count; i++) {
+            bus = &scan->buses[(scan->bus_next + i) % scan->bus_count];
+            if (bus->head != SUNS_SCAN_NONE && (bus->max == 0 || bus->in_flight < bus->max)) {
+                index = bus->head;
+                if ((bus->head = scan->next[index]) == SUNS_SCAN_NONE) {
+                    bus->tail = SUNS_SCAN_NONE;
+                }
+                bus->in_flight++;
+                scan->pending--;
+                scan->bus_next = (scan->bus_next + i + 1) % scan->bus_count;
+                *bus_ptr = bus;
+                return index;
+            }
+        }
+        pthread_cond_wait(&scan->ready, &scan->lock);
+    }
+
+    return SUNS_SCAN_NONE;
+}
+
+void *
+suns_scan_worker(void *arg)
+{
+    suns_scan_t *scan = (suns_scan_t *) arg;
+    suns_scan_bus_t *bus;
+    suns_scan_result_t result;
+    uint32_t index;
+
+    pthread_mutex_lock(&scan->lock);
+    while ((index = suns_scan_take(scan, &bus)) != SUNS_SCAN_NONE) {
+        pthread_mutex_unlock(&scan->lock);
+
+        result.index = index;
+        result.device = scan->targets[index].device;
+        result.start = suns_time_us();
+        result.err = scan->op(index, result.device, scan->op_arg);
+        result.duration = suns_time_us() - result.start;
+
+        pthread_mutex_lock(&scan->lock);
+        bus->in_flight--;
+        pthread_cond_broadcast(&scan->ready);
+        pthread_mutex_unlock(&scan->lock);
+
+        if (scan->func) {
+            pthread_mutex_lock(&scan->func_lock);
+            scan->func(&result, scan->arg);
+            pthread_mutex_unlock(&scan->func_lock);
+        }
+
+        pthread_mutex_lock(&scan->lock);
+    }
+    /* wake workers still waiting on a bus that has drained */
+    pthread_cond_broadcast(&scan->ready);
+    pthread_mutex_unlock(&scan->lock);
+
+    return NULL;
+}
+
+/*
+ * Run op on each target concurrently on a pool of worker threads. Targets
+ * are queued per bus so an exclusive RS-485 bus only has one operation in
+ * flight while targets on shared TCP hosts run in parallel. Each result is
+ * passed to func as the target completes. Returns once all targets have
+ * completed; per-target errors are only reported through func.
+ */
+suns_err_t
+suns_scan_run(suns_scan_target_t *targets, uint32_t count, uint16_t threads,
+              suns_scan_op_t op, void *op_arg, suns_scan_func_t func, void *arg)
+{
+    suns_scan_t scan;
+    suns_scan_bus_t *bus;
+    pthread_t *workers;
+    suns_err_t err = SUNS_ERR_OK;
+    uint16_t started;
+    uint32_t i;
+    uint32_t j;
+    int rc = 0;
+
+    if (targets == NULL || count == 0) {
+        return SUNS_ERR_OK;
+    }
+
+    if (threads == 0) {
+        threads = SUNS_SCAN_THREADS;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    scan.targets = targets;
+    scan.count = count;
+    scan.pending = count;
+    scan.op = op;
+    scan.op_arg = op_arg;
+    scan.func = func;
+    scan.arg = arg;
+    scan.buses = (suns_scan_bus_t *) calloc(count, sizeof(suns_scan_bus_t));
+    scan.next = (uint32_t *) malloc(count * sizeof(uint32_t));
+    workers = (pthread_t *) malloc(threads * sizeof(pthread_t));
+    if (scan.buses == NULL || scan.next == NULL || workers == NULL) {
+        err = SUNS_ERR_ALLOC;
+        goto suns_scan_many_exit;
+    }
+
+    /* queue targets on their bus in list order */
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < scan.bus_count; j++) {
+            if (scan.buses[j].bus == targets[i].bus) {
+                break;
+            }
+        }
+        bus = &scan.buses[j];
+        if (j == scan.bus_count) {
+            bus->bus = targets[i].bus;
+            bus->max = targets[i].bus_max;
+            bus->head = i;
+            scan.bus_count++;
+        } else {
+            scan.next[bus->tail] = i;
+        }
+        bus->tail = i;
+        scan.next[i] = SUNS_SCAN_NONE;
+    }
+
+    pthread_mutex_init(&scan.lock, NULL);
+    pthread_cond_init(&scan.ready, NULL);
+    pthread_mutex_init(&scan.func_lock, NULL);
+
+    for (started = 0; started < threads; started++) {
+        if ((rc = pthread_create(&workers[started], NULL, suns_scan_worker, &scan)) != 0) {
+            break;
+        }
+    }
+
+    if (started == 0) {
+        err = SUNS_ERR_ERRNO_BASE + rc;
+    } else {
+        for (i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+
+    pthread_mutex_destroy(&scan.func_lock);
+    pthread_cond_destroy(&scan.ready);
+    pthread_mutex_destroy(&scan.lock);
+
+suns_scan_many_exit:
+
+    free(workers);
+    free(scan.next);
+    free(scan.buses);
+
+    return err;
+}
+
+suns_err_t
+suns_scan_device(uint32_t index, suns_device_t *device, void *arg)
+{
+    return suns_device_scan(device);
+}
+
+/*
+ * Scan a list of devices, see suns_scan_run(). Concurrent scans add models
+ * through the shared definition registry, which relies on
+ * suns_model_def_get() serializing lazy loads under suns_model_def_lock.
+ */
+suns_err_t
+suns_scan_many(suns_scan_target_t *targets, uint32_t count, uint16_t threads,
+               suns_scan_func_t func, void *arg)
+{
+    return suns_scan_run(targets, count, threads, suns_scan_device, NULL, func, arg);
+}
@@ -0,0 +1,408 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sunspec.h"
+#include "sunspec_error.h"
+#include "sunspec_device.h"
+#include "sunspec_sched.h"
+#include "sunspec_time.h"
+
+#define SUNS_SCHED_HEAP_SIZE            16      /* initial heap allocation */
+
+void
+suns_sched_init(suns_sched_t *sched)
+{
+    memset(sched, 0, sizeof(*sched));
+    sched->state = SUNS_SCHED_SEED;
+}
+
+void
+suns_sched_free(suns_sched_t *sched)
+{
+    uint32_t i;
+
+    for (i = 0; i < sched->count; i++) {
+        free(sched->heap[i]);
+    }
+    free(sched->heap);
+    suns_sched_init(sched);
+}
+
+/* xorshift64* */
+uint64_t
+suns_sched_rand(suns_sched_t *sched)
+{
+    sched->state ^= sched->state >> 12;
+    sched->state ^= sched->state << 25;
+    sched->state ^= sched->state >> 27;
+
+    return sched->state * 0x2545f4914f6cdd1dULL;
+}
+
+void
+suns_sched_swap(suns_sched_t *sched, uint32_t a, uint32_t b)
+{
+    suns_sched_job_t *job = sched->heap[a];
+
+    sched->heap[a] = sched->heap[b];
+    sched->heap[b] = job;
+    sched->heap[a]->heap_index = a;
+    sched->heap[b]->heap_index = b;
+}
+
+void
+suns_sched_sift_up(suns_sched_t *sched, uint32_t i)
+{
+    while (i > 0 && sched->heap[i]->due < sched->heap[(i - 1) / 2]->due) {
+        suns_sched_swap(sched, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+void
+suns_sched_sift_down(suns_sched_t *sched, uint32_t i)
+{
+    uint32_t min;
+    uint32_t child;
+
+    for (;;) {
+        min = i;
+        child = 2 * i + 1;
+        if (child < sched->count && sched->heap[child]->due < sched->heap[min]->due) {
+            min = child;
+        }
+        child++;
+        if (child < sched->count && sched->heap[child]->due < sched->heap[min]->due) {
+            min = child;
+        }
+        if (min == i) {
+            break;
+        }
+        suns_sched_swap(sched, i, min);
+        i = min;
+    }
+}
+
+/*
+ * Add a job reading model every interval ms. The first deadline falls at
+ * a random point within the first interval so jobs added together don't
+ * all fire at once.
+ */
+suns_err_t
+suns_sched_add(suns_sched_t *sched, suns_model_t *model, uint32_t interval, uint32_t jitter,
+               suns_sched_func_t func, void *arg, uint64_t now, suns_sched_job_t **job_ptr)
+{
+    suns_sched_job_t *job;
+    suns_sched_job_t **heap;
+    uint32_t size;
+
+    if (sched == NULL || model == NULL || model->device == NULL || interval == 0) {
+        return SUNS_ERR_INIT;
+    }
+
+    if (sched->count == sched->size) {
+        size = sched->size ? sched->size * 2 : SUNS_SCHED_HEAP_SIZE;
+        if ((heap = realloc(sched->heap, size * sizeof(suns_sched_job_t *))) == NULL) {
+            return SUNS_ERR_ALLOC;
+        }
+        sched->heap = heap;
+        sched->size = size;
+    }
+
+    if ((job = calloc(1, sizeof(suns_sched_job_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    job->model = model;
+    job->interval = interval;
+    job->jitter = jitter;
+    job->func = func;
+    job->arg = arg;
+    job->base = now + suns_sched_rand(sched) % interval;
+    job->due = job->base;
+
+    job->heap_index = sched->count;
+    sched->heap[sched->count++] = job;
+    suns_sched_sift_up(sched, job->heap_index);
+
+    if (job_ptr) {
+        *job_ptr = job;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+/* insert the register range of point into the sorted read plan, merging close runs */
+void
+suns_sched_plan_add(suns_sched_job_t *job, suns_point_t *point)
+{
+    uint16_t addr = point->addr;
+    uint16_t end = point->addr + point->point_def->len;
+    uint16_t i;
+    uint16_t j;
+
+    for (i = 0; i < job->run_count; i++) {
+        if (addr <= job->runs[i].addr + job->runs[i].len + SUNS_SCHED_GAP &&
+            end + SUNS_SCHED_GAP >= job->runs[i].addr) {
+            /* overlaps or is within the gap of run i */
+            if (addr < job->runs[i].addr) {
+                job->runs[i].len += job->runs[i].addr - addr;
+                job->runs[i].addr = addr;
+            }
+            if (end > job->runs[i].addr + job->runs[i].len) {
+                job->runs[i].len = end - job->runs[i].addr;
+            }
+            /* absorb any following runs now within the gap */
+            while (i + 1 < job->run_count &&
+                   job->runs[i + 1].addr <= job->runs[i].addr + job->runs[i].len + SUNS_SCHED_GAP) {
+                end = job->runs[i + 1].addr + job->runs[i + 1].len;
+                if (end > job->runs[i].addr + job->runs[i].len) {
+                    job->runs[i].len = end - job->runs[i].addr;
+                }
+                for (j = i + 1; j + 1 < job->run_count; j++) {
+                    job->runs[j] = job->runs[j + 1];
+                }
+                job->run_count--;
+            }
+            return;
+        }
+        if (end < job->runs[i].addr) {
+            break;
+        }
+    }
+    for (j = job->run_count; j > i; j--) {
+        job->runs[j] = job->runs[j - 1];
+    }
+    job->runs[i].addr = addr;
+    job->runs[i].len = end - addr;
+    job->run_count++;
+}
+
+int
+suns_sched_point_has(suns_sched_job_t *job, suns_point_t *point)
+{
+    uint16_t i;
+
+    for (i = 0; i < job->point_count; i++) {
+        if (job->points[i] == point) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Restrict a job to a point set. The point's scale factor is read along
+ * with it so the value and its scale always come from the same read.
+ */
+suns_err_t
+suns_sched_job_point(suns_sched_job_t *job, char *id, uint16_t index)
+{
+    suns_point_t *point;
+    suns_point_t *sf_point;
+
+    if (job == NULL || (point = suns_model_get_point(job->model, id, index)) == NULL) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+    sf_point = point->sf_point;
+
+    if (job->point_count + (sf_point && !suns_sched_point_has(job, sf_point) ? 2 : 1) > SUNS_SCHED_POINTS_MAX) {
+        return SUNS_ERR_RANGE;
+    }
+    if (!suns_sched_point_has(job, point)) {
+        job->points[job->point_count++] = point;
+        suns_sched_plan_add(job, point);
+    }
+    if (sf_point && !suns_sched_point_has(job, sf_point)) {
+        job->points[job->point_count++] = sf_point;
+        suns_sched_plan_add(job, sf_point);
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_sched_remove(suns_sched_t *sched, suns_sched_job_t *job)
+{
+    uint32_t i;
+
+    if (sched == NULL || job == NULL || job->heap_index >= sched->count || sched->heap[job->heap_index] != job ||
+        job->removed) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+
+    /* suns_sched_run() still uses the job, it is dropped once the callback returns */
+    if (job == sched->running) {
+        job->removed = 1;
+        return SUNS_ERR_OK;
+    }
+
+    i = job->heap_index;
+    sched->count--;
+    if (i != sched->count) {
+        sched->heap[i] = sched->heap[sched->count];
+        sched->heap[i]->heap_index = i;
+        suns_sched_sift_down(sched, i);
+        suns_sched_sift_up(sched, i);
+    }
+    free(job);
+
+    return SUNS_ERR_OK;
+}
+
+/* ms until the next deadline, 0 if one is due, -1 if there are no jobs */
+int64_t
+suns_sched_next(suns_sched_t *sched, uint64_t now)
+{
+    if (sched->count == 0) {
+        return -1;
+    }
+    if (sched->heap[0]->due <= now) {
+        return 0;
+    }
+    return (int64_t) (sched->heap[0]->due - now);
+}
+
+suns_err_t
+suns_sched_read(suns_sched_job_t *job)
+{
+    suns_err_t err = SUNS_ERR_OK;
+    unsigned char buf[SUNS_MODEL_BUF_SIZE];
+    suns_sched_run_t *run;
+    suns_point_t *point;
+    uint16_t i;
+    uint16_t j;
+
+    if (job->point_count == 0) {
+        return suns_model_read(job->model);
+    }
+
+    for (i = 0; i < job->run_count && err == SUNS_ERR_OK; i++) {
+        run = &job->runs[i];
+        if (run->len * 2 > SUNS_MODEL_BUF_SIZE) {
+            return SUNS_ERR_BUF_SIZE;
+        }
+        if ((err = suns_device_modbus_read(job->model->device, run->addr, run->len, buf, 0)) != SUNS_ERR_OK) {
+            break;
+        }
+        for (j = 0; j < job->point_count; j++) {
+            point = job->points[j];
+            if (point->addr >= run->addr && point->addr < run->addr + run->len &&
+                point->point_def->type->modbus_to_value) {
+                point->point_def->type->modbus_to_value(buf + ((point->addr - run->addr) * 2),
+                                                        &point->value_base, point->point_def->len);
+                point->dirty = 0;
+                /*
+                 * only publish what was decoded, suns_model_update() skips
+                 * blocks that match the snapshot so registers of other
+                 * points in the run must keep their previous image
+                 */
+                suns_model_publish(job->model, point->addr - job->model->addr,
+                                   buf + ((point->addr - run->addr) * 2), point->point_def->len);
+            }
+        }
+    }
+
+    if (err == SUNS_ERR_OK) {
+        suns_model_points_update(job->model, job->points, job->point_count);
+    }
+
+    return err;
+}
+
+/*
+ * Dispatch every job that is due at now, in deadline order. A job that
+ * ran more than an interval late skips the deadlines it missed instead
+ * of reading several times in a row to catch up.
+ */
+uint32_t
+suns_sched_run(suns_sched_t *sched, uint64_t now)
+{
+    suns_sched_job_t *job;
+    uint64_t late;
+    uint32_t missed;
+    uint32_t count = 0;
+
+    while (sched->count > 0 && sched->heap[0]->due <= now) {
+        job = sched->heap[0];
+        late = now - job->due;
+        if (late > job->late_max) {
+            job->late_max = (uint32_t) late;
+        }
+
+        job->err = suns_sched_read(job);
+        job->reads++;
+        sched->reads++;
+        if (job->err != SUNS_ERR_OK) {
+            job->errors++;
+        }
+        if (job->func) {
+            sched->running = job;
+            job->func(job, job->arg);
+            sched->running = NULL;
+        }
+        count++;
+        if (job->removed) {
+            job->removed = 0;
+            suns_sched_remove(sched, job);
+            continue;
+        }
+
+        /* next deadline after now */
+        job->base += job->interval;
+        if (job->base <= now) {
+            missed = (uint32_t) ((now - job->base) / job->interval) + 1;
+            job->base += (uint64_t) missed * job->interval;
+            job->missed += missed;
+            sched->missed += missed;
+        }
+        job->due = job->base;
+        if (job->jitter) {
+            job->due += suns_sched_rand(sched) % (job->jitter + 1);
+        }
+        /* the callback may have added or removed jobs, so the job is not always the root */
+        suns_sched_sift_down(sched, job->heap_index);
+    }
+
+    return count;
+}
+
+/* sleep until the next deadline, at most timeout ms, then run due jobs */
+uint32_t
+suns_sched_poll(suns_sched_t *sched, uint32_t timeout)
+{
+    int64_t wait = suns_sched_next(sched, suns_time_ms());
+
+    if (wait < 0 || wait > timeout) {
+        wait = timeout;
+    }
+    if (wait > 0) {
+        usleep((useconds_t) wait * 1000);
+    }
+
+    return suns_sched_run(sched, suns_time_ms());
+}
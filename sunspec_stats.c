@@ -0,0 +1,197 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec_error.h"
+#include "sunspec_stats.h"
+
+#define SUNS_STATS_ADD(field, n)        __atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+#define SUNS_STATS_LOAD(field)          __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define SUNS_STATS_CLEAR(field)         __atomic_store_n(&(field), 0, __ATOMIC_RELAXED)
+
+uint16_t
+suns_stats_hist_index(uint32_t latency)
+{
+    uint16_t msb;
+
+    if (latency < SUNS_STATS_HIST_SUB) {
+        return latency;
+    }
+
+    msb = 31 - __builtin_clz(latency);
+
+    return SUNS_STATS_HIST_SUB + ((msb - SUNS_STATS_HIST_SUB_BITS) * SUNS_STATS_HIST_SUB) +
+           ((latency >> (msb - SUNS_STATS_HIST_SUB_BITS)) & (SUNS_STATS_HIST_SUB - 1));
+}
+
+/* midpoint of the latency range covered by a bucket */
+uint32_t
+suns_stats_hist_value(uint16_t index)
+{
+    uint16_t shift;
+    uint32_t lower;
+
+    if (index < SUNS_STATS_HIST_SUB) {
+        return index;
+    }
+
+    shift = (index - SUNS_STATS_HIST_SUB) / SUNS_STATS_HIST_SUB;
+    lower = (uint32_t) (SUNS_STATS_HIST_SUB + ((index - SUNS_STATS_HIST_SUB) % SUNS_STATS_HIST_SUB)) << shift;
+
+    return lower + ((1U << shift) >> 1);
+}
+
+void
+suns_stats_record(suns_stats_t *stats, uint8_t op, uint16_t count, uint32_t bytes,
+                  suns_err_t err, uint32_t latency)
+{
+    uint32_t max;
+
+    SUNS_STATS_ADD(stats->requests, 1);
+    if (op == SUNS_STATS_WRITE) {
+        SUNS_STATS_ADD(stats->writes, 1);
+    } else {
+        SUNS_STATS_ADD(stats->reads, 1);
+    }
+    SUNS_STATS_ADD(stats->bytes, bytes);
+
+    switch (err) {
+        case SUNS_ERR_OK:
+            SUNS_STATS_ADD(stats->registers, count);
+            break;
+        case SUNS_ERR_TIMEOUT:
+            SUNS_STATS_ADD(stats->timeouts, 1);
+            break;
+        case SUNS_ERR_MODBUS_CRC:
+            SUNS_STATS_ADD(stats->crc_errors, 1);
+            break;
+        case SUNS_ERR_MODBUS_EXCEPT:
+        case SUNS_ERR_MODBUS_EXCEPT_VALUE:
+            SUNS_STATS_ADD(stats->exceptions, 1);
+            break;
+        default:
+            SUNS_STATS_ADD(stats->errors, 1);
+            break;
+    }
+
+    SUNS_STATS_ADD(stats->latency_total, latency);
+    SUNS_STATS_ADD(stats->hist[suns_stats_hist_index(latency)], 1);
+
+    max = SUNS_STATS_LOAD(stats->latency_max);
+    while ((latency > max) &&
+           !__atomic_compare_exchange_n(&stats->latency_max, &max, latency, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        ;
+    }
+}
+
+void
+suns_stats_retry(suns_stats_t *stats)
+{
+    SUNS_STATS_ADD(stats->retries, 1);
+}
+
+void
+suns_stats_broadcast(suns_stats_t *stats)
+{
+    SUNS_STATS_ADD(stats->broadcasts, 1);
+}
+
+/* fields are read individually, a snapshot taken under load may be off by in-flight requests */
+void
+suns_stats_snapshot(const suns_stats_t *stats, suns_stats_t *snapshot)
+{
+    uint16_t i;
+
+    snapshot->requests = SUNS_STATS_LOAD(stats->requests);
+    snapshot->reads = SUNS_STATS_LOAD(stats->reads);
+    snapshot->writes = SUNS_STATS_LOAD(stats->writes);
+    snapshot->registers = SUNS_STATS_LOAD(stats->registers);
+    snapshot->bytes = SUNS_STATS_LOAD(stats->bytes);
+    snapshot->retries = SUNS_STATS_LOAD(stats->retries);
+    snapshot->broadcasts = SUNS_STATS_LOAD(stats->broadcasts);
+    snapshot->timeouts = SUNS_STATS_LOAD(stats->timeouts);
+    snapshot->crc_errors = SUNS_STATS_LOAD(stats->crc_errors);
+    snapshot->exceptions = SUNS_STATS_LOAD(stats->exceptions);
+    snapshot->errors = SUNS_STATS_LOAD(stats->errors);
+    snapshot->latency_total = SUNS_STATS_LOAD(stats->latency_total);
+    snapshot->latency_max = SUNS_STATS_LOAD(stats->latency_max);
+    for (i = 0; i < SUNS_STATS_HIST_BUCKETS; i++) {
+        snapshot->hist[i] = SUNS_STATS_LOAD(stats->hist[i]);
+    }
+}
+
+void
+suns_stats_reset(suns_stats_t *stats)
+{
+    uint16_t i;
+
+    SUNS_STATS_CLEAR(stats->requests);
+    SUNS_STATS_CLEAR(stats->reads);
+    SUNS_STATS_CLEAR(stats->writes);
+    SUNS_STATS_CLEAR(stats->registers);
+    SUNS_STATS_CLEAR(stats->bytes);
+    SUNS_STATS_CLEAR(stats->retries);
+    SUNS_STATS_CLEAR(stats->broadcasts);
+    SUNS_STATS_CLEAR(stats->timeouts);
+    SUNS_STATS_CLEAR(stats->crc_errors);
+    SUNS_STATS_CLEAR(stats->exceptions);
+    SUNS_STATS_CLEAR(stats->errors);
+    SUNS_STATS_CLEAR(stats->latency_total);
+    SUNS_STATS_CLEAR(stats->latency_max);
+    for (i = 0; i < SUNS_STATS_HIST_BUCKETS; i++) {
+        SUNS_STATS_CLEAR(stats->hist[i]);
+    }
+}
+
+/* latency in us at or below which percentile (0 to 100) of the requests completed */
+uint32_t
+suns_stats_percentile(const suns_stats_t *snapshot, double percentile)
+{
+    uint64_t total = 0;
+    uint64_t target;
+    uint64_t count = 0;
+    uint16_t i;
+
+    for (i = 0; i < SUNS_STATS_HIST_BUCKETS; i++) {
+        total += snapshot->hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    target = (uint64_t) ((percentile / 100.0) * total + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+
+    for (i = 0; i < SUNS_STATS_HIST_BUCKETS; i++) {
+        count += snapshot->hist[i];
+        if (count >= target) {
+            return suns_stats_hist_value(i);
+        }
+    }
+
+    return snapshot->latency_max;
+}
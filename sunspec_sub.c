@@ -0,0 +1,314 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec.h"
+#include "sunspec_device.h"
+#include "sunspec_error.h"
+#include "sunspec_sub.h"
+
+/* set the change callback for model, subscriptions are added with suns_sub_point() */
+suns_err_t
+suns_sub_model(suns_model_t *model, suns_sub_func_t func, void *arg)
+{
+    suns_sub_set_t *set = model->subs;
+
+    if (set == NULL) {
+        if ((set = calloc(1, sizeof(suns_sub_set_t))) == NULL) {
+            return SUNS_ERR_ALLOC;
+        }
+        set->image = calloc(model->len, 2);
+        set->block_changed = calloc(model->block_count, sizeof(uint8_t));
+        if (set->image == NULL || set->block_changed == NULL) {
+            free(set->image);
+            free(set->block_changed);
+            free(set);
+            return SUNS_ERR_ALLOC;
+        }
+        model->subs = set;
+    }
+    set->func = func;
+    set->arg = arg;
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_sub_point(suns_model_t *model, char *id, uint16_t index, uint8_t mode, float deadband,
+               void *arg, suns_sub_t **sub_ptr)
+{
+    suns_sub_set_t *set = model->subs;
+    suns_sub_change_t *changes;
+    suns_point_t *point;
+    suns_sub_t *sub;
+
+    if (set == NULL) {
+        return SUNS_ERR_INIT;
+    }
+    if (mode > SUNS_SUB_PCT || deadband < 0) {
+        return SUNS_ERR_RANGE;
+    }
+    if ((point = suns_model_get_point(model, id, index)) == NULL) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+    /* deadbands need a numeric value */
+    if (mode != SUNS_SUB_ANY && point->point_def->type->to_float == NULL) {
+        return SUNS_ERR_TYPE;
+    }
+
+    if ((changes = realloc(set->changes, (set->count + 1) * sizeof(suns_sub_change_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    set->changes = changes;
+    if ((sub = calloc(1, sizeof(suns_sub_t))) == NULL) {
+        return SUNS_ERR_ALLOC;
+    }
+    sub->point = point;
+    sub->mode = mode;
+    sub->deadband = deadband;
+    sub->arg = arg;
+    sub->next = set->subs;
+    set->subs = sub;
+    set->count++;
+
+    if (sub_ptr) {
+        *sub_ptr = sub;
+    }
+
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+suns_sub_remove(suns_model_t *model, suns_sub_t *sub)
+{
+    suns_sub_t **sub_list;
+
+    if (model->subs == NULL) {
+        return SUNS_ERR_NOT_FOUND;
+    }
+    for (sub_list = &model->subs->subs; *sub_list; sub_list = &(*sub_list)->next) {
+        if (*sub_list == sub) {
+            *sub_list = sub->next;
+            model->subs->count--;
+            free(sub);
+            return SUNS_ERR_OK;
+        }
+    }
+
+    return SUNS_ERR_NOT_FOUND;
+}
+
+void
+suns_sub_free(suns_model_t *model)
+{
+    suns_sub_set_t *set = model->subs;
+    suns_sub_t *sub;
+
+    if (set) {
+        while ((sub = set->subs) != NULL) {
+            set->subs = sub->next;
+            free(sub);
+        }
+        free(set->image);
+        free(set->block_changed);
+        free(set->changes);
+        free(set);
+        model->subs = NULL;
+    }
+}
+
+/* scaled value of point, 0 if it has none */
+float
+suns_sub_value(suns_point_t *point)
+{
+    suns_data_t *type = point->point_def->type;
+    int16_t sf = 0;
+    float f = 0;
+
+    if (type->to_float) {
+        if (point->sf_point) {
+            sf = point->sf_point->value_base.s16;
+        }
+        type->to_float(point->value_base, sf, &f);
+    }
+
+    return f;
+}
+
+/* whether a change of sub from its last report to value passes the deadband */
+int
+suns_sub_changed(suns_sub_t *sub, unsigned char *prev, unsigned char *regs, uint8_t impl, float value)
+{
+    float delta;
+
+    if (!sub->reported || impl != sub->impl) {
+        return 1;
+    }
+    if (!impl) {
+        return 0;
+    }
+
+    switch (sub->mode) {
+    case SUNS_SUB_ANY:
+        /* scale factor changes alter the value without touching the point */
+        return memcmp(prev, regs, sub->point->point_def->len * 2) != 0 || value != sub->value;
+    case SUNS_SUB_ABS:
+        return fabsf(value - sub->value) > sub->deadband;
+    case SUNS_SUB_PCT:
+        delta = fabsf(value - sub->value);
+        if (sub->value == 0) {
+            return delta > 0;
+        }
+        return delta * 100 > sub->deadband * fabsf(sub->value);
+    }
+
+    return 0;
+}
+
+/*
+ * Called by suns_model_update() after the points are decoded from buf.
+ * A block that matches the previous image can't have crossed a deadband
+ * since the last update, so its subscriptions are skipped; repeating
+ * blocks are still checked when the fixed block, which may hold their
+ * scale factors, changed.
+ */
+void
+suns_sub_update(suns_model_t *model, unsigned char *buf)
+{
+    suns_sub_set_t *set = model->subs;
+    suns_sub_change_t *change;
+    suns_block_t *block;
+    suns_point_t *point;
+    suns_sub_t *sub;
+    uint16_t offset;
+    uint16_t count = 0;
+    uint16_t i;
+    uint8_t impl;
+    float value;
+
+    if (set == NULL) {
+        return;
+    }
+
+    for (i = 0; i < model->block_count; i++) {
+        block = model->blocks[i];
+        offset = (block->addr - model->addr) * 2;
+        set->block_changed[i] = !set->image_valid ||
+                                memcmp(set->image + offset, buf + offset, block->block_def->len * 2) != 0;
+    }
+
+    for (sub = set->subs; sub; sub = sub->next) {
+        point = sub->point;
+        i = point->block->index;
+        if (sub->reported && !set->block_changed[i] && !(i > 0 && set->block_changed[0])) {
+            continue;
+        }
+
+        offset = (point->addr - model->addr) * 2;
+        impl = point->point_def->type->is_implemented(point->value_base) ? 1 : 0;
+        value = suns_sub_value(point);
+        if (!suns_sub_changed(sub, set->image + offset, buf + offset, impl, value)) {
+            continue;
+        }
+
+        change = &set->changes[count++];
+        change->sub = sub;
+        change->point = point;
+        change->first = !sub->reported;
+        change->impl = impl;
+        change->prev = sub->value;
+        change->value = value;
+        sub->reported = 1;
+        sub->impl = impl;
+        sub->value = value;
+    }
+
+    memcpy(set->image, buf, model->len * 2);
+    set->image_valid = 1;
+
+    if (count > 0 && set->func) {
+        set->func(model, set->changes, count, set->arg);
+    }
+}
+
+/*
+ * Check only the subscriptions of points, which were just decoded into a
+ * model image buf whose other registers may be stale. Only the registers
+ * of those points are kept as the previous image, so the next full update
+ * still compares the others with what was last reported.
+ */
+void
+suns_sub_update_points(suns_model_t *model, unsigned char *buf, suns_point_t **points, uint16_t count)
+{
+    suns_sub_set_t *set = model->subs;
+    suns_sub_change_t *change;
+    suns_point_t *point;
+    suns_sub_t *sub;
+    uint16_t offset;
+    uint16_t changes = 0;
+    uint16_t i;
+    uint8_t impl;
+    float value;
+
+    if (set == NULL) {
+        return;
+    }
+
+    for (sub = set->subs; sub; sub = sub->next) {
+        point = sub->point;
+        if (!suns_point_in(point, points, count)) {
+            continue;
+        }
+
+        offset = (point->addr - model->addr) * 2;
+        impl = point->point_def->type->is_implemented(point->value_base) ? 1 : 0;
+        value = suns_sub_value(point);
+        if (!suns_sub_changed(sub, set->image + offset, buf + offset, impl, value)) {
+            continue;
+        }
+
+        change = &set->changes[changes++];
+        change->sub = sub;
+        change->point = point;
+        change->first = !sub->reported;
+        change->impl = impl;
+        change->prev = sub->value;
+        change->value = value;
+        sub->reported = 1;
+        sub->impl = impl;
+        sub->value = value;
+    }
+
+    for (i = 0; i < count; i++) {
+        offset = (points[i]->addr - model->addr) * 2;
+        memcpy(set->image + offset, buf + offset, points[i]->point_def->len * 2);
+    }
+
+    if (changes > 0 && set->func) {
+        set->func(model, set->changes, changes, set->arg);
+    }
+}
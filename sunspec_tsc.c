@@ -0,0 +1,376 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sunspec_device.h"
+#include "sunspec_error.h"
+#include "sunspec_ring.h"
+#include "sunspec_tsc.h"
+
+/* worst case bits of one sample, a new chunk is started when less is left */
+#define SUNS_TSC_SAMPLE_BITS_MAX        160
+
+/* payload bits of the four prefix codes 0, 10, 110, 1110 follow, 1111 is the full value */
+uint8_t suns_tsc_time_bits[] = {7, 9, 12, 64};
+uint8_t suns_tsc_value_bits[] = {7, 14, 32, 64};
+
+suns_err_t
+suns_tsc_init(suns_tsc_t *tsc, int16_t type)
+{
+    /* string values are not numbers */
+    if (type == SUNS_TYPE_STR) {
+        return SUNS_ERR_TYPE;
+    }
+    memset(tsc, 0, sizeof(suns_tsc_t));
+    tsc->type = type;
+
+    return SUNS_ERR_OK;
+}
+
+void
+suns_tsc_free(suns_tsc_t *tsc)
+{
+    suns_tsc_chunk_t *chunk;
+
+    while ((chunk = tsc->chunks) != NULL) {
+        tsc->chunks = chunk->next;
+        free(chunk);
+    }
+    tsc->tail = NULL;
+    tsc->count = 0;
+    tsc->bytes = 0;
+}
+
+/* raw value of a sample as an integer, sign extended for signed types */
+uint64_t
+suns_tsc_raw(int16_t type, suns_value_t value)
+{
+    switch (type) {
+    case SUNS_TYPE_INT16:
+        return (uint64_t) (int64_t) value.s16;
+    case SUNS_TYPE_UINT16:
+        return value.u16;
+    case SUNS_TYPE_INT32:
+        return (uint64_t) (int64_t) value.s32;
+    case SUNS_TYPE_UINT32:
+    case SUNS_TYPE_FLOAT32:
+        return value.u32;
+    default:
+        return value.u64;
+    }
+}
+
+void
+suns_tsc_value(int16_t type, uint64_t raw, suns_value_t *value)
+{
+    value->u64 = 0;
+    switch (type) {
+    case SUNS_TYPE_INT16:
+    case SUNS_TYPE_UINT16:
+        value->u16 = (uint16_t) raw;
+        break;
+    case SUNS_TYPE_INT32:
+    case SUNS_TYPE_UINT32:
+    case SUNS_TYPE_FLOAT32:
+        value->u32 = (uint32_t) raw;
+        break;
+    default:
+        value->u64 = raw;
+        break;
+    }
+}
+
+void
+suns_tsc_put(suns_tsc_chunk_t *chunk, uint64_t value, uint8_t bits)
+{
+    uint32_t avail;
+    uint8_t n;
+
+    while (bits) {
+        avail = 8 - (chunk->bits & 7);
+        n = bits < avail ? bits : avail;
+        chunk->data[chunk->bits >> 3] |= (unsigned char) (((value >> (bits - n)) & ((1u << n) - 1)) << (avail - n));
+        chunk->bits += n;
+        bits -= n;
+    }
+}
+
+uint64_t
+suns_tsc_get(suns_tsc_chunk_t *chunk, uint32_t *pos, uint8_t bits)
+{
+    uint64_t value = 0;
+    uint32_t avail;
+    uint8_t n;
+
+    while (bits) {
+        avail = 8 - (*pos & 7);
+        n = bits < avail ? bits : avail;
+        value = (value << n) | ((chunk->data[*pos >> 3] >> (avail - n)) & ((1u << n) - 1));
+        *pos += n;
+        bits -= n;
+    }
+
+    return value;
+}
+
+uint64_t
+suns_tsc_zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+int64_t
+suns_tsc_unzigzag(uint64_t v)
+{
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/* '0' for zero, otherwise the shortest prefix code whose payload holds v */
+void
+suns_tsc_put_varint(suns_tsc_chunk_t *chunk, int64_t v, uint8_t *widths)
+{
+    uint64_t zz = suns_tsc_zigzag(v);
+    uint8_t i;
+
+    if (zz == 0) {
+        suns_tsc_put(chunk, 0, 1);
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        if (zz < (1ULL << widths[i])) {
+            /* i + 1 ones and a zero */
+            suns_tsc_put(chunk, ((1u << (i + 1)) - 1) << 1, i + 2);
+            suns_tsc_put(chunk, zz, widths[i]);
+            return;
+        }
+    }
+    suns_tsc_put(chunk, 0xf, 4);
+    suns_tsc_put(chunk, zz, widths[3]);
+}
+
+int64_t
+suns_tsc_get_varint(suns_tsc_chunk_t *chunk, uint32_t *pos, uint8_t *widths)
+{
+    uint8_t ones = 0;
+
+    while (ones < 4 && suns_tsc_get(chunk, pos, 1)) {
+        ones++;
+    }
+    if (ones == 0) {
+        return 0;
+    }
+    return suns_tsc_unzigzag(suns_tsc_get(chunk, pos, widths[ones - 1]));
+}
+
+/* Gorilla XOR encoding of float bits, reusing the previous window when it fits */
+void
+suns_tsc_put_xor(suns_tsc_chunk_t *chunk, suns_tsc_state_t *state, uint32_t value)
+{
+    uint32_t x = value ^ (uint32_t) state->value;
+    uint8_t lead;
+    uint8_t trail;
+
+    if (x == 0) {
+        suns_tsc_put(chunk, 0, 1);
+        return;
+    }
+    lead = __builtin_clz(x);
+    trail = __builtin_ctz(x);
+    if (lead >= 16) {
+        lead = 15;      /* 4 bits */
+    }
+    if (state->lead < 32 && lead >= state->lead && trail >= state->trail) {
+        suns_tsc_put(chunk, 2, 2);
+        suns_tsc_put(chunk, x >> state->trail, 32 - state->lead - state->trail);
+        return;
+    }
+    suns_tsc_put(chunk, 3, 2);
+    suns_tsc_put(chunk, lead, 4);
+    suns_tsc_put(chunk, 32 - lead - trail - 1, 5);
+    suns_tsc_put(chunk, x >> trail, 32 - lead - trail);
+    state->lead = lead;
+    state->trail = trail;
+}
+
+uint32_t
+suns_tsc_get_xor(suns_tsc_chunk_t *chunk, uint32_t *pos, suns_tsc_state_t *state)
+{
+    uint8_t len;
+
+    if (suns_tsc_get(chunk, pos, 1) == 0) {
+        return (uint32_t) state->value;
+    }
+    if (suns_tsc_get(chunk, pos, 1)) {
+        state->lead = (uint8_t) suns_tsc_get(chunk, pos, 4);
+        len = (uint8_t) suns_tsc_get(chunk, pos, 5) + 1;
+        state->trail = 32 - state->lead - len;
+    }
+    len = 32 - state->lead - state->trail;
+    return (uint32_t) state->value ^ ((uint32_t) suns_tsc_get(chunk, pos, len) << state->trail);
+}
+
+/* samples must be appended in time order */
+suns_err_t
+suns_tsc_append(suns_tsc_t *tsc, suns_ring_sample_t *sample)
+{
+    suns_tsc_chunk_t *chunk = tsc->tail;
+    suns_tsc_state_t *state = &tsc->state;
+    uint64_t raw = suns_tsc_raw(tsc->type, sample->value);
+    int64_t delta;
+
+    if (chunk && sample->time < state->time) {
+        return SUNS_ERR_RANGE;
+    }
+
+    if (chunk == NULL || chunk->bits + SUNS_TSC_SAMPLE_BITS_MAX > SUNS_TSC_CHUNK_SIZE * 8) {
+        if ((chunk = calloc(1, sizeof(suns_tsc_chunk_t))) == NULL) {
+            return SUNS_ERR_ALLOC;
+        }
+        if (tsc->tail) {
+            tsc->tail->next = chunk;
+        } else {
+            tsc->chunks = chunk;
+        }
+        tsc->tail = chunk;
+        tsc->bytes += sizeof(suns_tsc_chunk_t);
+
+        chunk->first_time = sample->time;
+        suns_tsc_put(chunk, sample->time, 64);
+        suns_tsc_put(chunk, raw, 64);
+        suns_tsc_put(chunk, (uint8_t) sample->sf, 8);
+        state->delta = 0;
+        state->lead = 32;
+        state->trail = 0;
+    } else {
+        delta = (int64_t) (sample->time - state->time);
+        suns_tsc_put_varint(chunk, delta - state->delta, suns_tsc_time_bits);
+        state->delta = delta;
+        if (tsc->type == SUNS_TYPE_FLOAT32) {
+            suns_tsc_put_xor(chunk, state, (uint32_t) raw);
+        } else {
+            suns_tsc_put_varint(chunk, (int64_t) (raw - state->value), suns_tsc_value_bits);
+        }
+        if (sample->sf == state->sf) {
+            suns_tsc_put(chunk, 0, 1);
+        } else {
+            suns_tsc_put(chunk, 0x100 | (uint8_t) sample->sf, 9);
+        }
+    }
+    state->time = sample->time;
+    state->value = raw;
+    state->sf = sample->sf;
+    chunk->last_time = sample->time;
+    chunk->count++;
+    tsc->count++;
+
+    return SUNS_ERR_OK;
+}
+
+/* move the samples of ring newer than the last appended sample */
+suns_err_t
+suns_tsc_append_ring(suns_tsc_t *tsc, suns_ring_t *ring)
+{
+    suns_ring_slice_t slices[2];
+    suns_err_t err;
+    uint64_t start = 0;
+    uint32_t i;
+    uint32_t j;
+
+    if (tsc->tail) {
+        start = tsc->state.time + 1;
+    }
+    suns_ring_range(ring, start, UINT64_MAX, slices);
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < slices[i].count; j++) {
+            if ((err = suns_tsc_append(tsc, &slices[i].samples[j])) != SUNS_ERR_OK) {
+                return err;
+            }
+        }
+    }
+
+    return SUNS_ERR_OK;
+}
+
+/* decode from the first sample at or after start, chunks ending before start are skipped */
+void
+suns_tsc_iter_init(suns_tsc_iter_t *iter, suns_tsc_t *tsc, uint64_t start)
+{
+    memset(iter, 0, sizeof(suns_tsc_iter_t));
+    iter->tsc = tsc;
+    iter->start = start;
+    iter->chunk = tsc->chunks;
+    while (iter->chunk && iter->chunk->last_time < start) {
+        iter->chunk = iter->chunk->next;
+    }
+}
+
+/* returns 1 with the next sample, 0 at the end of the history */
+int
+suns_tsc_next(suns_tsc_iter_t *iter, suns_ring_sample_t *sample)
+{
+    suns_tsc_state_t *state = &iter->state;
+    suns_tsc_chunk_t *chunk;
+    uint64_t raw;
+
+    do {
+        while ((chunk = iter->chunk) != NULL && iter->index >= chunk->count) {
+            iter->chunk = chunk->next;
+            iter->index = 0;
+            iter->pos = 0;
+        }
+        if (chunk == NULL) {
+            return 0;
+        }
+
+        if (iter->index == 0) {
+            state->time = suns_tsc_get(chunk, &iter->pos, 64);
+            state->value = suns_tsc_get(chunk, &iter->pos, 64);
+            state->sf = (int8_t) suns_tsc_get(chunk, &iter->pos, 8);
+            state->delta = 0;
+            state->lead = 32;
+            state->trail = 0;
+        } else {
+            state->delta += suns_tsc_get_varint(chunk, &iter->pos, suns_tsc_time_bits);
+            state->time += state->delta;
+            if (iter->tsc->type == SUNS_TYPE_FLOAT32) {
+                raw = suns_tsc_get_xor(chunk, &iter->pos, state);
+            } else {
+                raw = state->value + (uint64_t) suns_tsc_get_varint(chunk, &iter->pos, suns_tsc_value_bits);
+            }
+            state->value = raw;
+            if (suns_tsc_get(chunk, &iter->pos, 1)) {
+                state->sf = (int8_t) suns_tsc_get(chunk, &iter->pos, 8);
+            }
+        }
+        iter->index++;
+    } while (state->time < iter->start);
+
+    sample->time = state->time;
+    suns_tsc_value(iter->tsc->type, state->value, &sample->value);
+    sample->sf = state->sf;
+
+    return 1;
+}
@@ -0,0 +1,27 @@
+#include <stdio.h>
+
+#include "CuTest.h"
+
+CuSuite* bench_suite();
+
+int RunAllBenchmarks(void)
+{
+    int ret;
+
+    CuString *output = CuStringNew();
+    CuSuite* suite = CuSuiteNew();
+
+    CuSuiteAddSuite(suite, bench_suite());
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, output);
+    ret = CuSuiteDetails(suite, output);
+    printf("%s\n", output->buffer);
+    return ret;
+}
+
+int main(void)
+{
+    return RunAllBenchmarks();
+
+}
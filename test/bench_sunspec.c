@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmarks, run with make bench. They print throughput and latency and
+ * are kept out of the unit tests in AllTests.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+
+#include "cea2045lib.h"
+#include "sunspec.h"
+#include "sunspec_time.h"
+#include "cea2045_sgd.h"
+#include "test_model.h"
+
+extern int test_cea2045_link_wait(struct cea2045PortStruct *port);
+extern void test_tsc_sample(uint32_t i, uint32_t *rand, suns_ring_sample_t *sample);
+
+#define BENCH_CEA2045_MESSAGES          50
+#define BENCH_TSC_SAMPLES               86400   /* one day at 1 s */
+
+void
+bench_cea2045(CuTest* tc)
+{
+    sgd_sim_t *sgd;
+    sgd_sim_state_t state;
+    struct cea2045PortStruct *port;
+    uint64_t start;
+    uint64_t sent;
+    uint64_t latency;
+    uint64_t latency_total = 0;
+    uint64_t latency_max = 0;
+    uint64_t elapsed;
+    int i;
+    int j;
+
+    sgd = sgd_sim_open();
+    CuAssertTrue(tc, sgd != NULL);
+    sgd_sim_lock(sgd);
+    sgd->vendor_id = 0x1234;
+    sgd_sim_unlock(sgd);
+    port = cea2045Open(sgd_sim_path(sgd));
+    CuAssertTrue(tc, port != NULL);
+
+    /* alternate basic and intermediate requests, each answered by the SGD */
+    start = suns_time_us();
+    for (i = 0; i < BENCH_CEA2045_MESSAGES; i++) {
+        for (j = 0; j < 100 && port->linkData.txBlock; j++) {
+            cea2045Poll(port, CEA2045_TX_BLOCK_TIME);
+        }
+        if (i % 2 == 0) {
+            CuAssertTrue(tc, CEA2045basic(port, CEA2045_PRESENT_RELATIVE_PRICE, 0, 1.5) == 0);
+            port->basic.appAckRtn = CEA2045_PRESENT_RELATIVE_PRICE;
+        } else {
+            CuAssertTrue(tc, CEA2045inter(port, CEA2045_INFO_REQ, 0) == 0);
+            port->inter.respOpCode1 = CEA2045_INFO_REQ;
+            port->inter.respOpCode2 = 0x81;
+        }
+        sent = suns_time_us();
+        CuAssertTrue(tc, test_cea2045_link_wait(port) == 1);
+        latency = suns_time_us() - sent;
+        latency_total += latency;
+        if (latency > latency_max) {
+            latency_max = latency;
+        }
+
+        for (j = 0; j < 100 && port->linkData.rxCount == 0; j++) {
+            cea2045Poll(port, 10);
+        }
+        CuAssertTrue(tc, port->linkData.rxCount > 0);
+        if (i % 2 == 0) {
+            CuAssertTrue(tc, CEA2045basicRx(port) == CEA2045_APP_ACK);
+        } else {
+            CEA2045interRx(port);
+            CuAssertTrue(tc, port->inter.respOpCode1 == 0);
+            CuAssertTrue(tc, port->devInfo.vendorID == 0x1234);
+        }
+    }
+    /* let the last link ack go out */
+    sgd_sim_state(sgd, &state);
+    for (j = 0; j < 100 && (port->pendingTxLinkAck || state.acks < BENCH_CEA2045_MESSAGES); j++) {
+        cea2045Poll(port, CEA2045_LINK_ACK_DELAY);
+        sgd_sim_state(sgd, &state);
+    }
+    elapsed = suns_time_us() - start;
+
+    CuAssertTrue(tc, state.basic_count == BENCH_CEA2045_MESSAGES / 2);
+    CuAssertTrue(tc, state.inter_count == BENCH_CEA2045_MESSAGES / 2);
+    CuAssertTrue(tc, state.acks == BENCH_CEA2045_MESSAGES);
+    CuAssertTrue(tc, state.naks == 0 && state.naks_sent == 0);
+    CuAssertTrue(tc, port->linkStats.txMessages == BENCH_CEA2045_MESSAGES);
+    CuAssertTrue(tc, port->linkStats.rxMessages == BENCH_CEA2045_MESSAGES);
+
+    printf("cea2045: %d request/response pairs in %llu ms, %.1f messages/s, link ack latency avg %.2f ms max %.2f ms\n",
+           BENCH_CEA2045_MESSAGES, (unsigned long long) elapsed / 1000,
+           (2.0 * BENCH_CEA2045_MESSAGES * 1000000) / elapsed,
+           (double) latency_total / BENCH_CEA2045_MESSAGES / 1000, (double) latency_max / 1000);
+
+    cea2045Close(port);
+    sgd_sim_close(sgd);
+}
+
+#define BENCH_EXEC_MODELS                1024
+#define BENCH_EXEC_ROUNDS                20
+
+/* read of one simulated device, then decode and post-processing */
+typedef struct _bench_exec_read_t {
+    suns_exec_task_t task;
+    suns_device_t *device;
+    suns_model_t *model;
+    uint16_t map[14];
+    suns_err_t err;
+    float sum;
+} bench_exec_read_t;
+
+void
+bench_exec_decode(suns_exec_task_t *task, void *arg)
+{
+    bench_exec_read_t *decode = (bench_exec_read_t *) task;
+    suns_point_t *point;
+    suns_data_t *type;
+    char str[64];
+    float f;
+    int16_t sf;
+
+    /* each task has its own device, so reads don't share a transport */
+    if ((decode->err = suns_model_read(decode->model)) != SUNS_ERR_OK) {
+        return;
+    }
+
+    /* scale and export every point */
+    decode->sum = 0;
+    for (point = decode->model->blocks[0]->points; point; point = point->next) {
+        type = point->point_def->type;
+        sf = point->sf_point ? point->sf_point->value_base.s16 : 0;
+        if (type->to_float) {
+            type->to_float(point->value_base, sf, &f);
+            decode->sum += f;
+        }
+        if (type->to_str) {
+            type->to_str(point->value_base, sf, str, sizeof(str));
+        }
+    }
+}
+
+void
+bench_suns_exec(CuTest* tc)
+{
+    suns_exec_t exec;
+    bench_exec_read_t *reads;
+    uint16_t worker_counts[] = {1, 2, 4, 8};
+    uint64_t start;
+    uint64_t elapsed;
+    double rate;
+    double base = 0;
+    int w;
+    int r;
+    int i;
+    int j;
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    reads = calloc(BENCH_EXEC_MODELS, sizeof(bench_exec_read_t));
+    CuAssertTrue(tc, reads != NULL);
+    for (i = 0; i < BENCH_EXEC_MODELS; i++) {
+        for (j = 0; j < 10; j++) {
+            reads[i].map[4 + j] = i + j;
+        }
+        reads[i].map[12] = 0xffff;                              /* WMaxLimPct_SF -1 */
+        reads[i].device = suns_device_alloc();
+        CuAssertTrue(tc, suns_device_sim(reads[i].device, 40000, reads[i].map, sizeof(reads[i].map), 1) ==
+                     SUNS_ERR_OK);
+        CuAssertTrue(tc, suns_model_add(reads[i].device, TEST_GROUP_MODEL_ID, 10, 40004, &reads[i].model) ==
+                     SUNS_ERR_OK);
+    }
+
+    printf("\nexec benchmark: %d simulator reads and decodes per run, %ld cpus\n", BENCH_EXEC_MODELS * BENCH_EXEC_ROUNDS,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    for (w = 0; w < (int) (sizeof(worker_counts) / sizeof(worker_counts[0])); w++) {
+        CuAssertTrue(tc, suns_exec_start(&exec, worker_counts[w]) == SUNS_ERR_OK);
+        start = suns_time_us();
+        for (r = 0; r < BENCH_EXEC_ROUNDS; r++) {
+            for (i = 0; i < BENCH_EXEC_MODELS; i++) {
+                reads[i].task.func = bench_exec_decode;
+                suns_exec_submit(&exec, &reads[i].task);
+            }
+            CuAssertTrue(tc, suns_exec_wait(&exec, 10000) == SUNS_ERR_OK);
+        }
+        elapsed = suns_time_us() - start;
+        rate = (BENCH_EXEC_MODELS * BENCH_EXEC_ROUNDS) / (elapsed / 1000000.0);
+        if (w == 0) {
+            base = rate;
+        }
+        printf("  %2d workers: %9.0f decodes/s  speedup %.2f  stolen %llu\n", worker_counts[w], rate, rate / base,
+               (unsigned long long) suns_exec_stolen(&exec));
+        suns_exec_stop(&exec);
+    }
+
+    /* last decode of each model is complete and scaled */
+    for (i = 0; i < BENCH_EXEC_MODELS; i++) {
+        CuAssertTrue(tc, reads[i].err == SUNS_ERR_OK);
+        CuAssertIntEquals(tc, i + 3, suns_model_get_point(reads[i].model, "WMaxLimPct", 0)->value_base.u16);
+        CuAssertTrue(tc, reads[i].sum > 0);
+        reads[i].device->modbus_io.close(&reads[i].device->modbus_io);
+        suns_device_free(reads[i].device);
+    }
+
+    free(reads);
+}
+
+void
+bench_suns_tsc(CuTest* tc)
+{
+    suns_tsc_t tsc;
+    suns_tsc_iter_t iter;
+    suns_ring_sample_t sample;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t bits = 0;
+    uint64_t sum = 0;
+    suns_tsc_chunk_t *chunk;
+    uint32_t rand = 1;
+    uint32_t count = 0;
+    uint32_t i;
+    int r;
+
+    CuAssertTrue(tc, suns_tsc_init(&tsc, SUNS_TYPE_INT16) == SUNS_ERR_OK);
+    for (i = 0; i < BENCH_TSC_SAMPLES; i++) {
+        test_tsc_sample(i, &rand, &sample);
+        CuAssertTrue(tc, suns_tsc_append(&tsc, &sample) == SUNS_ERR_OK);
+    }
+    for (chunk = tsc.chunks; chunk; chunk = chunk->next) {
+        bits += chunk->bits;
+    }
+
+    start = suns_time_us();
+    for (r = 0; r < 10; r++) {
+        suns_tsc_iter_init(&iter, &tsc, 0);
+        while (suns_tsc_next(&iter, &sample)) {
+            sum += sample.value.u16;
+            count++;
+        }
+    }
+    elapsed = suns_time_us() - start;
+
+    printf("\ntsc benchmark: %d samples, %.2f encoded bytes/sample, %.2f allocated bytes/sample "
+           "(ring %d), decode %.1f Msamples/s\n",
+           BENCH_TSC_SAMPLES, bits / 8.0 / BENCH_TSC_SAMPLES, (double) tsc.bytes / BENCH_TSC_SAMPLES,
+           (int) sizeof(suns_ring_sample_t), count / (elapsed ? (double) elapsed : 1.0));
+    CuAssertTrue(tc, count == BENCH_TSC_SAMPLES * 10 && sum != 0);
+    CuAssertTrue(tc, tsc.bytes < BENCH_TSC_SAMPLES * sizeof(suns_ring_sample_t) / 4);
+
+    suns_tsc_free(&tsc);
+}
+
+CuSuite *
+bench_suite(void)
+{
+    CuSuite *suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, bench_cea2045);
+    SUITE_ADD_TEST(suite, bench_suns_exec);
+    SUITE_ADD_TEST(suite, bench_suns_tsc);
+
+    return suite;
+}
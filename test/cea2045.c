@@ -1,22 +0,0 @@
-
-#include <stdbool.h>
-#include <stdint.h>
-
-uint16_t
-cea2045_flush(bool txBufClear, bool rxBufClear, bool force)
-{
-    return 0;
-}
-
-int16_t
-CEA2045ss_read(unsigned char *buf, uint16_t len, uint32_t timeout)
-{
-    return 0;
-}
-
-int16_t
-CEA2045ss_write(unsigned char *buf, uint16_t len, uint32_t timeout)
-{
-    return 0;
-}
-
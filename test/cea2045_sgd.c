@@ -0,0 +1,294 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "cea2045lib.h"
+#include "sunspec_modbus.h"
+
+#include "cea2045_sgd.h"
+
+void
+sgd_sim_send(sgd_sim_t *sgd, unsigned char type, unsigned char protocol, unsigned char *payload, uint16_t len)
+{
+    unsigned char msg[512];
+
+    msg[0] = type;
+    msg[1] = protocol;
+    msg[2] = len >> 8;
+    msg[3] = len & 0xff;
+    memcpy(&msg[4], payload, len);
+    cea2045Checksum(msg, len + 4, false);
+    write(sgd->fd, msg, len + 6);
+}
+
+/* record what was received, before the link ack lets the UCM move on */
+void
+sgd_sim_record(sgd_sim_t *sgd, unsigned char *msg, uint16_t len)
+{
+    sgd_sim_state_t *state = &sgd->state;
+
+    if (msg[0] == 0x08 && msg[1] == 0x01) {
+        if (state->basic_count < SGD_BASIC_MAX) {
+            state->basic[state->basic_count][0] = msg[4];
+            state->basic[state->basic_count][1] = msg[5];
+        }
+        state->basic_count++;
+    } else if (msg[0] == 0x08 && msg[1] == 0x02) {
+        state->inter_count++;
+    } else if (msg[0] == 0x09 && msg[1] == 0x01) {
+        if (len - 6 <= (int) sizeof(state->frame)) {
+            memcpy(state->frame, &msg[4], len - 6);
+            state->frame_len = len - 6;
+        }
+        state->frames++;
+    }
+}
+
+void
+sgd_sim_basic(sgd_sim_t *sgd, unsigned char *msg)
+{
+    unsigned char resp[2];
+
+    switch (msg[4]) {
+    case CEA2045_APP_ACK:
+    case CEA2045_APP_NAK:
+    case CEA2045_OPER_STATE_RESP:
+        return;
+    case CEA2045_OPER_STATE_REQ:
+        resp[0] = CEA2045_OPER_STATE_RESP;
+        resp[1] = sgd->op_state;
+        break;
+    default:
+        resp[0] = CEA2045_APP_ACK;
+        resp[1] = msg[4];
+        break;
+    }
+    sgd_sim_send(sgd, 0x08, 0x01, resp, sizeof(resp));
+}
+
+void
+sgd_sim_inter(sgd_sim_t *sgd, unsigned char *msg)
+{
+    unsigned char resp[53];
+
+    memset(resp, 0, sizeof(resp));
+    resp[0] = msg[4];
+    if (msg[4] == CEA2045_INFO_REQ) {
+        resp[1] = 0x81;
+        resp[3] = '2';                          /* CEA-2045 version */
+        resp[4] = '0';
+        resp[5] = sgd->vendor_id >> 8;
+        resp[6] = sgd->vendor_id & 0xff;
+        memcpy(&resp[16], "SGD-SIM", 7);        /* model number */
+        memcpy(&resp[32], "0001", 4);           /* serial number */
+        sgd_sim_send(sgd, 0x08, 0x02, resp, sizeof(resp));
+    } else if (msg[4] == CEA2045_SET_UTC_TIME) {
+        resp[1] = 0x80;
+        sgd_sim_send(sgd, 0x08, 0x02, resp, 3);
+    }
+}
+
+void
+sgd_sim_pass_through(sgd_sim_t *sgd, unsigned char *msg)
+{
+    unsigned char resp[SGD_REGS * 2 + 5];
+    uint16_t addr;
+    uint16_t count;
+    uint16_t crc;
+    uint16_t len;
+    uint16_t i;
+
+    /* holding register reads, broadcasts get no response */
+    addr = suns_modbus_to_16(&msg[6]) - 40000;
+    count = suns_modbus_to_16(&msg[8]);
+    if (msg[4] == 0 || msg[5] != 3 || addr + count > SGD_REGS) {
+        return;
+    }
+    len = 0;
+    resp[len++] = msg[4];
+    resp[len++] = 3;
+    resp[len++] = count * 2;
+    for (i = 0; i < count; i++) {
+        suns_modbus_from_16(sgd->regs[addr + i], &resp[len]);
+        len += 2;
+    }
+    crc = suns_modbus_crc16(resp, len);
+    resp[len++] = crc & 0xff;
+    resp[len++] = (crc >> 8) & 0xff;
+    sgd_sim_send(sgd, 0x09, 0x01, resp, len);
+}
+
+/* called with lock held */
+void
+sgd_sim_message(sgd_sim_t *sgd, unsigned char *msg, uint16_t len)
+{
+    unsigned char ack[2] = {0x06, 0x00};
+
+    if (cea2045Checksum(msg, len - 2, true) != 0) {
+        ack[0] = 0x15;
+        ack[1] = 0x03;                          /* nak for bad checksum */
+    } else if (sgd->nak != 0) {
+        ack[0] = 0x15;
+        ack[1] = sgd->nak;
+        sgd->nak = 0;
+    }
+    if (ack[0] != 0x06) {
+        sgd->state.naks_sent++;
+        write(sgd->fd, ack, sizeof(ack));
+        return;
+    }
+
+    sgd_sim_record(sgd, msg, len);
+    write(sgd->fd, ack, sizeof(ack));
+
+    if (msg[0] == 0x08 && msg[1] == 0x01) {
+        sgd_sim_basic(sgd, msg);
+    } else if (msg[0] == 0x08 && msg[1] == 0x02) {
+        sgd_sim_inter(sgd, msg);
+    } else if (msg[0] == 0x09 && msg[1] == 0x01) {
+        sgd_sim_pass_through(sgd, msg);
+    }
+}
+
+void *
+sgd_sim_run(void *arg)
+{
+    sgd_sim_t *sgd = (sgd_sim_t *) arg;
+    unsigned char buf[512];
+    struct pollfd pfd;
+    int count = 0;
+    int msg_len;
+    int len;
+
+    pfd.fd = sgd->fd;
+    pfd.events = POLLIN;
+    while (!__atomic_load_n(&sgd->stop, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, 10) <= 0) {
+            continue;
+        }
+        if ((len = read(sgd->fd, &buf[count], sizeof(buf) - count)) <= 0) {
+            continue;
+        }
+        count += len;
+        pthread_mutex_lock(&sgd->lock);
+        while (count >= 2) {
+            /* link ack/nak from the UCM */
+            if (buf[0] == 0x06 || buf[0] == 0x15) {
+                if (buf[0] == 0x06) {
+                    sgd->state.acks++;
+                } else {
+                    sgd->state.naks++;
+                }
+                msg_len = 2;
+            } else {
+                if (count < 4) {
+                    break;
+                }
+                /* type, protocol, payload length, payload, checksum */
+                msg_len = ((buf[2] << 8) | buf[3]) + 6;
+                if (msg_len > (int) sizeof(buf)) {
+                    count = 0;
+                    break;
+                }
+                if (count < msg_len) {
+                    break;
+                }
+                sgd_sim_message(sgd, buf, msg_len);
+            }
+            count -= msg_len;
+            memmove(buf, &buf[msg_len], count);
+        }
+        pthread_mutex_unlock(&sgd->lock);
+    }
+    return NULL;
+}
+
+sgd_sim_t *
+sgd_sim_open()
+{
+    sgd_sim_t *sgd;
+
+    if ((sgd = calloc(1, sizeof(sgd_sim_t))) == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&sgd->lock, NULL);
+    if ((sgd->fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0) {
+        pthread_mutex_destroy(&sgd->lock);
+        free(sgd);
+        return NULL;
+    }
+    if (grantpt(sgd->fd) != 0 || unlockpt(sgd->fd) != 0 ||
+        pthread_create(&sgd->thread, NULL, sgd_sim_run, sgd) != 0) {
+        close(sgd->fd);
+        pthread_mutex_destroy(&sgd->lock);
+        free(sgd);
+        return NULL;
+    }
+    return sgd;
+}
+
+char *
+sgd_sim_path(sgd_sim_t *sgd)
+{
+    return ptsname(sgd->fd);
+}
+
+void
+sgd_sim_lock(sgd_sim_t *sgd)
+{
+    pthread_mutex_lock(&sgd->lock);
+}
+
+void
+sgd_sim_unlock(sgd_sim_t *sgd)
+{
+    pthread_mutex_unlock(&sgd->lock);
+}
+
+/* copy of what the SGD has received so far */
+void
+sgd_sim_state(sgd_sim_t *sgd, sgd_sim_state_t *state)
+{
+    pthread_mutex_lock(&sgd->lock);
+    *state = sgd->state;
+    pthread_mutex_unlock(&sgd->lock);
+}
+
+void
+sgd_sim_close(sgd_sim_t *sgd)
+{
+    __atomic_store_n(&sgd->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sgd->thread, NULL);
+    close(sgd->fd);
+    pthread_mutex_destroy(&sgd->lock);
+    free(sgd);
+}
@@ -0,0 +1,88 @@
+
+/*
+ * Copyright (C) 2014 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef _CEA2045_SGD_H_
+#define _CEA2045_SGD_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define SGD_REGS                16      /* holding registers from 40000 */
+#define SGD_BASIC_MAX           16      /* basic messages kept */
+
+/*
+ * Simulated SGD on the master side of a pty. The UCM opens the slave side
+ * (sgd_sim_path()) like a serial port. Every message is link acked, or
+ * link naked on a bad checksum or when nak is set. Basic commands are
+ * answered with an application ack, operational state requests with
+ * op_state, device information and set UTC time requests with their
+ * intermediate responses and SunSpec pass through holding register reads
+ * from regs.
+ */
+
+/* what the SGD received, recorded before the link ack goes out */
+typedef struct _sgd_sim_state_t {
+    unsigned char frame[512];           /* last pass through frame */
+    uint16_t frame_len;
+    uint32_t frames;
+    unsigned char basic[SGD_BASIC_MAX][2];
+    uint32_t basic_count;
+    uint32_t inter_count;
+    uint32_t acks;                      /* link acks from the UCM */
+    uint32_t naks;                      /* link naks from the UCM */
+    uint32_t naks_sent;
+} sgd_sim_state_t;
+
+/*
+ * The simulator thread holds lock while it handles a message, callers
+ * hold it (sgd_sim_lock()) to change nak, op_state, vendor_id or regs
+ * and read the state with sgd_sim_state().
+ */
+typedef struct _sgd_sim_t {
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int stop;
+    unsigned char nak;                  /* link nak code for the next message, 0 to ack */
+    unsigned char op_state;
+    uint16_t vendor_id;
+    uint16_t regs[SGD_REGS];
+    sgd_sim_state_t state;
+} sgd_sim_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+sgd_sim_t * sgd_sim_open();
+char * sgd_sim_path(sgd_sim_t *sgd);
+void sgd_sim_lock(sgd_sim_t *sgd);
+void sgd_sim_unlock(sgd_sim_t *sgd);
+void sgd_sim_state(sgd_sim_t *sgd, sgd_sim_state_t *state);
+void sgd_sim_close(sgd_sim_t *sgd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CEA2045_SGD_H_ */
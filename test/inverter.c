@@ -1082,6 +1082,53 @@ inv_set_connect(suns_device_t *device, inv_connect_t *connect)
     return err;
 }
 
+/*
+ * apply the same max power setting to a group of inverters, flags are the
+ * suns_group_cmd_t flags (SUNS_GROUP_BROADCAST only if the targets are
+ * every device on their rtu buses). As with inv_set_max_power(), timers an
+ * inverter does not implement are not written to it.
+ */
+suns_err_t
+inv_group_set_max_power(suns_scan_target_t *targets, uint32_t count, inv_max_power_t *max_power,
+                        uint16_t flags, suns_group_result_t *results)
+{
+    suns_group_cmd_t cmd;
+
+    suns_group_cmd_init(&cmd, 0, INV_MODEL_CONTROLS, 0, flags);
+    suns_group_cmd_point(&cmd, INV_W_MAX_LIM_PCT, (float) max_power->power);
+    if (max_power->timers.win_tms_valid) {
+        suns_group_cmd_point_optional(&cmd, INV_W_MAX_LIM_PCT_WIN_TMS, (float) max_power->timers.win_tms);
+    }
+    if (max_power->timers.rvrt_tms_valid) {
+        suns_group_cmd_point_optional(&cmd, INV_W_MAX_LIM_PCT_RVRT_TMS, (float) max_power->timers.rvrt_tms);
+    }
+    if (max_power->timers.rmp_tms_valid) {
+        suns_group_cmd_point_optional(&cmd, INV_W_MAX_LIM_PCT_RMP_TMS, (float) max_power->timers.rmp_tms);
+    }
+    suns_group_cmd_point(&cmd, INV_W_Max_LIM_ENA, (float) max_power->enabled);
+
+    return suns_group_write(targets, count, 0, &cmd, results);
+}
+
+/* apply the same connect setting to a group of inverters, flags as inv_group_set_max_power() */
+suns_err_t
+inv_group_set_connect(suns_scan_target_t *targets, uint32_t count, inv_connect_t *connect,
+                      uint16_t flags, suns_group_result_t *results)
+{
+    suns_group_cmd_t cmd;
+
+    suns_group_cmd_init(&cmd, 0, INV_MODEL_CONTROLS, 0, flags);
+    if (connect->timers.win_tms_valid) {
+        suns_group_cmd_point_optional(&cmd, INV_CONN_WIN_TMS, (float) connect->timers.win_tms);
+    }
+    if (connect->timers.rvrt_tms_valid) {
+        suns_group_cmd_point_optional(&cmd, INV_CONN_RVRT_TMS, (float) connect->timers.rvrt_tms);
+    }
+    suns_group_cmd_point(&cmd, INV_CONN, (float) connect->conn);
+
+    return suns_group_write(targets, count, 0, &cmd, results);
+}
+
 suns_err_t
 inv_get_status(suns_device_t *device, inv_status_t *status)
 {
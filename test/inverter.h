@@ -229,5 +229,9 @@ suns_err_t inv_set_max_power(suns_device_t *device, inv_max_power_t *max_power);
 suns_err_t inv_get_connect(suns_device_t *device, inv_connect_t *connect);
 suns_err_t inv_set_connect(suns_device_t *device, inv_connect_t *connect);
 suns_err_t inv_get_status(suns_device_t *device, inv_status_t *status);
+suns_err_t inv_group_set_max_power(suns_scan_target_t *targets, uint32_t count, inv_max_power_t *max_power,
+                                   uint16_t flags, suns_group_result_t *results);
+suns_err_t inv_group_set_connect(suns_scan_target_t *targets, uint32_t count, inv_connect_t *connect,
+                                 uint16_t flags, suns_group_result_t *results);
 
 #endif /* _INVERTER_H_ */
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+#include "sunspec_time.h"
+
+#include "test_model.h"
+
+#define TEST_BUS_PRODUCERS              4
+#define TEST_BUS_DEVICES                3
+#define TEST_BUS_OPS                    500
+
+typedef struct _test_bus_producer_t {
+    suns_bus_t *bus;
+    suns_bus_cq_t *cq;
+    suns_device_t *device;
+    uint16_t index;
+    suns_bus_op_t ops[TEST_BUS_OPS];
+    unsigned char buf[TEST_BUS_OPS][2];
+} test_bus_producer_t;
+
+void *
+test_bus_producer(void *arg)
+{
+    test_bus_producer_t *p = (test_bus_producer_t *) arg;
+    int i;
+
+    for (i = 0; i < TEST_BUS_OPS; i++) {
+        suns_modbus_from_16((p->index << 12) | i, p->buf[i]);
+        memset(&p->ops[i], 0, sizeof(p->ops[i]));
+        p->ops[i].type = SUNS_BUS_OP_WRITE;
+        p->ops[i].device = p->device;
+        p->ops[i].addr = 40015 + p->index;
+        p->ops[i].len = 1;
+        p->ops[i].buf = p->buf[i];
+        p->ops[i].arg = p;
+        suns_bus_submit(p->bus, &p->ops[i], p->cq);
+    }
+
+    return NULL;
+}
+
+void
+test_suns_bus(CuTest* tc)
+{
+    suns_bus_t buses[2];
+    suns_bus_cq_t cq;
+    suns_bus_op_t op;
+    suns_bus_op_t *done;
+    suns_device_t *devices[TEST_BUS_DEVICES];
+    test_bus_producer_t *producers;
+    pthread_t ids[TEST_BUS_PRODUCERS];
+    int last[TEST_BUS_PRODUCERS];
+    test_bus_producer_t *p;
+    unsigned char buf[2];
+    uint16_t map[24];
+    uint64_t start;
+    int seq;
+    int i;
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    /* SunS, controls model, end marker */
+    memset(map, 0, sizeof(map));
+    map[0] = 0x5375;
+    map[1] = 0x6e53;
+    map[2] = TEST_GROUP_MODEL_ID;
+    map[3] = 10;
+    map[7] = 42;                /* WMaxLimPct */
+    map[14] = 0xffff;
+    for (i = 0; i < TEST_BUS_DEVICES; i++) {
+        devices[i] = suns_device_alloc();
+        CuAssertTrue(tc, suns_device_sim(devices[i], 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+    }
+
+    CuAssertTrue(tc, suns_bus_cq_init(&cq) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_bus_start(&buses[0]) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_bus_start(&buses[1]) == SUNS_ERR_OK);
+
+    /* empty completion queue times out */
+    start = suns_time_ms();
+    CuAssertTrue(tc, suns_bus_cq_get(&cq, 20) == NULL);
+    CuAssertTrue(tc, suns_time_ms() - start >= 19);
+
+    /* scan then read a model on the bus that owns the device */
+    memset(&op, 0, sizeof(op));
+    op.type = SUNS_BUS_OP_SCAN;
+    op.device = devices[2];
+    suns_bus_submit(&buses[1], &op, &cq);
+    CuAssertTrue(tc, suns_bus_cq_get(&cq, 1000) == &op);
+    CuAssertTrue(tc, op.err == SUNS_ERR_OK);
+    CuAssertTrue(tc, op.completed >= op.submitted);
+    op.type = SUNS_BUS_OP_MODEL_READ;
+    op.model = suns_device_get_model(devices[2], TEST_GROUP_MODEL_ID, NULL, 1);
+    CuAssertTrue(tc, op.model != NULL);
+    suns_bus_submit(&buses[1], &op, &cq);
+    CuAssertTrue(tc, suns_bus_cq_get(&cq, 1000) == &op);
+    CuAssertTrue(tc, op.err == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 42, suns_model_get_point(op.model, "WMaxLimPct", 0)->value_base.u16);
+
+    /* producers on several threads, devices 0 and 1 on bus 0, device 2 on bus 1 */
+    producers = calloc(TEST_BUS_PRODUCERS, sizeof(test_bus_producer_t));
+    CuAssertTrue(tc, producers != NULL);
+    for (i = 0; i < TEST_BUS_PRODUCERS; i++) {
+        producers[i].device = devices[i % TEST_BUS_DEVICES];
+        producers[i].bus = &buses[(i % TEST_BUS_DEVICES) == 2];
+        producers[i].cq = &cq;
+        producers[i].index = i;
+        last[i] = -1;
+        pthread_create(&ids[i], NULL, test_bus_producer, &producers[i]);
+    }
+
+    /* completions from each producer arrive in submit order */
+    for (i = 0; i < TEST_BUS_PRODUCERS * TEST_BUS_OPS; i++) {
+        done = suns_bus_cq_get(&cq, 1000);
+        CuAssertTrue(tc, done != NULL);
+        CuAssertTrue(tc, done->err == SUNS_ERR_OK);
+        p = (test_bus_producer_t *) done->arg;
+        seq = suns_modbus_to_16(done->buf) & 0xfff;
+        CuAssertIntEquals(tc, last[p->index] + 1, seq);
+        last[p->index] = seq;
+    }
+    CuAssertTrue(tc, suns_bus_cq_get(&cq, 0) == NULL);
+
+    for (i = 0; i < TEST_BUS_PRODUCERS; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    suns_bus_stop(&buses[0]);
+    suns_bus_stop(&buses[1]);
+    CuAssertIntEquals(tc, buses[0].submitted, buses[0].completed);
+    CuAssertIntEquals(tc, TEST_BUS_PRODUCERS * TEST_BUS_OPS + 2, buses[0].completed + buses[1].completed);
+
+    /* last write from each producer wins */
+    for (i = 0; i < TEST_BUS_PRODUCERS; i++) {
+        CuAssertTrue(tc, suns_device_modbus_read(producers[i].device, 40015 + i, 1, buf, 0) == SUNS_ERR_OK);
+        CuAssertIntEquals(tc, (i << 12) | (TEST_BUS_OPS - 1), suns_modbus_to_16(buf));
+    }
+
+    free(producers);
+    suns_bus_cq_free(&cq);
+    for (i = 0; i < TEST_BUS_DEVICES; i++) {
+        devices[i]->modbus_io.close(&devices[i]->modbus_io);
+        suns_device_free(devices[i]);
+    }
+}
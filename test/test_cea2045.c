@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+
+#include "cea2045lib.h"
+#include "sunspec.h"
+
+#include "cea2045_sgd.h"
+
+void
+test_suns_cea2045_sunspec(CuTest* tc)
+{
+    sgd_sim_t *sgd;
+    sgd_sim_state_t state;
+    suns_device_t *device;
+    unsigned char buf[8];
+    int i;
+    int j;
+
+    sgd = sgd_sim_open();
+    CuAssertTrue(tc, sgd != NULL);
+    sgd_sim_lock(sgd);
+    for (i = 0; i < SGD_REGS; i++) {
+        sgd->regs[i] = 100 + i;
+    }
+    sgd_sim_unlock(sgd);
+
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_rtu_cea2045(device, sgd_sim_path(sgd), 1) == SUNS_ERR_OK);
+
+    /* back to back reads, each response received into the caller's buffer */
+    for (i = 0; i < 3; i++) {
+        memset(buf, 0, sizeof(buf));
+        CuAssertTrue(tc, suns_device_modbus_read(device, 40000 + i, 4, buf, 0) == SUNS_ERR_OK);
+        for (j = 0; j < 4; j++) {
+            CuAssertTrue(tc, suns_modbus_to_16(&buf[j * 2]) == 100 + i + j);
+        }
+    }
+    sgd_sim_state(sgd, &state);
+    CuAssertTrue(tc, state.frames == 3);
+
+    /* every response was link acked */
+    for (i = 0; i < 100 && state.acks < 3; i++) {
+        usleep(1000);
+        sgd_sim_state(sgd, &state);
+    }
+    CuAssertTrue(tc, state.acks == 3);
+
+    device->modbus_io.close(&device->modbus_io);
+    suns_device_free(device);
+    sgd_sim_close(sgd);
+}
+
+void
+test_cea2045_queue(CuTest* tc)
+{
+    sgd_sim_t *sgd;
+    sgd_sim_state_t state;
+    struct cea2045PortStruct *port;
+    int i;
+
+    sgd = sgd_sim_open();
+    CuAssertTrue(tc, sgd != NULL);
+    port = cea2045Open(sgd_sim_path(sgd));
+    CuAssertTrue(tc, port != NULL);
+
+    /* the latest price wins and an end shed cancels the queued shed */
+    CuAssertTrue(tc, CEA2045queue(port, CEA2045_PRESENT_RELATIVE_PRICE, 0, 1.0) == 1);
+    CuAssertTrue(tc, CEA2045queue(port, CEA2045_SHED, 60, 0) == 2);
+    /* a queued shed takes effect only when it is sent */
+    CuAssertTrue(tc, port->shedEndTime == 0);
+    CuAssertTrue(tc, CEA2045queue(port, CEA2045_PRESENT_RELATIVE_PRICE, 0, 2.0) == 2);
+    CuAssertTrue(tc, CEA2045queue(port, CEA2045_APP_ACK, 1, 0) == 3);
+    CuAssertTrue(tc, CEA2045queue(port, CEA2045_END_SHED, 0, 0) == 3);
+    CuAssertTrue(tc, CEA2045queue(port, CEA2045_PRESENT_RELATIVE_PRICE, 0, 3.0) == 3);
+    CuAssertTrue(tc, CEA2045queue(port, 0xff, 0, 0) == -1);
+    CuAssertTrue(tc, cea2045QueueDepth(port) == 3);
+    CuAssertTrue(tc, port->cmdQueue.coalesced == 3);
+
+    /* sent back to back as the link frees up, each acked by the SGD */
+    for (i = 0; i < 200 && (cea2045QueueDepth(port) > 0 || port->pendingLinkAck || port->cmdQueue.ackCount > 0); i++) {
+        cea2045Poll(port, 10);
+        /* application acks from the SGD */
+        if (port->linkData.rxCount > 0) {
+            CEA2045basicRx(port);
+        }
+    }
+    sgd_sim_state(sgd, &state);
+    for (i = 0; i < 100 && state.basic_count < 3; i++) {
+        usleep(1000);
+        sgd_sim_state(sgd, &state);
+    }
+    CuAssertTrue(tc, cea2045QueueDepth(port) == 0);
+    CuAssertTrue(tc, port->cmdQueue.sent == 3);
+    CuAssertTrue(tc, port->cmdQueue.acked == 2);
+    CuAssertTrue(tc, port->cmdQueue.ackCount == 0);
+    CuAssertTrue(tc, port->shedEndTime == 0);
+    CuAssertTrue(tc, state.basic_count == 3);
+    CuAssertTrue(tc, state.basic[0][0] == CEA2045_PRESENT_RELATIVE_PRICE && state.basic[0][1] == cea2045RelativePriceByte(3.0));
+    CuAssertTrue(tc, state.basic[1][0] == CEA2045_END_SHED);
+    CuAssertTrue(tc, state.basic[2][0] == CEA2045_APP_ACK && state.basic[2][1] == 1);
+
+    /* the shed end time is set once the shed is sent */
+    CuAssertTrue(tc, CEA2045queue(port, CEA2045_SHED, 60, 0) == 1);
+    CuAssertTrue(tc, port->shedEndTime == 0);
+    for (i = 0; i < 200 && (cea2045QueueDepth(port) > 0 || port->pendingLinkAck || port->cmdQueue.ackCount > 0); i++) {
+        cea2045Poll(port, 10);
+        if (port->linkData.rxCount > 0) {
+            CEA2045basicRx(port);
+        }
+    }
+    CuAssertTrue(tc, port->shedEndTime > 0);
+    CuAssertTrue(tc, port->cmdQueue.acked == 3);
+
+    cea2045Close(port);
+    sgd_sim_close(sgd);
+}
+
+/* wait for the link layer to report a link ack/nak or timeout */
+int
+test_cea2045_link_wait(struct cea2045PortStruct *port)
+{
+    int rtn = 0;
+    int i;
+
+    for (i = 0; i < 100 && rtn == 0; i++) {
+        rtn = cea2045Poll(port, CEA2045_LINK_ACK_TIMEOUT);
+    }
+    return rtn;
+}
+
+void
+test_cea2045_link_nak(CuTest* tc)
+{
+    sgd_sim_t *sgd;
+    struct cea2045PortStruct *port;
+
+    sgd = sgd_sim_open();
+    CuAssertTrue(tc, sgd != NULL);
+    port = cea2045Open(sgd_sim_path(sgd));
+    CuAssertTrue(tc, port != NULL);
+
+    /* a link nak from the SGD is reported to the caller */
+    sgd_sim_lock(sgd);
+    sgd->nak = 0x06;
+    sgd_sim_unlock(sgd);
+    CuAssertTrue(tc, CEA2045basic(port, CEA2045_OPER_STATE_REQ, 0, 0) == 0);
+    CuAssertTrue(tc, test_cea2045_link_wait(port) == -1);
+    CuAssertTrue(tc, port->linkData.nakVal == 0x06);
+
+    cea2045Close(port);
+    sgd_sim_close(sgd);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+
+#define TEST_EXEC_CHILDREN              2000
+#define TEST_EXEC_SUBMITTERS            2
+#define TEST_EXEC_SUBMITS               5000
+
+typedef struct _test_exec_t {
+    suns_exec_t *exec;
+    suns_exec_task_t *tasks;
+    int count;
+    int run;
+} test_exec_t;
+
+void
+test_exec_child(suns_exec_task_t *task, void *arg)
+{
+    test_exec_t *t = (test_exec_t *) arg;
+
+    /* some children block so their worker's backlog gets stolen */
+    if ((task - t->tasks) % 100 == 0) {
+        usleep(200);
+    }
+    __atomic_add_fetch(&t->run, 1, __ATOMIC_RELAXED);
+}
+
+void
+test_exec_root(suns_exec_task_t *task, void *arg)
+{
+    test_exec_t *t = (test_exec_t *) arg;
+    int i;
+
+    for (i = 0; i < t->count; i++) {
+        t->tasks[i].func = test_exec_child;
+        t->tasks[i].arg = t;
+        suns_exec_spawn(task, &t->tasks[i]);
+    }
+}
+
+void *
+test_exec_submitter(void *arg)
+{
+    test_exec_t *t = (test_exec_t *) arg;
+    int i;
+
+    for (i = 0; i < t->count; i++) {
+        t->tasks[i].func = test_exec_child;
+        t->tasks[i].arg = t;
+        suns_exec_submit(t->exec, &t->tasks[i]);
+    }
+
+    return NULL;
+}
+
+void
+test_suns_exec(CuTest* tc)
+{
+    suns_exec_t exec;
+    suns_exec_task_t root;
+    test_exec_t spawned;
+    test_exec_t submitted[TEST_EXEC_SUBMITTERS];
+    pthread_t ids[TEST_EXEC_SUBMITTERS];
+    uint64_t executed = 0;
+    int i;
+
+    CuAssertTrue(tc, suns_exec_start(&exec, 4) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 4, exec.count);
+    CuAssertTrue(tc, suns_exec_wait(&exec, 0) == SUNS_ERR_OK);
+
+    /* children spawned on one worker are spread by stealing */
+    memset(&spawned, 0, sizeof(spawned));
+    spawned.count = TEST_EXEC_CHILDREN;
+    spawned.tasks = calloc(TEST_EXEC_CHILDREN, sizeof(suns_exec_task_t));
+    CuAssertTrue(tc, spawned.tasks != NULL);
+    memset(&root, 0, sizeof(root));
+    root.func = test_exec_root;
+    root.arg = &spawned;
+    suns_exec_submit(&exec, &root);
+    CuAssertTrue(tc, suns_exec_wait(&exec, 5000) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, TEST_EXEC_CHILDREN, spawned.run);
+    CuAssertTrue(tc, suns_exec_stolen(&exec) > 0);
+
+    /* submits from several threads */
+    for (i = 0; i < TEST_EXEC_SUBMITTERS; i++) {
+        memset(&submitted[i], 0, sizeof(submitted[i]));
+        submitted[i].exec = &exec;
+        submitted[i].count = TEST_EXEC_SUBMITS;
+        submitted[i].tasks = calloc(TEST_EXEC_SUBMITS, sizeof(suns_exec_task_t));
+        CuAssertTrue(tc, submitted[i].tasks != NULL);
+        pthread_create(&ids[i], NULL, test_exec_submitter, &submitted[i]);
+    }
+    for (i = 0; i < TEST_EXEC_SUBMITTERS; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    CuAssertTrue(tc, suns_exec_wait(&exec, 5000) == SUNS_ERR_OK);
+    for (i = 0; i < TEST_EXEC_SUBMITTERS; i++) {
+        CuAssertIntEquals(tc, TEST_EXEC_SUBMITS, submitted[i].run);
+        free(submitted[i].tasks);
+    }
+    for (i = 0; i < exec.count; i++) {
+        executed += exec.workers[i].executed;
+    }
+    CuAssertTrue(tc, executed == 1 + TEST_EXEC_CHILDREN + TEST_EXEC_SUBMITTERS * TEST_EXEC_SUBMITS);
+
+    suns_exec_stop(&exec);
+    free(spawned.tasks);
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+#include "sunspec_modbus_rtu.h"
+#include "sunspec_stats.h"
+
+#include "cea2045_sgd.h"
+#include "inverter.h"
+#include "test_model.h"
+
+#define TEST_GROUP_SIM                  3
+#define TEST_GROUP_RTU                  2
+#define TEST_GROUP_COUNT                (TEST_GROUP_SIM + TEST_GROUP_RTU + 1)
+
+void
+test_suns_group_write(CuTest* tc)
+{
+    suns_scan_target_t targets[TEST_GROUP_COUNT];
+    suns_group_result_t results[TEST_GROUP_COUNT];
+    suns_model_t *model;
+    inv_max_power_t max_power;
+    inv_connect_t connect;
+    suns_stats_t stats;
+    sgd_sim_t *sgd;
+    sgd_sim_state_t state;
+    uint16_t map[14];
+    unsigned char buf[20];
+    int i;
+
+    /* model definition for the test devices */
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    /* rtu devices talk to an SGD on the other end of a pty */
+    sgd = sgd_sim_open();
+    CuAssertTrue(tc, sgd != NULL);
+
+    memset(map, 0, sizeof(map));
+    memset(targets, 0, sizeof(targets));
+    for (i = 0; i < TEST_GROUP_COUNT; i++) {
+        targets[i].device = suns_device_alloc();
+        if (i < TEST_GROUP_SIM) {
+            /*
+             * simulated devices behind one tcp host, the second has no ramp
+             * timer and the last scales WMaxLimPct by 0.1
+             */
+            map[10] = (i == 1) ? 0xffff : 0;
+            map[12] = (i == TEST_GROUP_SIM - 1) ? 0xffff : 0;
+            CuAssertTrue(tc, suns_device_sim(targets[i].device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+            targets[i].bus = 1;
+            targets[i].bus_max = SUNS_SCAN_BUS_SHARED;
+        } else if (i < TEST_GROUP_SIM + TEST_GROUP_RTU) {
+            /* rtu devices sharing a bus */
+            CuAssertTrue(tc, suns_device_rtu_cea2045(targets[i].device, sgd_sim_path(sgd), i) == SUNS_ERR_OK);
+            targets[i].bus = 2;
+            targets[i].bus_max = SUNS_SCAN_BUS_EXCLUSIVE;
+        } else {
+            /* device without the controls model */
+            CuAssertTrue(tc, suns_device_sim(targets[i].device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+            targets[i].bus = 3;
+            continue;
+        }
+        CuAssertTrue(tc, suns_model_add(targets[i].device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+    }
+
+    memset(&max_power, 0, sizeof(max_power));
+    max_power.enabled = 1;
+    max_power.power = 50;
+    max_power.timers.win_tms_valid = 1;
+    max_power.timers.win_tms = 10;
+    max_power.timers.rvrt_tms_valid = 1;
+    max_power.timers.rvrt_tms = 60;
+    max_power.timers.rmp_tms_valid = 1;
+    max_power.timers.rmp_tms = 5;
+
+    /* the two rtu devices are the whole bus */
+    CuAssertTrue(tc, inv_group_set_max_power(targets, TEST_GROUP_COUNT, &max_power, SUNS_GROUP_BROADCAST,
+                                             results) == SUNS_ERR_OK);
+
+    /*
+     * unicast writes to the simulated devices, encoded for each scale factor
+     * and skipping the unimplemented timer
+     */
+    for (i = 0; i < TEST_GROUP_SIM; i++) {
+        CuAssertTrue(tc, results[i].index == (uint32_t) i && results[i].err == SUNS_ERR_OK);
+        CuAssertTrue(tc, results[i].broadcast == 0);
+        CuAssertTrue(tc, suns_device_modbus_read(targets[i].device, 40007, 5, buf, 0) == SUNS_ERR_OK);
+        CuAssertTrue(tc, suns_modbus_to_16(buf) == ((i == TEST_GROUP_SIM - 1) ? 500 : 50));
+        CuAssertTrue(tc, suns_modbus_to_16(&buf[2]) == 10);
+        CuAssertTrue(tc, suns_modbus_to_16(&buf[4]) == 60);
+        CuAssertTrue(tc, suns_modbus_to_16(&buf[6]) == ((i == 1) ? 0xffff : 5));
+        CuAssertTrue(tc, suns_modbus_to_16(&buf[8]) == 1);
+    }
+
+    /* model reads, then one broadcast for the rtu bus */
+    sgd_sim_state(sgd, &state);
+    CuAssertTrue(tc, state.frames == TEST_GROUP_RTU + 1);
+    CuAssertTrue(tc, state.frame_len == 9 + 10);
+    CuAssertTrue(tc, state.frame[0] == 0 && state.frame[1] == 16);
+    CuAssertTrue(tc, suns_modbus_to_16(&state.frame[2]) == 40007);
+    CuAssertTrue(tc, suns_modbus_to_16(&state.frame[4]) == 5);
+    CuAssertTrue(tc, suns_modbus_to_16(&state.frame[7]) == 50);
+    for (i = TEST_GROUP_SIM; i < TEST_GROUP_SIM + TEST_GROUP_RTU; i++) {
+        CuAssertTrue(tc, results[i].err == SUNS_ERR_OK && results[i].broadcast == 1);
+        CuAssertTrue(tc, results[i].duration >= SUNS_MODBUS_RTU_TURNAROUND * 1000);
+        /* every member counts the broadcast, only the sender's transport carried it */
+        CuAssertTrue(tc, suns_device_stats_get(targets[i].device, &stats) == SUNS_ERR_OK);
+        CuAssertTrue(tc, stats.writes == 1 && stats.broadcasts == 1);
+        CuAssertTrue(tc, suns_modbus_rtu_stats_get(&targets[i].device->modbus_io, &stats) == SUNS_ERR_OK);
+        CuAssertTrue(tc, stats.broadcasts == ((i == TEST_GROUP_SIM) ? 1 : 0));
+    }
+    CuAssertTrue(tc, results[TEST_GROUP_COUNT - 1].err == SUNS_ERR_NOT_FOUND);
+
+    /* cached point values follow the write */
+    model = suns_device_get_model(targets[0].device, 0, INV_MODEL_CONTROLS, 1);
+    CuAssertTrue(tc, suns_model_get_point(model, INV_W_MAX_LIM_PCT_RVRT_TMS, 0)->value_base.u16 == 60);
+
+    /* disconnect with no timers is a single register */
+    memset(&connect, 0, sizeof(connect));
+    CuAssertTrue(tc, inv_group_set_connect(targets, TEST_GROUP_SIM, &connect, 0, results) == SUNS_ERR_OK);
+    for (i = 0; i < TEST_GROUP_SIM; i++) {
+        CuAssertTrue(tc, results[i].err == SUNS_ERR_OK);
+        CuAssertTrue(tc, suns_device_modbus_read(targets[i].device, 40006, 1, buf, 0) == SUNS_ERR_OK);
+        CuAssertTrue(tc, suns_modbus_to_16(buf) == 0);
+    }
+
+    /* scale factor the device does not implement */
+    suns_modbus_from_16(0x8000, buf);
+    CuAssertTrue(tc, suns_device_modbus_write(targets[0].device, 40012, 1, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, inv_group_set_max_power(targets, TEST_GROUP_SIM, &max_power, 0, results) == SUNS_ERR_OK);
+    CuAssertTrue(tc, results[0].err == SUNS_ERR_SF_RESOLVE);
+    CuAssertTrue(tc, results[1].err == SUNS_ERR_OK);
+
+    for (i = 0; i < TEST_GROUP_COUNT; i++) {
+        if (i >= TEST_GROUP_SIM && i < TEST_GROUP_SIM + TEST_GROUP_RTU) {
+            targets[i].device->modbus_io.close(&targets[i].device->modbus_io);
+        }
+        suns_device_free(targets[i].device);
+    }
+    sgd_sim_close(sgd);
+}
+
+/* device that acknowledges writes without applying them */
+suns_err_t
+test_group_write_ignore(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    return SUNS_ERR_OK;
+}
+
+void
+test_suns_group_write_stale(CuTest* tc)
+{
+    suns_scan_target_t target;
+    suns_group_result_t result;
+    suns_group_cmd_t cmd;
+    suns_model_t *model;
+    suns_point_t *point;
+    uint16_t map[14];
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    memset(map, 0, sizeof(map));
+    memset(&target, 0, sizeof(target));
+    target.device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_sim(target.device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_model_add(target.device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+    point = suns_model_get_point(model, "WMaxLimPct", 0);
+    CuAssertTrue(tc, suns_model_read(model) == SUNS_ERR_OK);
+    CuAssertTrue(tc, point->value_base.u16 == 0);
+    target.device->modbus_io.write = test_group_write_ignore;
+
+    /* the commanded value is cached after the write */
+    suns_group_cmd_init(&cmd, TEST_GROUP_MODEL_ID, NULL, 0, 0);
+    CuAssertTrue(tc, suns_group_cmd_point(&cmd, "WMaxLimPct", 50) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_group_write(&target, 1, 1, &cmd, &result) == SUNS_ERR_OK);
+    CuAssertTrue(tc, result.err == SUNS_ERR_OK);
+    CuAssertTrue(tc, point->value_base.u16 == 50);
+
+    /* the device kept the old value, the next read restores it */
+    CuAssertTrue(tc, suns_model_read(model) == SUNS_ERR_OK);
+    CuAssertTrue(tc, model->blocks_changed == 1);
+    CuAssertTrue(tc, point->value_base.u16 == 0);
+
+    suns_device_free(target.device);
+}
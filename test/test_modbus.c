@@ -0,0 +1,872 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+#include "sunspec_health.h"
+#include "sunspec_modbus_cache.h"
+#include "sunspec_modbus_fault.h"
+#include "sunspec_stats.h"
+#include "sunspec_modbus_server.h"
+#include "sunspec_time.h"
+
+
+/* test transport that fails or succeeds on demand */
+typedef struct {
+    suns_err_t err;
+    uint16_t requests;
+    uint16_t count_max;
+    uint32_t delay;                     /* read latency in ms */
+    uint16_t writes;
+    uint16_t closes;
+} test_modbus_t;
+
+suns_err_t
+test_modbus_read(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    test_modbus_t *test = (test_modbus_t *) prot;
+    uint16_t i;
+
+    test->requests++;
+    if (test->delay) {
+        usleep(test->delay * 1000);
+    }
+    if (test->count_max && count > test->count_max) {
+        return SUNS_ERR_MODBUS_EXCEPT_VALUE;
+    }
+    if (test->err == SUNS_ERR_OK) {
+        /* each register holds its own address */
+        for (i = 0; i < count; i++) {
+            suns_modbus_from_16(addr + i, &buf[i * 2]);
+        }
+    }
+    return test->err;
+}
+
+suns_err_t
+test_modbus_write(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    ((test_modbus_t *) prot)->writes++;
+    return SUNS_ERR_OK;
+}
+
+suns_err_t
+test_modbus_close(suns_modbus_io_t *io)
+{
+    ((test_modbus_t *) io->prot)->closes++;
+    return SUNS_ERR_OK;
+}
+
+/* long enough that the circuit is still open when the next request follows a trip */
+#define TEST_HEALTH_BACKOFF             50
+
+/* wait for the next circuit breaker probe time */
+void
+test_health_wait(suns_device_t *device)
+{
+    usleep((device->health.backoff + 1) * 1000);
+}
+
+void
+test_suns_device_health(CuTest* tc)
+{
+    suns_device_t *device;
+    suns_health_t health;
+    test_modbus_t test = {SUNS_ERR_TIMEOUT, 0, 0};
+    unsigned char buf[16];
+    suns_err_t err;
+    uint16_t i;
+
+    device = suns_device_alloc();
+    CuAssertTrue(tc, device != NULL);
+    device->modbus_io.read = test_modbus_read;
+    device->modbus_io.prot = &test;
+
+    err = suns_device_health_config(device, 2, TEST_HEALTH_BACKOFF, TEST_HEALTH_BACKOFF * 4);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+
+    /* circuit opens after threshold consecutive timeouts */
+    for (i = 0; i < 2; i++) {
+        err = suns_device_modbus_read(device, 40000, 2, buf, 0);
+        CuAssertTrue(tc, err == SUNS_ERR_TIMEOUT);
+    }
+    suns_device_health_get(device, &health);
+    CuAssertTrue(tc, health.state == SUNS_HEALTH_OPEN);
+    CuAssertTrue(tc, health.trips == 1);
+
+    /* requests are rejected without reaching the transport */
+    err = suns_device_modbus_read(device, 40000, 2, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_CIRCUIT_OPEN);
+    CuAssertTrue(tc, test.requests == 2);
+
+    /* failed probe doubles the backoff */
+    test_health_wait(device);
+    err = suns_device_modbus_read(device, 40000, 2, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_TIMEOUT);
+    suns_device_health_get(device, &health);
+    CuAssertTrue(tc, health.state == SUNS_HEALTH_OPEN);
+    CuAssertTrue(tc, health.backoff == TEST_HEALTH_BACKOFF * 2);
+    CuAssertTrue(tc, health.probes == 1);
+
+    /* probe that fails without a response also reopens the circuit */
+    test.err = SUNS_ERR_INIT;
+    test_health_wait(device);
+    err = suns_device_modbus_read(device, 40000, 2, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_INIT);
+    suns_device_health_get(device, &health);
+    CuAssertTrue(tc, health.state == SUNS_HEALTH_OPEN);
+    CuAssertTrue(tc, health.backoff == TEST_HEALTH_BACKOFF * 4);
+    CuAssertTrue(tc, health.probes == 2);
+
+    /* successful probe closes the circuit */
+    test.err = SUNS_ERR_OK;
+    test_health_wait(device);
+    err = suns_device_modbus_read(device, 40000, 2, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+    suns_device_health_get(device, &health);
+    CuAssertTrue(tc, health.state == SUNS_HEALTH_CLOSED);
+    CuAssertTrue(tc, health.failures == 0);
+
+    device->modbus_io.read = NULL;
+    device->modbus_io.prot = NULL;
+    suns_device_free(device);
+}
+
+void
+test_suns_device_req_max(CuTest* tc)
+{
+    suns_device_t *device;
+    test_modbus_t test = {SUNS_ERR_OK, 0, 64};
+    unsigned char buf[512];
+    suns_err_t err;
+    uint16_t req_max;
+    uint16_t i;
+
+    device = suns_device_alloc();
+    CuAssertTrue(tc, device != NULL);
+    device->modbus_io.read = test_modbus_read;
+    device->modbus_io.prot = &test;
+    CuAssertTrue(tc, suns_device_req_max_get(device) == SUNS_MODBUS_REQ_COUNT_MAX);
+
+    /* oversized requests are rejected until the limit is learned */
+    err = suns_device_modbus_read(device, 40000, 200, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_req_max_get(device) <= 64);
+    for (i = 0; i < 200; i++) {
+        CuAssertTrue(tc, suns_modbus_to_16(&buf[i * 2]) == 40000 + i);
+    }
+
+    /* learned limit avoids further failures */
+    test.requests = 0;
+    err = suns_device_modbus_read(device, 40000, 124, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+    CuAssertTrue(tc, test.requests == 2);
+
+    /* other exceptions do not shrink the limit */
+    req_max = suns_device_req_max_get(device);
+    test.requests = 0;
+    test.err = SUNS_ERR_MODBUS_EXCEPT;
+    err = suns_device_modbus_read(device, 40000, 124, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_MODBUS_EXCEPT);
+    CuAssertTrue(tc, test.requests == 1);
+    CuAssertTrue(tc, suns_device_req_max_get(device) == req_max);
+    test.err = SUNS_ERR_OK;
+
+    /* failed probe falls back to the learned limit */
+    test.requests = 0;
+    device->req_probe_time = 0;
+    err = suns_device_modbus_read(device, 40000, 124, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+    CuAssertTrue(tc, test.requests == 3);
+    CuAssertTrue(tc, suns_device_req_max_get(device) == req_max);
+
+    /* successful probe raises the limit */
+    test.count_max = 0;
+    device->req_probe_time = 0;
+    err = suns_device_modbus_read(device, 40000, 200, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_req_max_get(device) == req_max * 2);
+    for (i = 0; i < 200; i++) {
+        CuAssertTrue(tc, suns_modbus_to_16(&buf[i * 2]) == 40000 + i);
+    }
+
+    /* limit can be restored */
+    CuAssertTrue(tc, suns_device_req_max_set(device, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_req_max_get(device) == SUNS_MODBUS_REQ_COUNT_MAX);
+    CuAssertTrue(tc, suns_device_req_max_set(device, 200) == SUNS_ERR_RANGE);
+
+    device->modbus_io.read = NULL;
+    device->modbus_io.prot = NULL;
+    suns_device_free(device);
+}
+
+/* send a request to the server over fd and return the response length */
+int
+test_server_request(suns_server_t *server, int fd, unsigned char *req, int req_len, unsigned char *rsp, int rsp_size)
+{
+    if (write(fd, req, req_len) != req_len) {
+        return -1;
+    }
+    suns_server_poll(server, 100);
+    return read(fd, rsp, rsp_size);
+}
+
+void
+test_server_write(suns_server_t *server, suns_model_t *model, void *arg)
+{
+    (*(int *) arg)++;
+}
+
+void
+test_suns_server_image(CuTest* tc)
+{
+    suns_server_t *server;
+    unsigned char image[20];
+    unsigned char rsp[SUNS_SERVER_ADU_MAX];
+    unsigned char read_req[] = {0x12, 0x34, 0, 0, 0, 6, 1, 3, 0x9c, 0x42, 0, 3};
+    unsigned char write_req[] = {0, 1, 0, 0, 0, 11, 1, 16, 0x9c, 0x41, 0, 2, 4, 0xab, 0xcd, 0x12, 0x34};
+    unsigned char range_req[] = {0, 2, 0, 0, 0, 6, 1, 3, 0x9c, 0x48, 0, 3};
+    unsigned char rtu_req[8] = {1, 4, 0x9c, 0x41, 0, 2};
+    unsigned char func_req[4] = {1, 0x11};
+    uint16_t crc;
+    int fds[2];
+    int len;
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        suns_modbus_from_16(i, &image[i * 2]);
+    }
+
+    server = suns_server_alloc(1);
+    CuAssertTrue(tc, server != NULL);
+    CuAssertTrue(tc, suns_server_image_set(server, 40000, image, 10) == SUNS_ERR_OK);
+
+    /* tcp read echoes the transaction id and returns image data */
+    CuAssertTrue(tc, socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CuAssertTrue(tc, suns_server_tcp_attach(server, fds[0]) == SUNS_ERR_OK);
+    len = test_server_request(server, fds[1], read_req, sizeof(read_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 15, len);
+    CuAssertTrue(tc, rsp[0] == 0x12 && rsp[1] == 0x34 && rsp[5] == 9 && rsp[7] == 3 && rsp[8] == 6);
+    CuAssertTrue(tc, suns_modbus_to_16(&rsp[9]) == 2);
+    CuAssertTrue(tc, suns_modbus_to_16(&rsp[13]) == 4);
+
+    /* write updates the image */
+    len = test_server_request(server, fds[1], write_req, sizeof(write_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 12, len);
+    CuAssertTrue(tc, rsp[7] == 16 && suns_modbus_to_16(&rsp[10]) == 2);
+    CuAssertTrue(tc, suns_modbus_to_16(&server->image[2]) == 0xabcd);
+
+    /* reads past the end of the image return an exception */
+    len = test_server_request(server, fds[1], range_req, sizeof(range_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 9, len);
+    CuAssertTrue(tc, rsp[7] == 0x83 && rsp[8] == SUNS_MODBUS_EXCEPT_ADDR);
+    close(fds[1]);
+
+    /* rtu read of input registers */
+    CuAssertTrue(tc, socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CuAssertTrue(tc, suns_server_rtu_attach(server, fds[0]) == SUNS_ERR_OK);
+    crc = suns_modbus_crc16(rtu_req, 6);
+    rtu_req[6] = crc & 0xff;
+    rtu_req[7] = (crc >> 8) & 0xff;
+    len = test_server_request(server, fds[1], rtu_req, sizeof(rtu_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 9, len);
+    CuAssertTrue(tc, rsp[0] == 1 && rsp[1] == 4 && rsp[2] == 4);
+    CuAssertTrue(tc, suns_modbus_to_16(&rsp[3]) == 0xabcd);
+    crc = suns_modbus_crc16(rsp, 7);
+    CuAssertTrue(tc, rsp[7] == (crc & 0xff) && rsp[8] == ((crc >> 8) & 0xff));
+
+    /* unsupported rtu function is answered with an exception */
+    crc = suns_modbus_crc16(func_req, 2);
+    func_req[2] = crc & 0xff;
+    func_req[3] = (crc >> 8) & 0xff;
+    len = test_server_request(server, fds[1], func_req, sizeof(func_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 5, len);
+    CuAssertTrue(tc, rsp[0] == 1 && rsp[1] == 0x91 && rsp[2] == SUNS_MODBUS_EXCEPT_FUNC);
+    crc = suns_modbus_crc16(rsp, 3);
+    CuAssertTrue(tc, rsp[3] == (crc & 0xff) && rsp[4] == ((crc >> 8) & 0xff));
+
+    /* and the following request is still served */
+    len = test_server_request(server, fds[1], rtu_req, sizeof(rtu_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 9, len);
+    CuAssertTrue(tc, rsp[0] == 1 && rsp[1] == 4 && suns_modbus_to_16(&rsp[3]) == 0xabcd);
+    close(fds[1]);
+
+    suns_server_free(server);
+}
+
+void
+test_suns_server_model(CuTest* tc)
+{
+    suns_server_t *server;
+    suns_model_t *model;
+    suns_block_t *block;
+    suns_point_def_t defs[2];
+    suns_block_def_t block_def;
+    suns_point_t points[2];
+    unsigned char rsp[SUNS_SERVER_ADU_MAX];
+    unsigned char read_req[] = {0, 1, 0, 0, 0, 6, 1, 3, 0x9c, 0x40, 0, 9};
+    unsigned char write_req[] = {0, 2, 0, 0, 0, 11, 1, 16, 0x9c, 0x45, 0, 2, 4, 0xff, 0xff, 0xff, 0xfe};
+    unsigned char header_req[] = {0, 3, 0, 0, 0, 9, 1, 16, 0x9c, 0x42, 0, 1, 2, 0, 1};
+    int writes = 0;
+    int fds[2];
+    int len;
+
+    /* model with a uint16 point at offset 0 and an int32 point at offset 1 */
+    memset(defs, 0, sizeof(defs));
+    memset(&block_def, 0, sizeof(block_def));
+    memset(points, 0, sizeof(points));
+    defs[0].id = "A";
+    defs[0].type = suns_data_type_find("uint16");
+    defs[0].len = 1;
+    defs[1].id = "B";
+    defs[1].offset = 1;
+    defs[1].type = suns_data_type_find("int32");
+    defs[1].len = 2;
+    block_def.len = 3;
+
+    model = (suns_model_t *) calloc(1, sizeof(suns_model_t));
+    block = (suns_block_t *) calloc(1, sizeof(suns_block_t));
+    model->id = 64001;
+    model->len = 3;
+    model->addr = 50070;
+    model->block_count = 1;
+    model->blocks[0] = block;
+    block->model = model;
+    block->block_def = &block_def;
+    block->addr = 50070;
+    block->points = &points[0];
+    points[0].block = block;
+    points[0].point_def = &defs[0];
+    points[0].addr = 50070;
+    points[0].value_base.u16 = 1234;
+    points[0].next = &points[1];
+    points[1].block = block;
+    points[1].point_def = &defs[1];
+    points[1].addr = 50071;
+    points[1].value_base.s32 = -5;
+
+    server = suns_server_alloc(1);
+    CuAssertTrue(tc, suns_server_model_add(server, model) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_server_map_build(server, 40000) == SUNS_ERR_OK);
+    CuAssertTrue(tc, server->len == 9);
+    suns_server_write_func_set(server, test_server_write, &writes);
+
+    CuAssertTrue(tc, socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CuAssertTrue(tc, suns_server_tcp_attach(server, fds[0]) == SUNS_ERR_OK);
+
+    /* marker, model header, encoded points and end model */
+    len = test_server_request(server, fds[1], read_req, sizeof(read_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 27, len);
+    CuAssertTrue(tc, memcmp(&rsp[9], "SunS", 4) == 0);
+    CuAssertTrue(tc, suns_modbus_to_16(&rsp[13]) == 64001);
+    CuAssertTrue(tc, suns_modbus_to_16(&rsp[15]) == 3);
+    CuAssertTrue(tc, suns_modbus_to_16(&rsp[17]) == 1234);
+    CuAssertTrue(tc, (int32_t) suns_modbus_to_32(&rsp[19]) == -5);
+    CuAssertTrue(tc, suns_modbus_to_16(&rsp[23]) == SUNS_MODEL_ID_END);
+
+    /* point writes are decoded into the model */
+    len = test_server_request(server, fds[1], write_req, sizeof(write_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 12, len);
+    CuAssertTrue(tc, points[1].value_base.s32 == -2);
+    CuAssertTrue(tc, points[1].dirty == 1);
+    CuAssertTrue(tc, writes == 1);
+
+    /* model headers are not writable */
+    len = test_server_request(server, fds[1], header_req, sizeof(header_req), rsp, sizeof(rsp));
+    CuAssertIntEquals(tc, 9, len);
+    CuAssertTrue(tc, rsp[7] == 0x90 && rsp[8] == SUNS_MODBUS_EXCEPT_ADDR);
+
+    /* updated values are re-encoded */
+    points[0].value_base.u16 = 42;
+    CuAssertTrue(tc, suns_server_model_update(server, model) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_to_16(&server->image[8]) == 42);
+
+    close(fds[1]);
+    suns_server_free(server);
+    free(block);
+    free(model);
+}
+
+void
+test_cache_io(suns_modbus_io_t *io, test_modbus_t *test)
+{
+    memset(io, 0, sizeof(*io));
+    io->magic = SUNS_MODBUS_IO_MAGIC;
+    io->read = test_modbus_read;
+    io->write = test_modbus_write;
+    io->prot = test;
+}
+
+void
+test_suns_modbus_cache(CuTest* tc)
+{
+    suns_modbus_io_t io;
+    suns_modbus_cache_stats_t stats;
+    test_modbus_t test = {SUNS_ERR_OK, 0, 0, 0, 0};
+    unsigned char buf[64];
+    suns_err_t err;
+
+    test_cache_io(&io, &test);
+    CuAssertTrue(tc, suns_modbus_cache_open(&io, 1000) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_cache_ttl_set(&io, 40100, 10, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_cache_ttl_set(&io, 40200, 10, 5) == SUNS_ERR_OK);
+
+    /* reads contained in a cached range are served from the cache */
+    err = io.read(io.prot, 40000, 10, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+    err = io.read(io.prot, 40002, 4, buf, 0);
+    CuAssertTrue(tc, err == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_to_16(buf) == 40002);
+    CuAssertTrue(tc, suns_modbus_to_16(&buf[6]) == 40005);
+    CuAssertIntEquals(tc, 1, test.requests);
+
+    /* reads extending past a cached range go upstream */
+    err = io.read(io.prot, 40005, 10, buf, 0);
+    CuAssertIntEquals(tc, 2, test.requests);
+
+    /* ranges with a ttl of 0 are not cached */
+    io.read(io.prot, 40100, 2, buf, 0);
+    io.read(io.prot, 40100, 2, buf, 0);
+    CuAssertIntEquals(tc, 4, test.requests);
+
+    /* expired ranges are read again */
+    io.read(io.prot, 40200, 2, buf, 0);
+    usleep(10 * 1000);
+    io.read(io.prot, 40200, 2, buf, 0);
+    CuAssertIntEquals(tc, 6, test.requests);
+
+    /* writes invalidate overlapping ranges */
+    CuAssertTrue(tc, io.write(io.prot, 40003, 1, buf, 0) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 1, test.writes);
+    io.read(io.prot, 40000, 4, buf, 0);
+    CuAssertIntEquals(tc, 7, test.requests);
+
+    /* errors are not cached */
+    test.err = SUNS_ERR_TIMEOUT;
+    CuAssertTrue(tc, io.read(io.prot, 40300, 2, buf, 0) == SUNS_ERR_TIMEOUT);
+    test.err = SUNS_ERR_OK;
+    CuAssertTrue(tc, io.read(io.prot, 40300, 2, buf, 0) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 9, test.requests);
+
+    CuAssertTrue(tc, suns_modbus_cache_stats_get(&io, &stats) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 1, stats.hits);
+    CuAssertIntEquals(tc, 7, stats.misses);
+    CuAssertIntEquals(tc, 2, stats.uncached);
+    CuAssertIntEquals(tc, 1, stats.invalidations);
+
+    io.close(&io);
+    CuAssertTrue(tc, io.read == NULL);
+}
+
+#define TEST_CACHE_THREADS      4
+
+typedef struct {
+    suns_modbus_io_t *io;
+    suns_err_t err;
+    unsigned char buf[16];
+} test_cache_thread_t;
+
+void *
+test_cache_thread(void *arg)
+{
+    test_cache_thread_t *t = (test_cache_thread_t *) arg;
+
+    t->err = t->io->read(t->io->prot, 40000, 8, t->buf, 0);
+    return NULL;
+}
+
+void
+test_suns_modbus_cache_single_flight(CuTest* tc)
+{
+    suns_modbus_io_t io;
+    suns_modbus_cache_stats_t stats;
+    test_modbus_t test = {SUNS_ERR_OK, 0, 0, 50, 0};
+    test_cache_thread_t threads[TEST_CACHE_THREADS];
+    pthread_t ids[TEST_CACHE_THREADS];
+    int i;
+
+    test_cache_io(&io, &test);
+    CuAssertTrue(tc, suns_modbus_cache_open(&io, 1000) == SUNS_ERR_OK);
+
+    /* concurrent identical reads share one upstream transaction */
+    for (i = 0; i < TEST_CACHE_THREADS; i++) {
+        threads[i].io = &io;
+        pthread_create(&ids[i], NULL, test_cache_thread, &threads[i]);
+    }
+    for (i = 0; i < TEST_CACHE_THREADS; i++) {
+        pthread_join(ids[i], NULL);
+        CuAssertTrue(tc, threads[i].err == SUNS_ERR_OK);
+        CuAssertTrue(tc, suns_modbus_to_16(&threads[i].buf[14]) == 40007);
+    }
+    CuAssertIntEquals(tc, 1, test.requests);
+
+    suns_modbus_cache_stats_get(&io, &stats);
+    CuAssertIntEquals(tc, 1, stats.misses);
+    CuAssertIntEquals(tc, TEST_CACHE_THREADS - 1, stats.collapsed + stats.hits);
+
+    io.close(&io);
+}
+
+void
+test_suns_modbus_sim_bounds(CuTest* tc)
+{
+    suns_device_t *device;
+    uint16_t map[10];
+    unsigned char buf[20];
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        map[i] = 0x100 + i;
+    }
+
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_sim(device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+
+    /* last register is readable, one past the end is not */
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40006, 4, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_to_16(&buf[6]) == 0x109);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40008, 4, buf, 0) == SUNS_ERR_RANGE);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 39999, 2, buf, 0) == SUNS_ERR_RANGE);
+
+    suns_modbus_from_16(0xbeef, buf);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40009, 1, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40009, 2, buf, 0) == SUNS_ERR_RANGE);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40009, 1, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_to_16(buf) == 0xbeef);
+
+    device->modbus_io.close(&device->modbus_io);
+    suns_device_free(device);
+}
+
+#define TEST_SIM_DEVICES        2000
+#define TEST_SIM_REGS           200
+
+void
+test_suns_modbus_sim_file(CuTest* tc)
+{
+    char path[] = "/tmp/suns_sim_XXXXXX";
+    suns_modbus_sim_file_t *file;
+    suns_device_t *device;
+    unsigned char *regs;
+    unsigned char buf[TEST_SIM_REGS * 2];
+    int fd;
+    int i;
+
+    fd = mkstemp(path);
+    CuAssertTrue(tc, fd >= 0);
+    close(fd);
+
+    CuAssertTrue(tc, suns_modbus_sim_file_create(path, 40000, TEST_SIM_DEVICES, TEST_SIM_REGS) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_sim_file_open(&file, path, 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, file->hdr->device_count == TEST_SIM_DEVICES);
+
+    regs = suns_modbus_sim_file_regs(file, TEST_SIM_DEVICES - 1);
+    CuAssertTrue(tc, regs != NULL);
+    CuAssertTrue(tc, suns_modbus_sim_file_regs(file, TEST_SIM_DEVICES) == NULL);
+    memcpy(regs, "SunS", 4);
+    for (i = 2; i < TEST_SIM_REGS; i++) {
+        suns_modbus_from_16(i, &regs[i * 2]);
+    }
+
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_sim_file(device, file, TEST_SIM_DEVICES - 1, 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40000, TEST_SIM_REGS, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, memcmp(buf, "SunS", 4) == 0);
+    CuAssertTrue(tc, suns_modbus_to_16(&buf[(TEST_SIM_REGS - 1) * 2]) == TEST_SIM_REGS - 1);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40001, TEST_SIM_REGS, buf, 0) == SUNS_ERR_RANGE);
+
+    /* shared mappings write back to the file */
+    suns_modbus_from_16(0x1234, buf);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40010, 1, buf, 0) == SUNS_ERR_OK);
+    device->modbus_io.close(&device->modbus_io);
+    suns_modbus_sim_file_close(file);
+
+    CuAssertTrue(tc, suns_modbus_sim_file_open(&file, path, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_sim_file(device, file, TEST_SIM_DEVICES - 1, 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40010, 1, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_to_16(buf) == 0x1234);
+
+    /* private mappings do not */
+    suns_modbus_from_16(0x5678, buf);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40010, 1, buf, 0) == SUNS_ERR_OK);
+    device->modbus_io.close(&device->modbus_io);
+    suns_modbus_sim_file_close(file);
+
+    CuAssertTrue(tc, suns_modbus_sim_file_open(&file, path, 0) == SUNS_ERR_OK);
+    regs = suns_modbus_sim_file_regs(file, TEST_SIM_DEVICES - 1);
+    CuAssertTrue(tc, suns_modbus_to_16(&regs[20]) == 0x1234);
+    suns_modbus_sim_file_close(file);
+
+    suns_device_free(device);
+    unlink(path);
+}
+
+/* run a fault sequence over the test transport and record the results */
+void
+test_fault_run(suns_modbus_fault_config_t *config, suns_err_t *results, int count, suns_modbus_fault_stats_t *stats)
+{
+    suns_modbus_io_t io;
+    test_modbus_t test = {SUNS_ERR_OK, 0, 0, 0, 0};
+    unsigned char buf[250];
+    int i;
+
+    test_cache_io(&io, &test);
+    suns_modbus_fault_open(&io, config);
+    for (i = 0; i < count; i++) {
+        results[i] = io.read(io.prot, 40000, 10, buf, 100);
+    }
+    suns_modbus_fault_stats_get(&io, stats);
+    io.close(&io);
+}
+
+#define TEST_FAULT_REQUESTS     1000
+
+void
+test_suns_modbus_fault(CuTest* tc)
+{
+    suns_modbus_fault_config_t config;
+    suns_modbus_fault_stats_t stats;
+    suns_modbus_fault_stats_t stats2;
+    suns_modbus_io_t io;
+    test_modbus_t test = {SUNS_ERR_OK, 0, 0, 0, 0};
+    suns_err_t results[TEST_FAULT_REQUESTS];
+    suns_err_t results2[TEST_FAULT_REQUESTS];
+    int i;
+
+    /* serialization delay for a 10 register read at 9600 baud */
+    suns_modbus_fault_config_init(&config);
+    config.baudrate = 9600;
+    config.virtual_time = 1;
+    test_fault_run(&config, results, 1, &stats);
+    CuAssertTrue(tc, results[0] == SUNS_ERR_OK);
+    CuAssertTrue(tc, stats.clock == (8 + 5 + 20 + 7) * 11 * 1000000ULL / 9600);
+
+    /* the same seed gives the same faults and latencies */
+    config.seed = 42;
+    config.latency_dist = SUNS_FAULT_LATENCY_EXP;
+    config.latency_min = 1000;
+    config.latency_mean = 20000;
+    config.drop_ppm = 20000;
+    config.crc_ppm = 10000;
+    config.except_ppm = 5000;
+    test_fault_run(&config, results, TEST_FAULT_REQUESTS, &stats);
+    test_fault_run(&config, results2, TEST_FAULT_REQUESTS, &stats2);
+    CuAssertTrue(tc, memcmp(results, results2, sizeof(results)) == 0);
+    CuAssertTrue(tc, stats.clock == stats2.clock);
+    CuAssertTrue(tc, stats.drops > 0 && stats.crc_errors > 0 && stats.exceptions > 0);
+    CuAssertTrue(tc, stats.drops + stats.crc_errors + stats.exceptions < TEST_FAULT_REQUESTS / 10);
+    for (i = 0; i < TEST_FAULT_REQUESTS; i++) {
+        CuAssertTrue(tc, results[i] == SUNS_ERR_OK || results[i] == SUNS_ERR_TIMEOUT ||
+                         results[i] == SUNS_ERR_MODBUS_CRC || results[i] == SUNS_ERR_MODBUS_EXCEPT);
+    }
+
+    /* a different seed gives a different sequence */
+    config.seed = 43;
+    test_fault_run(&config, results2, TEST_FAULT_REQUESTS, &stats2);
+    CuAssertTrue(tc, stats.clock != stats2.clock);
+
+    /* dropped requests cost the request timeout */
+    suns_modbus_fault_config_init(&config);
+    config.drop_ppm = SUNS_FAULT_PPM;
+    config.virtual_time = 1;
+    test_fault_run(&config, results, 3, &stats);
+    CuAssertTrue(tc, results[0] == SUNS_ERR_TIMEOUT);
+    CuAssertTrue(tc, stats.clock == 3 * 100 * 1000);
+
+    /* probabilities above one are rejected */
+    test_cache_io(&io, &test);
+    config.drop_ppm = SUNS_FAULT_PPM + 1;
+    CuAssertTrue(tc, suns_modbus_fault_open(&io, &config) == SUNS_ERR_RANGE);
+    CuAssertTrue(tc, io.read == test_modbus_read);
+}
+
+void
+test_suns_modbus_record(CuTest* tc)
+{
+    char path[] = "/tmp/suns_rec_XXXXXX";
+    suns_device_t *device;
+    suns_modbus_replay_stats_t stats;
+    test_modbus_t test;
+    uint16_t map[20];
+    unsigned char buf[40];
+    unsigned char replay_buf[40];
+    uint64_t start;
+    int fd;
+    int i;
+
+    fd = mkstemp(path);
+    CuAssertTrue(tc, fd >= 0);
+    close(fd);
+
+    for (i = 0; i < 20; i++) {
+        map[i] = 0x200 + i;
+    }
+
+    /* capture reads, writes and errors from a simulated device */
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_sim(device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_record_start(device, path) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 10, buf, 0) == SUNS_ERR_OK);
+    usleep(20 * 1000);
+    suns_modbus_from_16(0x4321, buf);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40002, 1, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 10, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40018, 4, buf, 0) == SUNS_ERR_RANGE);
+    CuAssertTrue(tc, suns_device_record_stop(device) == SUNS_ERR_OK);
+    CuAssertTrue(tc, device->modbus_io.read != NULL);
+    device->modbus_io.close(&device->modbus_io);
+    suns_device_free(device);
+
+    /* replay returns the captured responses in order */
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_replay(device, path, SUNS_REPLAY_FAST) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 10, replay_buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_to_16(&replay_buf[4]) == 0x202);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40002, 1, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 10, replay_buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_modbus_to_16(&replay_buf[4]) == 0x4321);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40018, 4, replay_buf, 0) == SUNS_ERR_RANGE);
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40100, 4, replay_buf, 0) == SUNS_ERR_NOT_FOUND);
+    suns_modbus_replay_stats_get(&device->modbus_io, &stats);
+    CuAssertIntEquals(tc, 4, stats.records);
+    CuAssertIntEquals(tc, 4, stats.served);
+    CuAssertIntEquals(tc, 1, stats.missed);
+    device->modbus_io.close(&device->modbus_io);
+
+    /* realtime replay keeps the captured spacing */
+    CuAssertTrue(tc, suns_device_replay(device, path, SUNS_REPLAY_REALTIME) == SUNS_ERR_OK);
+    start = suns_time_us();
+    suns_device_modbus_read(device, 40000, 10, replay_buf, 0);
+    suns_device_modbus_write(device, 40002, 1, buf, 0);
+    CuAssertTrue(tc, suns_time_us() - start >= 20 * 1000);
+    device->modbus_io.close(&device->modbus_io);
+
+    /* capture write errors are reported when the capture stops, the reads still succeed */
+    CuAssertTrue(tc, suns_device_sim(device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_record_start(device, "/dev/full") == SUNS_ERR_OK);
+    for (i = 0; i < 500; i++) {
+        CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 10, buf, 0) == SUNS_ERR_OK);
+    }
+    CuAssertTrue(tc, suns_device_record_stop(device) == SUNS_ERR_ERRNO_BASE + ENOSPC);
+    CuAssertTrue(tc, device->modbus_io.read != NULL);
+    device->modbus_io.close(&device->modbus_io);
+
+    /* closing a failed capture still closes the wrapped transport */
+    memset(&test, 0, sizeof(test));
+    memset(&device->modbus_io, 0, sizeof(device->modbus_io));
+    device->modbus_io.read = test_modbus_read;
+    device->modbus_io.close = test_modbus_close;
+    device->modbus_io.prot = &test;
+    CuAssertTrue(tc, suns_device_record_start(device, "/dev/full") == SUNS_ERR_OK);
+    for (i = 0; i < 500; i++) {
+        CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 10, buf, 0) == SUNS_ERR_OK);
+    }
+    CuAssertTrue(tc, device->modbus_io.close(&device->modbus_io) == SUNS_ERR_ERRNO_BASE + ENOSPC);
+    CuAssertIntEquals(tc, 1, test.closes);
+    memset(&device->modbus_io, 0, sizeof(device->modbus_io));
+
+    /* read failures are not reported as allocation failures */
+    CuAssertTrue(tc, suns_device_replay(device, "/tmp", SUNS_REPLAY_FAST) == SUNS_ERR_ERRNO_BASE + EISDIR);
+
+    suns_device_free(device);
+    unlink(path);
+}
+
+void
+test_suns_stats_hist(CuTest* tc)
+{
+    suns_stats_t stats;
+    uint64_t v;
+    uint32_t mid;
+    uint16_t index;
+    uint16_t last = 0;
+
+    /* buckets are monotonic and within 1/16 of the value */
+    for (v = 0; v < 0xffffffff; v = v * 5 / 4 + 1) {
+        index = suns_stats_hist_index(v);
+        CuAssertTrue(tc, index < SUNS_STATS_HIST_BUCKETS);
+        CuAssertTrue(tc, index >= last);
+        mid = suns_stats_hist_value(index);
+        CuAssertTrue(tc, (mid >= v ? mid - v : v - mid) <= v / 16);
+        last = index;
+    }
+    CuAssertTrue(tc, suns_stats_hist_index(0xffffffff) == SUNS_STATS_HIST_BUCKETS - 1);
+
+    memset(&stats, 0, sizeof(stats));
+    for (v = 1; v <= 100; v++) {
+        suns_stats_record(&stats, SUNS_STATS_READ, 1, 2, SUNS_ERR_OK, v * 1000);
+    }
+    CuAssertTrue(tc, stats.latency_max == 100000);
+    mid = suns_stats_percentile(&stats, 50);
+    CuAssertTrue(tc, mid > 47000 && mid < 53000);
+    mid = suns_stats_percentile(&stats, 99);
+    CuAssertTrue(tc, mid > 95000 && mid < 103000);
+}
+
+void
+test_suns_device_stats(CuTest* tc)
+{
+    suns_device_t *device;
+    suns_stats_t stats;
+    test_modbus_t test = {SUNS_ERR_OK, 0, 32, 0, 0};
+    unsigned char buf[256];
+
+    device = suns_device_alloc();
+    device->modbus_io.read = test_modbus_read;
+    device->modbus_io.write = test_modbus_write;
+    device->modbus_io.prot = &test;
+
+    /* 64 register read is rejected, retried at 32 and completed in two requests */
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 64, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40000, 2, buf, 0) == SUNS_ERR_OK);
+    test.err = SUNS_ERR_TIMEOUT;
+    CuAssertTrue(tc, suns_device_modbus_read(device, 40000, 2, buf, 0) == SUNS_ERR_TIMEOUT);
+
+    CuAssertTrue(tc, suns_device_stats_get(device, &stats) == SUNS_ERR_OK);
+    CuAssertTrue(tc, stats.requests == 5);
+    CuAssertTrue(tc, stats.reads == 4);
+    CuAssertTrue(tc, stats.writes == 1);
+    CuAssertTrue(tc, stats.retries == 1);
+    CuAssertTrue(tc, stats.exceptions == 1);
+    CuAssertTrue(tc, stats.timeouts == 1);
+    CuAssertTrue(tc, stats.registers == 66);
+    CuAssertTrue(tc, stats.bytes == 132);
+
+    CuAssertTrue(tc, suns_device_stats_reset(device) == SUNS_ERR_OK);
+    suns_device_stats_get(device, &stats);
+    CuAssertTrue(tc, stats.requests == 0 && stats.hist[0] == 0);
+
+    device->modbus_io.read = NULL;
+    device->modbus_io.write = NULL;
+    device->modbus_io.prot = NULL;
+    suns_device_free(device);
+}
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+
+#include "test_model.h"
+
+extern suns_model_def_t *suns_model_def_list;
+extern suns_model_def_t *suns_model_def_find(suns_model_def_t *list, uint16_t id);
+
+/* controls subset with max power and connect points */
+const char test_group_model[] =
+    "<sunSpecModels><model id=\"64123\" len=\"10\" name=\"controls\"><block len=\"10\">"
+    "<point id=\"Conn_WinTms\" offset=\"0\" type=\"uint16\"/>"
+    "<point id=\"Conn_RvrtTms\" offset=\"1\" type=\"uint16\"/>"
+    "<point id=\"Conn\" offset=\"2\" type=\"enum16\"/>"
+    "<point id=\"WMaxLimPct\" offset=\"3\" type=\"uint16\" sf=\"WMaxLimPct_SF\"/>"
+    "<point id=\"WMaxLimPct_WinTms\" offset=\"4\" type=\"uint16\"/>"
+    "<point id=\"WMaxLimPct_RvrtTms\" offset=\"5\" type=\"uint16\"/>"
+    "<point id=\"WMaxLimPct_RmpTms\" offset=\"6\" type=\"uint16\"/>"
+    "<point id=\"WMaxLim_Ena\" offset=\"7\" type=\"enum16\"/>"
+    "<point id=\"WMaxLimPct_SF\" offset=\"8\" type=\"sunssf\"/>"
+    "<point id=\"Pad\" offset=\"9\" type=\"pad\"/>"
+    "</block></model></sunSpecModels>";
+
+/* load a model definition from xml unless it is already loaded */
+int
+test_model_load(const char *xml, uint16_t id)
+{
+    char path[] = "/tmp/suns_model_XXXXXX";
+    int fd;
+
+    if (suns_model_def_find(__atomic_load_n(&suns_model_def_list, __ATOMIC_ACQUIRE), id) == NULL) {
+        if ((fd = mkstemp(path)) < 0) {
+            return -1;
+        }
+        if (write(fd, xml, strlen(xml)) == (ssize_t) strlen(xml)) {
+            suns_model_def_load(path);
+        }
+        close(fd);
+        unlink(path);
+    }
+
+    return suns_model_def_get(id) != NULL ? 0 : -1;
+}
+
+int
+test_group_model_load()
+{
+    return test_model_load(test_group_model, TEST_GROUP_MODEL_ID);
+}
+
+#define TEST_SNAP_READERS               4
+#define TEST_SNAP_UPDATES               200000
+
+typedef struct _test_snap_t {
+    suns_model_t *model;
+    int stop;
+    int torn;
+    uint32_t snapshots;
+} test_snap_t;
+
+void *
+test_snap_reader(void *arg)
+{
+    test_snap_t *t = (test_snap_t *) arg;
+    unsigned char buf[20];
+    uint16_t first;
+    int i;
+
+    while (!__atomic_load_n(&t->stop, __ATOMIC_RELAXED)) {
+        if (suns_model_snapshot(t->model, buf, sizeof(buf), NULL) != SUNS_ERR_OK) {
+            t->torn++;
+            break;
+        }
+        /* every update writes the same value to all registers */
+        first = suns_modbus_to_16(buf);
+        for (i = 1; i < 10; i++) {
+            if (suns_modbus_to_16(&buf[i * 2]) != first) {
+                t->torn++;
+                break;
+            }
+        }
+        t->snapshots++;
+    }
+
+    return NULL;
+}
+
+#define TEST_SNAP_MAX_MODEL_ID          64127
+
+/* one register repeating block, so a model can be any length */
+const char test_snap_max_model[] =
+    "<sunSpecModels><model id=\"64127\" len=\"1\" name=\"snap_max\">"
+    "<block len=\"1\" type=\"repeating\"><point id=\"V\" offset=\"0\" type=\"uint16\"/></block>"
+    "</model></sunSpecModels>";
+
+void
+test_suns_model_snapshot(CuTest* tc)
+{
+    suns_device_t *device;
+    suns_model_t *model;
+    test_snap_t readers[TEST_SNAP_READERS];
+    pthread_t ids[TEST_SNAP_READERS];
+    suns_value_t value;
+    unsigned char buf[20];
+    unsigned char *max_buf;
+    uint64_t time;
+    uint16_t map[14];
+    int i;
+    int j;
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    memset(map, 0, sizeof(map));
+    map[7] = 77;                /* WMaxLimPct */
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_sim(device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_model_add(device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+
+    /* nothing published before the first read */
+    CuAssertTrue(tc, suns_model_snapshot(model, buf, 10, NULL) == SUNS_ERR_BUF_SIZE);
+    CuAssertTrue(tc, suns_model_snapshot(model, buf, sizeof(buf), &time) == SUNS_ERR_OK);
+    CuAssertTrue(tc, time == 0);
+
+    CuAssertTrue(tc, suns_model_read(model) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_model_snapshot(model, buf, sizeof(buf), &time) == SUNS_ERR_OK);
+    CuAssertTrue(tc, time != 0);
+    CuAssertTrue(tc, suns_model_snapshot_point(suns_model_get_point(model, "WMaxLimPct", 0), buf, &value) ==
+                 SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 77, value.u16);
+
+    /* readers racing a writer only ever see whole updates */
+    memset(buf, 0, sizeof(buf));
+    suns_model_update(model, buf);
+    for (i = 0; i < TEST_SNAP_READERS; i++) {
+        memset(&readers[i], 0, sizeof(readers[i]));
+        readers[i].model = model;
+        pthread_create(&ids[i], NULL, test_snap_reader, &readers[i]);
+    }
+    for (i = 0; i < TEST_SNAP_UPDATES; i++) {
+        for (j = 0; j < 10; j++) {
+            suns_modbus_from_16((uint16_t) i, &buf[j * 2]);
+        }
+        suns_model_update(model, buf);
+    }
+    for (i = 0; i < TEST_SNAP_READERS; i++) {
+        __atomic_store_n(&readers[i].stop, 1, __ATOMIC_RELAXED);
+        pthread_join(ids[i], NULL);
+        CuAssertIntEquals(tc, 0, readers[i].torn);
+        CuAssertTrue(tc, readers[i].snapshots > 0);
+    }
+    CuAssertTrue(tc, suns_model_snapshot(model, buf, sizeof(buf), NULL) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, (uint16_t) (TEST_SNAP_UPDATES - 1), suns_modbus_to_16(&buf[18]));
+
+    /* the largest model a device can report still has a snapshot */
+    CuAssertTrue(tc, test_model_load(test_snap_max_model, TEST_SNAP_MAX_MODEL_ID) == 0);
+    CuAssertTrue(tc, suns_model_add(device, TEST_SNAP_MAX_MODEL_ID, SUNS_MODEL_LEN_MAX, 50000, &model) == SUNS_ERR_OK);
+    max_buf = malloc(SUNS_MODEL_LEN_MAX * 2);
+    CuAssertTrue(tc, max_buf != NULL);
+    suns_modbus_from_16(0x1234, buf);
+    suns_model_publish(model, SUNS_MODEL_LEN_MAX - 1, buf, 1);
+    CuAssertTrue(tc, suns_model_snapshot(model, max_buf, SUNS_MODEL_LEN_MAX * 2, &time) == SUNS_ERR_OK);
+    CuAssertTrue(tc, time != 0);
+    CuAssertIntEquals(tc, 0x1234, suns_modbus_to_16(&max_buf[(SUNS_MODEL_LEN_MAX - 1) * 2]));
+    free(max_buf);
+
+    device->modbus_io.close(&device->modbus_io);
+    suns_device_free(device);
+}
+
+#define TEST_STRESS_THREADS             8
+#define TEST_STRESS_LOOPS               200
+#define TEST_STRESS_MODEL_ID            64125
+
+const char test_stress_model[] =
+    "<sunSpecModels><model id=\"64125\" len=\"2\" name=\"stress\"><block len=\"2\">"
+    "<point id=\"A\" offset=\"0\" type=\"uint16\"/>"
+    "<point id=\"B\" offset=\"1\" type=\"uint16\"/>"
+    "</block></model></sunSpecModels>";
+
+typedef struct _test_stress_t {
+    char *path;
+    uint16_t index;
+    uint32_t scans;
+    uint32_t reads;
+    uint32_t errors;
+    uint32_t found;
+} test_stress_t;
+
+void *
+test_stress_thread(void *arg)
+{
+    test_stress_t *t = (test_stress_t *) arg;
+    suns_device_t *device;
+    suns_model_t *model;
+    unsigned char buf[20];
+    uint16_t map[18];
+    int i;
+
+    /* SunS, controls model, end marker */
+    memset(map, 0, sizeof(map));
+    map[0] = 0x5375;
+    map[1] = 0x6e53;
+    map[2] = TEST_GROUP_MODEL_ID;
+    map[3] = 10;
+    map[7] = t->index;          /* WMaxLimPct */
+    map[14] = 0xffff;
+    device = suns_device_alloc();
+    if (suns_device_sim(device, 40000, map, sizeof(map), 1) != SUNS_ERR_OK) {
+        t->errors++;
+        return NULL;
+    }
+
+    for (i = 0; i < TEST_STRESS_LOOPS; i++) {
+        /* every thread races to load the same definitions part way through */
+        if (i == t->index * 5) {
+            suns_model_def_load(t->path);
+        }
+        if (suns_model_def_find(__atomic_load_n(&suns_model_def_list, __ATOMIC_ACQUIRE), TEST_STRESS_MODEL_ID)) {
+            t->found++;
+        }
+
+        suns_device_free_models(device);
+        if (suns_device_scan(device) != SUNS_ERR_OK ||
+            (model = suns_device_get_model(device, TEST_GROUP_MODEL_ID, NULL, 1)) == NULL) {
+            t->errors++;
+            continue;
+        }
+        t->scans++;
+        if (suns_model_read(model) != SUNS_ERR_OK ||
+            suns_model_snapshot(model, buf, sizeof(buf), NULL) != SUNS_ERR_OK ||
+            suns_modbus_to_16(&buf[6]) != t->index) {
+            t->errors++;
+            continue;
+        }
+        t->reads++;
+    }
+
+    device->modbus_io.close(&device->modbus_io);
+    suns_device_free(device);
+
+    return NULL;
+}
+
+void
+test_suns_thread_stress(CuTest* tc)
+{
+    char path[] = "/tmp/suns_stress_XXXXXX";
+    test_stress_t threads[TEST_STRESS_THREADS];
+    pthread_t ids[TEST_STRESS_THREADS];
+    suns_model_def_t *model_def;
+    int count = 0;
+    int fd;
+    int i;
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    fd = mkstemp(path);
+    CuAssertTrue(tc, fd >= 0);
+    CuAssertTrue(tc, write(fd, test_stress_model, strlen(test_stress_model)) == (ssize_t) strlen(test_stress_model));
+    close(fd);
+
+    /* scan, poll and load definitions from many threads at once */
+    for (i = 0; i < TEST_STRESS_THREADS; i++) {
+        memset(&threads[i], 0, sizeof(threads[i]));
+        threads[i].path = path;
+        threads[i].index = i;
+        pthread_create(&ids[i], NULL, test_stress_thread, &threads[i]);
+    }
+    for (i = 0; i < TEST_STRESS_THREADS; i++) {
+        pthread_join(ids[i], NULL);
+        CuAssertIntEquals(tc, 0, threads[i].errors);
+        CuAssertIntEquals(tc, TEST_STRESS_LOOPS, threads[i].scans);
+        CuAssertIntEquals(tc, TEST_STRESS_LOOPS, threads[i].reads);
+        /* visible to a thread from its own load on */
+        CuAssertTrue(tc, threads[i].found >= TEST_STRESS_LOOPS - i * 5);
+    }
+    unlink(path);
+
+    /* concurrent loads of the same file publish one definition */
+    for (model_def = suns_model_def_list; model_def; model_def = model_def->next) {
+        if (model_def->id == TEST_STRESS_MODEL_ID) {
+            count++;
+        }
+    }
+    CuAssertIntEquals(tc, 1, count);
+    CuAssertTrue(tc, suns_model_def_get(TEST_STRESS_MODEL_ID) != NULL);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+
+#include "test_model.h"
+
+void
+test_suns_ring(CuTest* tc)
+{
+    suns_device_t *device;
+    suns_model_t *model;
+    suns_ring_t *lim;
+    suns_ring_t *tms;
+    suns_ring_slice_t slices[2];
+    unsigned char buf[20];
+    uint32_t bytes;
+    int i;
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_model_add(device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+
+    /* budget covers one ring of 4 samples and one of 8 */
+    bytes = SUNS_RING_BYTES(4) + SUNS_RING_BYTES(8);
+    CuAssertTrue(tc, suns_device_ring_budget(device, bytes) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_ring_point(model, "WMaxLimPct", 0, 4, &lim) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_ring_point(model, "WMaxLimPct_WinTms", 0, 9, NULL) == SUNS_ERR_BUDGET);
+    CuAssertTrue(tc, suns_ring_point(model, "WMaxLimPct_WinTms", 0, 8, &tms) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, bytes, device->ring_bytes);
+    CuAssertTrue(tc, suns_ring_point(model, "NoSuchPoint", 0, 4, NULL) == SUNS_ERR_NOT_FOUND);
+    CuAssertTrue(tc, suns_device_ring_budget(device, bytes - 1) == SUNS_ERR_BUDGET);
+
+    /* every update appends, the oldest samples are overwritten */
+    memset(buf, 0, sizeof(buf));
+    suns_modbus_from_16(0xffff, &buf[16]);      /* WMaxLimPct_SF -1 */
+    for (i = 0; i < 6; i++) {
+        suns_modbus_from_16(100 + i, &buf[6]);
+        suns_model_update(model, buf);
+    }
+    CuAssertIntEquals(tc, 4, lim->count);
+    CuAssertIntEquals(tc, 6, tms->count);
+    CuAssertIntEquals(tc, 4, suns_ring_range(lim, 0, UINT64_MAX, slices));
+    CuAssertIntEquals(tc, 2, slices[0].count);
+    CuAssertIntEquals(tc, 2, slices[1].count);
+    CuAssertIntEquals(tc, 102, slices[0].samples[0].value.u16);
+    CuAssertIntEquals(tc, -1, slices[0].samples[0].sf);
+    CuAssertIntEquals(tc, 105, slices[1].samples[1].value.u16);
+
+    /* time range across the wrap */
+    for (i = 0; i < 4; i++) {
+        suns_modbus_from_16(200 + i, &buf[6]);
+        suns_model_update(model, buf);
+        lim->samples[(lim->head + 3) % 4].time = 1000 * (i + 1);
+    }
+    CuAssertIntEquals(tc, 0, suns_ring_range(lim, 0, 999, slices));
+    CuAssertIntEquals(tc, 0, suns_ring_range(lim, 4001, 5000, slices));
+    CuAssertIntEquals(tc, 1, suns_ring_range(lim, 2000, 2000, slices));
+    CuAssertIntEquals(tc, 201, slices[0].samples[0].value.u16);
+    CuAssertIntEquals(tc, 3, suns_ring_range(lim, 1500, 4000, slices));
+    CuAssertIntEquals(tc, 3, slices[0].count + slices[1].count);
+    CuAssertIntEquals(tc, 201, slices[0].samples[0].value.u16);
+
+    CuAssertTrue(tc, suns_ring_remove(model, tms) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, SUNS_RING_BYTES(4), device->ring_bytes);
+
+    suns_device_free(device);
+}
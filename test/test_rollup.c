@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+#include "sunspec_time.h"
+
+#include "test_model.h"
+
+#define TEST_ROLLUP_MODEL_ID            64126
+
+/* meter subset with a power reading and accumulators */
+const char test_rollup_model[] =
+    "<sunSpecModels><model id=\"64126\" len=\"6\" name=\"meter\"><block len=\"6\">"
+    "<point id=\"W\" offset=\"0\" type=\"int16\" sf=\"W_SF\"/>"
+    "<point id=\"Evt\" offset=\"1\" type=\"acc16\"/>"
+    "<point id=\"TotWh\" offset=\"2\" type=\"acc32\" sf=\"TotWh_SF\"/>"
+    "<point id=\"W_SF\" offset=\"4\" type=\"sunssf\"/>"
+    "<point id=\"TotWh_SF\" offset=\"5\" type=\"sunssf\"/>"
+    "</block></model></sunSpecModels>";
+
+typedef struct _test_rollup_t {
+    int calls;
+    int count;
+    suns_rollup_result_t results[4];
+} test_rollup_t;
+
+void
+test_rollup_func(suns_model_t *model, suns_rollup_result_t *results, uint16_t count, void *arg)
+{
+    test_rollup_t *t = (test_rollup_t *) arg;
+
+    t->calls++;
+    t->count = count;
+    memcpy(t->results, results, count * sizeof(suns_rollup_result_t));
+}
+
+suns_rollup_result_t *
+test_rollup_find(test_rollup_t *t, char *arg)
+{
+    int i;
+
+    for (i = 0; i < t->count; i++) {
+        if (t->results[i].arg == arg) {
+            return &t->results[i];
+        }
+    }
+    return NULL;
+}
+
+/* decode W, Evt and TotWh and feed the rollups at time */
+void
+test_rollup_update(suns_model_t *model, int16_t w, uint16_t evt, uint32_t wh, uint64_t time)
+{
+    unsigned char buf[12];
+
+    memset(buf, 0, sizeof(buf));
+    suns_modbus_from_16((uint16_t) w, &buf[0]);
+    suns_modbus_from_16(evt, &buf[2]);
+    suns_modbus_from_16((uint16_t) (wh >> 16), &buf[4]);
+    suns_modbus_from_16((uint16_t) wh, &buf[6]);
+    suns_modbus_from_16(0xffff, &buf[8]);       /* W_SF -1 */
+    suns_modbus_from_16(1, &buf[10]);           /* TotWh_SF 1 */
+    suns_block_update_diff(model->blocks[0], buf, NULL);
+    suns_rollup_update(model, time);
+}
+
+void
+test_suns_rollup(CuTest* tc)
+{
+    suns_device_t *device;
+    suns_model_t *model;
+    suns_rollup_result_t *result;
+    test_rollup_t t;
+    char *w_arg = "w";
+    char *evt_arg = "evt";
+    char *wh_arg = "wh";
+    unsigned char buf[12];
+    uint64_t now;
+    int i;
+
+    CuAssertTrue(tc, test_model_load(test_rollup_model, TEST_ROLLUP_MODEL_ID) == 0);
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_model_add(device, TEST_ROLLUP_MODEL_ID, 6, 40004, &model) == SUNS_ERR_OK);
+
+    memset(&t, 0, sizeof(t));
+    CuAssertTrue(tc, suns_rollup_point(model, "W", 0, w_arg, NULL) == SUNS_ERR_INIT);
+    CuAssertTrue(tc, suns_rollup_model(model, 0, test_rollup_func, &t) == SUNS_ERR_RANGE);
+    CuAssertTrue(tc, suns_rollup_model(model, 60000, test_rollup_func, &t) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_rollup_point(model, "W", 0, w_arg, NULL) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_rollup_point(model, "Evt", 0, evt_arg, NULL) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_rollup_point(model, "TotWh", 0, wh_arg, NULL) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_rollup_point(model, "NoSuchPoint", 0, NULL, NULL) == SUNS_ERR_NOT_FOUND);
+
+    /* one minute at 1 s, nothing reported until the window closes */
+    for (i = 0; i < 60; i++) {
+        test_rollup_update(model, 1000 + i * 10, 0xfff0 + i, 100 + i * 2, 120000 + i * 1000);
+    }
+    CuAssertIntEquals(tc, 0, t.calls);
+
+    test_rollup_update(model, 500, 0x0030, 300, 180000);
+    CuAssertIntEquals(tc, 1, t.calls);
+    CuAssertIntEquals(tc, 3, t.count);
+    CuAssertTrue(tc, (result = test_rollup_find(&t, w_arg)) != NULL);
+    CuAssertTrue(tc, result->start == 120000);
+    CuAssertIntEquals(tc, 60, result->count);
+    CuAssertTrue(tc, fabsf(result->min - 100.0) < 0.001);
+    CuAssertTrue(tc, fabsf(result->max - 159.0) < 0.001);
+    CuAssertTrue(tc, fabsf(result->avg - 129.5) < 0.001);
+    CuAssertTrue(tc, fabsf(result->last - 159.0) < 0.001);
+
+    /* first accumulator reading is the base, 0xfff0..0x002b wraps once */
+    CuAssertTrue(tc, (result = test_rollup_find(&t, evt_arg)) != NULL);
+    CuAssertIntEquals(tc, 59, result->count);
+    CuAssertTrue(tc, fabsf(result->delta - 59) < 0.001);
+    CuAssertTrue(tc, fabsf(result->min - 1) < 0.001 && fabsf(result->max - 1) < 0.001);
+    CuAssertIntEquals(tc, 1, result->rollovers);
+    CuAssertIntEquals(tc, 0, result->resets);
+
+    /* scaled by TotWh_SF */
+    CuAssertTrue(tc, (result = test_rollup_find(&t, wh_arg)) != NULL);
+    CuAssertTrue(tc, fabsf(result->delta - 59 * 2 * 10) < 0.001);
+    CuAssertTrue(tc, fabsf(result->last - 2180) < 0.001);
+
+    /* counter reset, then flush the partial window */
+    test_rollup_update(model, 600, 0x0031, 5, 181000);
+    suns_rollup_flush(model);
+    CuAssertIntEquals(tc, 2, t.calls);
+    CuAssertTrue(tc, (result = test_rollup_find(&t, wh_arg)) != NULL);
+    CuAssertTrue(tc, result->start == 180000);
+    CuAssertIntEquals(tc, 2, result->count);
+    CuAssertIntEquals(tc, 1, result->resets);
+    CuAssertTrue(tc, fabsf(result->delta - (820 + 50)) < 0.001);
+    CuAssertTrue(tc, (result = test_rollup_find(&t, evt_arg)) != NULL);
+    CuAssertTrue(tc, fabsf(result->delta - 6) < 0.001);
+    CuAssertIntEquals(tc, 0, result->rollovers);
+
+    /* nothing left to report */
+    suns_rollup_flush(model);
+    CuAssertIntEquals(tc, 2, t.calls);
+
+    /* model updates report windows on the wall clock */
+    memset(buf, 0, sizeof(buf));
+    now = suns_time_wall_ms();
+    suns_model_update(model, buf);
+    suns_rollup_flush(model);
+    CuAssertIntEquals(tc, 3, t.calls);
+    CuAssertTrue(tc, (result = test_rollup_find(&t, w_arg)) != NULL);
+    CuAssertTrue(tc, result->start % 60000 == 0);
+    CuAssertTrue(tc, result->start + 60000 > now && result->start <= suns_time_wall_ms());
+
+    suns_device_free(device);
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+
+#include "test_model.h"
+
+extern suns_err_t test_modbus_write(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout);
+
+/* simulated bus that tracks the number of concurrent transactions */
+typedef struct {
+    int active;
+    int peak;
+} test_scan_bus_t;
+
+uint16_t test_scan_regs[] = {0x5375, 0x6e53, 64123, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+suns_err_t
+test_scan_read(void *prot, uint16_t addr, uint16_t count, unsigned char *buf, uint32_t timeout)
+{
+    test_scan_bus_t *bus = (test_scan_bus_t *) prot;
+    uint32_t reg;
+    uint16_t i;
+    int active = __atomic_add_fetch(&bus->active, 1, __ATOMIC_SEQ_CST);
+    int peak = __atomic_load_n(&bus->peak, __ATOMIC_SEQ_CST);
+
+    while (active > peak && !__atomic_compare_exchange_n(&bus->peak, &peak, active, 0,
+                                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    }
+    usleep(2000);
+    /* SunS marker and the controls model, so every scan looks up the registry, then the end model */
+    memset(buf, 0xff, count * 2);
+    for (i = 0; i < count; i++) {
+        reg = addr + i - 40000;
+        if (reg < sizeof(test_scan_regs) / sizeof(test_scan_regs[0])) {
+            suns_modbus_from_16(test_scan_regs[reg], &buf[i * 2]);
+        }
+    }
+    __atomic_sub_fetch(&bus->active, 1, __ATOMIC_SEQ_CST);
+
+    return SUNS_ERR_OK;
+}
+
+#define TEST_SCAN_RTU                   4
+#define TEST_SCAN_TCP                   8
+#define TEST_SCAN_COUNT                 (TEST_SCAN_RTU * 2 + TEST_SCAN_TCP)
+
+typedef struct {
+    uint16_t done[TEST_SCAN_COUNT];
+    uint16_t results;
+    uint16_t errors;
+} test_scan_t;
+
+void
+test_scan_result(suns_scan_result_t *result, void *arg)
+{
+    test_scan_t *test = (test_scan_t *) arg;
+
+    test->done[result->index]++;
+    test->results++;
+    if (result->err != SUNS_ERR_OK) {
+        test->errors++;
+    }
+}
+
+void
+test_suns_scan_many(CuTest* tc)
+{
+    test_scan_bus_t buses[3];
+    suns_scan_target_t targets[TEST_SCAN_COUNT];
+    test_scan_t test;
+    uint32_t bus;
+    int i;
+
+    memset(buses, 0, sizeof(buses));
+    memset(&test, 0, sizeof(test));
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    /* two exclusive RS-485 buses and one TCP host */
+    for (i = 0; i < TEST_SCAN_COUNT; i++) {
+        bus = (i < TEST_SCAN_RTU * 2) ? i % 2 : 2;
+        targets[i].device = suns_device_alloc();
+        targets[i].device->modbus_io.read = test_scan_read;
+        targets[i].device->modbus_io.write = test_modbus_write;
+        targets[i].device->modbus_io.prot = &buses[bus];
+        targets[i].bus = bus;
+        targets[i].bus_max = (bus < 2) ? SUNS_SCAN_BUS_EXCLUSIVE : SUNS_SCAN_BUS_SHARED;
+    }
+
+    CuAssertTrue(tc, suns_scan_many(targets, TEST_SCAN_COUNT, 8, test_scan_result, &test) == SUNS_ERR_OK);
+    CuAssertTrue(tc, test.results == TEST_SCAN_COUNT);
+    CuAssertTrue(tc, test.errors == 0);
+    for (i = 0; i < TEST_SCAN_COUNT; i++) {
+        CuAssertTrue(tc, test.done[i] == 1);
+        CuAssertTrue(tc, targets[i].device->base_addr == 40000);
+        CuAssertTrue(tc, suns_device_get_model(targets[i].device, TEST_GROUP_MODEL_ID, NULL, 1) != NULL);
+    }
+    CuAssertTrue(tc, buses[0].peak == 1);
+    CuAssertTrue(tc, buses[1].peak == 1);
+    CuAssertTrue(tc, buses[2].peak > 1);
+
+    for (i = 0; i < TEST_SCAN_COUNT; i++) {
+        targets[i].device->modbus_io.read = NULL;
+        targets[i].device->modbus_io.write = NULL;
+        targets[i].device->modbus_io.prot = NULL;
+        suns_device_free(targets[i].device);
+    }
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+
+#include "test_model.h"
+
+#define TEST_SCHED_DUE_MAX              64
+
+typedef struct _test_sched_t {
+    uint64_t due[TEST_SCHED_DUE_MAX];
+    int count;
+} test_sched_t;
+
+void
+test_sched_func(suns_sched_job_t *job, void *arg)
+{
+    test_sched_t *t = (test_sched_t *) arg;
+
+    if (t->count < TEST_SCHED_DUE_MAX) {
+        t->due[t->count++] = job->due;
+    }
+}
+
+void
+test_sched_remove_func(suns_sched_job_t *job, void *arg)
+{
+    suns_sched_remove((suns_sched_t *) arg, job);
+}
+
+void
+test_suns_sched(CuTest* tc)
+{
+    suns_sched_t sched;
+    suns_sched_job_t *model_job;
+    suns_sched_job_t *point_job;
+    suns_device_t *device;
+    suns_model_t *model;
+    test_sched_t order;
+    uint16_t map[14];
+    uint64_t now;
+    int i;
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+
+    memset(map, 0, sizeof(map));
+    map[6] = 1;                 /* Conn */
+    map[7] = 77;                /* WMaxLimPct */
+    map[12] = 0xffff;           /* WMaxLimPct_SF */
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_sim(device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_model_add(device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+
+    memset(&order, 0, sizeof(order));
+    suns_sched_init(&sched);
+    CuAssertIntEquals(tc, -1, (int) suns_sched_next(&sched, 0));
+    CuAssertTrue(tc, suns_sched_add(&sched, model, 100, 0, test_sched_func, &order, 0, &model_job) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sched_add(&sched, model, 50, 10, test_sched_func, &order, 0, &point_job) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sched_add(&sched, model, 0, 0, NULL, NULL, 0, NULL) == SUNS_ERR_INIT);
+
+    /* point and its scale factor are read in one run */
+    CuAssertTrue(tc, suns_sched_job_point(point_job, "WMaxLimPct", 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sched_job_point(point_job, "WMaxLimPct", 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sched_job_point(point_job, "NoSuchPoint", 0) == SUNS_ERR_NOT_FOUND);
+    CuAssertIntEquals(tc, 2, point_job->point_count);
+    CuAssertIntEquals(tc, 1, point_job->run_count);
+    CuAssertIntEquals(tc, 40007, point_job->runs[0].addr);
+    CuAssertIntEquals(tc, 6, point_job->runs[0].len);
+
+    /* first deadlines are spread within the first interval */
+    CuAssertTrue(tc, model_job->due < 100);
+    CuAssertTrue(tc, point_job->due < 50);
+    CuAssertTrue(tc, suns_sched_next(&sched, 0) >= 0 && suns_sched_next(&sched, 0) < 50);
+
+    /* point set read touches only its own points */
+    CuAssertTrue(tc, suns_sched_run(&sched, point_job->due) >= 1);
+    CuAssertIntEquals(tc, 1, point_job->reads);
+    CuAssertIntEquals(tc, 77, suns_model_get_point(model, "WMaxLimPct", 0)->value_base.u16);
+    CuAssertIntEquals(tc, -1, suns_model_get_point(model, "WMaxLimPct_SF", 0)->value_base.s16);
+    CuAssertTrue(tc, point_job->due >= point_job->base && point_job->due <= point_job->base + 10);
+    CuAssertIntEquals(tc, 0, point_job->missed);
+    if (model_job->reads == 0) {
+        CuAssertIntEquals(tc, 0, suns_model_get_point(model, "Conn", 0)->value_base.u16);
+        suns_sched_run(&sched, model_job->due);
+    }
+    CuAssertIntEquals(tc, 1, model_job->reads);
+    CuAssertIntEquals(tc, 1, suns_model_get_point(model, "Conn", 0)->value_base.u16);
+    for (i = 1; i < order.count; i++) {
+        CuAssertTrue(tc, order.due[i - 1] <= order.due[i]);
+    }
+
+    /* late jobs skip missed deadlines instead of bursting */
+    CuAssertIntEquals(tc, 2, suns_sched_run(&sched, 1000));
+    CuAssertTrue(tc, point_job->missed >= 15);
+    CuAssertTrue(tc, model_job->missed >= 7);
+    CuAssertIntEquals(tc, sched.missed, point_job->missed + model_job->missed);
+    CuAssertTrue(tc, point_job->late_max >= 800);
+    CuAssertTrue(tc, suns_sched_next(&sched, 1000) > 0);
+
+    /* on time, each job reads once per interval, in deadline order */
+    order.count = 0;
+    for (now = 1001; now <= 2000; now++) {
+        suns_sched_run(&sched, now);
+    }
+    CuAssertTrue(tc, point_job->reads >= 2 + 19 && point_job->reads <= 2 + 21);
+    CuAssertTrue(tc, model_job->reads >= 2 + 9 && model_job->reads <= 2 + 11);
+    for (i = 1; i < order.count; i++) {
+        CuAssertTrue(tc, order.due[i - 1] <= order.due[i]);
+    }
+    CuAssertTrue(tc, point_job->late_max >= 800);
+    CuAssertIntEquals(tc, 0, point_job->errors + model_job->errors);
+
+    /* a job can remove itself from its callback */
+    CuAssertTrue(tc, suns_sched_add(&sched, model, 10, 0, test_sched_remove_func, &sched, 2000, NULL) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 3, sched.count);
+    for (now = 2001; now <= 2010; now++) {
+        suns_sched_run(&sched, now);
+    }
+    CuAssertIntEquals(tc, 2, sched.count);
+    CuAssertTrue(tc, sched.running == NULL);
+
+    CuAssertTrue(tc, suns_sched_remove(&sched, point_job) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 1, sched.count);
+    CuAssertTrue(tc, sched.heap[0] == model_job);
+
+    suns_sched_free(&sched);
+    device->modbus_io.close(&device->modbus_io);
+    suns_device_free(device);
+}
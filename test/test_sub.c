@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+
+#include "test_model.h"
+
+#define TEST_SUB_CHANGES                8
+
+typedef struct _test_sub_t {
+    int calls;
+    int count;
+    suns_sub_change_t changes[TEST_SUB_CHANGES];
+} test_sub_t;
+
+void
+test_sub_func(suns_model_t *model, suns_sub_change_t *changes, uint16_t count, void *arg)
+{
+    test_sub_t *t = (test_sub_t *) arg;
+
+    t->calls++;
+    t->count = count < TEST_SUB_CHANGES ? count : TEST_SUB_CHANGES;
+    memcpy(t->changes, changes, t->count * sizeof(suns_sub_change_t));
+}
+
+/* change reported for the subscription with arg, NULL if none */
+suns_sub_change_t *
+test_sub_find(test_sub_t *t, char *arg)
+{
+    int i;
+
+    for (i = 0; i < t->count; i++) {
+        if (t->changes[i].sub->arg == arg) {
+            return &t->changes[i];
+        }
+    }
+    return NULL;
+}
+
+void
+test_suns_sub(CuTest* tc)
+{
+    suns_device_t *device;
+    suns_model_t *model;
+    suns_sub_t *lim;
+    suns_sub_change_t *change;
+    test_sub_t t;
+    unsigned char buf[20];
+    char *lim_arg = "lim";
+    char *conn_arg = "conn";
+    char *tms_arg = "tms";
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_model_add(device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+
+    memset(&t, 0, sizeof(t));
+    CuAssertTrue(tc, suns_sub_point(model, "Conn", 0, SUNS_SUB_ANY, 0, conn_arg, NULL) == SUNS_ERR_INIT);
+    CuAssertTrue(tc, suns_sub_model(model, test_sub_func, &t) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sub_point(model, "WMaxLimPct", 0, SUNS_SUB_ABS, 5, lim_arg, &lim) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sub_point(model, "Conn", 0, SUNS_SUB_ANY, 0, conn_arg, NULL) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sub_point(model, "WMaxLimPct_WinTms", 0, SUNS_SUB_PCT, 10, tms_arg, NULL) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sub_point(model, "NoSuchPoint", 0, SUNS_SUB_ANY, 0, NULL, NULL) == SUNS_ERR_NOT_FOUND);
+    CuAssertTrue(tc, suns_sub_point(model, "Conn", 0, SUNS_SUB_PCT, -1, NULL, NULL) == SUNS_ERR_RANGE);
+
+    /* first update reports every subscription */
+    memset(buf, 0, sizeof(buf));
+    suns_modbus_from_16(100, &buf[6]);          /* WMaxLimPct 10.0 */
+    suns_modbus_from_16(100, &buf[8]);          /* WMaxLimPct_WinTms */
+    suns_modbus_from_16(0xffff, &buf[16]);      /* WMaxLimPct_SF -1 */
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 1, t.calls);
+    CuAssertIntEquals(tc, 3, t.count);
+    CuAssertTrue(tc, (change = test_sub_find(&t, lim_arg)) != NULL);
+    CuAssertTrue(tc, change->first && change->impl);
+    CuAssertTrue(tc, fabsf(change->value - 10.0) < 0.001);
+
+    /* unchanged image, no callback */
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 1, t.calls);
+
+    /* absolute deadband is measured from the last reported value */
+    suns_modbus_from_16(140, &buf[6]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 1, t.calls);
+    suns_modbus_from_16(170, &buf[6]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 2, t.calls);
+    CuAssertIntEquals(tc, 1, t.count);
+    CuAssertTrue(tc, (change = test_sub_find(&t, lim_arg)) != NULL);
+    CuAssertTrue(tc, !change->first);
+    CuAssertTrue(tc, fabsf(change->prev - 10.0) < 0.001 && fabsf(change->value - 17.0) < 0.001);
+
+    /* percent deadband */
+    suns_modbus_from_16(109, &buf[8]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 2, t.calls);
+    suns_modbus_from_16(111, &buf[8]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 3, t.calls);
+    CuAssertTrue(tc, test_sub_find(&t, tms_arg) != NULL);
+
+    /* any change, batched with others from the same update */
+    suns_modbus_from_16(1, &buf[4]);
+    suns_modbus_from_16(0, &buf[16]);           /* WMaxLimPct_SF 0, 17.0 becomes 170 */
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 4, t.calls);
+    CuAssertIntEquals(tc, 2, t.count);
+    CuAssertTrue(tc, test_sub_find(&t, conn_arg) != NULL);
+    CuAssertTrue(tc, (change = test_sub_find(&t, lim_arg)) != NULL);
+    CuAssertTrue(tc, fabsf(change->value - 170.0) < 0.001);
+
+    /* unimplemented value is reported once */
+    suns_modbus_from_16(0xffff, &buf[6]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 5, t.calls);
+    CuAssertTrue(tc, (change = test_sub_find(&t, lim_arg)) != NULL && !change->impl);
+
+    /* removed subscriptions are quiet */
+    CuAssertTrue(tc, suns_sub_remove(model, lim) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sub_remove(model, lim) == SUNS_ERR_NOT_FOUND);
+    suns_modbus_from_16(10, &buf[6]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 5, t.calls);
+
+    suns_device_free(device);
+}
+
+void
+test_suns_model_diff(CuTest* tc)
+{
+    suns_device_t *device;
+    suns_model_t *model;
+    suns_point_t *point;
+    unsigned char buf[20];
+    uint16_t value;
+    int16_t sf;
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_model_add(device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+    point = suns_model_get_point(model, "WMaxLimPct_WinTms", 0);
+    CuAssertTrue(tc, point != NULL);
+
+    /* first update decodes everything */
+    memset(buf, 0, sizeof(buf));
+    suns_modbus_from_16(100, &buf[8]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 1, model->blocks_changed);
+    CuAssertIntEquals(tc, 10, model->points_changed);
+
+    /* identical image skips the block */
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 0, model->blocks_changed);
+    CuAssertIntEquals(tc, 0, model->points_changed);
+
+    /* one register changed, one point decoded */
+    suns_modbus_from_16(200, &buf[8]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 1, model->blocks_changed);
+    CuAssertIntEquals(tc, 1, model->points_changed);
+    CuAssertTrue(tc, suns_point_get_uint16(point, &value, &sf) == SUNS_ERR_OK && value == 200);
+
+    /* unwritten local value is replaced by the device value */
+    CuAssertTrue(tc, suns_point_set_uint16(point, 300, 0) == SUNS_ERR_OK);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 1, model->points_changed);
+    CuAssertTrue(tc, suns_point_get_uint16(point, &value, &sf) == SUNS_ERR_OK && value == 200);
+
+    /* discarded write is refreshed on the next update */
+    CuAssertTrue(tc, suns_point_set_uint16(point, 300, 0) == SUNS_ERR_OK);
+    suns_block_clear_write(model->blocks[0]);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 1, model->blocks_changed);
+    CuAssertTrue(tc, suns_point_get_uint16(point, &value, &sf) == SUNS_ERR_OK && value == 200);
+    suns_model_update(model, buf);
+    CuAssertIntEquals(tc, 0, model->blocks_changed);
+
+    suns_device_free(device);
+}
+
+/* a point set read must not hide changes to registers it did not decode */
+void
+test_suns_model_diff_sched(CuTest* tc)
+{
+    suns_sched_t sched;
+    suns_sched_job_t *job;
+    suns_device_t *device;
+    suns_model_t *model;
+    suns_point_t *point;
+    suns_ring_t *conn_ring;
+    suns_ring_t *tms_ring;
+    suns_sub_change_t *change;
+    test_sub_t t;
+    unsigned char buf[6];
+    uint16_t map[14];
+    uint16_t value;
+    int16_t sf;
+    char *conn_arg = "conn";
+    char *tms_arg = "tms";
+
+    CuAssertTrue(tc, test_group_model_load() == 0);
+    memset(map, 0, sizeof(map));
+    map[4] = 1;                 /* Conn_WinTms */
+    map[5] = 2;                 /* Conn_RvrtTms */
+    map[6] = 3;                 /* Conn */
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_device_sim(device, 40000, map, sizeof(map), 1) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_model_add(device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_model_read(model) == SUNS_ERR_OK);
+    point = suns_model_get_point(model, "Conn_RvrtTms", 0);
+
+    memset(&t, 0, sizeof(t));
+    CuAssertTrue(tc, suns_sub_model(model, test_sub_func, &t) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sub_point(model, "Conn", 0, SUNS_SUB_ANY, 0, conn_arg, NULL) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sub_point(model, "Conn_RvrtTms", 0, SUNS_SUB_ANY, 0, tms_arg, NULL) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_ring_point(model, "Conn", 0, 4, &conn_ring) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_ring_point(model, "Conn_RvrtTms", 0, 4, &tms_ring) == SUNS_ERR_OK);
+
+    /* job on the points either side of Conn_RvrtTms reads it in the same run */
+    suns_sched_init(&sched);
+    CuAssertTrue(tc, suns_sched_add(&sched, model, 1000, 0, NULL, NULL, 0, &job) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sched_job_point(job, "Conn_WinTms", 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sched_job_point(job, "Conn", 0) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 1, job->run_count);
+    CuAssertIntEquals(tc, 3, job->runs[0].len);
+
+    suns_modbus_from_16(10, &buf[0]);
+    suns_modbus_from_16(20, &buf[2]);
+    suns_modbus_from_16(30, &buf[4]);
+    CuAssertTrue(tc, suns_device_modbus_write(device, 40004, 3, buf, 0) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_sched_run(&sched, job->due) == 1);
+    CuAssertTrue(tc, suns_point_get_uint16(point, &value, &sf) == SUNS_ERR_OK && value == 2);
+
+    /* subscriptions and rings are fed for the points the job read */
+    CuAssertIntEquals(tc, 1, t.calls);
+    CuAssertIntEquals(tc, 1, t.count);
+    CuAssertTrue(tc, (change = test_sub_find(&t, conn_arg)) != NULL && change->value == 30);
+    CuAssertIntEquals(tc, 1, conn_ring->count);
+    CuAssertIntEquals(tc, 0, tms_ring->count);
+
+    /* full read picks up the register the job skipped */
+    CuAssertTrue(tc, suns_model_read(model) == SUNS_ERR_OK);
+    CuAssertIntEquals(tc, 1, model->blocks_changed);
+    CuAssertIntEquals(tc, 1, model->points_changed);
+    CuAssertTrue(tc, suns_point_get_uint16(point, &value, &sf) == SUNS_ERR_OK && value == 20);
+    CuAssertIntEquals(tc, 2, t.calls);
+    CuAssertIntEquals(tc, 1, t.count);
+    CuAssertTrue(tc, (change = test_sub_find(&t, tms_arg)) != NULL && change->value == 20);
+    CuAssertIntEquals(tc, 2, conn_ring->count);
+    CuAssertIntEquals(tc, 1, tms_ring->count);
+
+    suns_sched_free(&sched);
+    suns_device_free(device);
+}
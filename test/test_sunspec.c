@@ -1879,6 +1879,35 @@ extern void test_inv();
 extern void test_inv_freq_watt();
 extern void test_inv_volt_var();
 extern void test_inv_volt_watt();
+extern void test_suns_device_health();
+extern void test_suns_device_req_max();
+extern void test_suns_server_image();
+extern void test_suns_server_model();
+extern void test_suns_modbus_cache();
+extern void test_suns_modbus_cache_single_flight();
+extern void test_suns_modbus_sim_bounds();
+extern void test_suns_modbus_sim_file();
+extern void test_suns_modbus_fault();
+extern void test_suns_modbus_record();
+extern void test_suns_stats_hist();
+extern void test_suns_device_stats();
+extern void test_suns_scan_many();
+extern void test_suns_group_write();
+extern void test_suns_group_write_stale();
+extern void test_suns_cea2045_sunspec();
+extern void test_cea2045_queue();
+extern void test_cea2045_link_nak();
+extern void test_suns_sched();
+extern void test_suns_model_snapshot();
+extern void test_suns_thread_stress();
+extern void test_suns_bus();
+extern void test_suns_exec();
+extern void test_suns_sub();
+extern void test_suns_model_diff();
+extern void test_suns_model_diff_sched();
+extern void test_suns_ring();
+extern void test_suns_tsc();
+extern void test_suns_rollup();
 
 CuSuite *
 sunspec_suite(void)
@@ -1901,6 +1930,35 @@ sunspec_suite(void)
     SUITE_ADD_TEST(suite, test_inv_volt_var);
     SUITE_ADD_TEST(suite, test_inv_volt_watt);
     SUITE_ADD_TEST(suite, test_inv);
+    SUITE_ADD_TEST(suite, test_suns_device_health);
+    SUITE_ADD_TEST(suite, test_suns_device_req_max);
+    SUITE_ADD_TEST(suite, test_suns_server_image);
+    SUITE_ADD_TEST(suite, test_suns_server_model);
+    SUITE_ADD_TEST(suite, test_suns_modbus_cache);
+    SUITE_ADD_TEST(suite, test_suns_modbus_cache_single_flight);
+    SUITE_ADD_TEST(suite, test_suns_modbus_sim_bounds);
+    SUITE_ADD_TEST(suite, test_suns_modbus_sim_file);
+    SUITE_ADD_TEST(suite, test_suns_modbus_fault);
+    SUITE_ADD_TEST(suite, test_suns_modbus_record);
+    SUITE_ADD_TEST(suite, test_suns_stats_hist);
+    SUITE_ADD_TEST(suite, test_suns_device_stats);
+    SUITE_ADD_TEST(suite, test_suns_scan_many);
+    SUITE_ADD_TEST(suite, test_suns_group_write);
+    SUITE_ADD_TEST(suite, test_suns_group_write_stale);
+    SUITE_ADD_TEST(suite, test_suns_cea2045_sunspec);
+    SUITE_ADD_TEST(suite, test_cea2045_queue);
+    SUITE_ADD_TEST(suite, test_cea2045_link_nak);
+    SUITE_ADD_TEST(suite, test_suns_sched);
+    SUITE_ADD_TEST(suite, test_suns_model_snapshot);
+    SUITE_ADD_TEST(suite, test_suns_thread_stress);
+    SUITE_ADD_TEST(suite, test_suns_bus);
+    SUITE_ADD_TEST(suite, test_suns_exec);
+    SUITE_ADD_TEST(suite, test_suns_sub);
+    SUITE_ADD_TEST(suite, test_suns_model_diff);
+    SUITE_ADD_TEST(suite, test_suns_model_diff_sched);
+    SUITE_ADD_TEST(suite, test_suns_ring);
+    SUITE_ADD_TEST(suite, test_suns_tsc);
+    SUITE_ADD_TEST(suite, test_suns_rollup);
 
     return suite;
 }
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2014-2015 SunSpec Alliance
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "CuTest.h"
+
+#include "sunspec.h"
+
+#include "test_model.h"
+
+#define TEST_TSC_SAMPLES                86400   /* one day at 1 s */
+
+/* power readings: slow drift, sampling jitter and an occasional step */
+void
+test_tsc_sample(uint32_t i, uint32_t *rand, suns_ring_sample_t *sample)
+{
+    *rand ^= *rand << 13;
+    *rand ^= *rand >> 17;
+    *rand ^= *rand << 5;
+
+    sample->time = 1000000 + (uint64_t) i * 1000 + ((*rand & 0xff) == 0 ? (*rand >> 8) % 20 : 0);
+    sample->value.u64 = 0;
+    sample->value.s16 = (int16_t) (25000 + 5000 * sinf(i / 3600.0f) + ((*rand >> 16) % 7) - 3 +
+                                   ((i / 7200) % 2) * 1000);
+    sample->sf = (i < TEST_TSC_SAMPLES / 2) ? -1 : -2;
+}
+
+void
+test_suns_tsc(CuTest* tc)
+{
+    suns_tsc_t tsc;
+    suns_tsc_iter_t iter;
+    suns_ring_sample_t sample;
+    suns_ring_sample_t out;
+    suns_device_t *device;
+    suns_model_t *model;
+    suns_ring_t *ring;
+    unsigned char buf[20];
+    uint64_t times[] = {0, 1000, 2000, 2000, 2999, 1000000000000ULL, 1000000001000ULL};
+    int64_t values[] = {-32768, 32767, 0, 1, -1, 32767, -32768};
+    float floats[] = {230.1f, 230.1f, 230.2f, -1.5f, 0.0f, 1e30f, 230.2f};
+    uint32_t rand = 1;
+    uint32_t i;
+
+    /* extremes round trip */
+    CuAssertTrue(tc, suns_tsc_init(&tsc, SUNS_TYPE_STR) == SUNS_ERR_TYPE);
+    CuAssertTrue(tc, suns_tsc_init(&tsc, SUNS_TYPE_INT16) == SUNS_ERR_OK);
+    for (i = 0; i < 7; i++) {
+        sample.time = times[i];
+        sample.value.u64 = 0;
+        sample.value.s16 = (int16_t) values[i];
+        sample.sf = (int16_t) (i - 3);
+        CuAssertTrue(tc, suns_tsc_append(&tsc, &sample) == SUNS_ERR_OK);
+    }
+    sample.time = 0;
+    CuAssertTrue(tc, suns_tsc_append(&tsc, &sample) == SUNS_ERR_RANGE);
+    suns_tsc_iter_init(&iter, &tsc, 0);
+    for (i = 0; i < 7; i++) {
+        CuAssertTrue(tc, suns_tsc_next(&iter, &out) == 1);
+        CuAssertTrue(tc, out.time == times[i]);
+        CuAssertIntEquals(tc, values[i], out.value.s16);
+        CuAssertIntEquals(tc, i - 3, out.sf);
+    }
+    CuAssertTrue(tc, suns_tsc_next(&iter, &out) == 0);
+    suns_tsc_free(&tsc);
+
+    CuAssertTrue(tc, suns_tsc_init(&tsc, SUNS_TYPE_FLOAT32) == SUNS_ERR_OK);
+    for (i = 0; i < 7; i++) {
+        sample.time = times[i];
+        sample.value.f32 = floats[i];
+        sample.sf = 0;
+        CuAssertTrue(tc, suns_tsc_append(&tsc, &sample) == SUNS_ERR_OK);
+    }
+    suns_tsc_iter_init(&iter, &tsc, 0);
+    for (i = 0; i < 7; i++) {
+        CuAssertTrue(tc, suns_tsc_next(&iter, &out) == 1);
+        CuAssertTrue(tc, out.value.f32 == floats[i]);
+    }
+    suns_tsc_free(&tsc);
+
+    /* many chunks, streaming from the middle */
+    CuAssertTrue(tc, suns_tsc_init(&tsc, SUNS_TYPE_INT16) == SUNS_ERR_OK);
+    for (i = 0; i < 20000; i++) {
+        test_tsc_sample(i, &rand, &sample);
+        CuAssertTrue(tc, suns_tsc_append(&tsc, &sample) == SUNS_ERR_OK);
+    }
+    CuAssertTrue(tc, tsc.chunks != tsc.tail);
+    CuAssertTrue(tc, tsc.bytes < 20000 * sizeof(suns_ring_sample_t) / 4);
+    rand = 1;
+    for (i = 0; i < 15000; i++) {
+        test_tsc_sample(i, &rand, &sample);
+    }
+    suns_tsc_iter_init(&iter, &tsc, sample.time);
+    CuAssertTrue(tc, iter.chunk != tsc.chunks);
+    for (i = 15000; i < 20000; i++) {
+        CuAssertTrue(tc, suns_tsc_next(&iter, &out) == 1);
+        CuAssertTrue(tc, out.time == sample.time && out.value.s16 == sample.value.s16 && out.sf == sample.sf);
+        test_tsc_sample(i, &rand, &sample);
+    }
+    suns_tsc_free(&tsc);
+
+    /* draining a ring only appends new samples */
+    CuAssertTrue(tc, test_group_model_load() == 0);
+    device = suns_device_alloc();
+    CuAssertTrue(tc, suns_model_add(device, TEST_GROUP_MODEL_ID, 10, 40004, &model) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_ring_point(model, "WMaxLimPct", 0, 8, &ring) == SUNS_ERR_OK);
+    CuAssertTrue(tc, suns_tsc_init(&tsc, ring->point->point_def->type->base_type) == SUNS_ERR_OK);
+    memset(buf, 0, sizeof(buf));
+    suns_modbus_from_16(0xffff, &buf[16]);
+    for (i = 0; i < 5; i++) {
+        suns_modbus_from_16(100 + i, &buf[6]);
+        suns_model_update(model, buf);
+        ring->samples[(ring->head + 7) % 8].time = 1000 * (i + 1);
+        if (i == 2 || i == 4) {
+            CuAssertTrue(tc, suns_tsc_append_ring(&tsc, ring) == SUNS_ERR_OK);
+        }
+    }
+    CuAssertTrue(tc, tsc.count == 5);
+    suns_tsc_iter_init(&iter, &tsc, 0);
+    for (i = 0; i < 5; i++) {
+        CuAssertTrue(tc, suns_tsc_next(&iter, &out) == 1);
+        CuAssertIntEquals(tc, 100 + i, out.value.u16);
+        CuAssertIntEquals(tc, -1, out.sf);
+    }
+    suns_tsc_free(&tsc);
+    suns_device_free(device);
+}